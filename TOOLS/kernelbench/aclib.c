@@ -0,0 +1,188 @@
+/*
+ * fast_memcpy() and mem2agpcpy() from libvo/aclib
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "config.h"
+#include "ffmpeg_files/x86_cpu.h"
+#include "kernelbench.h"
+
+#define BLOCK_SIZE 4096
+#define CONFUSION_FACTOR 0
+
+// Compile every variant the build supports, like libvo/aclib.c does with
+// runtime CPU detection.
+#if ARCH_X86
+
+#if HAVE_MMX
+#define COMPILE_MMX
+#endif
+
+#if HAVE_MMX2
+#define COMPILE_MMX2
+#endif
+
+#if HAVE_AMD3DNOW
+#define COMPILE_3DNOW
+#endif
+
+#if HAVE_SSE2
+#define COMPILE_SSE
+#endif
+
+#ifdef COMPILE_MMX
+#undef RENAME
+#undef HAVE_MMX
+#undef HAVE_MMX2
+#undef HAVE_AMD3DNOW
+#undef HAVE_SSE
+#undef HAVE_SSE2
+#define HAVE_MMX 1
+#define HAVE_MMX2 0
+#define HAVE_AMD3DNOW 0
+#define HAVE_SSE 0
+#define HAVE_SSE2 0
+#define RENAME(a) a ## _MMX
+#include "libvo/aclib_template.c"
+#endif
+
+#ifdef COMPILE_MMX2
+#undef RENAME
+#undef HAVE_MMX
+#undef HAVE_MMX2
+#undef HAVE_AMD3DNOW
+#undef HAVE_SSE
+#undef HAVE_SSE2
+#define HAVE_MMX 1
+#define HAVE_MMX2 1
+#define HAVE_AMD3DNOW 0
+#define HAVE_SSE 0
+#define HAVE_SSE2 0
+#define RENAME(a) a ## _MMX2
+#include "libvo/aclib_template.c"
+#endif
+
+#ifdef COMPILE_3DNOW
+#undef RENAME
+#undef HAVE_MMX
+#undef HAVE_MMX2
+#undef HAVE_AMD3DNOW
+#undef HAVE_SSE
+#undef HAVE_SSE2
+#define HAVE_MMX 1
+#define HAVE_MMX2 0
+#define HAVE_AMD3DNOW 1
+#define HAVE_SSE 0
+#define HAVE_SSE2 0
+#define RENAME(a) a ## _3DNow
+#include "libvo/aclib_template.c"
+#endif
+
+#ifdef COMPILE_SSE
+#undef RENAME
+#undef HAVE_MMX
+#undef HAVE_MMX2
+#undef HAVE_AMD3DNOW
+#undef HAVE_SSE
+#undef HAVE_SSE2
+#define HAVE_MMX 1
+#define HAVE_MMX2 1
+#define HAVE_AMD3DNOW 0
+#define HAVE_SSE 1
+#define HAVE_SSE2 1
+#define RENAME(a) a ## _SSE
+#include "libvo/aclib_template.c"
+#endif
+
+#endif /* ARCH_X86 */
+
+typedef void *(*copy_fn)(void *to, const void *from, size_t len);
+
+static const struct {
+    const char *name;
+    unsigned cpu;
+    copy_fn copy;
+    copy_fn agp_copy;   // mem2agpcpy(), for copies into video memory
+} variants[] = {
+    {"C",     0,                          memcpy,            memcpy},
+#ifdef COMPILE_MMX
+    {"MMX",   KB_CPU_MMX,                 fast_memcpy_MMX,   mem2agpcpy_MMX},
+#endif
+#ifdef COMPILE_MMX2
+    {"MMX2",  KB_CPU_MMX | KB_CPU_MMX2,   fast_memcpy_MMX2,  mem2agpcpy_MMX2},
+#endif
+#ifdef COMPILE_3DNOW
+    {"3DNow", KB_CPU_MMX | KB_CPU_3DNOW,  fast_memcpy_3DNow, mem2agpcpy_3DNow},
+#endif
+#ifdef COMPILE_SSE
+    {"SSE",   KB_CPU_MMX | KB_CPU_MMX2 | KB_CPU_SSE | KB_CPU_SSE2,
+              fast_memcpy_SSE, mem2agpcpy_SSE},
+#endif
+    {0}
+};
+
+struct copy_args {
+    copy_fn copy;
+    uint8_t *dst, *src;
+    size_t len;
+};
+
+static void run_copy(void *arg)
+{
+    struct copy_args *a = arg;
+    a->copy(a->dst, a->src, a->len);
+}
+
+static void bench_size(struct kernelbench *kb, const char *kernel, size_t len,
+                       bool agp)
+{
+    // odd offsets and length so the unaligned head and tail are copied too
+    size_t check_len = len - 13;
+    uint8_t *src = kb_alloc(kb, len + 64);
+    uint8_t *ref = kb_alloc(kb, len + 64);
+    uint8_t *dst = kb_alloc(kb, len + 64);
+    kb_fill(kb, src, len + 64);
+
+    memcpy(ref, src, len + 64);
+    memcpy(ref + 3, src + 5, check_len);
+
+    for (int i = 0; variants[i].name; i++) {
+        if (!kb_variant(kb, kernel, variants[i].name, variants[i].cpu))
+            continue;
+        copy_fn copy = agp ? variants[i].agp_copy : variants[i].copy;
+        memcpy(dst, src, len + 64);
+        copy(dst + 3, src + 5, check_len);
+        int diff = kb_max_diff_u8(dst, ref, len + 64);
+        kb_check(kb, diff == 0, diff);
+
+        struct copy_args a = {copy, dst, src, len};
+        kb_time(kb, run_copy, &a, len);
+    }
+}
+
+void kb_aclib(struct kernelbench *kb)
+{
+    bench_size(kb, "memcpy_64k", 64 * 1024, false);
+    // a 1080p YV12 frame
+    bench_size(kb, "memcpy_3m", 1920 * 1080 * 3 / 2, false);
+    bench_size(kb, "mem2agpcpy_3m", 1920 * 1080 * 3 / 2, true);
+}
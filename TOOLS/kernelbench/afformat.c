@@ -0,0 +1,92 @@
+/*
+ * s16/float conversion from libaf/af_format.c
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libaf/af_format.c"
+
+#include "kernelbench.h"
+
+// 7.1 at 192 kHz for 1/10 s, plus an odd tail for the C loop
+#define SAMPLES (8 * 19200 + 5)
+
+/* Both directions have exact results, so the variants must match the C
+ * versions bit for bit.
+ */
+static const struct kb_variant float2s16_variants[] = {
+    {"C", 0, float2s16_c},
+#if HAVE_SSE2
+    {"SSE2", KB_CPU_SSE2, float2s16_sse2},
+#endif
+    {0}
+};
+
+static const struct kb_variant s162float_variants[] = {
+    {"C", 0, s162float_c},
+#if HAVE_SSE2
+    {"SSE2", KB_CPU_SSE2, s162float_sse2},
+#endif
+    {0}
+};
+
+struct conv_ctx {
+    void *in, *out;
+};
+
+static void run_float2s16(void *arg, const void *impl)
+{
+    struct conv_ctx *c = arg;
+    void (*conv)(const float *in, int16_t *out, int len) = impl;
+    conv(c->in, c->out, SAMPLES);
+}
+
+static void run_s162float(void *arg, const void *impl)
+{
+    struct conv_ctx *c = arg;
+    void (*conv)(const int16_t *in, float *out, int len) = impl;
+    conv(c->in, c->out, SAMPLES);
+}
+
+void kb_afformat(struct kernelbench *kb)
+{
+    float *f = kb_alloc(kb, SAMPLES * sizeof(float));
+    int16_t *s16 = kb_alloc(kb, SAMPLES * sizeof(int16_t));
+
+    // including values out of range, which are clipped
+    for (int i = 0; i < SAMPLES; i++)
+        f[i] = kb_random(kb) / (float)(1 << 23) * 1.1 - 1.1;
+    kb_run(kb, &(struct kb_kernel){
+        .name = "float_to_s16",
+        .variants = float2s16_variants,
+        .run = run_float2s16,
+        .out = s16,
+        .size = SAMPLES * sizeof(int16_t),
+        .type = KB_S16,
+        .bytes = SAMPLES * sizeof(float),
+    }, &(struct conv_ctx){f, s16});
+
+    kb_fill(kb, s16, SAMPLES * sizeof(int16_t));
+    kb_run(kb, &(struct kb_kernel){
+        .name = "s16_to_float",
+        .variants = s162float_variants,
+        .run = run_s162float,
+        .out = f,
+        .size = SAMPLES * sizeof(float),
+        .type = KB_FLOAT,
+        .bytes = SAMPLES * sizeof(int16_t),
+    }, &(struct conv_ctx){s16, f});
+}
@@ -0,0 +1,196 @@
+/*
+ * Channel mixing from libaf/af_pan.c
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "libaf/fftconv.c"
+
+#include <stdio.h>
+#include <math.h>
+
+#include "kernelbench.h"
+
+#define BLOCK 128
+// 0.1 s of stereo at 48 kHz
+#define NCH 2
+#define SAMPLES 4800
+// longer than several partitions, the cross terms shorter than one
+#define LEN 1000
+#define CROSS_LEN 100
+
+/* The SSE multiply-add sums the products in a different order, and the
+ * convolution as a whole is compared with a direct convolution in the time
+ * domain, which it matches up to the rounding of the FFTs.
+ */
+#define MAC_TOLERANCE 1e-6
+#define CONV_TOLERANCE 1e-4
+
+typedef void mac_fn(float *acc, const float *x, const float *h, int block);
+
+static const struct kb_variant mac_variants[] = {
+    {"C", 0, mac_c},
+#if HAVE_SSE
+    {"SSE", KB_CPU_SSE, mac_sse},
+#endif
+    {0}
+};
+
+struct mac_ctx {
+    float *acc, *x, *h;
+};
+
+static void run_mac(void *arg, const void *impl)
+{
+    struct mac_ctx *c = arg;
+    mac_fn *mac = (mac_fn *)impl;
+    mac(c->acc, c->x, c->h, BLOCK);
+}
+
+static void bench_mac(struct kernelbench *kb)
+{
+    struct mac_ctx c = {
+        .acc = kb_alloc(kb, 2 * BLOCK * sizeof(float)),
+        .x = kb_alloc(kb, 2 * BLOCK * sizeof(float)),
+        .h = kb_alloc(kb, 2 * BLOCK * sizeof(float)),
+    };
+    for (int i = 0; i < 2 * BLOCK; i++) {
+        c.x[i] = (int16_t)kb_random(kb) / 32768.0;
+        c.h[i] = (int16_t)kb_random(kb) / 32768.0;
+    }
+    kb_run(kb, &(struct kb_kernel){
+        .name = "fftconv_mac",
+        .variants = mac_variants,
+        .run = run_mac,
+        .out = c.acc,
+        .size = 2 * BLOCK * sizeof(float),
+        .type = KB_FLOAT,
+        .tolerance = MAC_TOLERANCE,
+        .bytes = 2 * BLOCK * sizeof(float),
+    }, &c);
+}
+
+// af_fftconv_process() picks the multiply-add with the CPU caps.
+static const bool no_sse = false;
+#if HAVE_SSE
+static const bool use_sse = true;
+#endif
+
+static const struct kb_variant process_variants[] = {
+    {"C", 0, &no_sse},
+#if HAVE_SSE
+    {"SSE", KB_CPU_SSE, &use_sse},
+#endif
+    {0}
+};
+
+struct process_ctx {
+    struct af_fftconv *conv;
+    float *in, *out;
+    double *ref;
+};
+
+static void run_process(void *arg, const void *impl)
+{
+    struct process_ctx *c = arg;
+    float *in[NCH], *out[NCH];
+    for (int ch = 0; ch < NCH; ch++) {
+        in[ch] = c->in + ch;
+        out[ch] = c->out + ch;
+    }
+    gCpuCaps.hasSSE = *(const bool *)impl;
+    af_fftconv_process(c->conv, in, NCH, out, NCH, SAMPLES);
+}
+
+static void reset_conv(void *arg)
+{
+    struct process_ctx *c = arg;
+    af_fftconv_reset(c->conv);
+}
+
+static double diff_process(void *arg)
+{
+    struct process_ctx *c = arg;
+    double max = 0;
+    for (int i = 0; i < SAMPLES * NCH; i++)
+        max = FFMAX(max, fabs(c->out[i] - c->ref[i]));
+    return max;
+}
+
+static void bench_process(struct kernelbench *kb)
+{
+    struct process_ctx c = {
+        .conv = af_fftconv_new(BLOCK, NCH, NCH),
+        .in = kb_alloc(kb, SAMPLES * NCH * sizeof(float)),
+        .out = kb_alloc(kb, SAMPLES * NCH * sizeof(float)),
+        .ref = kb_alloc(kb, SAMPLES * NCH * sizeof(double)),
+    };
+    float *ir[NCH][NCH];
+    int len[NCH][NCH];
+    bool ok = c.conv;
+    for (int o = 0; o < NCH; o++) {
+        for (int i = 0; i < NCH; i++) {
+            len[o][i] = o == i ? LEN : CROSS_LEN;
+            ir[o][i] = kb_alloc(kb, len[o][i] * sizeof(float));
+            for (int n = 0; n < len[o][i]; n++)
+                ir[o][i][n] = (int16_t)kb_random(kb) / 32768.0 *
+                              exp(-n * 5.0 / LEN);
+            if (ok)
+                ok = af_fftconv_set_kernel(c.conv, o, i, ir[o][i],
+                                           len[o][i], 1) >= 0;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Could not set up the FFT convolution.\n");
+        af_fftconv_free(c.conv);
+        return;
+    }
+    for (int i = 0; i < SAMPLES * NCH; i++)
+        c.in[i] = (int16_t)kb_random(kb) / 32768.0;
+
+    // the output lags the input by a block
+    for (int o = 0; o < NCH; o++) {
+        for (int t = BLOCK; t < SAMPLES; t++) {
+            double sum = 0;
+            for (int i = 0; i < NCH; i++)
+                for (int n = 0; n < len[o][i] && n <= t - BLOCK; n++)
+                    sum += ir[o][i][n] * c.in[(t - BLOCK - n) * NCH + i];
+            c.ref[t * NCH + o] = sum;
+        }
+    }
+
+    bool has_sse = gCpuCaps.hasSSE;
+    kb_run(kb, &(struct kb_kernel){
+        .name = "fftconv",
+        .variants = process_variants,
+        .run = run_process,
+        .prepare = reset_conv,
+        .out = c.out,
+        .size = SAMPLES * NCH * sizeof(float),
+        .diff = diff_process,
+        .tolerance = CONV_TOLERANCE,
+        .bytes = SAMPLES * NCH * sizeof(float),
+    }, &c);
+    gCpuCaps.hasSSE = has_sse;
+    af_fftconv_free(c.conv);
+}
+
+void kb_fftconv(struct kernelbench *kb)
+{
+    bench_mac(kb);
+    bench_process(kb);
+}
@@ -0,0 +1,72 @@
+/*
+ * YV12 to half height YUY2 conversion from libmpcodecs/vf_halfpack.c
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libmpcodecs/vf_halfpack.c"
+
+#include "kernelbench.h"
+
+#define W 1920
+#define H 1080
+
+typedef void halfpack_fn(unsigned char *dst, unsigned char *src[3],
+                         int dststride, int srcstride[3], int w, int h);
+
+static const struct kb_variant variants[] = {
+    {"C",   0,          halfpack_C},
+#if HAVE_MMX
+    {"MMX", KB_CPU_MMX, halfpack_MMX},
+#endif
+    {0}
+};
+
+struct halfpack_ctx {
+    uint8_t *planes[3];
+    int stride[3];
+    uint8_t *dst;
+};
+
+static void run_halfpack(void *arg, const void *impl)
+{
+    struct halfpack_ctx *c = arg;
+    halfpack_fn *pack = (halfpack_fn *)impl;
+    pack(c->dst, c->planes, W * 2, c->stride, W, H);
+}
+
+void kb_halfpack(struct kernelbench *kb)
+{
+    size_t size = W * 2 * H / 2;
+    struct halfpack_ctx c = {
+        .planes = {kb_alloc(kb, W * H), kb_alloc(kb, W * H / 4),
+                   kb_alloc(kb, W * H / 4)},
+        .stride = {W, W / 2, W / 2},
+        .dst = kb_alloc(kb, size),
+    };
+    for (int i = 0; i < 3; i++)
+        kb_fill(kb, c.planes[i], c.stride[i] * (i ? H / 2 : H));
+
+    kb_run(kb, &(struct kb_kernel){
+        .name = "halfpack",
+        .variants = variants,
+        .run = run_halfpack,
+        .out = c.dst,
+        .size = size,
+        .type = KB_U8,
+        .bytes = W * H * 3 / 2,
+    }, &c);
+}
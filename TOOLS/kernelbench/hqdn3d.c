@@ -0,0 +1,110 @@
+/*
+ * 3D denoiser from libmpcodecs/vf_hqdn3d.c
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libmpcodecs/vf_hqdn3d.c"
+
+#include "kernelbench.h"
+
+#define W 1920
+#define H 1080
+
+/* The filter has no SIMD version yet. The plane is filtered in one piece
+ * as the reference, and in slices as done with --vf-slice-threads, which
+ * must give the same result.
+ */
+static const int one_slice = 1, four_slices = 4;
+
+static const struct kb_variant variants[] = {
+    {"C",      0, &one_slice},
+    {"slices", 0, &four_slices},
+    {0}
+};
+
+struct denoise_ctx {
+    struct vf_priv_s *p;
+    uint8_t *src, *dst;
+    unsigned short *frame_ant;
+    unsigned int *horiz;
+};
+
+static void run_denoise(void *arg, const void *impl)
+{
+    struct denoise_ctx *c = arg;
+    int slices = *(const int *)impl;
+    int *spatial = c->p->Coefs[0], *temporal = c->p->Coefs[1];
+    if (slices == 1) {
+        deNoise(c->src, c->dst, c->p->Line, c->frame_ant, W, H, W, W,
+                spatial, spatial, temporal);
+        return;
+    }
+    for (int s = 0; s < slices; s++)
+        deNoiseRows(c->src, c->dst, c->horiz, c->frame_ant, W,
+                    H * s / slices, H * (s + 1) / slices, W, W,
+                    spatial, spatial, temporal);
+    for (int s = 0; s < slices; s++)
+        deNoiseColumns(c->dst, c->p->Line, c->horiz, c->frame_ant, W, H,
+                       W * s / slices, W * (s + 1) / slices, W,
+                       spatial, spatial, temporal);
+}
+
+static void reset_frame_ant(void *arg)
+{
+    struct denoise_ctx *c = arg;
+    for (int i = 0; i < W * H; i++)
+        c->frame_ant[i] = c->src[i] << 8;
+}
+
+static void bench_params(struct kernelbench *kb, const char *kernel,
+                         double spatial, double temporal)
+{
+    struct vf_priv_s *p = kb_alloc(kb, sizeof(*p));
+    PrecalcCoefs(p->Coefs[0], spatial);
+    PrecalcCoefs(p->Coefs[1], temporal);
+    p->Line = kb_alloc(kb, W * sizeof(unsigned int));
+
+    struct denoise_ctx c = {
+        .p = p,
+        .src = kb_alloc(kb, W * H),
+        .dst = kb_alloc(kb, W * H),
+        .frame_ant = kb_alloc(kb, W * H * sizeof(unsigned short)),
+        .horiz = kb_alloc(kb, W * H * sizeof(unsigned int)),
+    };
+    // smooth gradient with noise
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            c.src[y * W + x] = (x + y) / 12 + (kb_random(kb) & 15);
+
+    kb_run(kb, &(struct kb_kernel){
+        .name = kernel,
+        .variants = variants,
+        .run = run_denoise,
+        .prepare = reset_frame_ant,
+        .out = c.dst,
+        .size = W * H,
+        .type = KB_U8,
+        .bytes = W * H,
+    }, &c);
+}
+
+void kb_hqdn3d(struct kernelbench *kb)
+{
+    bench_params(kb, "hqdn3d", PARAM1_DEFAULT, PARAM3_DEFAULT);
+    bench_params(kb, "hqdn3d_spatial", PARAM1_DEFAULT, 0);
+    bench_params(kb, "hqdn3d_temporal", 0, PARAM3_DEFAULT);
+}
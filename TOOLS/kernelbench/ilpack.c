@@ -0,0 +1,103 @@
+/*
+ * Interlaced YV12 to YUY2 conversion from libmpcodecs/vf_ilpack.c
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libmpcodecs/vf_ilpack.c"
+
+#include "kernelbench.h"
+
+#define W 1920
+#define H 1080
+
+struct pack_funcs {
+    pack_func_t *nn, *li_0, *li_1;
+};
+
+static const struct pack_funcs funcs_c = {pack_nn_C, pack_li_0_C, pack_li_1_C};
+#if HAVE_MMX
+#if HAVE_EBX_AVAILABLE
+static const struct pack_funcs funcs_mmx =
+    {pack_nn_MMX, pack_li_0_MMX, pack_li_1_MMX};
+#else
+static const struct pack_funcs funcs_mmx =
+    {pack_nn_MMX, pack_li_0_C, pack_li_1_C};
+#endif
+#endif
+
+static const struct kb_variant variants[] = {
+    {"C",   0,          &funcs_c},
+#if HAVE_MMX
+    {"MMX", KB_CPU_MMX, &funcs_mmx},
+#endif
+    {0}
+};
+
+struct ilpack_ctx {
+    bool linear;
+    uint8_t *planes[3];
+    int stride[3];
+    uint8_t *dst;
+};
+
+static void run_ilpack(void *arg, const void *impl)
+{
+    struct ilpack_ctx *c = arg;
+    const struct pack_funcs *f = impl;
+    // ilpack() uses pack_nn for the first and last two lines
+    pack_nn = f->nn;
+    pack_li_0 = f->li_0;
+    pack_li_1 = f->li_1;
+    pack_func_t *pack[2] = {pack_nn, pack_nn};
+    if (c->linear) {
+        pack[0] = pack_li_0;
+        pack[1] = pack_li_1;
+    }
+    ilpack(c->dst, c->planes, W * 2, c->stride, W, H, pack);
+    KB_EMMS();
+}
+
+static void bench_mode(struct kernelbench *kb, const char *kernel,
+                       bool linear)
+{
+    size_t size = W * 2 * H;
+    struct ilpack_ctx c = {
+        .linear = linear,
+        .planes = {kb_alloc(kb, W * H), kb_alloc(kb, W * H / 4),
+                   kb_alloc(kb, W * H / 4)},
+        .stride = {W, W / 2, W / 2},
+        .dst = kb_alloc(kb, size),
+    };
+    for (int i = 0; i < 3; i++)
+        kb_fill(kb, c.planes[i], c.stride[i] * (i ? H / 2 : H));
+
+    kb_run(kb, &(struct kb_kernel){
+        .name = kernel,
+        .variants = variants,
+        .run = run_ilpack,
+        .out = c.dst,
+        .size = size,
+        .type = KB_U8,
+        .bytes = W * H * 3 / 2,
+    }, &c);
+}
+
+void kb_ilpack(struct kernelbench *kb)
+{
+    bench_mode(kb, "ilpack_nn", false);
+    bench_mode(kb, "ilpack_linear", true);
+}
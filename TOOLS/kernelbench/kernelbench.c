@@ -0,0 +1,427 @@
+/*
+ * Microbenchmark and regression test for the optimized kernels
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "talloc.h"
+#include "mpcommon.h"
+#include "cpudetect.h"
+#include "osdep/timer.h"
+#include "kernelbench.h"
+
+enum status {
+    STATUS_UNCHECKED,
+    STATUS_OK,
+    STATUS_MISMATCH,
+    STATUS_SKIPPED,
+};
+
+static const char *const status_names[] = {
+    [STATUS_UNCHECKED] = "unchecked",
+    [STATUS_OK]        = "ok",
+    [STATUS_MISMATCH]  = "MISMATCH",
+    [STATUS_SKIPPED]   = "skipped",
+};
+
+static const struct {
+    const char *name;
+    unsigned flag;
+} cpu_flags[] = {
+    {"mmx",   KB_CPU_MMX},
+    {"mmx2",  KB_CPU_MMX2},
+    {"3dnow", KB_CPU_3DNOW},
+    {"sse",   KB_CPU_SSE},
+    {"sse2",  KB_CPU_SSE2},
+    {0}
+};
+
+static const struct {
+    const char *name;
+    void (*run)(struct kernelbench *kb);
+} kernels[] = {
+    {"aclib",      kb_aclib},
+    {"osd",        kb_osd},
+    {"reorder",    kb_reorder},
+    {"yadif",      kb_yadif},
+    {"hqdn3d",     kb_hqdn3d},
+    {"scaletempo", kb_scaletempo},
+    {"halfpack",   kb_halfpack},
+    {"ilpack",     kb_ilpack},
+    {"afformat",   kb_afformat},
+    {"volume",     kb_volume},
+    {"pan",        kb_pan},
+    {"fftconv",    kb_fftconv},
+    {0}
+};
+
+struct result {
+    const char *kernel;
+    const char *variant;
+    unsigned cpu;
+    enum status status;
+    double max_diff;
+    double ns_per_call;
+    double mb_per_s;
+    double speedup;             // relative to the reference variant
+};
+
+struct kernelbench {
+    unsigned cpu;               // usable KB_CPU_* flags
+    double min_time;            // seconds per timed variant
+    bool json;
+    uint32_t seed;
+
+    struct result *results;
+    int num_results;
+    struct result *cur;
+    const char *ref_kernel;     // kernel of ref_ns
+    double ref_ns;
+};
+
+static unsigned detect_cpu(void)
+{
+    unsigned cpu = 0;
+    GetCpuCaps(&gCpuCaps);
+    if (gCpuCaps.hasMMX)
+        cpu |= KB_CPU_MMX;
+    if (gCpuCaps.hasMMX2)
+        cpu |= KB_CPU_MMX2;
+    if (gCpuCaps.has3DNow)
+        cpu |= KB_CPU_3DNOW;
+    if (gCpuCaps.hasSSE)
+        cpu |= KB_CPU_SSE;
+    if (gCpuCaps.hasSSE2)
+        cpu |= KB_CPU_SSE2;
+    return cpu;
+}
+
+static void cpu_string(char *buf, size_t size, unsigned cpu)
+{
+    buf[0] = '\0';
+    for (int i = 0; cpu_flags[i].name; i++) {
+        if (cpu & cpu_flags[i].flag) {
+            size_t len = strlen(buf);
+            snprintf(buf + len, size - len, "%s%s", len ? "," : "",
+                     cpu_flags[i].name);
+        }
+    }
+}
+
+static bool parse_cpu(const char *s, unsigned *cpu)
+{
+    *cpu = 0;
+    if (!strcmp(s, "none"))
+        return true;
+    while (*s) {
+        size_t len = strcspn(s, ",");
+        int i;
+        for (i = 0; cpu_flags[i].name; i++) {
+            if (strlen(cpu_flags[i].name) == len
+                && !strncmp(cpu_flags[i].name, s, len))
+                break;
+        }
+        if (!cpu_flags[i].name)
+            return false;
+        *cpu |= cpu_flags[i].flag;
+        s += len;
+        if (*s)
+            s++;
+    }
+    return true;
+}
+
+bool kb_variant(struct kernelbench *kb, const char *kernel,
+                const char *variant, unsigned cpu)
+{
+    MP_RESIZE_ARRAY(kb, kb->results, kb->num_results + 1);
+    struct result *r = &kb->results[kb->num_results++];
+    *r = (struct result){
+        .kernel = kernel,
+        .variant = variant,
+        .cpu = cpu,
+        .status = STATUS_SKIPPED,
+    };
+    kb->cur = NULL;
+    if ((cpu & kb->cpu) != cpu)
+        return false;
+    kb->cur = r;
+    r->status = STATUS_UNCHECKED;
+    return true;
+}
+
+void kb_check(struct kernelbench *kb, bool ok, double max_diff)
+{
+    kb->cur->status = ok ? STATUS_OK : STATUS_MISMATCH;
+    kb->cur->max_diff = max_diff;
+}
+
+static double run_batch(void (*fn)(void *arg), void *arg, int64_t calls)
+{
+    int64_t start = mp_time_ns();
+    for (int64_t i = 0; i < calls; i++)
+        fn(arg);
+    return mp_time_ns() - start;
+}
+
+void kb_time(struct kernelbench *kb, void (*fn)(void *arg), void *arg,
+             int64_t bytes)
+{
+    struct result *r = kb->cur;
+    // Find a batch size that takes about a tenth of the time, then report
+    // the fastest of the batches, which is the least disturbed one.
+    int64_t calls = 1;
+    double t = run_batch(fn, arg, calls);
+    while (t < kb->min_time * 1e9 / 10 && calls < (1LL << 40)) {
+        calls *= 2;
+        t = run_batch(fn, arg, calls);
+    }
+    double best = t;
+    for (int i = 1; i < 10; i++) {
+        t = run_batch(fn, arg, calls);
+        if (t < best)
+            best = t;
+    }
+    r->ns_per_call = best / calls;
+    r->mb_per_s = bytes / r->ns_per_call * 1e3;
+    if (!kb->ref_kernel || strcmp(kb->ref_kernel, r->kernel)) {
+        kb->ref_kernel = r->kernel;
+        kb->ref_ns = r->ns_per_call;
+    }
+    r->speedup = kb->ref_ns / r->ns_per_call;
+}
+
+struct run_args {
+    const struct kb_kernel *k;
+    void *ctx;
+    const void *impl;
+};
+
+static void run_variant(void *arg)
+{
+    struct run_args *a = arg;
+    a->k->run(a->ctx, a->impl);
+}
+
+static double max_diff(const struct kb_kernel *k, const void *out,
+                       const void *ref)
+{
+    double max = 0;
+    switch (k->type) {
+    case KB_U8:
+        return kb_max_diff_u8(out, ref, k->size);
+    case KB_S16: {
+        const int16_t *a = out, *b = ref;
+        for (size_t i = 0; i < k->size / sizeof(int16_t); i++)
+            if (abs(a[i] - b[i]) > max)
+                max = abs(a[i] - b[i]);
+        break;
+    }
+    case KB_FLOAT: {
+        const float *a = out, *b = ref;
+        for (size_t i = 0; i < k->size / sizeof(float); i++)
+            if (fabs(a[i] - b[i]) > max)
+                max = fabs(a[i] - b[i]);
+        break;
+    }
+    }
+    return max;
+}
+
+void kb_run(struct kernelbench *kb, const struct kb_kernel *k, void *ctx)
+{
+    void *ref = k->diff ? NULL : kb_alloc(kb, k->size);
+    for (int i = 0; k->variants[i].name; i++) {
+        const struct kb_variant *v = &k->variants[i];
+        if (!kb_variant(kb, k->name, v->name, v->cpu))
+            continue;
+        struct run_args a = {k, ctx, v->impl};
+        if (k->out)
+            memset(k->out, 0, k->size);
+        if (k->prepare)
+            k->prepare(ctx);
+        run_variant(&a);
+        double diff;
+        if (k->diff) {
+            diff = k->diff(ctx);
+        } else {
+            if (i == 0)
+                memcpy(ref, k->out, k->size);
+            diff = max_diff(k, k->out, ref);
+        }
+        kb_check(kb, diff <= k->tolerance, diff);
+        kb_time(kb, run_variant, &a, k->bytes);
+    }
+}
+
+void *kb_alloc(struct kernelbench *kb, size_t size)
+{
+    uint8_t *p = talloc_zero_size(kb, size + 63);
+    return p + (-(uintptr_t)p & 63);
+}
+
+uint32_t kb_random(struct kernelbench *kb)
+{
+    kb->seed = kb->seed * 1664525 + 1013904223;
+    return kb->seed >> 8;
+}
+
+void kb_fill(struct kernelbench *kb, void *buf, size_t size)
+{
+    uint8_t *p = buf;
+    for (size_t i = 0; i < size; i++)
+        p[i] = kb_random(kb);
+}
+
+int kb_max_diff_u8(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    int max = 0;
+    for (size_t i = 0; i < size; i++) {
+        int d = abs(a[i] - b[i]);
+        if (d > max)
+            max = d;
+    }
+    return max;
+}
+
+static void print_text(struct kernelbench *kb)
+{
+    printf("%-20s %-8s %-10s %8s %12s %10s %8s\n", "kernel", "variant",
+           "check", "diff", "ns/call", "MB/s", "speedup");
+    for (int i = 0; i < kb->num_results; i++) {
+        struct result *r = &kb->results[i];
+        printf("%-20s %-8s %-10s", r->kernel, r->variant,
+               status_names[r->status]);
+        if (r->status == STATUS_SKIPPED)
+            printf("\n");
+        else
+            printf(" %8g %12.1f %10.1f %7.2fx\n", r->max_diff,
+                   r->ns_per_call, r->mb_per_s, r->speedup);
+    }
+}
+
+static void print_json(struct kernelbench *kb)
+{
+    char buf[80];
+    cpu_string(buf, sizeof(buf), kb->cpu);
+    printf("{\n  \"cpu\": \"%s\",\n  \"results\": [", buf);
+    for (int i = 0; i < kb->num_results; i++) {
+        struct result *r = &kb->results[i];
+        cpu_string(buf, sizeof(buf), r->cpu);
+        printf("%s\n    {\"kernel\": \"%s\", \"variant\": \"%s\", "
+               "\"cpu\": \"%s\", \"check\": \"%s\"", i ? "," : "",
+               r->kernel, r->variant, buf, status_names[r->status]);
+        if (r->status != STATUS_SKIPPED)
+            printf(", \"max_diff\": %g, \"ns_per_call\": %.1f, "
+                   "\"mb_per_s\": %.1f, \"speedup\": %.3f", r->max_diff,
+                   r->ns_per_call, r->mb_per_s, r->speedup);
+        printf("}");
+    }
+    printf("\n  ]\n}\n");
+}
+
+static void usage(void)
+{
+    printf("usage: kernelbench [-j] [-t seconds] [-c flags] [kernel...]\n"
+           "  -j          write the results as JSON\n"
+           "  -t seconds  minimum time spent timing each variant "
+           "(default 0.2)\n"
+           "  -c flags    only use these of the detected CPU features, e.g. "
+           "'mmx,sse' or 'none'\n"
+           "kernels:");
+    for (int i = 0; kernels[i].name; i++)
+        printf(" %s", kernels[i].name);
+    printf("\n\nExits with status 1 if a variant does not match its C "
+           "reference.\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct kernelbench *kb = talloc_zero(NULL, struct kernelbench);
+    kb->min_time = 0.2;
+    kb->seed = 1;
+    kb->cpu = detect_cpu();
+
+    int opt;
+    unsigned mask;
+    while ((opt = getopt(argc, argv, "jt:c:h")) != -1) {
+        switch (opt) {
+        case 'j':
+            kb->json = true;
+            break;
+        case 't':
+            kb->min_time = atof(optarg);
+            break;
+        case 'c':
+            if (!parse_cpu(optarg, &mask)) {
+                fprintf(stderr, "Unknown CPU feature in '%s'.\n", optarg);
+                return 2;
+            }
+            kb->cpu &= mask;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    for (int i = optind; i < argc; i++) {
+        int k;
+        for (k = 0; kernels[k].name; k++)
+            if (!strcmp(kernels[k].name, argv[i]))
+                break;
+        if (!kernels[k].name) {
+            fprintf(stderr, "Unknown kernel '%s'.\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (!kb->json) {
+        char buf[80];
+        cpu_string(buf, sizeof(buf), kb->cpu);
+        printf("CPU features: %s\n\n", buf[0] ? buf : "none");
+    }
+
+    for (int k = 0; kernels[k].name; k++) {
+        bool selected = optind == argc;
+        for (int i = optind; i < argc; i++)
+            selected |= !strcmp(kernels[k].name, argv[i]);
+        if (selected)
+            kernels[k].run(kb);
+    }
+
+    if (kb->json)
+        print_json(kb);
+    else
+        print_text(kb);
+
+    int failed = 0;
+    for (int i = 0; i < kb->num_results; i++)
+        failed += kb->results[i].status == STATUS_MISMATCH;
+    if (failed)
+        fprintf(stderr, "%d variant(s) do not match the C reference.\n",
+                failed);
+    talloc_free(kb);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_KERNELBENCH_H
+#define MPLAYER_KERNELBENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/* Microbenchmarks for the optimized inner loops of the player.
+ *
+ * Every kernel has a list of variants. The first one is the plain C
+ * reference; the others need the CPU features given with KB_CPU_* flags and
+ * are only run if cpudetect reports them (and they are not masked out on
+ * the command line). Each variant is run on the same input as the
+ * reference, its output is compared with the reference output, and then it
+ * is timed.
+ *
+ * Most kernels describe themselves with a struct kb_kernel and leave the
+ * loop over the variants to kb_run(). Kernels that need more control call
+ * kb_variant() for each variant, and if that returns true, kb_check() with
+ * the comparison result and kb_time() with a function running the variant
+ * once.
+ */
+
+enum {
+    KB_CPU_MMX   = 1 << 0,
+    KB_CPU_MMX2  = 1 << 1,
+    KB_CPU_3DNOW = 1 << 2,
+    KB_CPU_SSE   = 1 << 3,
+    KB_CPU_SSE2  = 1 << 4,
+};
+
+struct kernelbench;
+
+enum kb_type {
+    KB_U8,
+    KB_S16,
+    KB_FLOAT,
+};
+
+struct kb_variant {
+    const char *name;
+    unsigned cpu;               // KB_CPU_* flags the variant needs
+    const void *impl;           // passed to kb_kernel.run
+};
+
+struct kb_kernel {
+    const char *name;
+    // The first one is the C reference. Terminated by an entry without name.
+    const struct kb_variant *variants;
+    // Run a variant once on ctx.
+    void (*run)(void *ctx, const void *impl);
+    // Optional, called before the run that is checked, after out is cleared.
+    void (*prepare)(void *ctx);
+    // The output of run, size bytes of type elements. The output of each
+    // variant must be within tolerance of the one of the reference.
+    void *out;
+    size_t size;
+    enum kb_type type;
+    double tolerance;
+    // Optional, replaces the comparison of out: returns how far the result
+    // of the last run is off.
+    double (*diff)(void *ctx);
+    // Bytes processed per run, for the MB/s figure.
+    int64_t bytes;
+};
+
+// Start measuring a variant of a kernel. Returns false if the CPU lacks one
+// of the features in cpu, or the kernel was not selected.
+bool kb_variant(struct kernelbench *kb, const char *kernel,
+                const char *variant, unsigned cpu);
+// Record whether the output of the current variant matches the reference.
+// max_diff is the largest difference found, for the report.
+void kb_check(struct kernelbench *kb, bool ok, double max_diff);
+// Time fn(arg), which processes bytes bytes per call, and report the current
+// variant.
+void kb_time(struct kernelbench *kb, void (*fn)(void *arg), void *arg,
+             int64_t bytes);
+
+// Check and time every variant of k the CPU supports.
+void kb_run(struct kernelbench *kb, const struct kb_kernel *k, void *ctx);
+
+// Aligned buffer, freed at exit.
+void *kb_alloc(struct kernelbench *kb, size_t size);
+// Fill with reproducible pseudo-random bytes.
+void kb_fill(struct kernelbench *kb, void *buf, size_t size);
+uint32_t kb_random(struct kernelbench *kb);
+// Largest absolute difference between two byte buffers.
+int kb_max_diff_u8(const uint8_t *a, const uint8_t *b, size_t size);
+
+#if HAVE_MMX
+#define KB_EMMS() __asm__ volatile("emms" ::: "memory")
+#else
+#define KB_EMMS() do {} while (0)
+#endif
+
+void kb_aclib(struct kernelbench *kb);
+void kb_osd(struct kernelbench *kb);
+void kb_reorder(struct kernelbench *kb);
+void kb_yadif(struct kernelbench *kb);
+void kb_hqdn3d(struct kernelbench *kb);
+void kb_scaletempo(struct kernelbench *kb);
+void kb_halfpack(struct kernelbench *kb);
+void kb_ilpack(struct kernelbench *kb);
+void kb_afformat(struct kernelbench *kb);
+void kb_volume(struct kernelbench *kb);
+void kb_pan(struct kernelbench *kb);
+void kb_fftconv(struct kernelbench *kb);
+
+#endif /* MPLAYER_KERNELBENCH_H */
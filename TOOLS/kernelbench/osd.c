@@ -0,0 +1,213 @@
+/*
+ * OSD alpha blending from libvo/osd_template.c
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "libavutil/common.h"
+#include "kernelbench.h"
+
+#if ARCH_X86
+static const uint64_t bFF __attribute__((aligned(8))) = 0xFFFFFFFFFFFFFFFFULL;
+static const unsigned long long mask24lh  __attribute__((aligned(8))) = 0xFFFF000000000000ULL;
+static const unsigned long long mask24hl  __attribute__((aligned(8))) = 0x0000FFFFFFFFFFFFULL;
+
+#if HAVE_MMX
+#define COMPILE_MMX
+#endif
+
+#if HAVE_MMX2
+#define COMPILE_MMX2
+#endif
+
+#if HAVE_AMD3DNOW
+#define COMPILE_3DNOW
+#endif
+#endif /* ARCH_X86 */
+
+#undef HAVE_MMX
+#undef HAVE_MMX2
+#undef HAVE_AMD3DNOW
+#define HAVE_MMX 0
+#define HAVE_MMX2 0
+#define HAVE_AMD3DNOW 0
+#define RENAME(a) a ## _C
+#include "libvo/osd_template.c"
+
+#ifdef COMPILE_MMX
+#undef RENAME
+#undef HAVE_MMX
+#undef HAVE_MMX2
+#undef HAVE_AMD3DNOW
+#define HAVE_MMX 1
+#define HAVE_MMX2 0
+#define HAVE_AMD3DNOW 0
+#define RENAME(a) a ## _MMX
+#include "libvo/osd_template.c"
+#endif
+
+#ifdef COMPILE_MMX2
+#undef RENAME
+#undef HAVE_MMX
+#undef HAVE_MMX2
+#undef HAVE_AMD3DNOW
+#define HAVE_MMX 1
+#define HAVE_MMX2 1
+#define HAVE_AMD3DNOW 0
+#define RENAME(a) a ## _MMX2
+#include "libvo/osd_template.c"
+#endif
+
+#ifdef COMPILE_3DNOW
+#undef RENAME
+#undef HAVE_MMX
+#undef HAVE_MMX2
+#undef HAVE_AMD3DNOW
+#define HAVE_MMX 1
+#define HAVE_MMX2 0
+#define HAVE_AMD3DNOW 1
+#define RENAME(a) a ## _3DNow
+#include "libvo/osd_template.c"
+#endif
+
+typedef void draw_alpha_fn(int w, int h, unsigned char *src,
+                           unsigned char *srca, int srcstride,
+                           unsigned char *dstbase, int dststride);
+
+#define VARIANTS(name, fmt)                                             \
+    static const struct variant name[] = {                              \
+        {"C",     0,                         vo_draw_alpha_##fmt##_C},  \
+        MMX_VARIANTS(fmt)                                               \
+        {0}                                                             \
+    }
+
+struct variant {
+    const char *name;
+    unsigned cpu;
+    draw_alpha_fn *draw;
+};
+
+#ifdef COMPILE_MMX
+#define MMX_VARIANT(fmt) {"MMX", KB_CPU_MMX, vo_draw_alpha_##fmt##_MMX},
+#else
+#define MMX_VARIANT(fmt)
+#endif
+#ifdef COMPILE_MMX2
+#define MMX2_VARIANT(fmt) \
+    {"MMX2", KB_CPU_MMX | KB_CPU_MMX2, vo_draw_alpha_##fmt##_MMX2},
+#else
+#define MMX2_VARIANT(fmt)
+#endif
+#ifdef COMPILE_3DNOW
+#define AMD3DNOW_VARIANT(fmt) \
+    {"3DNow", KB_CPU_MMX | KB_CPU_3DNOW, vo_draw_alpha_##fmt##_3DNow},
+#else
+#define AMD3DNOW_VARIANT(fmt)
+#endif
+#define MMX_VARIANTS(fmt) MMX_VARIANT(fmt) MMX2_VARIANT(fmt) AMD3DNOW_VARIANT(fmt)
+
+VARIANTS(variants_yv12, yv12);
+VARIANTS(variants_yuy2, yuy2);
+VARIANTS(variants_rgb24, rgb24);
+VARIANTS(variants_rgb32, rgb32);
+
+// size of the rendered text, e.g. two lines of subtitles on 1080p
+#define W 1280
+#define H 128
+#define DST_STRIDE (1920 * 4)
+
+struct draw_args {
+    draw_alpha_fn *draw;
+    uint8_t *src, *srca, *dst;
+};
+
+static void run_draw(void *arg)
+{
+    struct draw_args *a = arg;
+    a->draw(W, H, a->src, a->srca, W, a->dst, DST_STRIDE);
+}
+
+// The SIMD versions multiply with srca - 1, and blend transparent pixels
+// next to visible ones with srca 255 instead of skipping them.
+#define TOLERANCE 1
+
+// Compare only the first used bytes of every step bytes. The SIMD versions
+// don't fade the chroma of YUY2 like the C version, and they change the
+// unused fourth byte of RGB32.
+static int max_diff(const uint8_t *a, const uint8_t *b, size_t size,
+                    int step, int used)
+{
+    int max = 0;
+    for (size_t i = 0; i < size; i += step)
+        for (int j = 0; j < used; j++)
+            max = FFMAX(max, abs(a[i + j] - b[i + j]));
+    return max;
+}
+
+static void bench_format(struct kernelbench *kb, const char *kernel,
+                         const struct variant *variants, int bpp,
+                         int step, int used)
+{
+    size_t dst_size = DST_STRIDE * H;
+    uint8_t *src = kb_alloc(kb, W * H);
+    uint8_t *srca = kb_alloc(kb, W * H);
+    uint8_t *dst0 = kb_alloc(kb, dst_size);
+    uint8_t *ref = kb_alloc(kb, dst_size);
+    uint8_t *dst = kb_alloc(kb, dst_size);
+
+    // Like rendered text: runs of transparent pixels (srca 0, src 0), which
+    // the SIMD versions skip, and runs of glyph pixels, where srca is
+    // 256 - alpha and src is premultiplied with alpha, so that the sum
+    // can't overflow.
+    for (int i = 0; i < W * H; i += 16) {
+        bool transparent = kb_random(kb) & 1;
+        for (int j = i; j < i + 16; j++) {
+            int alpha = transparent ? 0 : 1 + kb_random(kb) % 255;
+            srca[j] = (256 - alpha) & 255;
+            src[j] = alpha * (kb_random(kb) & 255) >> 8;
+        }
+    }
+    kb_fill(kb, dst0, dst_size);
+
+    for (int i = 0; variants[i].name; i++) {
+        if (!kb_variant(kb, kernel, variants[i].name, variants[i].cpu))
+            continue;
+        memcpy(dst, dst0, dst_size);
+        variants[i].draw(W, H, src, srca, W, dst, DST_STRIDE);
+        if (i == 0)
+            memcpy(ref, dst, dst_size);
+        int diff = max_diff(dst, ref, dst_size, step, used);
+        kb_check(kb, diff <= TOLERANCE, diff);
+
+        // Blending the same image repeatedly still takes the same time.
+        struct draw_args a = {variants[i].draw, src, srca, dst};
+        kb_time(kb, run_draw, &a, W * H * bpp);
+    }
+}
+
+void kb_osd(struct kernelbench *kb)
+{
+    bench_format(kb, "alpha_yv12", variants_yv12, 1, 1, 1);
+    bench_format(kb, "alpha_yuy2", variants_yuy2, 2, 2, 1);
+    bench_format(kb, "alpha_rgb24", variants_rgb24, 3, 1, 1);
+    bench_format(kb, "alpha_rgb32", variants_rgb32, 4, 4, 3);
+}
@@ -0,0 +1,98 @@
+/*
+ * Channel mixing from libaf/af_pan.c
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libaf/af_pan.c"
+
+#include "kernelbench.h"
+
+#define FRAMES (19200 + 1)
+
+/* The SSE version adds the products in the same order as the C version,
+ * which gives the same result unless the C version is compiled to x87 code
+ * or fused multiply-adds; allow for the rounding differences of those.
+ */
+#define TOLERANCE 1e-6
+
+typedef void mix_fn(float *out, const float *in, int frames, int nchi,
+                    float level[AF_NCH][AF_NCH]);
+
+static void mix_stereo_c(float *out, const float *in, int frames, int nchi,
+                         float level[AF_NCH][AF_NCH])
+{
+    mix_c(out, in, frames, nchi, 2, level);
+}
+
+static const struct kb_variant variants[] = {
+    {"C", 0, mix_stereo_c},
+#if HAVE_SSE
+    {"SSE", KB_CPU_SSE, mix_stereo_sse},
+#endif
+    {0}
+};
+
+struct mix_ctx {
+    float *out, *in;
+    int nchi;
+    float (*level)[AF_NCH];
+};
+
+static void run_mix(void *arg, const void *impl)
+{
+    struct mix_ctx *c = arg;
+    mix_fn *mix = (mix_fn *)impl;
+    mix(c->out, c->in, FRAMES, c->nchi, c->level);
+}
+
+static void bench_downmix(struct kernelbench *kb, const char *kernel,
+                          int nchi, float level[AF_NCH][AF_NCH])
+{
+    struct mix_ctx c = {
+        .out = kb_alloc(kb, FRAMES * 2 * sizeof(float)),
+        .in = kb_alloc(kb, FRAMES * nchi * sizeof(float)),
+        .nchi = nchi,
+        .level = level,
+    };
+    for (int i = 0; i < FRAMES * nchi; i++)
+        c.in[i] = (int16_t)kb_random(kb) / 32768.0;
+
+    kb_run(kb, &(struct kb_kernel){
+        .name = kernel,
+        .variants = variants,
+        .run = run_mix,
+        .out = c.out,
+        .size = FRAMES * 2 * sizeof(float),
+        .type = KB_FLOAT,
+        .tolerance = TOLERANCE,
+        .bytes = FRAMES * nchi * sizeof(float),
+    }, &c);
+}
+void kb_pan(struct kernelbench *kb)
+{
+    // the automatic downmix matrices from libaf/af.c
+    static float stereo_from_51[AF_NCH][AF_NCH] = {
+        {0.4, 0, 0.2, 0, 0.3, 0.1},
+        {0, 0.4, 0, 0.2, 0.3, 0.1},
+    };
+    static float stereo_from_71[AF_NCH][AF_NCH] = {
+        {0.4, 0, 0.15, 0, 0.25, 0.1, 0.1, 0},
+        {0, 0.4, 0, 0.15, 0.25, 0.1, 0, 0.1},
+    };
+    bench_downmix(kb, "pan_6ch_to_2ch", 6, stereo_from_51);
+    bench_downmix(kb, "pan_8ch_to_2ch", 8, stereo_from_71);
+}
@@ -0,0 +1,132 @@
+/*
+ * Channel reordering from libaf/reorder_ch.c
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "libaf/reorder_ch.h"
+#include "kernelbench.h"
+
+#define FRAMES 8192
+
+/* There are no SIMD versions; the unrolled copies in reorder_ch.c and the
+ * in-place reordering are checked against a plain permutation built from
+ * the channel names of the layouts.
+ */
+static const struct layout {
+    int layout;
+    const char *channels[8];
+} layouts[] = {
+    {AF_CHANNEL_LAYOUT_5_0_A, {"L", "R", "C", "Ls", "Rs"}},
+    {AF_CHANNEL_LAYOUT_5_0_D, {"C", "L", "R", "Ls", "Rs"}},
+    {AF_CHANNEL_LAYOUT_5_1_A, {"L", "R", "C", "LFE", "Ls", "Rs"}},
+    {AF_CHANNEL_LAYOUT_5_1_B, {"L", "R", "Ls", "Rs", "C", "LFE"}},
+    {AF_CHANNEL_LAYOUT_5_1_C, {"L", "C", "R", "Ls", "Rs", "LFE"}},
+    {AF_CHANNEL_LAYOUT_5_1_E, {"LFE", "L", "C", "R", "Ls", "Rs"}},
+    {AF_CHANNEL_LAYOUT_7_1_A, {"L", "R", "C", "LFE", "Ls", "Rs", "Rls", "Rrs"}},
+    {AF_CHANNEL_LAYOUT_7_1_B, {"L", "R", "Ls", "Rs", "C", "LFE", "Rls", "Rrs"}},
+};
+
+static const struct layout *find_layout(int layout)
+{
+    for (int i = 0; ; i++)
+        if (layouts[i].layout == layout)
+            return &layouts[i];
+}
+
+static void reference(const uint8_t *src, const struct layout *from,
+                      uint8_t *dst, const struct layout *to, int frames,
+                      int samplesize)
+{
+    int nch = AF_GET_CH_NUM(from->layout);
+    int map[8];
+    for (int c = 0; c < nch; c++)
+        for (int s = 0; s < nch; s++)
+            if (!strcmp(to->channels[c], from->channels[s]))
+                map[c] = s;
+    for (int f = 0; f < frames; f++) {
+        for (int c = 0; c < nch; c++)
+            memcpy(dst + (f * nch + c) * samplesize,
+                   src + (f * nch + map[c]) * samplesize, samplesize);
+    }
+}
+
+struct reorder_args {
+    uint8_t *src, *dst;
+    int from, to, samples, samplesize;
+};
+
+static void run_copy(void *arg)
+{
+    struct reorder_args *a = arg;
+    reorder_channel_copy(a->src, a->from, a->dst, a->to, a->samples,
+                         a->samplesize);
+}
+
+static void run_inplace(void *arg)
+{
+    struct reorder_args *a = arg;
+    reorder_channel(a->dst, a->from, a->to, a->samples, a->samplesize);
+}
+
+static void bench_layouts(struct kernelbench *kb, const char *kernel,
+                          int from, int to, int samplesize)
+{
+    const struct layout *lfrom = find_layout(from), *lto = find_layout(to);
+    int samples = FRAMES * AF_GET_CH_NUM(from);
+    size_t size = samples * samplesize;
+    uint8_t *src = kb_alloc(kb, size);
+    uint8_t *ref = kb_alloc(kb, size);
+    uint8_t *dst = kb_alloc(kb, size);
+    kb_fill(kb, src, size);
+    reference(src, lfrom, ref, lto, FRAMES, samplesize);
+
+    struct reorder_args a = {src, dst, from, to, samples, samplesize};
+    int diff;
+
+    if (kb_variant(kb, kernel, "copy", 0)) {
+        memset(dst, 0, size);
+        run_copy(&a);
+        diff = kb_max_diff_u8(dst, ref, size);
+        kb_check(kb, diff == 0, diff);
+        kb_time(kb, run_copy, &a, size);
+    }
+
+    if (kb_variant(kb, kernel, "inplace", 0)) {
+        memcpy(dst, src, size);
+        run_inplace(&a);
+        diff = kb_max_diff_u8(dst, ref, size);
+        kb_check(kb, diff == 0, diff);
+        kb_time(kb, run_inplace, &a, size);
+    }
+}
+
+void kb_reorder(struct kernelbench *kb)
+{
+    bench_layouts(kb, "reorder_5.0_s16", AF_CHANNEL_LAYOUT_5_0_D,
+                  AF_CHANNEL_LAYOUT_5_0_A, 2);
+    bench_layouts(kb, "reorder_5.1_s16", AF_CHANNEL_LAYOUT_5_1_C,
+                  AF_CHANNEL_LAYOUT_5_1_A, 2);
+    bench_layouts(kb, "reorder_5.1_s24", AF_CHANNEL_LAYOUT_5_1_E,
+                  AF_CHANNEL_LAYOUT_5_1_B, 3);
+    bench_layouts(kb, "reorder_5.1_flt", AF_CHANNEL_LAYOUT_5_1_A,
+                  AF_CHANNEL_LAYOUT_5_1_B, 4);
+    bench_layouts(kb, "reorder_7.1_flt", AF_CHANNEL_LAYOUT_7_1_A,
+                  AF_CHANNEL_LAYOUT_7_1_B, 4);
+}
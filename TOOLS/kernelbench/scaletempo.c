@@ -0,0 +1,222 @@
+/*
+ * Overlap search and blending from libaf/af_scaletempo.c
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libaf/af_scaletempo.c"
+
+#include <math.h>
+
+#include "kernelbench.h"
+
+/* The reference is the plain cross-correlation of the windowed overlap
+ * with every search position. The float versions may sum in a different
+ * order, so they pass if the correlation at the offset they pick is as
+ * good as the best one up to rounding. The blending must be exact.
+ */
+#define FLOAT_TOLERANCE 1e-5
+
+static double correlation_float(af_scaletempo_t *s, int off)
+{
+    float *w = s->table_window, *o = s->buf_overlap;
+    float *q = (float *)s->buf_queue + off * s->num_channels;
+    double corr = 0;
+    for (int i = s->num_channels; i < s->samples_overlap; i++)
+        corr += (double)(w[i - s->num_channels] * o[i]) * q[i];
+    return corr;
+}
+
+static int64_t correlation_s16(af_scaletempo_t *s, int off)
+{
+    int32_t *w = s->table_window;
+    int16_t *o = s->buf_overlap;
+    int16_t *q = (int16_t *)s->buf_queue + off * s->num_channels;
+    int64_t corr = 0;
+    for (int i = s->num_channels; i < s->samples_overlap; i++)
+        corr += (int64_t)((w[i - s->num_channels] * o[i]) >> 15) * q[i];
+    return corr;
+}
+
+static const struct kb_variant search_float[] = {
+    {"C", 0, best_overlap_offset_float},
+#if HAVE_SSE
+    {"SSE", KB_CPU_SSE, best_overlap_offset_float_sse},
+#endif
+    {0}
+};
+
+static const struct kb_variant search_s16[] = {
+    {"C", 0, best_overlap_offset_s16},
+#if HAVE_SSE2
+    {"SSE2", KB_CPU_SSE2, best_overlap_offset_s16_sse2},
+#endif
+    {0}
+};
+
+static const struct kb_variant blend_float[] = {
+    {"C", 0, output_overlap_float},
+#if HAVE_SSE
+    {"SSE", KB_CPU_SSE, output_overlap_float_sse},
+#endif
+    {0}
+};
+
+static const struct kb_variant blend_s16[] = {
+    {"C", 0, output_overlap_s16},
+#if HAVE_SSE2
+    {"SSE2", KB_CPU_SSE2, output_overlap_s16_sse2},
+#endif
+    {0}
+};
+
+struct search_ctx {
+    af_scaletempo_t *s;
+    int bytes_off;              // result of the last run
+    double best;                // correlation at the best offset
+    int best_off;
+};
+
+static void run_search(void *arg, const void *impl)
+{
+    struct search_ctx *c = arg;
+    int (*search)(af_scaletempo_t *s) = impl;
+    c->bytes_off = search(c->s);
+}
+
+static double diff_float(void *arg)
+{
+    struct search_ctx *c = arg;
+    int off = c->bytes_off / (4 * c->s->num_channels);
+    return (c->best - correlation_float(c->s, off)) / fabs(c->best);
+}
+
+static double diff_s16(void *arg)
+{
+    struct search_ctx *c = arg;
+    int off = c->bytes_off / (2 * c->s->num_channels);
+    return abs(off - c->best_off);
+}
+
+struct blend_ctx {
+    af_scaletempo_t *s;
+    void *out;
+};
+
+static void run_blend(void *arg, const void *impl)
+{
+    struct blend_ctx *c = arg;
+    void (*blend)(af_scaletempo_t *s, void *out, int bytes_off) = impl;
+    blend(c->s, c->out, 0);
+}
+
+static af_instance_t *open_filter(struct kernelbench *kb, int format,
+                                  int bps, int nch)
+{
+    af_instance_t *af = kb_alloc(kb, sizeof(*af));
+    af_open(af);
+    af_scaletempo_t *s = af->setup;
+    s->scale = 1.5;
+    af_data_t data = {.rate = 48000, .nch = nch, .format = format,
+                      .bps = bps};
+    control(af, AF_CONTROL_REINIT, &data);
+    kb_fill(kb, s->buf_queue, s->bytes_queue);
+    kb_fill(kb, s->buf_overlap, s->bytes_overlap);
+    if (format == AF_FORMAT_FLOAT_NE) {
+        // random bytes are not sane floats
+        float *q = (float *)s->buf_queue, *o = s->buf_overlap;
+        for (int i = 0; i < s->bytes_queue / 4; i++)
+            q[i] = (int16_t)kb_random(kb) / 32768.0;
+        for (int i = 0; i < s->samples_overlap; i++)
+            o[i] = (int16_t)kb_random(kb) / 32768.0;
+    }
+    s->bytes_queued = s->bytes_queue;
+    return af;
+}
+
+static void bench_blend(struct kernelbench *kb, const char *kernel,
+                        af_scaletempo_t *s, const struct kb_variant *v)
+{
+    struct blend_ctx c = {s, kb_alloc(kb, s->bytes_overlap)};
+    kb_run(kb, &(struct kb_kernel){
+        .name = kernel,
+        .variants = v,
+        .run = run_blend,
+        .out = c.out,
+        .size = s->bytes_overlap,
+        .type = KB_U8,
+        .bytes = s->bytes_overlap,
+    }, &c);
+}
+
+static void bench_float(struct kernelbench *kb, const char *search_kernel,
+                        const char *blend_kernel, int nch)
+{
+    af_instance_t *af = open_filter(kb, AF_FORMAT_FLOAT_NE, 4, nch);
+    af_scaletempo_t *s = af->setup;
+
+    struct search_ctx c = {.s = s, .best = -INFINITY};
+    for (int off = 0; off < s->frames_search; off++)
+        c.best = FFMAX(c.best, correlation_float(s, off));
+
+    kb_run(kb, &(struct kb_kernel){
+        .name = search_kernel,
+        .variants = search_float,
+        .run = run_search,
+        .diff = diff_float,
+        .tolerance = FLOAT_TOLERANCE,
+        .bytes = s->frames_search * s->bytes_overlap,
+    }, &c);
+    if (blend_kernel)
+        bench_blend(kb, blend_kernel, s, blend_float);
+    uninit(af);
+}
+
+static void bench_s16(struct kernelbench *kb, const char *search_kernel,
+                      const char *blend_kernel, int nch)
+{
+    af_instance_t *af = open_filter(kb, AF_FORMAT_S16_NE, 2, nch);
+    af_scaletempo_t *s = af->setup;
+
+    struct search_ctx c = {.s = s};
+    int64_t best = INT64_MIN;
+    for (int off = 0; off < s->frames_search; off++) {
+        int64_t corr = correlation_s16(s, off);
+        if (corr > best) {
+            best = corr;
+            c.best_off = off;
+        }
+    }
+
+    kb_run(kb, &(struct kb_kernel){
+        .name = search_kernel,
+        .variants = search_s16,
+        .run = run_search,
+        .diff = diff_s16,
+        .bytes = s->frames_search * s->bytes_overlap,
+    }, &c);
+    if (blend_kernel)
+        bench_blend(kb, blend_kernel, s, blend_s16);
+    uninit(af);
+}
+
+void kb_scaletempo(struct kernelbench *kb)
+{
+    bench_float(kb, "scaletempo_float", "scaletempo_blend_flt", 2);
+    bench_float(kb, "scaletempo_float_6ch", NULL, 6);
+    bench_s16(kb, "scaletempo_s16", "scaletempo_blend_s16", 2);
+    bench_s16(kb, "scaletempo_s16_6ch", NULL, 6);
+}
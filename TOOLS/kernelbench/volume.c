@@ -0,0 +1,83 @@
+/*
+ * s16 volume control from libaf/af_volume.c
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libaf/af_volume.c"
+
+#include "kernelbench.h"
+
+#define FRAMES (19200 + 3)
+
+// The results are exact, including the clipping of boosted channels.
+static const struct kb_variant variants[] = {
+    {"C", 0, volume_s16_c},
+#if HAVE_SSE2
+    {"SSE2", KB_CPU_SSE2, volume_s16_sse2},
+#endif
+    {0}
+};
+
+struct volume_ctx {
+    int16_t *in, *a;
+    int len, nch;
+    const int *vol;
+};
+
+static void run_volume(void *arg, const void *impl)
+{
+    struct volume_ctx *c = arg;
+    void (*volume)(int16_t *a, int len, int nch, const int *vol) = impl;
+    volume(c->a, c->len, c->nch, c->vol);
+}
+
+// The filter works in place; the timed runs keep scaling the same buffer.
+static void copy_input(void *arg)
+{
+    struct volume_ctx *c = arg;
+    memcpy(c->a, c->in, c->len * sizeof(int16_t));
+}
+
+static void bench_layout(struct kernelbench *kb, const char *kernel, int nch,
+                         const int *vol)
+{
+    int len = FRAMES * nch;
+    size_t size = len * sizeof(int16_t);
+    struct volume_ctx c = {kb_alloc(kb, size), kb_alloc(kb, size), len, nch,
+                           vol};
+    kb_fill(kb, c.in, size);
+
+    kb_run(kb, &(struct kb_kernel){
+        .name = kernel,
+        .variants = variants,
+        .run = run_volume,
+        .prepare = copy_input,
+        .out = c.a,
+        .size = size,
+        .type = KB_S16,
+        .bytes = size,
+    }, &c);
+}
+
+void kb_volume(struct kernelbench *kb)
+{
+    static const int stereo[] = {179, 179};
+    // 5.1 with a disabled (256) and a boosted channel
+    static const int surround[] = {179, 179, 256, 512, 90, 90};
+    bench_layout(kb, "volume_s16_2ch", 2, stereo);
+    bench_layout(kb, "volume_s16_6ch", 6, surround);
+}
@@ -0,0 +1,90 @@
+/*
+ * Deinterlacing line filter from libmpcodecs/vf_yadif.c
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libmpcodecs/vf_yadif.c"
+
+#include "kernelbench.h"
+
+#define W 1920
+// The filter reads two lines above and below, and a few pixels left and
+// right of the line.
+#define STRIDE (W + 64)
+#define LINES 5
+#define CUR_OFFSET (2 * STRIDE + 32)
+
+typedef void line_fn(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev,
+                     uint8_t *cur, uint8_t *next, int w, int refs, int parity);
+
+static const struct kb_variant variants[] = {
+    {"C",    0,                        filter_line_c},
+#if HAVE_MMX
+    {"MMX2", KB_CPU_MMX | KB_CPU_MMX2, filter_line_mmx2},
+#endif
+    {0}
+};
+
+struct line_ctx {
+    struct vf_priv_s p;
+    uint8_t *fields[3];
+    uint8_t *dst;
+};
+
+// Both parities, into two lines of dst.
+static void run_line(void *arg, const void *impl)
+{
+    struct line_ctx *c = arg;
+    line_fn *filter = (line_fn *)impl;
+    for (int parity = 0; parity < 2; parity++)
+        filter(&c->p, c->dst + parity * W, c->fields[0] + CUR_OFFSET,
+               c->fields[1] + CUR_OFFSET, c->fields[2] + CUR_OFFSET, W,
+               STRIDE, parity);
+    KB_EMMS();
+}
+
+static void bench_mode(struct kernelbench *kb, const char *kernel, int mode)
+{
+    struct line_ctx c = {.p = {.mode = mode}, .dst = kb_alloc(kb, W * 2)};
+    for (int i = 0; i < 3; i++) {
+        c.fields[i] = kb_alloc(kb, STRIDE * LINES);
+        kb_fill(kb, c.fields[i], STRIDE * LINES);
+    }
+    // Mostly static content with some motion, so that both the temporal
+    // and the spatial prediction are used.
+    for (int i = 0; i < STRIDE * LINES; i++) {
+        if (kb_random(kb) & 3) {
+            c.fields[0][i] = c.fields[1][i];
+            c.fields[2][i] = c.fields[1][i];
+        }
+    }
+    kb_run(kb, &(struct kb_kernel){
+        .name = kernel,
+        .variants = variants,
+        .run = run_line,
+        .out = c.dst,
+        .size = W * 2,
+        .type = KB_U8,
+        .bytes = W * 2,
+    }, &c);
+}
+
+void kb_yadif(struct kernelbench *kb)
+{
+    bench_mode(kb, "yadif_line", 0);
+    bench_mode(kb, "yadif_line_mode2", 2);
+}
@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+
+# Decode and filter benchmark.
+#
+# Runs video files through the demuxer, decoder and filter chain as fast as
+# possible (--benchmark --vo=null, no audio output timing) for every
+# combination of the given thread counts and filter chains, and prints the
+# results as JSON: frames/s, input MB/s, peak RSS and the per-stage times
+# collected with --perf-stats.
+#
+# Without input files, a raw YUV4MPEG test clip is generated with the
+# player itself (vf_test patterns written by vo_yuv4mpeg), so the numbers
+# don't depend on any external media. Generated clips are kept in the media
+# directory and reused by later runs.
+#
+# usage:
+#   mpbench.py [--mplayer ./mplayer] [--threads 1,2,4] [--vf hqdn3d]
+#              [--vf scale=1280:720,unsharp] [--output results.json] [file...]
+#              [-- options for every run]
+
+import argparse
+import json
+import os
+import platform
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+COMMON_ARGS = ["--noconfig=all", "--really-quiet", "--benchmark",
+               "--noframedrop"]
+
+def run_player(mplayer, args):
+    """Run the player, return (exit status, wall time, peak RSS in KiB)."""
+    start = time.monotonic()
+    proc = subprocess.Popen([mplayer] + args, stdin=subprocess.DEVNULL,
+                            stdout=subprocess.DEVNULL)
+    _, status, usage = os.wait4(proc.pid, 0)
+    wall = time.monotonic() - start
+    proc.returncode = os.waitstatus_to_exitcode(status)
+    rss = usage.ru_maxrss
+    if sys.platform == "darwin":
+        rss //= 1024        # bytes instead of KiB
+    return proc.returncode, wall, rss
+
+def generate_clip(mplayer, media_dir, width, height, frames):
+    path = os.path.join(media_dir, "mpbench-%dx%d-%d.y4m" %
+                        (width, height, frames))
+    if os.path.exists(path):
+        return path
+    tmp = path + ".part"
+    # vf_test outputs 512x512 patterns; scale them to the wanted size
+    status, _, _ = run_player(mplayer, COMMON_ARGS + [
+        "--nosound", "--demuxer=rawvideo",
+        "--rawvideo=w=%d:h=%d:fps=25:format=i420" % (width, height),
+        "--frames=%d" % frames,
+        "--vf=test,scale=%d:%d" % (width, height),
+        "--vo=yuv4mpeg:file=%s" % tmp, "/dev/zero"])
+    if status != 0 or not os.path.exists(tmp):
+        sys.exit("Could not generate the test clip with %s." % mplayer)
+    os.rename(tmp, path)
+    return path
+
+def thread_args(threads, pipeline):
+    args = ["--lavdopts=threads=%d" % threads,
+            "--vf-slice-threads=%d" % threads]
+    if pipeline:
+        args.append("--vf-threads")
+    return args
+
+def bench_one(mplayer, path, vf, threads, opts):
+    stats_file = tempfile.NamedTemporaryFile(suffix=".json", delete=False)
+    stats_file.close()
+    args = COMMON_ARGS + ["--vo=null", "--perf-stats=%s" % stats_file.name]
+    args += ["--ao=pcm:fast:nowaveheader:file=%s" % os.devnull] \
+            if opts.audio else ["--nosound"]
+    if vf:
+        args.append("--vf=%s" % vf)
+    args += thread_args(threads, opts.vf_threads)
+    args += opts.extra
+    args.append(path)
+
+    runs = []
+    for _ in range(opts.runs):
+        status, wall, rss = run_player(mplayer, args)
+        if status != 0:
+            os.unlink(stats_file.name)
+            sys.exit("%s failed on %s with exit status %d." %
+                     (mplayer, path, status))
+        with open(stats_file.name) as f:
+            stats = json.load(f)
+        runs.append({"wall_s": wall, "peak_rss_kb": rss, "stats": stats})
+    os.unlink(stats_file.name)
+
+    # report the run with the median wall time
+    runs.sort(key=lambda r: r["wall_s"])
+    median = runs[len(runs) // 2]
+    stages = {s["name"]: {k: v for k, v in s.items() if k != "name"}
+              for s in median["stats"]["stages"]}
+    frames = stages.get("vo_draw", {}).get("count", 0)
+    wall = median["wall_s"]
+    return {
+        "file": path,
+        "vf": vf,
+        "threads": threads,
+        "vf_threads": opts.vf_threads,
+        "runs": [r["wall_s"] for r in runs],
+        "wall_s": wall,
+        "frames": frames,
+        "fps": frames / wall if wall > 0 else 0,
+        "mb_per_s": os.path.getsize(path) / 1e6 / wall if wall > 0 else 0,
+        "peak_rss_kb": max(r["peak_rss_kb"] for r in runs),
+        "wall_s_stdev": statistics.pstdev(r["wall_s"] for r in runs),
+        "stages": stages,
+    }
+
+def player_version(mplayer):
+    try:
+        out = subprocess.run([mplayer, "--noconfig=all"],
+                             stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                             stdin=subprocess.DEVNULL).stdout
+    except OSError as e:
+        sys.exit("Could not run %s: %s" % (mplayer, e))
+    lines = out.decode("utf-8", "replace").splitlines()
+    return lines[0] if lines else ""
+
+def int_list(s):
+    return [int(x) for x in s.split(",")]
+
+def size(s):
+    w, h = s.split("x")
+    return int(w), int(h)
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Benchmark demuxing, decoding and video filtering.")
+    parser.add_argument("files", nargs="*",
+                        help="input files (default: generate a test clip)")
+    parser.add_argument("--mplayer", default="./mplayer",
+                        help="player binary (default: %(default)s)")
+    parser.add_argument("--threads", type=int_list, default=[1],
+                        help="comma separated decoder and slice thread "
+                             "counts to test (default: 1)")
+    parser.add_argument("--vf", action="append",
+                        help="filter chain to test, can be given more than "
+                             "once; '' for no filters (default: '' and "
+                             "'hqdn3d,unsharp')")
+    parser.add_argument("--vf-threads", action="store_true",
+                        help="run the filter chain as a thread pipeline")
+    parser.add_argument("--audio", action="store_true",
+                        help="also decode and filter audio")
+    parser.add_argument("--runs", type=int, default=3,
+                        help="runs per configuration, the median is "
+                             "reported (default: %(default)s)")
+    parser.add_argument("--size", type=size, default=(1280, 720),
+                        help="size of the generated clip "
+                             "(default: 1280x720)")
+    parser.add_argument("--frames", type=int, default=500,
+                        help="length of the generated clip "
+                             "(default: %(default)s)")
+    parser.add_argument("--media-dir", default=tempfile.gettempdir(),
+                        help="where to keep generated clips "
+                             "(default: %(default)s)")
+    parser.add_argument("--output", help="write JSON here instead of stdout")
+    # options after "--" are passed to every benchmark run
+    argv = sys.argv[1:]
+    extra = []
+    if "--" in argv:
+        extra = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+    opts = parser.parse_args(argv)
+    opts.extra = extra
+    chains = opts.vf if opts.vf is not None else ["", "hqdn3d,unsharp"]
+
+    version = player_version(opts.mplayer)
+    files = opts.files or [generate_clip(opts.mplayer, opts.media_dir,
+                                         opts.size[0], opts.size[1],
+                                         opts.frames)]
+    results = []
+    for path in files:
+        for vf in chains:
+            for threads in opts.threads:
+                r = bench_one(opts.mplayer, path, vf, threads, opts)
+                sys.stderr.write("%s vf=%s threads=%d: %.1f fps, %.1f MB/s, "
+                                 "%d KiB\n" % (os.path.basename(path),
+                                               vf or "-", threads, r["fps"],
+                                               r["mb_per_s"],
+                                               r["peak_rss_kb"]))
+                results.append(r)
+
+    report = {
+        "mplayer": opts.mplayer,
+        "version": version,
+        "host": {
+            "system": platform.system(),
+            "machine": platform.machine(),
+            "cpus": os.cpu_count(),
+        },
+        "args": opts.extra,
+        "results": results,
+    }
+    out = json.dumps(report, indent=2, sort_keys=True) + "\n"
+    if opts.output:
+        with open(opts.output, "w") as f:
+            f.write(out)
+    else:
+        sys.stdout.write(out)
+
+if __name__ == "__main__":
+    main()
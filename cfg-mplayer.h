@@ -387,6 +387,8 @@ const m_option_t common_opts[] = {
 #else
     {"cache", "MPlayer was compiled without cache2 support.\n", CONF_TYPE_PRINT, CONF_NOCFG, 0, 0, NULL},
 #endif /* CONFIG_STREAM_CACHE */
+    OPT_STRING("disk-cache-dir", disk_cache_dir, 0),
+    OPT_INTRANGE("disk-cache-size", disk_cache_size, 0, 1, 1048576),
     {"cdrom-device", &cdrom_device, CONF_TYPE_STRING, 0, 0, 0, NULL},
 #ifdef CONFIG_DVDREAD
     {"dvd-device", &dvd_device,  CONF_TYPE_STRING, 0, 0, 0, NULL},
@@ -466,6 +468,9 @@ const m_option_t common_opts[] = {
     {"forceidx", &index_mode, CONF_TYPE_FLAG, 0, -1, 2, NULL},
     {"saveidx", &index_file_save, CONF_TYPE_STRING, 0, 0, 0, NULL},
     {"loadidx", &index_file_load, CONF_TYPE_STRING, 0, 0, 0, NULL},
+    // Matroska, MPEG-PS and MPEG-TS: keep the keyframe index built while
+    // playing in this directory
+    OPT_STRING("index-cache-dir", index_cache_dir, 0),
 
     // select audio/video/subtitle stream
     OPT_INTRANGE("aid", audio_id, 0, -2, 8190),
@@ -498,6 +503,9 @@ const m_option_t common_opts[] = {
     OPT_STRING("audio-demuxer", audio_demuxer_name, 0),
     OPT_STRING("sub-demuxer", sub_demuxer_name, 0),
     OPT_MAKE_FLAGS("extbased", extension_parsing, 0),
+    OPT_MAKE_FLAGS("demuxer-thread", demuxer_thread, 0),
+    OPT_FLOATRANGE("demuxer-readahead-secs", demuxer_readahead_secs, 0, 0, 600),
+    OPT_INTRANGE("demuxer-readahead-size", demuxer_readahead_size, 0, 64, 131072),
 
     {"mf", (void *) mfopts_conf, CONF_TYPE_SUBCONFIG, 0,0,0, NULL},
 #ifdef CONFIG_RADIO
@@ -554,6 +562,9 @@ const m_option_t common_opts[] = {
     {"af-adv", (void *) audio_filter_conf, CONF_TYPE_SUBCONFIG, 0, 0, 0, NULL},
 
     OPT_SETTINGSLIST("vf*", vf_settings, 0, &vf_obj_list),
+    // must come after "vf*" to take precedence over it
+    OPT_MAKE_FLAGS("vf-threads", vf_threads, 0),
+    OPT_INTRANGE("vf-slice-threads", vf_slice_threads, 0, 0, 16),
     // select audio/video codec (by name) or codec family (by number):
     {"afm", &audio_fm_list, CONF_TYPE_STRING_LIST, 0, 0, 0, NULL},
     {"vfm", &video_fm_list, CONF_TYPE_STRING_LIST, 0, 0, 0, NULL},
@@ -678,6 +689,7 @@ const m_option_t mplayer_opts[]={
     OPT_MAKE_FLAGS("gapless-audio", gapless_audio, 0),
     // override audio buffer size (used only by -ao oss/win32, obsolete)
     OPT_INT("abs", ao_buffersize, 0),
+    OPT_FLOATRANGE("ao-thread-buffer", ao_thread_buffer, 0, 0, 10),
 
     {"edlout", &edl_output_filename,  CONF_TYPE_STRING, 0, 0, 0, NULL},
 
@@ -803,6 +815,9 @@ const m_option_t mplayer_opts[]={
     OPT_INTRANGE("autoq", auto_quality, 0, 0, 100),
 
     OPT_FLAG_ON("benchmark", benchmark, 0),
+    OPT_STRING("perf-stats", perf_stats_file, 0),
+    OPT_STRING("trace", trace_file, 0),
+    OPT_INTRANGE("trace-buffer", trace_buffer, 0, 1000, 100000000),
 
     // dump some stream out instead of playing the file
     OPT_STRING("dumpfile", stream_dump_name, 0, OPTDEF_STR("stream.dump")),
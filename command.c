@@ -66,6 +66,7 @@
 #include "stream/stream_dvdnav.h"
 #include "m_struct.h"
 #include "screenshot.h"
+#include "profiler.h"
 
 #include "mp_core.h"
 #include "mp_fifo.h"
@@ -373,11 +374,15 @@ static int mp_property_stream_pos(m_option_t *prop, int action, void *arg,
         return M_PROPERTY_ERROR;
     switch (action) {
     case M_PROPERTY_GET:
+        demux_lock(mpctx->demuxer);
         *(off_t *) arg = stream_tell(mpctx->demuxer->stream);
+        demux_unlock(mpctx->demuxer);
         return M_PROPERTY_OK;
     case M_PROPERTY_SET:
         M_PROPERTY_CLAMP(prop, *(off_t *) arg);
+        demux_lock(mpctx->demuxer);
         stream_seek(mpctx->demuxer->stream, *(off_t *) arg);
+        demux_unlock(mpctx->demuxer);
         return M_PROPERTY_OK;
     }
     return M_PROPERTY_NOT_IMPLEMENTED;
@@ -1781,6 +1786,7 @@ static int mp_property_sub(m_option_t *prop, int action, void *arg,
         opts->sub_id = source_pos;
         if (d_sub && opts->sub_id < MAX_S_STREAMS) {
             int i = 0;
+            demux_lock(d_sub->demuxer);
             // default: assume 1:1 mapping of sid and stream id
             d_sub->id = opts->sub_id;
             d_sub->sh = mpctx->d_sub->demuxer->s_streams[d_sub->id];
@@ -1805,6 +1811,7 @@ static int mp_property_sub(m_option_t *prop, int action, void *arg,
                 d_sub->id = -2;
                 d_sub->sh = NULL;
             }
+            demux_unlock(d_sub->demuxer);
         }
     }
 #ifdef CONFIG_DVDREAD
@@ -3138,6 +3145,7 @@ void run_command(MPContext *mpctx, mp_cmd_t *cmd)
     case MP_CMD_RADIO_STEP_CHANNEL:
         if (mpctx->demuxer->stream->type == STREAMTYPE_RADIO) {
             int v = cmd->args[0].v.i;
+            demux_lock(mpctx->demuxer);
             if (v > 0)
                 radio_step_channel(mpctx->demuxer->stream,
                                    RADIO_CHANNEL_HIGHER);
@@ -3149,28 +3157,37 @@ void run_command(MPContext *mpctx, mp_cmd_t *cmd)
                              "Channel: %s",
                              radio_get_channel_name(mpctx->demuxer->stream));
             }
+            demux_unlock(mpctx->demuxer);
         }
         break;
 
     case MP_CMD_RADIO_SET_CHANNEL:
         if (mpctx->demuxer->stream->type == STREAMTYPE_RADIO) {
+            demux_lock(mpctx->demuxer);
             radio_set_channel(mpctx->demuxer->stream, cmd->args[0].v.s);
             if (radio_get_channel_name(mpctx->demuxer->stream)) {
                 set_osd_tmsg(OSD_MSG_RADIO_CHANNEL, 1, osd_duration,
                              "Channel: %s",
                              radio_get_channel_name(mpctx->demuxer->stream));
             }
+            demux_unlock(mpctx->demuxer);
         }
         break;
 
     case MP_CMD_RADIO_SET_FREQ:
-        if (mpctx->demuxer->stream->type == STREAMTYPE_RADIO)
+        if (mpctx->demuxer->stream->type == STREAMTYPE_RADIO) {
+            demux_lock(mpctx->demuxer);
             radio_set_freq(mpctx->demuxer->stream, cmd->args[0].v.f);
+            demux_unlock(mpctx->demuxer);
+        }
         break;
 
     case MP_CMD_RADIO_STEP_FREQ:
-        if (mpctx->demuxer->stream->type == STREAMTYPE_RADIO)
+        if (mpctx->demuxer->stream->type == STREAMTYPE_RADIO) {
+            demux_lock(mpctx->demuxer);
             radio_step_freq(mpctx->demuxer->stream, cmd->args[0].v.f);
+            demux_unlock(mpctx->demuxer);
+        }
         break;
 #endif
 
@@ -3366,6 +3383,17 @@ void run_command(MPContext *mpctx, mp_cmd_t *cmd)
         screenshot_request(mpctx, cmd->args[0].v.i, cmd->args[1].v.i);
         break;
 
+    case MP_CMD_PERF_STATS_DUMP: {
+        char *file = cmd->args[0].v.s;
+        if (!mp_profiling) {
+            mp_msg(MSGT_CPLAYER, MSGL_WARN, "Performance statistics are "
+                   "only collected with --perf-stats.\n");
+        } else {
+            mp_profiler_dump(file[0] ? file : opts->perf_stats_file);
+        }
+        break;
+    }
+
     case MP_CMD_VF_CHANGE_RECTANGLE:
         if (!sh_video)
             break;
@@ -27,6 +27,8 @@ void set_default_mplayer_options(struct MPOpts *opts)
         .chapter_merge_threshold = 100,
         .stream_cache_min_percent = 20.0,
         .stream_cache_seek_min_percent = 50.0,
+        .disk_cache_size = 1024,
+        .trace_buffer = 200000,
         .chapterrange = {-1, -1},
         .edition_id = -1,
         .user_correct_pts = -1,
@@ -39,10 +41,13 @@ void set_default_mplayer_options(struct MPOpts *opts)
         .sub_id = -1,
         .sub_visibility = 1,
         .extension_parsing = 1,
+        .demuxer_readahead_secs = 1.0,
+        .demuxer_readahead_size = 16384,
         .audio_output_channels = 2,
         .audio_output_format = -1,  // AF_FORMAT_UNKNOWN
         .playback_speed = 1.,
         .drc_level = 1.,
+        .vf_slice_threads = 1,
         .movie_aspect = -1.,
         .flip = -1,
         .vd_use_slices = 1,
@@ -73,4 +73,12 @@ typedef int x86_reg;
 #    define BROKEN_RELOCATIONS 1
 #endif
 
+/* The compiler only keeps values in the SSE registers (and only accepts
+ * them as clobbers) if it generates SSE code itself. */
+#ifdef __SSE__
+#    define XMM_CLOBBERS(...)        __VA_ARGS__,
+#else
+#    define XMM_CLOBBERS(...)
+#endif
+
 #endif /* AVUTIL_X86_CPU_H */
@@ -114,6 +114,7 @@ static const mp_cmd_t mp_cmds[] = {
   { MP_CMD_SPEED_SET, "speed_set", { ARG_FLOAT } },
   { MP_CMD_QUIT, "quit", { OARG_INT(0) } },
   { MP_CMD_STOP, "stop", },
+  { MP_CMD_PERF_STATS_DUMP, "perf_stats_dump", { OARG_STRING("") } },
   { MP_CMD_PAUSE, "pause", },
   { MP_CMD_FRAME_STEP, "frame_step", },
   { MP_CMD_PLAY_TREE_STEP, "pt_step", { ARG_INT, OARG_INT(0) } },
@@ -1291,6 +1292,34 @@ int mp_input_queue_cmd(struct input_ctx *ictx, mp_cmd_t *cmd)
     return 1;
 }
 
+// Time in ms until check_autorepeat() may produce the next command, or -1.
+static int autorepeat_timeout(struct input_ctx *ictx)
+{
+    if (ictx->ar_rate <= 0 || ictx->ar_state < 0 || !ictx->num_key_down
+        || (ictx->key_down[ictx->num_key_down - 1] & MP_NO_REPEAT_KEY))
+        return -1;
+    unsigned int t = GetTimer();
+    int left = ictx->ar_state == 0 ?
+        ictx->ar_delay * 1000 - (t - ictx->last_key_down) :
+        1000000 / ictx->ar_rate - (t - ictx->last_ar);
+    return left > 0 ? (left + 999) / 1000 : 0;
+}
+
+void mp_input_wait(struct input_ctx *ictx, double time)
+{
+    if (async_quit_request || ictx->control_cmd_queue.num_cmds
+        || ictx->key_cmd_queue.num_cmds)
+        return;
+    // Round down; callers needing exact timing sleep for the remainder.
+    int ms = time * 1000;
+    if (ms < 0)
+        ms = 0;
+    int ar = autorepeat_timeout(ictx);
+    if (ar >= 0 && ar < ms)
+        ms = ar;
+    read_all_events(ictx, ms);
+}
+
 /**
  * \param peek_only when set, the returned command stays in the queue.
  * Do not free the returned cmd whe you set this!
@@ -1700,7 +1729,8 @@ static int print_cmd_list(m_option_t *cfg, char *optname, char *optparam)
 
 void mp_input_wakeup(struct input_ctx *ictx)
 {
-    if (ictx->wakeup_pipe[1] >= 0)
+    // If the pipe is full a wakeup is pending anyway, so ignore EAGAIN.
+    if (ictx && ictx->wakeup_pipe[1] >= 0)
         write(ictx->wakeup_pipe[1], &(char){0}, 1);
 }
 
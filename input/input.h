@@ -128,6 +128,7 @@ enum mp_command_type {
     MP_CMD_ASS_USE_MARGINS,
     MP_CMD_SWITCH_TITLE,
     MP_CMD_STOP,
+    MP_CMD_PERF_STATS_DUMP,
 
     /// DVDNAV commands
     MP_CMD_DVDNAV_UP = 1000,
@@ -259,7 +260,18 @@ void mp_input_uninit(struct input_ctx *ictx);
 struct m_config;
 void mp_input_register_options(struct m_config *cfg);
 
-// Wake up sleeping input loop from another thread.
+/* Sleep until an input event arrives, mp_input_wakeup() is called or
+ * "time" seconds have passed. Returns immediately if commands are queued.
+ * The wait has millisecond resolution and never ends late because of
+ * rounding, so it may return up to 1 ms before the deadline.
+ */
+void mp_input_wait(struct input_ctx *ictx, double time);
+
+/* Wake up the sleeping input loop (mp_input_wait() or mp_input_get_cmd()).
+ * Safe to call from any thread, and from a forked cache process since the
+ * wakeup pipe is inherited. Used by audio outputs and the cache to make
+ * the playloop react to their state changes without polling.
+ */
 void mp_input_wakeup(struct input_ctx *ictx);
 
 // Interruptible usleep:  (used by libmpdemux)
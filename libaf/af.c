@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "osdep/strsep.h"
+#include "profiler.h"
 
 #include "af.h"
 
@@ -43,6 +44,7 @@ extern af_info_t af_info_lavcac3enc;
 extern af_info_t af_info_lavrresample;
 extern af_info_t af_info_sweep;
 extern af_info_t af_info_hrtf;
+extern af_info_t af_info_fir;
 extern af_info_t af_info_ladspa;
 extern af_info_t af_info_center;
 extern af_info_t af_info_sinesuppress;
@@ -72,6 +74,7 @@ static af_info_t* filter_list[]={
    &af_info_lavrresample,
    &af_info_sweep,
    &af_info_hrtf,
+   &af_info_fir,
 #ifdef CONFIG_LADSPA
    &af_info_ladspa,
 #endif
@@ -131,6 +134,7 @@ static af_instance_t* af_create(af_stream_t* s, const char* name_with_cmd)
     goto err_out;
   }
   memset(new,0,sizeof(af_instance_t));
+  new->stream = s;
 
   // Check for commandline parameters
   strsep(&cmdline, "=");
@@ -158,6 +162,11 @@ static af_instance_t* af_create(af_stream_t* s, const char* name_with_cmd)
       if(AF_ERROR>=new->control(new,AF_CONTROL_COMMAND_LINE,cmdline))
         goto err_out;
     }
+    if (mp_profiling) {
+      char stage[40];
+      snprintf(stage, sizeof(stage), "af_%s", new->info->name);
+      new->prof_stage = mp_prof_get_stage(stage);
+    }
     free(name);
     return new;
   }
@@ -387,8 +396,14 @@ int af_reinit(af_stream_t* s, af_instance_t* af)
 // Uninit and remove all filters
 void af_uninit(af_stream_t* s)
 {
+  int i;
   while(s->first)
     af_remove(s,s->first);
+  for(i=0;i<2;i++){
+    free(s->arena[i]);
+    s->arena[i] = NULL;
+    s->arena_len[i] = 0;
+  }
 }
 
 /**
@@ -463,6 +478,37 @@ static void af_downmix(af_stream_t* s)
         af_append(s, s->first, af_pan_str);
 }
 
+/* With floating point processing, convert the input to float once at the
+ * start of the chain if a filter further down needs float, instead of
+ * converting back and forth around each such filter. The format-agnostic
+ * filters then work on float as well, and the conversions that were
+ * inserted for the filters become redundant and detach themselves.
+ */
+static int af_float_chain(af_stream_t* s)
+{
+    af_instance_t* af;
+    int format = AF_FORMAT_FLOAT_NE;
+
+    if ((s->cfg.force & AF_INIT_FORMAT_MASK) != AF_INIT_FLOAT
+        || (AF_INIT_TYPE_MASK & s->cfg.force) == AF_INIT_FORCE
+        || s->input.format == AF_FORMAT_FLOAT_NE)
+        return AF_OK;
+    for (af = s->first->next; af; af = af->next) {
+        if (!strcmp(af->info->name, "format")
+            && af->data->format == AF_FORMAT_FLOAT_NE)
+            break;
+    }
+    if (!af)
+        return AF_OK;
+
+    af = af_prepend(s, s->first, "format");
+    if (!af || AF_OK != af->control(af, AF_CONTROL_FORMAT_FMT, &format))
+        return AF_ERROR;
+    mp_msg(MSGT_AFILTER, MSGL_V, "[libaf] Converting to float at the start "
+           "of the chain.\n");
+    return af_reinit(s, s->first);
+}
+
 /* Initialize the stream "s". This function creates a new filter list
    if necessary according to the values set in input and output. Input
    and output should contain the format of the current movie and the
@@ -517,6 +563,9 @@ int af_init(af_stream_t* s)
     if (!af_append(s,s->first,"dummy") || AF_OK != af_reinit(s,s->first))
       return -1;
 
+  if (AF_OK != af_float_chain(s))
+    return -1;
+
   // Check output format
   if((AF_INIT_TYPE_MASK & s->cfg.force) != AF_INIT_FORCE){
     af_instance_t* af = NULL; // New filter
@@ -592,8 +641,11 @@ af_data_t* af_play(af_stream_t* s, af_data_t* data)
   af_instance_t* af=s->first;
   // Iterate through all filters
   do{
+    struct mp_prof_scope prof;
     if (data->len <= 0) break;
+    MP_PROF_BEGIN_STAGE(&prof, af->prof_stage);
     data=af->play(af,data);
+    MP_PROF_END(&prof);
     af=af->next;
   }while(af && data);
   return data;
@@ -641,19 +693,28 @@ double af_calc_delay(af_stream_t* s)
    function should not be called directly */
 int af_resize_local_buffer(af_instance_t* af, af_data_t* data)
 {
-  // Calculate new length
-  register int len = af_lencalc(af->mul,data);
-  mp_msg(MSGT_AFILTER, MSGL_V, "[libaf] Reallocating memory in module %s, "
-	 "old len = %i, new len = %i\n",af->info->name,af->data->len,len);
-  // If there is a buffer free it
-  free(af->data->audio);
-  // Create new buffer and check that it is OK
-  af->data->audio = malloc(len);
-  if(!af->data->audio){
-    mp_msg(MSGT_AFILTER, MSGL_FATAL, "[libaf] Could not allocate memory \n");
-    return AF_ERROR;
+  af_stream_t* s = af->stream;
+  // Write to the buffer the input is not in
+  int i = data->audio == s->arena[0];
+  int len = af_lencalc(af->mul,data);
+  if(s->arena_len[i] < len){
+    // Leave room for blocks of slightly varying size
+    len += len / 2;
+    mp_msg(MSGT_AFILTER, MSGL_V, "[libaf] Reallocating buffer %d for module "
+	   "%s, old len = %i, new len = %i\n",i,af->info->name,
+	   s->arena_len[i],len);
+    // The contents don't need to be kept
+    free(s->arena[i]);
+    s->arena_len[i] = 0;
+    s->arena[i] = malloc(len);
+    if(!s->arena[i]){
+      mp_msg(MSGT_AFILTER, MSGL_FATAL, "[libaf] Could not allocate memory \n");
+      return AF_ERROR;
+    }
+    s->arena_len[i] = len;
   }
-  af->data->len=len;
+  af->data->audio = s->arena[i];
+  af->data->len = s->arena_len[i];
   return AF_OK;
 }
 
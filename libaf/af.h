@@ -30,6 +30,7 @@
 #include "mp_msg.h"
 
 struct af_instance_s;
+struct af_stream;
 
 // Number of channels
 #ifndef AF_NCH
@@ -77,6 +78,8 @@ typedef struct af_instance_s
 		 * corresponding output */
   double mul; /* length multiplier: how much does this instance change
 		 the length of the buffer. */
+  struct mp_prof_stage *prof_stage; // for --perf-stats, NULL if disabled
+  struct af_stream *stream; // chain the instance belongs to
 }af_instance_t;
 
 // Initialization flags
@@ -116,6 +119,9 @@ typedef struct af_stream
   // Configuration for this stream
   af_cfg_t cfg;
   struct MPOpts *opts;
+  // Output buffers shared by the filters, see af_resize_local_buffer()
+  void *arena[2];
+  int arena_len[2];
 }af_stream_t;
 
 /*********************************************
@@ -234,7 +240,11 @@ double af_calc_delay(af_stream_t* s);
  */
 
 /* Helper function called by the macro with the same name only to be
-   called from inside filters */
+   called from inside filters. Points af->data->audio to the one of the
+   chain's two output buffers that doesn't hold the input data, and makes
+   sure it is big enough for the output. The buffers are reused for every
+   block and filter, so the output is only valid until the next filter in
+   the chain has processed it. */
 int af_resize_local_buffer(af_instance_t* af, af_data_t* data);
 
 /* Helper function used to calculate the exact buffer length needed
@@ -318,13 +328,13 @@ void af_help(void);
  */
 void af_fix_parameters(af_data_t *data);
 
-/** Memory reallocation macro: if a local buffer is used (i.e. if the
+/** Output buffer macro: if a local buffer is used (i.e. if the
    filter doesn't operate on the incoming buffer this macro must be
-   called to ensure the buffer is big enough.
+   called to get a buffer big enough for the output in a->data->audio.
+   Filters must not free that buffer.
  * \ingroup af_filter
  */
-#define RESIZE_LOCAL_BUFFER(a,d)\
-((a->data->len < af_lencalc(a->mul,d))?af_resize_local_buffer(a,d):AF_OK)
+#define RESIZE_LOCAL_BUFFER(a,d) af_resize_local_buffer(a,d)
 
 /* Some other useful macro definitions*/
 #ifndef min
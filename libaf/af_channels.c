@@ -132,6 +132,18 @@ static int check_routes(af_channels_t* s, int nin, int nout)
   return AF_OK;
 }
 
+// Whether the routes copy the first nout channels to themselves
+static int is_truncation(af_channels_t* s, int nout)
+{
+  int i;
+  if(s->nr != nout)
+    return 0;
+  for(i=0;i<s->nr;i++)
+    if(s->route[i][FR] != i || s->route[i][TO] != i)
+      return 0;
+  return 1;
+}
+
 // Initialization and runtime control
 static int control(struct af_instance_s* af, int cmd, void* arg)
 {
@@ -250,8 +262,6 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 static void uninit(struct af_instance_s* af)
 {
   free(af->setup);
-  if (af->data)
-      free(af->data->audio);
   free(af->data);
 }
 
@@ -263,19 +273,29 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data)
   af_channels_t* s = af->setup;
   int 		 i;
 
-  if(AF_OK != RESIZE_LOCAL_BUFFER(af,data))
-    return NULL;
+  if(l->nch < c->nch && is_truncation(s,l->nch)){
+    // Dropping the last channels: move the frames down in place
+    int frames = c->len / (c->nch * c->bps);
+    int outsize = l->nch * c->bps;
+    for(i=1;i<frames;i++)
+      memmove((char*)c->audio + i*outsize,
+	      (char*)c->audio + i*c->nch*c->bps, outsize);
+  } else {
+    if(AF_OK != RESIZE_LOCAL_BUFFER(af,data))
+      return NULL;
+
+    // Reset unused channels
+    memset(l->audio,0,c->len / c->nch * l->nch);
 
-  // Reset unused channels
-  memset(l->audio,0,c->len / c->nch * l->nch);
+    if(AF_OK == check_routes(s,c->nch,l->nch))
+      for(i=0;i<s->nr;i++)
+	copy(c->audio,l->audio,c->nch,s->route[i][FR],
+	     l->nch,s->route[i][TO],c->len,c->bps);
 
-  if(AF_OK == check_routes(s,c->nch,l->nch))
-    for(i=0;i<s->nr;i++)
-      copy(c->audio,l->audio,c->nch,s->route[i][FR],
-	   l->nch,s->route[i][TO],c->len,c->bps);
+    c->audio = l->audio;
+  }
 
   // Set output data
-  c->audio = l->audio;
   c->len   = c->len / c->nch * l->nch;
   c->nch   = l->nch;
 
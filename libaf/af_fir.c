@@ -0,0 +1,248 @@
+/*
+ * FIR filter with an impulse response from a WAV file, e.g. for room
+ * correction or convolution reverb
+ *
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include <libavutil/common.h>
+#include <libavutil/intfloat.h>
+#include <libavutil/intreadwrite.h>
+
+#include "talloc.h"
+#include "subopt-helper.h"
+#include "af.h"
+#include "fftconv.h"
+
+// refuse impulse responses longer than this many frames
+#define MAX_IR_LEN (1 << 22)
+
+struct af_fir {
+    // options
+    char *file;
+    int block;
+    float gain;                 // dB
+
+    float *ir;                  // interleaved
+    int ir_len;                 // frames
+    int ir_nch;
+    int ir_rate;
+
+    struct af_fftconv *fftconv;
+    int nch;                    // channels fftconv was set up for
+};
+
+static float read_sample(const uint8_t *p, int format, int bits)
+{
+    if (format == 3)
+        return av_int2float(AV_RL32(p));
+    switch (bits) {
+    case 16: return (int16_t)AV_RL16(p) / 32768.0;
+    case 24: return ((int32_t)(AV_RL24(p) << 8) >> 8) / 8388608.0;
+    default: return (int32_t)AV_RL32(p) / 2147483648.0;
+    }
+}
+
+// Read 16, 24 or 32 bit integer or 32 bit float PCM from a WAV file.
+static bool load_ir(struct af_fir *s)
+{
+    FILE *f = fopen(s->file, "rb");
+    if (!f) {
+        mp_msg(MSGT_AFILTER, MSGL_ERR, "[fir] Cannot open %s.\n", s->file);
+        return false;
+    }
+    uint8_t hdr[40];
+    int format = 0, bits = 0, align = 0;
+    bool ok = false;
+    if (fread(hdr, 12, 1, f) != 1 || memcmp(hdr, "RIFF", 4) ||
+        memcmp(hdr + 8, "WAVE", 4))
+        goto done;
+    while (fread(hdr, 8, 1, f) == 1) {
+        uint32_t size = AV_RL32(hdr + 4);
+        if (!memcmp(hdr, "fmt ", 4) && size >= 16) {
+            int len = FFMIN(size, 40);
+            if (fread(hdr, len, 1, f) != 1)
+                goto done;
+            format = AV_RL16(hdr);
+            s->ir_nch = AV_RL16(hdr + 2);
+            s->ir_rate = AV_RL32(hdr + 4);
+            align = AV_RL16(hdr + 12);
+            bits = AV_RL16(hdr + 14);
+            // WAVE_FORMAT_EXTENSIBLE, the format is the start of the GUID
+            if (format == 0xFFFE && len >= 26)
+                format = AV_RL16(hdr + 24);
+            size -= len;
+        } else if (!memcmp(hdr, "data", 4) && format) {
+            if (!((format == 1 && (bits == 16 || bits == 24 || bits == 32)) ||
+                  (format == 3 && bits == 32)) ||
+                s->ir_nch < 1 || s->ir_nch > AF_NCH || s->ir_rate <= 0 ||
+                align != s->ir_nch * bits / 8) {
+                mp_msg(MSGT_AFILTER, MSGL_ERR, "[fir] %s: unsupported "
+                       "format.\n", s->file);
+                goto done;
+            }
+            s->ir_len = FFMIN(size / align, MAX_IR_LEN);
+            uint8_t *data = talloc_size(NULL, (size_t)s->ir_len * align);
+            if (s->ir_len < 1 || fread(data, align, s->ir_len, f) !=
+                                     (size_t)s->ir_len) {
+                talloc_free(data);
+                goto done;
+            }
+            s->ir = talloc_array(s, float, s->ir_len * s->ir_nch);
+            for (int i = 0; i < s->ir_len * s->ir_nch; i++)
+                s->ir[i] = read_sample(data + i * bits / 8, format, bits);
+            talloc_free(data);
+            ok = true;
+            goto done;
+        }
+        // chunks are padded to an even size
+        if (fseek(f, size + (size & 1), SEEK_CUR))
+            break;
+    }
+    mp_msg(MSGT_AFILTER, MSGL_ERR, "[fir] %s is not a WAV file.\n", s->file);
+done:
+    fclose(f);
+    return ok;
+}
+
+static bool setup_fftconv(struct af_fir *s, int nch)
+{
+    af_fftconv_free(s->fftconv);
+    s->fftconv = af_fftconv_new(s->block, nch, nch);
+    s->nch = 0;
+    if (!s->fftconv)
+        return false;
+    float *h = talloc_array(NULL, float, s->ir_len);
+    float gain = pow(10, s->gain / 20);
+    bool ok = true;
+    for (int ch = 0; ch < nch; ch++) {
+        // a mono impulse response is used for every channel
+        int ir_ch = s->ir_nch > 1 ? ch : 0;
+        for (int i = 0; i < s->ir_len; i++)
+            h[i] = s->ir[i * s->ir_nch + ir_ch];
+        ok &= af_fftconv_set_kernel(s->fftconv, ch, ch, h, s->ir_len,
+                                    gain) >= 0;
+    }
+    talloc_free(h);
+    if (ok)
+        s->nch = nch;
+    return ok;
+}
+
+static int control(struct af_instance_s *af, int cmd, void *arg)
+{
+    struct af_fir *s = af->setup;
+    struct af_data *in = arg;
+
+    switch (cmd) {
+    case AF_CONTROL_REINIT:
+        if (!s->ir) {
+            mp_msg(MSGT_AFILTER, MSGL_ERR, "[fir] No impulse response file "
+                   "given.\n");
+            return AF_ERROR;
+        }
+        // Convert the input to the rate of the impulse response, and to
+        // its channels if it has more than one.
+        af->data->rate = s->ir_rate;
+        af->data->nch = s->ir_nch > 1 ? s->ir_nch : in->nch;
+        af->data->format = AF_FORMAT_FLOAT_NE;
+        af->data->bps = 4;
+        af->mul = 1;
+        af->delay = s->block * af->data->nch * af->data->bps;
+        if (s->nch != af->data->nch && !setup_fftconv(s, af->data->nch)) {
+            mp_msg(MSGT_AFILTER, MSGL_ERR, "[fir] Out of memory.\n");
+            return AF_ERROR;
+        }
+        mp_msg(MSGT_AFILTER, MSGL_V, "[fir] %d taps, %d channels, "
+               "block %d\n", s->ir_len, s->ir_nch, s->block);
+        return af_test_output(af, in);
+    case AF_CONTROL_COMMAND_LINE: {
+        const opt_t subopts[] = {
+            {"file",  OPT_ARG_MSTRZ, &s->file,  NULL},
+            {"block", OPT_ARG_INT,   &s->block, NULL},
+            {"gain",  OPT_ARG_FLOAT, &s->gain,  NULL},
+            {NULL}
+        };
+        if (subopt_parse(arg, subopts) != 0) {
+            mp_msg(MSGT_AFILTER, MSGL_ERR, "[fir] Invalid option specified.\n");
+            return AF_ERROR;
+        }
+        if (s->block < AF_FFTCONV_MIN_BLOCK ||
+            s->block > AF_FFTCONV_MAX_BLOCK || (s->block & (s->block - 1))) {
+            mp_msg(MSGT_AFILTER, MSGL_ERR, "[fir] block must be a power of "
+                   "2 between %d and %d.\n", AF_FFTCONV_MIN_BLOCK,
+                   AF_FFTCONV_MAX_BLOCK);
+            return AF_ERROR;
+        }
+        talloc_free(s->ir);
+        s->ir = NULL;
+        s->nch = 0;
+        if (s->file && !load_ir(s))
+            return AF_ERROR;
+        return AF_OK;
+    }
+    }
+    return AF_UNKNOWN;
+}
+
+static void uninit(struct af_instance_s *af)
+{
+    struct af_fir *s = af->setup;
+    if (s) {
+        af_fftconv_free(s->fftconv);
+        free(s->file);
+        talloc_free(s);
+    }
+}
+
+static struct af_data *play(struct af_instance_s *af, struct af_data *data)
+{
+    struct af_fir *s = af->setup;
+    float *ch[AF_NCH];
+    for (int i = 0; i < data->nch; i++)
+        ch[i] = (float *)data->audio + i;
+    af_fftconv_process(s->fftconv, ch, data->nch, ch, data->nch,
+                       data->len / data->bps / data->nch);
+    return data;
+}
+
+static int af_open(struct af_instance_s *af)
+{
+    struct af_fir *s = talloc_zero(NULL, struct af_fir);
+    af->control = control;
+    af->uninit  = uninit;
+    af->play    = play;
+    af->mul     = 1;
+    af->data    = talloc_zero(s, struct af_data);
+    af->setup   = s;
+    s->block = 1024;
+    return AF_OK;
+}
+
+struct af_info af_info_fir = {
+    "FIR filter with an impulse response from a file",
+    "fir",
+    "",
+    "",
+    AF_FLAGS_REENTRANT,
+    af_open
+};
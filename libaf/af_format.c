@@ -169,8 +169,6 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 // Deallocate memory
 static void uninit(struct af_instance_s* af)
 {
-  if (af->data)
-      free(af->data->audio);
   free(af->data);
   af->setup = 0;
 }
@@ -181,12 +179,8 @@ static af_data_t* play_swapendian(struct af_instance_s* af, af_data_t* data)
   af_data_t*   c   = data;	// Current working data
   int 	       len = c->len/c->bps; // Length in samples of current audio block
 
-  if(AF_OK != RESIZE_LOCAL_BUFFER(af,data))
-    return NULL;
-
-  endian(c->audio,l->audio,len,c->bps);
+  endian(c->audio,c->audio,len,c->bps);
 
-  c->audio = l->audio;
   c->format = l->format;
 
   return c;
@@ -198,12 +192,9 @@ static af_data_t* play_float_s16(struct af_instance_s* af, af_data_t* data)
   af_data_t*   c   = data;	// Current working data
   int 	       len = c->len/4; // Length in samples of current audio block
 
-  if(AF_OK != RESIZE_LOCAL_BUFFER(af,data))
-    return NULL;
-
-  float2int(c->audio, l->audio, len, 2);
+  // in place, every sample is read before it is overwritten
+  float2int(c->audio, c->audio, len, 2);
 
-  c->audio = l->audio;
   c->len = len*2;
   c->bps = 2;
   c->format = l->format;
@@ -236,9 +227,15 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data)
   af_data_t*   l   = af->data;	// Local data
   af_data_t*   c   = data;	// Current working data
   int 	       len = c->len/c->bps; // Length in samples of current audio block
-
-  if(AF_OK != RESIZE_LOCAL_BUFFER(af,data))
-    return NULL;
+  void*        out = c->audio;	// Output audio data
+
+  // All conversions go sample by sample from the start, so they can
+  // overwrite the input unless the samples get larger
+  if(l->bps > c->bps){
+    if(AF_OK != RESIZE_LOCAL_BUFFER(af,data))
+      return NULL;
+    out = l->audio;
+  }
 
   // Change to cpu native endian format
   if((c->format&AF_FORMAT_END_MASK)!=AF_FORMAT_NE)
@@ -246,29 +243,29 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data)
 
   // Conversion table
   if((c->format & AF_FORMAT_SPECIAL_MASK) == AF_FORMAT_MU_LAW) {
-    from_ulaw(c->audio, l->audio, len, l->bps, l->format&AF_FORMAT_POINT_MASK);
+    from_ulaw(c->audio, out, len, l->bps, l->format&AF_FORMAT_POINT_MASK);
     if(AF_FORMAT_A_LAW == (l->format&AF_FORMAT_SPECIAL_MASK))
-      to_ulaw(l->audio, l->audio, len, 1, AF_FORMAT_SI);
+      to_ulaw(out, out, len, 1, AF_FORMAT_SI);
     if((l->format&AF_FORMAT_SIGN_MASK) == AF_FORMAT_US)
-      si2us(l->audio,len,l->bps);
+      si2us(out,len,l->bps);
   } else if((c->format & AF_FORMAT_SPECIAL_MASK) == AF_FORMAT_A_LAW) {
-    from_alaw(c->audio, l->audio, len, l->bps, l->format&AF_FORMAT_POINT_MASK);
+    from_alaw(c->audio, out, len, l->bps, l->format&AF_FORMAT_POINT_MASK);
     if(AF_FORMAT_A_LAW == (l->format&AF_FORMAT_SPECIAL_MASK))
-      to_alaw(l->audio, l->audio, len, 1, AF_FORMAT_SI);
+      to_alaw(out, out, len, 1, AF_FORMAT_SI);
     if((l->format&AF_FORMAT_SIGN_MASK) == AF_FORMAT_US)
-      si2us(l->audio,len,l->bps);
+      si2us(out,len,l->bps);
   } else if((c->format & AF_FORMAT_POINT_MASK) == AF_FORMAT_F) {
     switch(l->format&AF_FORMAT_SPECIAL_MASK){
     case(AF_FORMAT_MU_LAW):
-      to_ulaw(c->audio, l->audio, len, c->bps, c->format&AF_FORMAT_POINT_MASK);
+      to_ulaw(c->audio, out, len, c->bps, c->format&AF_FORMAT_POINT_MASK);
       break;
     case(AF_FORMAT_A_LAW):
-      to_alaw(c->audio, l->audio, len, c->bps, c->format&AF_FORMAT_POINT_MASK);
+      to_alaw(c->audio, out, len, c->bps, c->format&AF_FORMAT_POINT_MASK);
       break;
     default:
-      float2int(c->audio, l->audio, len, l->bps);
+      float2int(c->audio, out, len, l->bps);
       if((l->format&AF_FORMAT_SIGN_MASK) == AF_FORMAT_US)
-	si2us(l->audio,len,l->bps);
+	si2us(out,len,l->bps);
       break;
     }
   } else {
@@ -281,30 +278,29 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data)
     // Convert to special formats
     switch(l->format&(AF_FORMAT_SPECIAL_MASK|AF_FORMAT_POINT_MASK)){
     case(AF_FORMAT_MU_LAW):
-      to_ulaw(c->audio, l->audio, len, c->bps, c->format&AF_FORMAT_POINT_MASK);
+      to_ulaw(c->audio, out, len, c->bps, c->format&AF_FORMAT_POINT_MASK);
       break;
     case(AF_FORMAT_A_LAW):
-      to_alaw(c->audio, l->audio, len, c->bps, c->format&AF_FORMAT_POINT_MASK);
+      to_alaw(c->audio, out, len, c->bps, c->format&AF_FORMAT_POINT_MASK);
       break;
     case(AF_FORMAT_F):
-      int2float(c->audio, l->audio, len, c->bps);
+      int2float(c->audio, out, len, c->bps);
       break;
     default:
       // Change the number of bits
+      // (with the same number of bits, the samples are already in place)
       if(c->bps != l->bps)
-	change_bps(c->audio,l->audio,len,c->bps,l->bps);
-      else
-	fast_memcpy(l->audio,c->audio,len*c->bps);
+	change_bps(c->audio,out,len,c->bps,l->bps);
       break;
     }
   }
 
   // Switch from cpu native endian to the correct endianness
   if((l->format&AF_FORMAT_END_MASK)!=AF_FORMAT_NE)
-    endian(l->audio,l->audio,len,l->bps);
+    endian(out,out,len,l->bps);
 
   // Set output data
-  c->audio  = l->audio;
+  c->audio  = out;
   c->len    = len*l->bps;
   c->bps    = l->bps;
   c->format = l->format;
@@ -472,6 +468,96 @@ static void change_bps(void* in, void* out, int len, int inbps, int outbps)
   }
 }
 
+/* The s16 conversions are the ones used for most playback; they have
+   SSE2 versions, which give the same results as the C versions. out may
+   be the same as in for float2s16. */
+static void float2s16_c(const float* in, int16_t* out, int len)
+{
+  int i;
+  for(i=0;i<len;i++)
+    out[i] = lrintf(32767.0 * clamp(in[i], -1.0f, +1.0f));
+}
+
+static void s162float_c(const int16_t* in, float* out, int len)
+{
+  int i;
+  for(i=0;i<len;i++)
+    out[i]=(1.0/32768.0)*in[i];
+}
+
+#if HAVE_SSE2
+static const float ps_1[4] __attribute__((aligned(16))) =
+  {1.0, 1.0, 1.0, 1.0};
+static const float ps_32767[4] __attribute__((aligned(16))) =
+  {32767.0, 32767.0, 32767.0, 32767.0};
+static const float ps_1_32768[4] __attribute__((aligned(16))) =
+  {1.0/32768.0, 1.0/32768.0, 1.0/32768.0, 1.0/32768.0};
+
+static void float2s16_sse2(const float* in, int16_t* out, int len)
+{
+  int n = len & ~7;
+  x86_reg i = -n;
+  if (n) {
+    // cvtps2dq rounds like lrintf(), packssdw can't overflow after clamping
+    __asm__ volatile(
+        "movaps          %3, %%xmm4 \n"
+        "movaps          %4, %%xmm5 \n"
+        "xorps       %%xmm6, %%xmm6 \n"
+        "subps       %%xmm5, %%xmm6 \n"
+        "1: \n"
+        "movups   (%1,%0,4), %%xmm0 \n"
+        "movups 16(%1,%0,4), %%xmm1 \n"
+        "minps       %%xmm5, %%xmm0 \n"
+        "minps       %%xmm5, %%xmm1 \n"
+        "maxps       %%xmm6, %%xmm0 \n"
+        "maxps       %%xmm6, %%xmm1 \n"
+        "mulps       %%xmm4, %%xmm0 \n"
+        "mulps       %%xmm4, %%xmm1 \n"
+        "cvtps2dq    %%xmm0, %%xmm0 \n"
+        "cvtps2dq    %%xmm1, %%xmm1 \n"
+        "packssdw    %%xmm1, %%xmm0 \n"
+        "movdqu      %%xmm0, (%2,%0,2) \n"
+        "add             $8, %0 \n"
+        "jl 1b \n"
+        :"+r"(i)
+        :"r"(in+n), "r"(out+n), "m"(*ps_32767), "m"(*ps_1)
+        :XMM_CLOBBERS("xmm0", "xmm1", "xmm4", "xmm5", "xmm6") "memory"
+    );
+  }
+  float2s16_c(in+n, out+n, len-n);
+}
+
+static void s162float_sse2(const int16_t* in, float* out, int len)
+{
+  int n = len & ~7;
+  x86_reg i = -n;
+  if (n) {
+    __asm__ volatile(
+        "movaps          %3, %%xmm4 \n"
+        "1: \n"
+        "movdqu   (%1,%0,2), %%xmm0 \n"
+        "movdqa      %%xmm0, %%xmm1 \n"
+        "punpcklwd   %%xmm0, %%xmm0 \n"
+        "punpckhwd   %%xmm1, %%xmm1 \n"
+        "psrad          $16, %%xmm0 \n" // sign extend
+        "psrad          $16, %%xmm1 \n"
+        "cvtdq2ps    %%xmm0, %%xmm0 \n"
+        "cvtdq2ps    %%xmm1, %%xmm1 \n"
+        "mulps       %%xmm4, %%xmm0 \n"
+        "mulps       %%xmm4, %%xmm1 \n"
+        "movups      %%xmm0, (%2,%0,4) \n"
+        "movups      %%xmm1, 16(%2,%0,4) \n"
+        "add             $8, %0 \n"
+        "jl 1b \n"
+        :"+r"(i)
+        :"r"(in+n), "r"(out+n), "m"(*ps_1_32768)
+        :XMM_CLOBBERS("xmm0", "xmm1", "xmm4") "memory"
+    );
+  }
+  s162float_c(in+n, out+n, len-n);
+}
+#endif
+
 static void float2int(float* in, void* out, int len, int bps)
 {
   register int i;
@@ -481,8 +567,13 @@ static void float2int(float* in, void* out, int len, int bps)
       ((int8_t*)out)[i] = lrintf(127.0 * clamp(in[i], -1.0f, +1.0f));
     break;
   case(2):
-    for(i=0;i<len;i++)
-      ((int16_t*)out)[i] = lrintf(32767.0 * clamp(in[i], -1.0f, +1.0f));
+#if HAVE_SSE2
+    if(gCpuCaps.hasSSE2){
+      float2s16_sse2(in, out, len);
+      break;
+    }
+#endif
+    float2s16_c(in, out, len);
     break;
   case(3):
     for(i=0;i<len;i++)
@@ -504,8 +595,13 @@ static void int2float(void* in, float* out, int len, int bps)
       out[i]=(1.0/128.0)*((int8_t*)in)[i];
     break;
   case(2):
-    for(i=0;i<len;i++)
-      out[i]=(1.0/32768.0)*((int16_t*)in)[i];
+#if HAVE_SSE2
+    if(gCpuCaps.hasSSE2){
+      s162float_sse2(in, out, len);
+      break;
+    }
+#endif
+    s162float_c(in, out, len);
     break;
   case(3):
     for(i=0;i<len;i++)
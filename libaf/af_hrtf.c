@@ -29,10 +29,18 @@
 
 #include "af.h"
 #include "dsp.h"
+#include "fftconv.h"
+#include "libavutil/common.h"
 
 /* HRTF filter coefficients and adjustable parameters */
 #include "af_hrtf.h"
 
+/* Inputs of the mixer filter matrix */
+enum {
+    SRC_LF, SRC_RF, SRC_LR, SRC_RR, SRC_CF, SRC_CR, SRC_BA_L, SRC_BA_R,
+    SRC_LFE, NUM_SRC
+};
+
 typedef struct af_hrtf_s {
     /* Lengths */
     int dlbuflen, hrflen, basslen;
@@ -68,28 +76,13 @@ typedef struct af_hrtf_s {
     /* Cyclic position on the ring buffer */
     int cyc_pos;
     int print_flag;
+    /* FFT convolution of the sources into the left and right output,
+       one block of each at a time */
+    struct af_fftconv *fftconv;
+    float *src[NUM_SRC];
+    float *mix[2];
 } af_hrtf_t;
 
-/* Convolution on a ring buffer
- *    nx:	length of the ring buffer
- *    nk:	length of the convolution kernel
- *    sx:	ring buffer
- *    sk:	convolution kernel
- *    offset:	offset on the ring buffer, can be
- */
-static float conv(const int nx, const int nk, const float *sx, const float *sk,
-		  const int offset)
-{
-    /* k = reminder of offset / nx */
-    int k = offset >= 0 ? offset % nx : nx + (offset % nx);
-
-    if(nk + k <= nx)
-	return af_filter_fir(nk, sx + k, sk);
-    else
-	return af_filter_fir(nk + k - nx, sx, sk + nx - k) +
-	    af_filter_fir(nx - k, sx + k, sk);
-}
-
 /* Detect when the impulse response starts (significantly) */
 static int pulse_detect(const float *sx)
 {
@@ -280,6 +273,66 @@ static inline void update_ch(af_hrtf_t *s, short *in, const int k)
     s->ba_r[k] = in[4] + in[1] + in[3];
 }
 
+/* Set the filter of the mixer from source src to output out (0 = L,
+   1 = R) to an HRTF delayed by offset samples */
+static int set_hrtf(af_hrtf_t *s, int out, int src, const float *ir,
+		    int offset, float gain)
+{
+    float h[128];
+
+    memset(h, 0, offset * sizeof(float));
+    memcpy(h + offset, ir, s->hrflen * sizeof(float));
+    return af_fftconv_set_kernel(s->fftconv, out, src, h, offset + s->hrflen,
+				 gain);
+}
+
+/* Set up the mixer filter matrix for the decoding mode */
+static int setup_mixer(af_hrtf_t *s)
+{
+    const float one = 1;
+    const float rear_gain = s->matrix_mode ? M1_76DB : 1;
+    int err = 0;
+    int i, j;
+
+    for(i = 0; i < 2; i++)
+	for(j = 0; j < NUM_SRC; j++)
+	    err |= af_fftconv_set_kernel(s->fftconv, i, j, NULL, 0, 0);
+
+    for(i = 0; i < 2; i++) {
+	/* Sources on the same side as ear i, and on the opposite side */
+	const int f_a = i ? SRC_RF : SRC_LF, f_o = i ? SRC_LF : SRC_RF;
+	const int r_a = i ? SRC_RR : SRC_LR, r_o = i ? SRC_LR : SRC_RR;
+	const int b_a = i ? SRC_BA_R : SRC_BA_L, b_o = i ? SRC_BA_L : SRC_BA_R;
+
+	err |= set_hrtf(s, i, f_a, s->af_ir, s->af_o, 1);
+	err |= set_hrtf(s, i, f_o, s->of_ir, s->of_o, 1);
+	if(s->decode_mode != HRTF_MIX_STEREO) {
+	    err |= set_hrtf(s, i, SRC_CF, s->cf_ir, s->cf_o, 1);
+	    /* In matrix decoding mode, the rear channel gain must be
+	       renormalized, as there is an additional channel. */
+	    err |= set_hrtf(s, i, r_a, s->ar_ir, s->ar_o, rear_gain);
+	    err |= set_hrtf(s, i, r_o, s->or_ir, s->or_o, rear_gain);
+	    if(s->matrix_mode)
+		err |= set_hrtf(s, i, SRC_CR, s->cr_ir, s->cr_o, M1_76DB);
+	}
+
+	/* Bass compensation for the lower frequency cut of the HRTF.  A
+	   cross talk of the left and right channel is introduced to
+	   match the directional characteristics of higher frequencies.
+	   The bass will not have any real 3D perception, but that is
+	   OK (note at 180 Hz, the wavelength is about 2 m, and any
+	   spatial perception is impossible). */
+	err |= af_fftconv_set_kernel(s->fftconv, i, b_a, s->ba_ir, s->basslen,
+				     1 - BASSCROSS);
+	err |= af_fftconv_set_kernel(s->fftconv, i, b_o, s->ba_ir, s->basslen,
+				     BASSCROSS);
+
+	/* Also mix the LFE channel (zero if not available) */
+	err |= af_fftconv_set_kernel(s->fftconv, i, SRC_LFE, &one, 1, M3_01DB);
+    }
+    return err ? -1 : 0;
+}
+
 /* Initialization and runtime control */
 static int control(struct af_instance_s *af, int cmd, void* arg)
 {
@@ -312,6 +365,12 @@ static int control(struct af_instance_s *af, int cmd, void* arg)
 	af->data->bps    = 2;
 	test_output_res = af_test_output(af, (af_data_t*)arg);
 	af->mul = 2.0 / af->data->nch;
+	/* The mixer outputs a block later */
+	af->delay = HRTFBLOCKLEN * af->data->nch * 2;
+	if(setup_mixer(s) < 0) {
+	    mp_msg(MSGT_AFILTER, MSGL_ERR, "[hrtf] Memory allocation error.\n");
+	    return AF_ERROR;
+	}
 	// after testing input set the real output format
 	af->data->nch = 2;
 	s->print_flag = 1;
@@ -362,10 +421,10 @@ static void uninit(struct af_instance_s *af)
 	free(s->fwrbuf_r);
 	free(s->fwrbuf_lr);
 	free(s->fwrbuf_rr);
+	af_fftconv_free(s->fftconv);
+	free(s->src[0]);
 	free(af->setup);
     }
-    if(af->data)
-	free(af->data->audio);
     free(af->data);
 }
 
@@ -386,8 +445,7 @@ static af_data_t* play(struct af_instance_s *af, af_data_t *data)
     short *in = data->audio; // Input audio data
     short *out = NULL; // Output audio data
     short *end = in + data->len / sizeof(short); // Loop end
-    float common, left, right, diff, left_b, right_b;
-    const int dblen = s->dlbuflen, hlen = s->hrflen, blen = s->basslen;
+    float left, right, diff;
 
     if(AF_OK != RESIZE_LOCAL_BUFFER(af, data))
 	return NULL;
@@ -444,122 +502,76 @@ static af_data_t* play(struct af_instance_s *af, af_data_t *data)
      */
 
     while(in < end) {
-	const int k = s->cyc_pos;
-
-	update_ch(s, in, k);
-
-	/* Simulate a 7.5 ms -20 dB echo of the center channel in the
-	   front channels (like reflection from a room wall) - a kind of
-	   psycho-acoustically "cheating" to focus the center front
-	   channel, which is normally hard to be perceived as front */
-	s->lf[k] += CFECHOAMPL * s->cf[(k + CFECHODELAY) % s->dlbuflen];
-	s->rf[k] += CFECHOAMPL * s->cf[(k + CFECHODELAY) % s->dlbuflen];
-
-	switch (s->decode_mode) {
-	case HRTF_MIX_51:
-	case HRTF_MIX_MATRIX2CH:
-	   /* Mixer filter matrix */
-	   common = conv(dblen, hlen, s->cf, s->cf_ir, k + s->cf_o);
-	   if(s->matrix_mode) {
-	      /* In matrix decoding mode, the rear channel gain must be
-		 renormalized, as there is an additional channel. */
-	      matrix_decode(in, k, 2, 3, 0, s->dlbuflen,
-			    s->lr_fwr, s->rr_fwr,
-			    s->lrprr_fwr, s->lrmrr_fwr,
-			    &(s->adapt_lr_gain), &(s->adapt_rr_gain),
-			    &(s->adapt_lrprr_gain), &(s->adapt_lrmrr_gain),
-			    s->lr, s->rr, NULL, NULL, s->cr);
-	      common +=
-		 conv(dblen, hlen, s->cr, s->cr_ir, k + s->cr_o) *
-		 M1_76DB;
-	      left    =
-		 ( conv(dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
-		   conv(dblen, hlen, s->rf, s->of_ir, k + s->of_o) +
-		   (conv(dblen, hlen, s->lr, s->ar_ir, k + s->ar_o) +
-		    conv(dblen, hlen, s->rr, s->or_ir, k + s->or_o)) *
-		   M1_76DB + common);
-	      right   =
-		 ( conv(dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
-		   conv(dblen, hlen, s->lf, s->of_ir, k + s->of_o) +
-		   (conv(dblen, hlen, s->rr, s->ar_ir, k + s->ar_o) +
-		    conv(dblen, hlen, s->lr, s->or_ir, k + s->or_o)) *
-		   M1_76DB + common);
-	   } else {
-	      left    =
-		 ( conv(dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
-		   conv(dblen, hlen, s->rf, s->of_ir, k + s->of_o) +
-		   conv(dblen, hlen, s->lr, s->ar_ir, k + s->ar_o) +
-		   conv(dblen, hlen, s->rr, s->or_ir, k + s->or_o) +
-		   common);
-	      right   =
-		 ( conv(dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
-		   conv(dblen, hlen, s->lf, s->of_ir, k + s->of_o) +
-		   conv(dblen, hlen, s->rr, s->ar_ir, k + s->ar_o) +
-		   conv(dblen, hlen, s->lr, s->or_ir, k + s->or_o) +
-		   common);
-	   }
-	   break;
-	case HRTF_MIX_STEREO:
-	   left    =
-	      ( conv(dblen, hlen, s->lf, s->af_ir, k + s->af_o) +
-		conv(dblen, hlen, s->rf, s->of_ir, k + s->of_o));
-	   right   =
-	      ( conv(dblen, hlen, s->rf, s->af_ir, k + s->af_o) +
-		conv(dblen, hlen, s->lf, s->of_ir, k + s->of_o));
-	   break;
-	default:
-	    /* make gcc happy */
-	    left = 0.0;
-	    right = 0.0;
-	    break;
+	const int n = FFMIN((end - in) / data->nch, HRTFBLOCKLEN);
+	int i;
+
+	/* Decode the input into the sources of the mixer */
+	for(i = 0; i < n; i++) {
+	    const int k = s->cyc_pos;
+
+	    update_ch(s, in, k);
+
+	    /* Simulate a 7.5 ms -20 dB echo of the center channel in the
+	       front channels (like reflection from a room wall) - a kind of
+	       psycho-acoustically "cheating" to focus the center front
+	       channel, which is normally hard to be perceived as front */
+	    s->lf[k] += CFECHOAMPL * s->cf[(k + CFECHODELAY) % s->dlbuflen];
+	    s->rf[k] += CFECHOAMPL * s->cf[(k + CFECHODELAY) % s->dlbuflen];
+
+	    if(s->matrix_mode && s->decode_mode != HRTF_MIX_STEREO)
+	       matrix_decode(in, k, 2, 3, 0, s->dlbuflen,
+			     s->lr_fwr, s->rr_fwr,
+			     s->lrprr_fwr, s->lrmrr_fwr,
+			     &(s->adapt_lr_gain), &(s->adapt_rr_gain),
+			     &(s->adapt_lrprr_gain), &(s->adapt_lrmrr_gain),
+			     s->lr, s->rr, NULL, NULL, s->cr);
+
+	    s->src[SRC_LF][i] = s->lf[k];
+	    s->src[SRC_RF][i] = s->rf[k];
+	    s->src[SRC_LR][i] = s->lr[k];
+	    s->src[SRC_RR][i] = s->rr[k];
+	    s->src[SRC_CF][i] = s->cf[k];
+	    s->src[SRC_CR][i] = s->cr[k];
+	    s->src[SRC_BA_L][i] = s->ba_l[k];
+	    s->src[SRC_BA_R][i] = s->ba_r[k];
+	    s->src[SRC_LFE][i] = data->nch >= 6 ? in[5] : 0;
+
+	    /* Next sample... */
+	    in = &in[data->nch];
+	    (s->cyc_pos)--;
+	    if(s->cyc_pos < 0)
+		s->cyc_pos += s->dlbuflen;
 	}
 
-	/* Bass compensation for the lower frequency cut of the HRTF.  A
-	   cross talk of the left and right channel is introduced to
-	   match the directional characteristics of higher frequencies.
-	   The bass will not have any real 3D perception, but that is
-	   OK (note at 180 Hz, the wavelength is about 2 m, and any
-	   spatial perception is impossible). */
-	left_b  = conv(dblen, blen, s->ba_l, s->ba_ir, k);
-	right_b = conv(dblen, blen, s->ba_r, s->ba_ir, k);
-	left  += (1 - BASSCROSS) * left_b  + BASSCROSS * right_b;
-	right += (1 - BASSCROSS) * right_b + BASSCROSS * left_b;
-	/* Also mix the LFE channel (if available) */
-	if(data->nch >= 6) {
-	    left  += in[5] * M3_01DB;
-	    right += in[5] * M3_01DB;
-	}
-
-	/* Amplitude renormalization. */
-	left  *= AMPLNORM;
-	right *= AMPLNORM;
-
-	switch (s->decode_mode) {
-	case HRTF_MIX_51:
-	case HRTF_MIX_STEREO:
-	   /* "Cheating": linear stereo expansion to amplify the 3D
-	      perception.  Note: Too much will destroy the acoustic space
-	      and may even result in headaches. */
-	   diff = STEXPAND2 * (left - right);
-	   out[0] = (int16_t)(left  + diff);
-	   out[1] = (int16_t)(right - diff);
-	   break;
-	case HRTF_MIX_MATRIX2CH:
-	   /* Do attempt any stereo expansion with matrix encoded
-	      sources.  The L, R channels are already stereo expanded
-	      by the steering, any further stereo expansion will sound
-	      very unnatural. */
-	   out[0] = (int16_t)left;
-	   out[1] = (int16_t)right;
-	   break;
+	/* Mixer filter matrix, including the bass compensation */
+	af_fftconv_process(s->fftconv, s->src, 1, s->mix, 1, n);
+
+	for(i = 0; i < n; i++) {
+	    /* Amplitude renormalization. */
+	    left  = s->mix[0][i] * AMPLNORM;
+	    right = s->mix[1][i] * AMPLNORM;
+
+	    switch (s->decode_mode) {
+	    case HRTF_MIX_51:
+	    case HRTF_MIX_STEREO:
+	       /* "Cheating": linear stereo expansion to amplify the 3D
+		  perception.  Note: Too much will destroy the acoustic space
+		  and may even result in headaches. */
+	       diff = STEXPAND2 * (left - right);
+	       out[0] = (int16_t)(left  + diff);
+	       out[1] = (int16_t)(right - diff);
+	       break;
+	    case HRTF_MIX_MATRIX2CH:
+	       /* Do attempt any stereo expansion with matrix encoded
+		  sources.  The L, R channels are already stereo expanded
+		  by the steering, any further stereo expansion will sound
+		  very unnatural. */
+	       out[0] = (int16_t)left;
+	       out[1] = (int16_t)right;
+	       break;
+	    }
+	    out = &out[af->data->nch];
 	}
-
-	/* Next sample... */
-	in = &in[data->nch];
-	out = &out[af->data->nch];
-	(s->cyc_pos)--;
-	if(s->cyc_pos < 0)
-	    s->cyc_pos += dblen;
     }
 
     /* Set output data */
@@ -572,6 +584,8 @@ static af_data_t* play(struct af_instance_s *af, af_data_t *data)
 
 static int allocate(af_hrtf_t *s)
 {
+    int i;
+
     if ((s->lf = malloc(s->dlbuflen * sizeof(float))) == NULL) return -1;
     if ((s->rf = malloc(s->dlbuflen * sizeof(float))) == NULL) return -1;
     if ((s->lr = malloc(s->dlbuflen * sizeof(float))) == NULL) return -1;
@@ -588,6 +602,15 @@ static int allocate(af_hrtf_t *s)
 	 malloc(s->dlbuflen * sizeof(float))) == NULL) return -1;
     if ((s->fwrbuf_rr =
 	 malloc(s->dlbuflen * sizeof(float))) == NULL) return -1;
+    if ((s->src[0] =
+	 malloc((NUM_SRC + 2) * HRTFBLOCKLEN * sizeof(float))) == NULL)
+	return -1;
+    for (i = 1; i < NUM_SRC; i++)
+	s->src[i] = s->src[0] + i * HRTFBLOCKLEN;
+    s->mix[0] = s->src[0] + NUM_SRC * HRTFBLOCKLEN;
+    s->mix[1] = s->mix[0] + HRTFBLOCKLEN;
+    if ((s->fftconv =
+	 af_fftconv_new(HRTFBLOCKLEN, NUM_SRC, 2)) == NULL) return -1;
     return 0;
 }
 
@@ -33,6 +33,8 @@
 
 #define DELAYBUFLEN	1024	/* Length of the delay buffer */
 #define HRTFFILTLEN	64	/* HRTF filter length */
+#define HRTFBLOCKLEN	128	/* Block length of the FFT convolution
+				   (latency in samples) */
 #define IRTHRESH	0.001	/* Impulse response pruning thresh. */
 
 #define AMPLNORM	M6_99DB	/* Overall amplitude renormalization */
@@ -141,12 +141,73 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 // Deallocate memory
 static void uninit(struct af_instance_s* af)
 {
-  if(af->data)
-    free(af->data->audio);
   free(af->data);
   free(af->setup);
 }
 
+/* Mix frames of nchi channels into frames of ncho channels. out may be
+   the same as in if ncho <= nchi. */
+static void mix_c(float* out, const float* in, int frames, int nchi, int ncho,
+		  float level[AF_NCH][AF_NCH])
+{
+  float	frame[AF_NCH];		// Output of the current frame
+  register int  j,k;
+  while(frames--){
+    for(j=0;j<ncho;j++){
+      register float  x   = 0.0;
+      register const float* tin = in;
+      for(k=0;k<nchi;k++)
+	x += tin[k] * level[j][k];
+      frame[j] = x;
+    }
+    for(j=0;j<ncho;j++)
+      out[j] = frame[j];
+    out+= ncho;
+    in+= nchi;
+  }
+}
+
+#if HAVE_SSE
+/* Mix to stereo, two frames at a time: the lanes are the left and right
+   channels of both frames. The sums are formed in the same order as in C,
+   so the results are the same unless the compiler contracts the C version
+   to fused multiply-adds or uses x87 precision. */
+static void mix_stereo_sse(float* out, const float* in, int frames, int nchi,
+			   float level[AF_NCH][AF_NCH])
+{
+  float cols[AF_NCH][4] __attribute__((aligned(16)));
+  int f, k;
+  for(k=0;k<nchi;k++){
+    cols[k][0] = cols[k][2] = level[0][k];
+    cols[k][1] = cols[k][3] = level[1][k];
+  }
+  for(f=0;f+1<frames;f+=2){
+    x86_reg i = -nchi;
+    const float* col = cols[0];
+    __asm__ volatile(
+        "xorps       %%xmm0, %%xmm0 \n"
+        "1: \n"
+        "movss    (%2,%0,4), %%xmm1 \n"
+        "movss    (%3,%0,4), %%xmm2 \n"
+        "unpcklps    %%xmm2, %%xmm1 \n"
+        "unpcklps    %%xmm1, %%xmm1 \n" // in0[k] in0[k] in1[k] in1[k]
+        "mulps         (%1), %%xmm1 \n"
+        "addps       %%xmm1, %%xmm0 \n"
+        "add            $16, %1 \n"
+        "add             $1, %0 \n"
+        "jl 1b \n"
+        "movups      %%xmm0, (%4) \n"
+        :"+r"(i), "+r"(col)
+        :"r"(in+nchi), "r"(in+2*nchi), "r"(out)
+        :XMM_CLOBBERS("xmm0", "xmm1", "xmm2") "memory"
+    );
+    in += 2*nchi;
+    out += 4;
+  }
+  mix_c(out, in, frames-f, nchi, 2, level);
+}
+#endif
+
 // Filter data through filter
 static af_data_t* play(struct af_instance_s* af, af_data_t* data)
 {
@@ -154,32 +215,29 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data)
   af_data_t*	l    = af->data;	// Local data
   af_pan_t*  	s    = af->setup; 	// Setup for this instance
   float*   	in   = c->audio;	// Input audio data
-  float*   	out  = NULL;		// Output audio data
-  float*	end  = in+c->len/4; 	// End of loop
+  float*   	out  = in;		// Output audio data
   int		nchi = c->nch;		// Number of input channels
   int		ncho = l->nch;		// Number of output channels
-  register int  j,k;
+  int		frames = c->len/4/nchi;	// Number of frames
 
-  if(AF_OK != RESIZE_LOCAL_BUFFER(af,data))
-    return NULL;
+  // Mixing down writes each frame over the input frame (or the frames
+  // before it), which has been read completely by then
+  if(ncho > nchi){
+    if(AF_OK != RESIZE_LOCAL_BUFFER(af,data))
+      return NULL;
+    out = l->audio;
+  }
+  c->audio = out;
 
-  out = l->audio;
   // Execute panning
-  // FIXME: Too slow
-  while(in < end){
-    for(j=0;j<ncho;j++){
-      register float  x   = 0.0;
-      register float* tin = in;
-      for(k=0;k<nchi;k++)
-	x += tin[k] * s->level[j][k];
-      out[j] = x;
-    }
-    out+= ncho;
-    in+= nchi;
-  }
+#if HAVE_SSE
+  if(ncho == 2 && gCpuCaps.hasSSE)
+    mix_stereo_sse(out, in, frames, nchi, s->level);
+  else
+#endif
+  mix_c(out, in, frames, nchi, ncho, s->level);
 
   // Set output data
-  c->audio = l->audio;
   c->len   = c->len / c->nch * l->nch;
   c->nch   = l->nch;
 
@@ -116,7 +116,9 @@ static int fill_queue(struct af_instance_s* af, af_data_t* data, int offset)
   return offset - offset_unchanged;
 }
 
-#define UNROLL_PADDING (4*4)
+// The search functions read whole blocks of up to 8 samples past the end
+// of buf_pre_corr and buf_queue.
+#define UNROLL_PADDING (4*8)
 
 static int best_overlap_offset_float(af_scaletempo_t* s)
 {
@@ -151,6 +153,66 @@ static int best_overlap_offset_float(af_scaletempo_t* s)
   return best_off * 4 * s->num_channels;
 }
 
+#if HAVE_SSE
+static int best_overlap_offset_float_sse(af_scaletempo_t* s)
+{
+  float *pw, *po, *ppc, *search_start;
+  float best_corr = INT_MIN;
+  int best_off = 0;
+  int n = s->samples_overlap - s->num_channels;
+  int n8 = (n + 7) & ~7;
+  int i, off;
+
+  pw  = s->table_window;
+  po  = s->buf_overlap;
+  po += s->num_channels;
+  ppc = s->buf_pre_corr;
+  for (i=0; i<n; i++)
+    ppc[i] = pw[i] * po[i];
+  for (; i<n8; i++)
+    ppc[i] = 0;
+
+  // all channels of a frame are correlated together, 8 samples at a time
+  search_start = (float*)s->buf_queue + s->num_channels;
+  for (off=0; off<s->frames_search; off++) {
+    float corr;
+    x86_reg j = -4 * n8;
+    __asm__ volatile(
+        "xorps       %%xmm0, %%xmm0 \n"
+        "xorps       %%xmm1, %%xmm1 \n"
+        "1: \n"
+        "movups   (%2,%0), %%xmm2 \n"
+        "movups 16(%2,%0), %%xmm3 \n"
+        "movups   (%3,%0), %%xmm4 \n"
+        "movups 16(%3,%0), %%xmm5 \n"
+        "mulps       %%xmm4, %%xmm2 \n"
+        "mulps       %%xmm5, %%xmm3 \n"
+        "addps       %%xmm2, %%xmm0 \n"
+        "addps       %%xmm3, %%xmm1 \n"
+        "add            $32, %0 \n"
+        "jl 1b \n"
+        "addps       %%xmm1, %%xmm0 \n"
+        "movhlps     %%xmm0, %%xmm1 \n"
+        "addps       %%xmm1, %%xmm0 \n"
+        "movaps      %%xmm0, %%xmm1 \n"
+        "shufps $0x55, %%xmm1, %%xmm1 \n"
+        "addss       %%xmm1, %%xmm0 \n"
+        "movss       %%xmm0, %1 \n"
+        :"+r"(j), "=m"(corr)
+        :"r"(search_start+n8), "r"(ppc+n8)
+        :XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5") "memory"
+    );
+    if (corr > best_corr) {
+      best_corr = corr;
+      best_off  = off;
+    }
+    search_start += s->num_channels;
+  }
+
+  return best_off * 4 * s->num_channels;
+}
+#endif
+
 static int best_overlap_offset_s16(af_scaletempo_t* s)
 {
   int32_t *pw, *ppc;
@@ -167,6 +229,7 @@ static int best_overlap_offset_s16(af_scaletempo_t* s)
   for (i=s->num_channels; i<s->samples_overlap; i++) {
     *ppc++ = ( *pw++ * *po++ ) >> 15;
   }
+  memset(ppc, 0, UNROLL_PADDING);
 
   search_start = (int16_t*)s->buf_queue + s->num_channels;
   for (off=0; off<s->frames_search; off++) {
@@ -193,30 +256,200 @@ static int best_overlap_offset_s16(af_scaletempo_t* s)
   return best_off * 2 * s->num_channels;
 }
 
+#if HAVE_SSE2
+// Longest overlap for which the sums of the high parts can't overflow.
+#define SSE2_MAX_SAMPLES_OVERLAP (1 << 17)
+
+static int best_overlap_offset_s16_sse2(af_scaletempo_t* s)
+{
+  int32_t *pw;
+  int16_t *po, *ppc, *search_start;
+  int64_t best_corr = INT64_MIN;
+  int best_off = 0;
+  int n = s->samples_overlap - s->num_channels;
+  int n8 = (n + 7) & ~7;
+  int i, off;
+
+  /* The windowed overlap needs 17 bits, too many for pmaddwd. Split it
+   * into v = hi * 2^15 + lo with 0 <= lo < 2^15 and -2 <= hi <= 1, and
+   * store blocks of 8 lo values followed by the 8 hi values of the same
+   * samples. Both products are exact, so the result is that of the C
+   * version.
+   */
+  pw  = s->table_window;
+  po  = s->buf_overlap;
+  po += s->num_channels;
+  ppc = s->buf_pre_corr;
+  for (i=0; i<n8; i++) {
+    int32_t v = i < n ? (pw[i] * po[i]) >> 15 : 0;
+    ppc[(i & ~7) * 2 + (i & 7)]     = v & 0x7fff;
+    ppc[(i & ~7) * 2 + (i & 7) + 8] = v >> 15;
+  }
+
+  search_start = (int16_t*)s->buf_queue + s->num_channels;
+  for (off=0; off<s->frames_search; off++) {
+    struct {
+      int64_t lo[2];
+      int32_t hi[4];
+    } sum;
+    x86_reg j = -2 * n8;
+    __asm__ volatile(
+        "pxor        %%xmm0, %%xmm0 \n"
+        "pxor        %%xmm1, %%xmm1 \n"
+        "1: \n"
+        "movdqu   (%2,%0), %%xmm2 \n"
+        "movdqu   (%3,%0,2), %%xmm3 \n"
+        "movdqu 16(%3,%0,2), %%xmm4 \n"
+        "pmaddwd     %%xmm2, %%xmm3 \n"
+        "pmaddwd     %%xmm2, %%xmm4 \n"
+        "paddd       %%xmm4, %%xmm1 \n"
+        // sign extend the lo sums to 64 bits
+        "movdqa      %%xmm3, %%xmm4 \n"
+        "psrad          $31, %%xmm4 \n"
+        "movdqa      %%xmm3, %%xmm5 \n"
+        "punpckldq   %%xmm4, %%xmm3 \n"
+        "punpckhdq   %%xmm4, %%xmm5 \n"
+        "paddq       %%xmm3, %%xmm0 \n"
+        "paddq       %%xmm5, %%xmm0 \n"
+        "add            $16, %0 \n"
+        "jl 1b \n"
+        "movdqu      %%xmm0, (%1) \n"
+        "movdqu      %%xmm1, 16(%1) \n"
+        :"+r"(j)
+        :"r"(&sum), "r"(search_start+n8), "r"(ppc+2*n8)
+        :XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5") "memory"
+    );
+    int64_t corr = sum.lo[0] + sum.lo[1]
+                   + ((int64_t)sum.hi[0] + sum.hi[1] + sum.hi[2] + sum.hi[3])
+                     * 32768;
+    if (corr > best_corr) {
+      best_corr = corr;
+      best_off  = off;
+    }
+    search_start += s->num_channels;
+  }
+
+  return best_off * 2 * s->num_channels;
+}
+#endif
+
+static void blend_float_c(float* pout, const float* po, const float* pin,
+                          const float* pb, int n)
+{
+  int i;
+  for (i=0; i<n; i++) {
+    *pout++ = *po - *pb++ * ( *po - *pin++ ); po++;
+  }
+}
+
+static void blend_s16_c(int16_t* pout, const int16_t* po, const int16_t* pin,
+                        const uint16_t* pb, int n)
+{
+  int i;
+  for (i=0; i<n; i++) {
+    *pout++ = *po - ( ( (int64_t)*pb++ * ( *po - *pin++ ) ) >> 16 ); po++;
+  }
+}
+
 static void output_overlap_float(af_scaletempo_t* s, void* buf_out,
 				  int bytes_off)
+{
+  blend_float_c(buf_out, s->buf_overlap,
+                (float*)(s->buf_queue + bytes_off), s->table_blend,
+                s->samples_overlap);
+}
+static void output_overlap_s16(af_scaletempo_t* s, void* buf_out,
+			       int bytes_off)
+{
+  blend_s16_c(buf_out, s->buf_overlap,
+              (int16_t*)(s->buf_queue + bytes_off), s->table_blend,
+              s->samples_overlap);
+}
+
+#if HAVE_SSE
+static void output_overlap_float_sse(af_scaletempo_t* s, void* buf_out,
+                                     int bytes_off)
 {
   float* pout = buf_out;
   float* pb   = s->table_blend;
   float* po   = s->buf_overlap;
   float* pin  = (float*)(s->buf_queue + bytes_off);
-  int i;
-  for (i=0; i<s->samples_overlap; i++) {
-    *pout++ = *po - *pb++ * ( *po - *pin++ ); po++;
-  }
+  int n4 = s->samples_overlap & ~3;
+  x86_reg i = -4 * n4;
+  if (n4)
+    __asm__ volatile(
+        "1: \n"
+        "movups   (%2,%0), %%xmm0 \n"
+        "movups   (%3,%0), %%xmm1 \n"
+        "movups   (%4,%0), %%xmm2 \n"
+        "movaps      %%xmm0, %%xmm3 \n"
+        "subps       %%xmm1, %%xmm3 \n"
+        "mulps       %%xmm2, %%xmm3 \n"
+        "subps       %%xmm3, %%xmm0 \n"
+        "movups      %%xmm0, (%1,%0) \n"
+        "add            $16, %0 \n"
+        "jl 1b \n"
+        :"+r"(i)
+        :"r"(pout+n4), "r"(po+n4), "r"(pin+n4), "r"(pb+n4)
+        :XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3") "memory"
+    );
+  blend_float_c(pout+n4, po+n4, pin+n4, pb+n4, s->samples_overlap-n4);
 }
-static void output_overlap_s16(af_scaletempo_t* s, void* buf_out,
-			       int bytes_off)
+#endif
+
+#if HAVE_SSE2
+static void output_overlap_s16_sse2(af_scaletempo_t* s, void* buf_out,
+                                    int bytes_off)
 {
-  int16_t* pout = buf_out;
-  int32_t* pb   = s->table_blend;
-  int16_t* po   = s->buf_overlap;
-  int16_t* pin  = (int16_t*)(s->buf_queue + bytes_off);
-  int i;
-  for (i=0; i<s->samples_overlap; i++) {
-    *pout++ = *po - ( ( *pb++ * ( *po - *pin++ ) ) >> 16 ); po++;
-  }
+  int16_t*  pout = buf_out;
+  uint16_t* pb   = s->table_blend;
+  int16_t*  po   = s->buf_overlap;
+  int16_t*  pin  = (int16_t*)(s->buf_queue + bytes_off);
+  int n8 = s->samples_overlap & ~7;
+  x86_reg i = -2 * n8;
+  /* The high words of the 32 bit products b * po and b * pin, with b
+   * unsigned, and the borrow from their low words give
+   * (b * (po - pin)) >> 16 modulo 2^16, the same as the C version.
+   */
+  if (n8)
+    __asm__ volatile(
+        "1: \n"
+        "movdqu   (%2,%0), %%xmm0 \n"       // po
+        "movdqu   (%3,%0), %%xmm1 \n"       // pin
+        "movdqu   (%4,%0), %%xmm2 \n"       // b
+        "movdqa      %%xmm2, %%xmm3 \n"
+        "psraw          $15, %%xmm3 \n"     // b >= 2^15
+        "movdqa      %%xmm0, %%xmm4 \n"
+        "pand        %%xmm3, %%xmm4 \n"
+        "pand        %%xmm1, %%xmm3 \n"
+        "movdqa      %%xmm2, %%xmm6 \n"
+        "pmulhw      %%xmm0, %%xmm6 \n"
+        "paddw       %%xmm4, %%xmm6 \n"     // high word of b * po
+        "movdqa      %%xmm2, %%xmm7 \n"
+        "pmulhw      %%xmm1, %%xmm7 \n"
+        "paddw       %%xmm3, %%xmm7 \n"     // high word of b * pin
+        "psubw       %%xmm7, %%xmm6 \n"
+        "movdqa      %%xmm2, %%xmm4 \n"
+        "pmullw      %%xmm0, %%xmm4 \n"
+        "pmullw      %%xmm1, %%xmm2 \n"
+        "pcmpeqw     %%xmm3, %%xmm3 \n"
+        "psllw          $15, %%xmm3 \n"
+        "pxor        %%xmm3, %%xmm4 \n"
+        "pxor        %%xmm3, %%xmm2 \n"
+        "pcmpgtw     %%xmm4, %%xmm2 \n"     // borrow, unsigned compare
+        "paddw       %%xmm2, %%xmm6 \n"
+        "psubw       %%xmm6, %%xmm0 \n"
+        "movdqu      %%xmm0, (%1,%0) \n"
+        "add            $16, %0 \n"
+        "jl 1b \n"
+        :"+r"(i)
+        :"r"(pout+n8), "r"(po+n8), "r"(pin+n8), "r"(pb+n8)
+        :XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3",
+                      "xmm4", "xmm6", "xmm7") "memory"
+    );
+  blend_s16_c(pout+n8, po+n8, pin+n8, pb+n8, s->samples_overlap-n8);
 }
+#endif
 
 // Filter data through filter
 static af_data_t* play(struct af_instance_s* af, af_data_t* data)
@@ -350,16 +583,20 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
       }
       memset(s->buf_overlap, 0, s->bytes_overlap);
       if (use_int) {
-        int32_t* pb = s->table_blend;
+        uint16_t* pb = s->table_blend;
         int64_t blend = 0;
         for (i=0; i<frames_overlap; i++) {
-          int32_t v = blend / frames_overlap;
+          uint16_t v = blend / frames_overlap;
           for (j=0; j<nch; j++) {
             *pb++ = v;
           }
           blend += 65536;  // 2^16
         }
         s->output_overlap = output_overlap_s16;
+#if HAVE_SSE2
+        if (gCpuCaps.hasSSE2)
+          s->output_overlap = output_overlap_s16_sse2;
+#endif
       } else {
         float* pb = s->table_blend;
         for (i=0; i<frames_overlap; i++) {
@@ -369,6 +606,10 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
           }
         }
         s->output_overlap = output_overlap_float;
+#if HAVE_SSE
+        if (gCpuCaps.hasSSE)
+          s->output_overlap = output_overlap_float_sse;
+#endif
       }
     }
 
@@ -386,7 +627,6 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
           mp_msg(MSGT_AFILTER, MSGL_FATAL, "[scaletempo] Out of memory\n");
           return AF_ERROR;
         }
-        memset((char *)s->buf_pre_corr + s->bytes_overlap * 2, 0, UNROLL_PADDING);
         pw = s->table_window;
         for (i=1; i<frames_overlap; i++) {
           int32_t v = ( i * (t - i) * n ) >> 15;
@@ -395,9 +635,13 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
           }
         }
         s->best_overlap_offset = best_overlap_offset_s16;
+#if HAVE_SSE2
+        if (gCpuCaps.hasSSE2 && s->samples_overlap <= SSE2_MAX_SAMPLES_OVERLAP)
+          s->best_overlap_offset = best_overlap_offset_s16_sse2;
+#endif
       } else {
         float* pw;
-        s->buf_pre_corr = realloc(s->buf_pre_corr, s->bytes_overlap);
+        s->buf_pre_corr = realloc(s->buf_pre_corr, s->bytes_overlap + UNROLL_PADDING);
         s->table_window = realloc(s->table_window, s->bytes_overlap - nch * bps);
         if(!s->buf_pre_corr || !s->table_window) {
           mp_msg(MSGT_AFILTER, MSGL_FATAL, "[scaletempo] Out of memory\n");
@@ -411,6 +655,10 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
           }
         }
         s->best_overlap_offset = best_overlap_offset_float;
+#if HAVE_SSE
+        if (gCpuCaps.hasSSE)
+          s->best_overlap_offset = best_overlap_offset_float_sse;
+#endif
       }
     }
 
@@ -149,8 +149,6 @@ static int control(struct af_instance_s* af, int cmd, void* arg)
 // Deallocate memory
 static void uninit(struct af_instance_s* af)
 {
-  if(af->data)
-    free(af->data->audio);
   free(af->data);
   free(af->setup);
 }
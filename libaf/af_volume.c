@@ -137,6 +137,64 @@ static void uninit(struct af_instance_s* af)
     free(af->setup);
 }
 
+/* Multiply the samples of each channel ch with vol[ch] / 256. The samples
+   are interleaved, nch channels at a time. */
+static void volume_s16_c(int16_t* a, int len, int nch, const int* vol)
+{
+  for (int ch = 0; ch < nch; ch++) {
+    if (vol[ch] != 256) {
+      for(int i=ch;i<len;i+=nch){
+	register int x = (a[i] * vol[ch]) >> 8;
+	a[i]=clamp(x,SHRT_MIN,SHRT_MAX);
+      }
+    }
+  }
+}
+
+#if HAVE_SSE2
+/* Same result as the C version. The volumes are repeated to fill nch
+   vectors of 8 samples, which cover a whole number of frames, and must fit
+   into 16 bits for pmulhw. */
+static void volume_s16_sse2(int16_t* a, int len, int nch, const int* vol)
+{
+  int16_t pattern[8 * AF_NCH] __attribute__((aligned(16)));
+  int block = 8 * nch;
+  int n = len - len % block;
+  int i;
+  for (i = 0; i < block; i++) {
+    if (vol[i % nch] > SHRT_MAX) {
+      volume_s16_c(a, len, nch, vol);
+      return;
+    }
+    pattern[i] = vol[i % nch];
+  }
+  for (int pos = 0; pos < n; pos += block) {
+    x86_reg j = -block;
+    __asm__ volatile(
+        "1: \n"
+        "movdqu    (%1,%0,2), %%xmm0 \n"
+        "movdqa    (%2,%0,2), %%xmm1 \n"
+        "movdqa       %%xmm0, %%xmm2 \n"
+        "pmullw       %%xmm1, %%xmm0 \n"
+        "pmulhw       %%xmm1, %%xmm2 \n"
+        "movdqa       %%xmm0, %%xmm3 \n"
+        "punpcklwd    %%xmm2, %%xmm0 \n" // 32 bit products
+        "punpckhwd    %%xmm2, %%xmm3 \n"
+        "psrad            $8, %%xmm0 \n"
+        "psrad            $8, %%xmm3 \n"
+        "packssdw     %%xmm3, %%xmm0 \n" // clamp
+        "movdqu       %%xmm0, (%1,%0,2) \n"
+        "add              $8, %0 \n"
+        "jl 1b \n"
+        :"+r"(j)
+        :"r"(a+pos+block), "r"(pattern+block)
+        :XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3") "memory"
+    );
+  }
+  volume_s16_c(a+n, len-n, nch, vol);
+}
+#endif
+
 // Filter data through filter
 static af_data_t* play(struct af_instance_s* af, af_data_t* data)
 {
@@ -149,14 +207,19 @@ static af_data_t* play(struct af_instance_s* af, af_data_t* data)
   if(af->data->format == (AF_FORMAT_S16_NE)){
     int16_t*    a   = (int16_t*)c->audio;	// Audio data
     int         len = c->len/2;			// Number of samples
+    int         vol[AF_NCH];			// Volume for each channel
+    int         change = 0;
     for (int ch = 0; ch < nch; ch++) {
-      int vol = 256.0 * s->level[ch];
-      if (s->enable[ch] && vol != 256) {
-	for(i=ch;i<len;i+=nch){
-	  register int x = (a[i] * vol) >> 8;
-	  a[i]=clamp(x,SHRT_MIN,SHRT_MAX);
-	}
-      }
+      vol[ch] = s->enable[ch] ? 256.0 * s->level[ch] : 256;
+      change |= vol[ch] != 256;
+    }
+    if (change) {
+#if HAVE_SSE2
+      if (gCpuCaps.hasSSE2)
+	volume_s16_sse2(a, len, nch, vol);
+      else
+#endif
+      volume_s16_c(a, len, nch, vol);
     }
   }
   // Machine is fast and data is floating point
@@ -0,0 +1,320 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Each block, the last two input blocks are transformed (2 * block real
+ * samples) and stored in a ring of spectra, the frequency domain delay line.
+ * Partition p of a kernel is multiplied with the spectrum from p blocks ago,
+ * and the second half of the inverse transform of the sum is free of
+ * circular wrap-around, since the partitions are zero-padded to twice their
+ * length. The spectra use the packed layout of the Libav RDFT: DC and
+ * Nyquist bins (both real) first, then real and imaginary parts of the other
+ * bins.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <libavcodec/avfft.h>
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+
+#include "config.h"
+#include "cpudetect.h"
+#include "fftconv.h"
+
+struct kernel {
+    int parts;
+    float *spectra;     // parts spectra of 2 * block floats
+};
+
+struct af_fftconv {
+    int block;
+    int nin, nout;
+    RDFTContext *rdft, *irdft;
+    struct kernel *kernels;     // [out * nin + in]
+    bool *used;         // whether an input has any kernel
+    int parts;          // length of the delay lines, longest kernel
+    int cur;            // slot of the newest spectrum in the delay lines
+    int pos;            // samples of the current block read so far
+    float **time;       // per input: previous and current block
+    float **fdl;        // per input: spectra of the last parts blocks
+    float **outbuf;     // per output: output of the previous block
+    float *acc;
+};
+
+static void mac_c(float *acc, const float *x, const float *h, int block)
+{
+    acc[0] += x[0] * h[0];
+    acc[1] += x[1] * h[1];
+    for (int j = 2; j < 2 * block; j += 2) {
+        acc[j]     += x[j] * h[j]     - x[j + 1] * h[j + 1];
+        acc[j + 1] += x[j] * h[j + 1] + x[j + 1] * h[j];
+    }
+}
+
+#if HAVE_SSE
+static const uint32_t ps_sign_re[4] __attribute__((aligned(16))) =
+    {0x80000000, 0, 0x80000000, 0};
+
+// Two bins at a time; the first 4 floats (DC, Nyquist and bin 1) are
+// done in C.
+static void mac_sse(float *acc, const float *x, const float *h, int block)
+{
+    x86_reg i = -4 * (2 * block - 4);
+    mac_c(acc, x, h, 2);
+    __asm__ volatile(
+        "movaps        %4, %%xmm7 \n"
+        "1: \n"
+        "movups  (%2,%0), %%xmm0 \n"    // xr xi
+        "movups  (%3,%0), %%xmm1 \n"    // hr hi
+        "movaps   %%xmm0, %%xmm2 \n"
+        "shufps $0xB1, %%xmm2, %%xmm2 \n" // xi xr
+        "movaps   %%xmm1, %%xmm3 \n"
+        "shufps $0xA0, %%xmm3, %%xmm3 \n" // hr hr
+        "shufps $0xF5, %%xmm1, %%xmm1 \n" // hi hi
+        "mulps    %%xmm3, %%xmm0 \n"
+        "mulps    %%xmm1, %%xmm2 \n"
+        "xorps    %%xmm7, %%xmm2 \n"    // -xi*hi xr*hi
+        "movups  (%1,%0), %%xmm4 \n"
+        "addps    %%xmm0, %%xmm4 \n"
+        "addps    %%xmm2, %%xmm4 \n"
+        "movups   %%xmm4, (%1,%0) \n"
+        "add         $16, %0 \n"
+        "jl 1b \n"
+        :"+r"(i)
+        :"r"(acc + 2 * block), "r"(x + 2 * block), "r"(h + 2 * block),
+         "m"(*ps_sign_re)
+        :XMM_CLOBBERS("xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm7")
+         "memory"
+    );
+}
+#endif
+
+struct af_fftconv *af_fftconv_new(int block, int nin, int nout)
+{
+    if (block < AF_FFTCONV_MIN_BLOCK || block > AF_FFTCONV_MAX_BLOCK ||
+        (block & (block - 1)))
+        return NULL;
+    struct af_fftconv *c = av_mallocz(sizeof(*c));
+    if (!c)
+        return NULL;
+    c->block = block;
+    c->nin = nin;
+    c->nout = nout;
+    c->rdft = av_rdft_init(av_log2(2 * block), DFT_R2C);
+    c->irdft = av_rdft_init(av_log2(2 * block), IDFT_C2R);
+    c->kernels = av_mallocz(nin * nout * sizeof(*c->kernels));
+    c->used = av_mallocz(nin * sizeof(*c->used));
+    c->time = av_mallocz(nin * sizeof(*c->time));
+    c->fdl = av_mallocz(nin * sizeof(*c->fdl));
+    c->outbuf = av_mallocz(nout * sizeof(*c->outbuf));
+    c->acc = av_malloc(2 * block * sizeof(float));
+    if (!c->rdft || !c->irdft || !c->kernels || !c->used || !c->time ||
+        !c->fdl || !c->outbuf || !c->acc)
+        goto error;
+    for (int i = 0; i < nin; i++) {
+        c->time[i] = av_mallocz(2 * block * sizeof(float));
+        if (!c->time[i])
+            goto error;
+    }
+    for (int o = 0; o < nout; o++) {
+        c->outbuf[o] = av_mallocz(block * sizeof(float));
+        if (!c->outbuf[o])
+            goto error;
+    }
+    return c;
+
+error:
+    af_fftconv_free(c);
+    return NULL;
+}
+
+void af_fftconv_free(struct af_fftconv *c)
+{
+    if (!c)
+        return;
+    if (c->rdft)
+        av_rdft_end(c->rdft);
+    if (c->irdft)
+        av_rdft_end(c->irdft);
+    for (int k = 0; c->kernels && k < c->nin * c->nout; k++)
+        av_free(c->kernels[k].spectra);
+    for (int i = 0; i < c->nin; i++) {
+        if (c->time)
+            av_free(c->time[i]);
+        if (c->fdl)
+            av_free(c->fdl[i]);
+    }
+    for (int o = 0; c->outbuf && o < c->nout; o++)
+        av_free(c->outbuf[o]);
+    av_free(c->kernels);
+    av_free(c->used);
+    av_free(c->time);
+    av_free(c->fdl);
+    av_free(c->outbuf);
+    av_free(c->acc);
+    av_free(c);
+}
+
+int af_fftconv_set_kernel(struct af_fftconv *c, int out, int in,
+                          const float *ir, int len, float gain)
+{
+    int n = 2 * c->block;
+    struct kernel *k = &c->kernels[out * c->nin + in];
+    int parts = len > 0 ? (len + c->block - 1) / c->block : 0;
+    float *spectra = NULL;
+    float **fdl = NULL;
+
+    // Allocate everything before changing any state, so that a failure
+    // leaves the previous kernel and delay lines in place.
+    int max_parts = parts;
+    for (int i = 0; i < c->nin * c->nout; i++)
+        if (&c->kernels[i] != k)
+            max_parts = FFMAX(max_parts, c->kernels[i].parts);
+    if (parts) {
+        spectra = av_malloc(parts * n * sizeof(float));
+        if (!spectra)
+            goto error;
+    }
+    if (max_parts != c->parts) {
+        fdl = av_mallocz(c->nin * sizeof(*fdl));
+        if (!fdl)
+            goto error;
+        for (int i = 0; i < c->nin && max_parts; i++) {
+            fdl[i] = av_malloc(max_parts * n * sizeof(float));
+            if (!fdl[i])
+                goto error;
+        }
+    }
+
+    // the inverse transform scales by block
+    gain /= c->block;
+    for (int p = 0; p < parts; p++) {
+        float *h = spectra + p * n;
+        int plen = FFMIN(c->block, len - p * c->block);
+        for (int j = 0; j < plen; j++)
+            h[j] = ir[p * c->block + j] * gain;
+        memset(h + plen, 0, (n - plen) * sizeof(float));
+        av_rdft_calc(c->rdft, h);
+    }
+    av_free(k->spectra);
+    k->spectra = spectra;
+    k->parts = parts;
+    if (fdl) {
+        for (int i = 0; i < c->nin; i++)
+            av_free(c->fdl[i]);
+        av_free(c->fdl);
+        c->fdl = fdl;
+        c->parts = max_parts;
+    }
+    for (int i = 0; i < c->nin; i++) {
+        c->used[i] = false;
+        for (int o = 0; o < c->nout; o++)
+            c->used[i] |= c->kernels[o * c->nin + i].parts > 0;
+    }
+    af_fftconv_reset(c);
+    return 0;
+
+error:
+    for (int i = 0; fdl && i < c->nin; i++)
+        av_free(fdl[i]);
+    av_free(fdl);
+    av_free(spectra);
+    return -1;
+}
+
+void af_fftconv_reset(struct af_fftconv *c)
+{
+    int n = 2 * c->block;
+    for (int i = 0; i < c->nin; i++) {
+        memset(c->time[i], 0, n * sizeof(float));
+        if (c->fdl[i])
+            memset(c->fdl[i], 0, c->parts * n * sizeof(float));
+    }
+    for (int o = 0; o < c->nout; o++)
+        memset(c->outbuf[o], 0, c->block * sizeof(float));
+    c->cur = 0;
+    c->pos = 0;
+}
+
+static void process_block(struct af_fftconv *c)
+{
+    int block = c->block, n = 2 * block;
+    void (*mac)(float *acc, const float *x, const float *h, int block) = mac_c;
+#if HAVE_SSE
+    if (gCpuCaps.hasSSE)
+        mac = mac_sse;
+#endif
+
+    if (c->parts)
+        c->cur = (c->cur + 1) % c->parts;
+    for (int i = 0; i < c->nin; i++) {
+        if (c->used[i]) {
+            float *x = c->fdl[i] + c->cur * n;
+            memcpy(x, c->time[i], n * sizeof(float));
+            av_rdft_calc(c->rdft, x);
+        }
+        memcpy(c->time[i], c->time[i] + block, block * sizeof(float));
+    }
+
+    for (int o = 0; o < c->nout; o++) {
+        bool any = false;
+        memset(c->acc, 0, n * sizeof(float));
+        for (int i = 0; i < c->nin; i++) {
+            struct kernel *k = &c->kernels[o * c->nin + i];
+            for (int p = 0; p < k->parts; p++) {
+                int slot = (c->cur - p + c->parts) % c->parts;
+                mac(c->acc, c->fdl[i] + slot * n, k->spectra + p * n, block);
+                any = true;
+            }
+        }
+        if (any) {
+            av_rdft_calc(c->irdft, c->acc);
+            memcpy(c->outbuf[o], c->acc + block, block * sizeof(float));
+        } else {
+            memset(c->outbuf[o], 0, block * sizeof(float));
+        }
+    }
+}
+
+void af_fftconv_process(struct af_fftconv *c, float *const *in, int in_stride,
+                        float *const *out, int out_stride, int n)
+{
+    int done = 0;
+    while (done < n) {
+        int len = FFMIN(n - done, c->block - c->pos);
+        // all inputs of a sample are read before the outputs are written
+        for (int i = 0; i < c->nin; i++) {
+            const float *src = in[i] + done * in_stride;
+            float *dst = c->time[i] + c->block + c->pos;
+            for (int j = 0; j < len; j++)
+                dst[j] = src[j * in_stride];
+        }
+        for (int o = 0; o < c->nout; o++) {
+            const float *src = c->outbuf[o] + c->pos;
+            float *dst = out[o] + done * out_stride;
+            for (int j = 0; j < len; j++)
+                dst[j * out_stride] = src[j];
+        }
+        c->pos += len;
+        done += len;
+        if (c->pos == c->block) {
+            process_block(c);
+            c->pos = 0;
+        }
+    }
+}
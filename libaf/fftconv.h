@@ -0,0 +1,55 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_FFTCONV_H
+#define MPLAYER_FFTCONV_H
+
+/* Uniformly partitioned FFT convolution (overlap-save).
+ *
+ * Every output is the sum of the inputs, each convolved with its own
+ * kernel (impulse response). Kernels are cut into partitions of the block
+ * size, and the spectra of the last input blocks are kept, so a block costs
+ * one FFT per input and output plus a multiply-add of the spectra per
+ * kernel partition, whatever the kernel length. The output lags the input
+ * by exactly block samples.
+ */
+
+#define AF_FFTCONV_MIN_BLOCK 16
+#define AF_FFTCONV_MAX_BLOCK 16384
+
+struct af_fftconv;
+
+// block must be a power of 2 between the limits above. Returns NULL on
+// failure.
+struct af_fftconv *af_fftconv_new(int block, int nin, int nout);
+void af_fftconv_free(struct af_fftconv *c);
+
+// Set the kernel from input in to output out to len samples of ir times
+// gain, replacing the previous one; len 0 removes it. Clears the history of
+// the signals. Returns -1 if out of memory, leaving everything unchanged.
+int af_fftconv_set_kernel(struct af_fftconv *c, int out, int in,
+                          const float *ir, int len, float gain);
+// Forget the input seen so far, as if it had been silence.
+void af_fftconv_reset(struct af_fftconv *c);
+
+// Read n samples of every input and write n samples of every output. Input
+// i is read from in[i], in[i] + in_stride, ..., likewise for the outputs,
+// so interleaved audio can be processed directly, also in place.
+void af_fftconv_process(struct af_fftconv *c, float *const *in, int in_stride,
+                        float *const *out, int out_stride, int n);
+
+#endif /* MPLAYER_FFTCONV_H */
@@ -34,6 +34,7 @@
 #include <math.h>
 #include <string.h>
 #include <alloca.h>
+#include <poll.h>
 
 #include "config.h"
 #include "subopt-helper.h"
@@ -71,6 +72,9 @@ static size_t bytes_per_sample;
 
 static int alsa_can_pause;
 static snd_pcm_sframes_t prepause_frames;
+static int alsa_mmap;
+static int alsa_noblock;
+static snd_pcm_uframes_t alsa_period_size;
 
 #define ALSA_DEVICE_SIZE 256
 
@@ -97,6 +101,27 @@ static void alsa_error_handler(const char *file, int line, const char *function,
 static int control(int cmd, void *arg)
 {
   switch(cmd) {
+  case AOCONTROL_GET_POLL_FDS: {
+    struct ao_poll_fds *p = arg;
+    int count;
+    if (!alsa_handler)
+      return CONTROL_ERROR;
+    count = snd_pcm_poll_descriptors_count(alsa_handler);
+    if (count < 1 || count > AO_MAX_POLL_FDS)
+      return CONTROL_FALSE;
+    p->num_fds = snd_pcm_poll_descriptors(alsa_handler, p->fds, count);
+    return p->num_fds > 0 ? CONTROL_OK : CONTROL_FALSE;
+  }
+  case AOCONTROL_CHECK_POLL_FDS: {
+    struct ao_poll_fds *p = arg;
+    unsigned short revents;
+    if (!alsa_handler ||
+        snd_pcm_poll_descriptors_revents(alsa_handler, p->fds, p->num_fds,
+                                         &revents) < 0)
+      return CONTROL_ERROR;
+    /* let play() handle errors such as underruns */
+    return revents & (POLLOUT | POLLERR) ? CONTROL_TRUE : CONTROL_FALSE;
+  }
   case AOCONTROL_GET_MUTE:
   case AOCONTROL_SET_MUTE:
   case AOCONTROL_GET_VOLUME:
@@ -275,6 +300,12 @@ static void print_help (void)
     "[AO_ALSA] Options:\n"\
     "[AO_ALSA]   noblock\n"\
     "[AO_ALSA]     Opens device in non-blocking mode.\n"\
+    "[AO_ALSA]   mmap\n"\
+    "[AO_ALSA]     Write directly to the mmapped device buffer.\n"\
+    "[AO_ALSA]   buffer=<ms>\n"\
+    "[AO_ALSA]     Sets the device buffer size in milliseconds.\n"\
+    "[AO_ALSA]   period=<ms>\n"\
+    "[AO_ALSA]     Sets the period size in milliseconds.\n"\
     "[AO_ALSA]   device=<device-name>\n"\
     "[AO_ALSA]     Sets device (change , to . and : to =)\n");
 }
@@ -337,12 +368,16 @@ static int init(int rate_hz, int channels, int format, int flags)
 {
     int err;
     int block;
+    int buffer_ms, period_ms;
     strarg_t device;
     snd_pcm_uframes_t chunk_size;
     snd_pcm_uframes_t bufsize;
     snd_pcm_uframes_t boundary;
     const opt_t subopts[] = {
       {"block", OPT_ARG_BOOL, &block, NULL},
+      {"mmap", OPT_ARG_BOOL, &alsa_mmap, NULL},
+      {"buffer", OPT_ARG_INT, &buffer_ms, int_pos},
+      {"period", OPT_ARG_INT, &period_ms, int_non_neg},
       {"device", OPT_ARG_STR, &device, str_maxlen},
       {NULL}
     };
@@ -431,6 +466,9 @@ static int init(int rate_hz, int channels, int format, int flags)
     //subdevice parsing
     // set defaults
     block = 1;
+    alsa_mmap = 0;
+    buffer_ms = BUFFER_TIME / 1000;
+    period_ms = 0;
     /* switch for spdif
      * sets opening sequence for SPDIF
      * sets also the playback and other switches 'on the fly'
@@ -483,6 +521,7 @@ static int init(int rate_hz, int channels, int format, int flags)
         return 0;
     }
     parse_device(alsa_device, device.str, device.len);
+    alsa_noblock = !block;
 
     mp_msg(MSGT_AO,MSGL_V,"alsa-init: using device %s\n", alsa_device);
 
@@ -494,6 +533,7 @@ static int init(int rate_hz, int channels, int format, int flags)
 	{
 	  if (err != -EBUSY && !block) {
 	    mp_tmsg(MSGT_AO,MSGL_INFO,"[AO_ALSA] Open in nonblock-mode failed, trying to open in block-mode.\n");
+	    alsa_noblock = 0;
 	    if ((err = try_open_device(alsa_device, 0, isac3)) < 0) {
 	      mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] Playback open error: %s\n", snd_strerror(err));
 	      return 0;
@@ -521,8 +561,18 @@ static int init(int rate_hz, int channels, int format, int flags)
 	  return 0;
 	}
 
-      err = snd_pcm_hw_params_set_access(alsa_handler, alsa_hwparams,
-					 SND_PCM_ACCESS_RW_INTERLEAVED);
+      if (alsa_mmap) {
+        err = snd_pcm_hw_params_set_access(alsa_handler, alsa_hwparams,
+                                           SND_PCM_ACCESS_MMAP_INTERLEAVED);
+        if (err < 0) {
+          mp_msg(MSGT_AO, MSGL_WARN, "[AO_ALSA] mmap access not supported, "
+                 "using normal writes: %s\n", snd_strerror(err));
+          alsa_mmap = 0;
+        }
+      }
+      if (!alsa_mmap)
+        err = snd_pcm_hw_params_set_access(alsa_handler, alsa_hwparams,
+                                           SND_PCM_ACCESS_RW_INTERLEAVED);
       if (err < 0) {
 	mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] Unable to set access type: %s\n",
 	       snd_strerror(err));
@@ -583,15 +633,20 @@ static int init(int rate_hz, int channels, int format, int flags)
       ao_data.bps = ao_data.samplerate * bytes_per_sample;
 
 	if ((err = snd_pcm_hw_params_set_buffer_time_near(alsa_handler, alsa_hwparams,
-							  &(unsigned int){BUFFER_TIME}, NULL)) < 0)
+							  &(unsigned int){buffer_ms * 1000}, NULL)) < 0)
 	  {
 	    mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] Unable to set buffer time near: %s\n",
 		   snd_strerror(err));
 	    return 0;
 	  }
 
-	if ((err = snd_pcm_hw_params_set_periods_near(alsa_handler, alsa_hwparams,
-						      &(unsigned int){FRAGCOUNT}, NULL)) < 0) {
+	if (period_ms > 0)
+	  err = snd_pcm_hw_params_set_period_time_near(alsa_handler, alsa_hwparams,
+						       &(unsigned int){period_ms * 1000}, NULL);
+	else
+	  err = snd_pcm_hw_params_set_periods_near(alsa_handler, alsa_hwparams,
+						   &(unsigned int){FRAGCOUNT}, NULL);
+	if (err < 0) {
 	  mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] Unable to set periods: %s\n",
 		 snd_strerror(err));
 	  return 0;
@@ -625,6 +680,7 @@ static int init(int rate_hz, int channels, int format, int flags)
 	mp_msg(MSGT_AO,MSGL_V,"alsa-init: got period size %li\n", chunk_size);
       }
       ao_data.outburst = chunk_size * bytes_per_sample;
+      alsa_period_size = chunk_size;
 
       /* setting software parameters */
       if ((err = snd_pcm_sw_params_current(alsa_handler, alsa_swparams)) < 0) {
@@ -649,6 +705,12 @@ static int init(int rate_hz, int channels, int format, int flags)
 	       snd_strerror(err));
 	return 0;
       }
+      /* wake up poll() as soon as a period can be written */
+      if ((err = snd_pcm_sw_params_set_avail_min(alsa_handler, alsa_swparams, chunk_size)) < 0) {
+	mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] Unable to set avail_min: %s\n",
+	       snd_strerror(err));
+	return 0;
+      }
       /* play silence when there is an underrun */
       if ((err = snd_pcm_sw_params_set_silence_size(alsa_handler, alsa_swparams, boundary)) < 0) {
 	mp_tmsg(MSGT_AO,MSGL_ERR,"[AO_ALSA] Unable to set silence size: %s\n",
@@ -662,9 +724,10 @@ static int init(int rate_hz, int channels, int format, int flags)
       }
       /* end setting sw-params */
 
-      mp_msg(MSGT_AO,MSGL_V,"alsa: %d Hz/%d channels/%d bpf/%d bytes buffer/%s\n",
+      mp_msg(MSGT_AO,MSGL_V,"alsa: %d Hz/%d channels/%d bpf/%d bytes buffer/%d bytes period/%s%s\n",
 	     ao_data.samplerate, ao_data.channels, (int)bytes_per_sample, ao_data.buffersize,
-	     snd_pcm_format_description(alsa_format));
+	     ao_data.outburst, snd_pcm_format_description(alsa_format),
+	     alsa_mmap ? "/mmap" : "");
 
     } // end switch alsa_handler (spdif)
     alsa_can_pause = snd_pcm_hw_params_can_pause(alsa_hwparams);
@@ -776,6 +839,58 @@ static void reset(void)
     thanxs for marius <marius@rospot.com> for giving us the light ;)
 */
 
+/* Copy frames directly into the mmapped device buffer. Returns the number
+ * of frames written, or a negative error code like snd_pcm_writei(). */
+static snd_pcm_sframes_t write_mmap(void *data, snd_pcm_uframes_t num_frames)
+{
+  snd_pcm_uframes_t written = 0;
+  snd_pcm_sframes_t avail = snd_pcm_avail_update(alsa_handler);
+  if (avail < 0)
+    return avail;
+  if (avail == 0) {
+    int err;
+    if (alsa_noblock)
+      return 0;
+    /* behave like a blocking write */
+    err = snd_pcm_wait(alsa_handler, 1000);
+    return err < 0 ? err : 0;
+  }
+  while (written < num_frames && avail > 0) {
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t frames = num_frames - written;
+    snd_pcm_sframes_t res;
+    int err;
+    if (frames > (snd_pcm_uframes_t)avail)
+      frames = avail;
+    err = snd_pcm_mmap_begin(alsa_handler, &areas, &offset, &frames);
+    if (err < 0)
+      return err;
+    /* interleaved access: all channels are in the first area */
+    memcpy((char *)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8,
+           (char *)data + written * bytes_per_sample,
+           frames * bytes_per_sample);
+    res = snd_pcm_mmap_commit(alsa_handler, offset, frames);
+    if (res < 0)
+      return res;
+    if ((snd_pcm_uframes_t)res != frames)
+      return -EPIPE;
+    written += frames;
+    avail -= frames;
+  }
+  /* mmap transfers don't start the stream by themselves */
+  if (snd_pcm_state(alsa_handler) == SND_PCM_STATE_PREPARED) {
+    snd_pcm_sframes_t space = snd_pcm_avail_update(alsa_handler);
+    snd_pcm_sframes_t queued = ao_data.buffersize / bytes_per_sample - space;
+    if (space >= 0 && queued >= (snd_pcm_sframes_t)alsa_period_size) {
+      int err = snd_pcm_start(alsa_handler);
+      if (err < 0)
+        return err;
+    }
+  }
+  return written;
+}
+
 static int play(void* data, int len, int flags)
 {
   int num_frames;
@@ -795,7 +910,10 @@ static int play(void* data, int len, int flags)
     return 0;
 
   do {
-    res = snd_pcm_writei(alsa_handler, data, num_frames);
+    if (alsa_mmap)
+      res = write_mmap(data, num_frames);
+    else
+      res = snd_pcm_writei(alsa_handler, data, num_frames);
 
       if (res == -EINTR) {
 	/* nothing to do */
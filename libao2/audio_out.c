@@ -21,12 +21,17 @@
 #include <string.h>
 #include <assert.h>
 
+#include <libavutil/common.h>
+
 #include "talloc.h"
 
 #include "config.h"
 #include "audio_out.h"
 
 #include "mp_msg.h"
+#include "options.h"
+#include "profiler.h"
+#include "osdep/timer.h"
 
 // there are some globals:
 struct ao *global_ao;
@@ -110,6 +115,15 @@ struct ao *ao_create(struct MPOpts *opts, struct input_ctx *input)
     return r;
 }
 
+static void init_done(struct ao *ao)
+{
+    ao->initialized = true;
+#ifdef HAVE_PTHREADS
+    if (ao->opts->ao_thread_buffer > 0)
+        ao->thread = ao_thread_create(ao, ao->opts->ao_thread_buffer);
+#endif
+}
+
 void ao_init(struct ao *ao, char **ao_list)
 {
     /* Caller adding child blocks is not supported as we may call
@@ -150,7 +164,7 @@ void ao_init(struct ao *ao, char **ao_list)
             ao->driver = audio_out;
             if (audio_out->init(ao, params) >= 0) {
                 ao->driver = audio_out;
-                ao->initialized = true;
+                init_done(ao);
                 return;
             }
             mp_tmsg(MSGT_AO, MSGL_WARN,
@@ -172,8 +186,8 @@ void ao_init(struct ao *ao, char **ao_list)
         const struct ao_driver *audio_out = audio_out_drivers[i];
         ao->driver = audio_out;
         if (audio_out->init(ao, NULL) >= 0) {
-            ao->initialized = true;
             ao->driver = audio_out;
+            init_done(ao);
             return;
         }
         talloc_free_children(ao);
@@ -186,6 +200,8 @@ void ao_uninit(struct ao *ao, bool cut_audio)
 {
     assert(ao->buffer.len >= ao->buffer_playable_size);
     ao->buffer.len = ao->buffer_playable_size;
+    if (ao->thread)
+        ao_thread_uninit(ao, cut_audio);
     if (ao->initialized)
         ao->driver->uninit(ao, cut_audio);
     if (!cut_audio && ao->buffer.len)
@@ -193,29 +209,125 @@ void ao_uninit(struct ao *ao, bool cut_audio)
     talloc_free(ao);
 }
 
-int ao_play(struct ao *ao, void *data, int len, int flags)
+int ao_control(struct ao *ao, enum aocontrol cmd, void *arg)
 {
-    return ao->driver->play(ao, data, len, flags);
+    if (!ao->driver->control)
+        return CONTROL_UNKNOWN;
+    if (ao->thread)
+        return ao_thread_control(ao, cmd, arg);
+    return ao->driver->control(ao, cmd, arg);
 }
 
-int ao_control(struct ao *ao, enum aocontrol cmd, void *arg)
+/* Measure the driver delay and publish the resulting position. fed is the
+ * number of bytes passed to the driver so far. Only one thread may call
+ * this at a time, and it must be allowed to call into the driver.
+ */
+void ao_update_clock(struct ao *ao, uint64_t fed, bool running)
+{
+    if (!ao->driver->get_delay || !ao->bps)
+        return;
+    struct ao_clock *c = &ao->clock;
+    double end = fed / (double)ao->bps;
+    double pos = end - ao->driver->get_delay(ao);
+    double rate = running ? 1 : 0;
+    int64_t now = mp_time_ns();
+    unsigned seq = c->seq;
+    __atomic_store_n(&c->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store(&c->pos, &pos, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->time, now, __ATOMIC_RELAXED);
+    __atomic_store(&c->rate, &rate, __ATOMIC_RELAXED);
+    __atomic_store(&c->end, &end, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void read_clock(struct ao *ao, struct ao_clock *out)
 {
-    if (ao->driver->control)
-        return ao->driver->control(ao, cmd, arg);
-    return CONTROL_UNKNOWN;
+    struct ao_clock *c = &ao->clock;
+    unsigned seq;
+    do {
+        seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        __atomic_load(&c->pos, &out->pos, __ATOMIC_RELAXED);
+        out->time = __atomic_load_n(&c->time, __ATOMIC_RELAXED);
+        __atomic_load(&c->rate, &out->rate, __ATOMIC_RELAXED);
+        __atomic_load(&c->end, &out->end, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || __atomic_load_n(&c->seq, __ATOMIC_RELAXED) != seq);
 }
 
+/* Account for audio just given to the driver. The driver is only asked for
+ * its delay if the published position is older than AO_CLOCK_REFRESH_NS,
+ * as in ao_get_delay(). Otherwise only the end of the buffered audio moves.
+ */
+static void advance_clock(struct ao *ao)
+{
+    if (!ao->driver->get_delay || !ao->bps)
+        return;
+    struct ao_clock *c = &ao->clock;
+    struct ao_clock cur;
+    read_clock(ao, &cur);
+    double rate = ao->paused ? 0 : 1;
+    if (mp_time_ns() - cur.time > AO_CLOCK_REFRESH_NS || cur.rate != rate) {
+        ao_update_clock(ao, ao->written, !ao->paused);
+        return;
+    }
+    double end = ao->written / (double)ao->bps;
+    unsigned seq = c->seq;
+    __atomic_store_n(&c->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store(&c->end, &end, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int ao_play(struct ao *ao, void *data, int len, int flags)
+{
+    if (ao->thread) {
+        int r = ao_thread_play(ao, data, len, flags);
+        if (r > 0)
+            ao->written += r;
+        return r;
+    }
+    struct mp_prof_scope prof;
+    MP_PROF_BEGIN(&prof, "ao_play");
+    int r = ao->driver->play(ao, data, len, flags);
+    MP_PROF_END(&prof);
+    if (r > 0) {
+        ao->written += r;
+        advance_clock(ao);
+    }
+    return r;
+}
+
+/* Extrapolate the published position instead of asking the driver, which
+ * can be slow (a round trip to the sound server for ao_pulse) and would
+ * have to wait for the feeder thread. The position stops at the end of the
+ * audio the driver has been given, so audio still queued in the feeder's
+ * ring is not counted as played if the driver runs dry.
+ */
 double ao_get_delay(struct ao *ao)
 {
     if (!ao->driver->get_delay) {
         assert(ao->untimed);
         return 0;
     }
-    return ao->driver->get_delay(ao);
+    if (!ao->bps)
+        return ao->driver->get_delay(ao);
+    int64_t now = mp_time_ns();
+    struct ao_clock c;
+    read_clock(ao, &c);
+    // Without the feeder thread nothing else keeps the clock current.
+    if (!ao->thread && now - c.time > AO_CLOCK_REFRESH_NS) {
+        ao_update_clock(ao, ao->written, !ao->paused);
+        read_clock(ao, &c);
+    }
+    double pos = FFMIN(c.pos + (now - c.time) / 1e9 * c.rate, c.end);
+    return FFMAX(ao->written / (double)ao->bps - pos, 0);
 }
 
 int ao_get_space(struct ao *ao)
 {
+    if (ao->thread)
+        return ao_thread_get_space(ao);
     return ao->driver->get_space(ao);
 }
 
@@ -223,20 +335,37 @@ void ao_reset(struct ao *ao)
 {
     ao->buffer.len = 0;
     ao->buffer_playable_size = 0;
+    if (ao->thread) {
+        ao_thread_reset(ao);
+        return;
+    }
     if (ao->driver->reset)
         ao->driver->reset(ao);
+    ao_update_clock(ao, ao->written, false);
 }
 
 void ao_pause(struct ao *ao)
 {
+    ao->paused = true;
+    if (ao->thread) {
+        ao_thread_pause(ao);
+        return;
+    }
     if (ao->driver->pause)
         ao->driver->pause(ao);
+    ao_update_clock(ao, ao->written, false);
 }
 
 void ao_resume(struct ao *ao)
 {
+    ao->paused = false;
+    if (ao->thread) {
+        ao_thread_resume(ao);
+        return;
+    }
     if (ao->driver->resume)
         ao->driver->resume(ao);
+    ao_update_clock(ao, ao->written, true);
 }
 
 
@@ -20,6 +20,7 @@
 #define MPLAYER_AUDIO_OUT_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "bstr.h"
 
@@ -38,6 +39,22 @@ enum aocontrol {
     // _MUTE commands take a pointer to bool
     AOCONTROL_GET_MUTE,
     AOCONTROL_SET_MUTE,
+    // Takes struct ao_poll_fds pointer. Fills in file descriptors which
+    // poll() as ready when the driver can accept another period of audio.
+    AOCONTROL_GET_POLL_FDS,
+    // Takes struct ao_poll_fds pointer with the revents of a poll() on those
+    // fds. Returns CONTROL_TRUE if the driver can accept audio (or needs
+    // play() to recover from an error), CONTROL_FALSE if the wakeup was not
+    // for writing.
+    AOCONTROL_CHECK_POLL_FDS,
+};
+
+#define AO_MAX_POLL_FDS 8
+
+struct pollfd;
+struct ao_poll_fds {
+    int num_fds;
+    struct pollfd *fds;     // array of AO_MAX_POLL_FDS entries
 };
 
 #define AOPLAY_FINAL_CHUNK 1
@@ -88,6 +105,22 @@ struct ao_driver {
     void (*resume)(struct ao *ao);
 };
 
+/* Playback position, published by whichever thread talks to the driver
+ * and read without locking by ao_get_delay(), which extrapolates it to the
+ * current time. Positions are in seconds of audio since the AO was opened.
+ * Readers retry while seq is odd or changes under them.
+ */
+struct ao_clock {
+    unsigned seq;
+    double pos;         // position audible at time
+    int64_t time;       // mp_time_ns() of the measurement
+    double rate;        // advance of pos per second, 0 while stopped
+    double end;         // end of the audio passed to the driver
+};
+
+// The driver delay is measured again at least this often while playing.
+#define AO_CLOCK_REFRESH_NS 50000000
+
 /* global data used by mplayer and plugins */
 struct ao {
     int samplerate;
@@ -103,10 +136,14 @@ struct ao {
     bool initialized;
     bool untimed;
     bool no_persistent_volume;
+    bool paused;
     const struct ao_driver *driver;
     void *priv;
     struct MPOpts *opts;
     struct input_ctx *input_ctx;
+    struct ao_thread *thread;   // feeder thread, see audio_out_thread.c
+    struct ao_clock clock;
+    uint64_t written;           // bytes accepted by ao_play()
 };
 
 extern char *ao_subdevice;
@@ -123,6 +160,16 @@ int ao_get_space(struct ao *ao);
 void ao_reset(struct ao *ao);
 void ao_pause(struct ao *ao);
 void ao_resume(struct ao *ao);
+void ao_update_clock(struct ao *ao, uint64_t fed, bool running);
+
+struct ao_thread *ao_thread_create(struct ao *ao, double buffer);
+void ao_thread_uninit(struct ao *ao, bool cut_audio);
+int ao_thread_play(struct ao *ao, void *data, int len, int flags);
+int ao_thread_control(struct ao *ao, enum aocontrol cmd, void *arg);
+int ao_thread_get_space(struct ao *ao);
+void ao_thread_reset(struct ao *ao);
+void ao_thread_pause(struct ao *ao);
+void ao_thread_resume(struct ao *ao);
 
 int old_ao_control(struct ao *ao, enum aocontrol cmd, void *arg);
 int old_ao_init(struct ao *ao, char *params);
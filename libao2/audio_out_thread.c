@@ -0,0 +1,345 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Feeder thread between the player and the audio output driver.
+ *
+ * The player writes decoded and filtered audio into a ring buffer, and a
+ * separate thread moves it to the driver whenever the driver has space.
+ * This way the driver buffer is kept filled while the main thread is busy
+ * with video filtering or a slow VO flip, so drivers can run with small
+ * buffers.
+ *
+ * The ring has a single producer (the player thread, through ao_play())
+ * and a single consumer (the feeder thread), and its positions are
+ * published with atomic loads and stores, so queuing audio never waits
+ * for the driver. All driver calls are serialized with a mutex, since
+ * drivers are not thread safe. ao_reset() is the only place where the
+ * player modifies the read position; it does so with the mutex held,
+ * which the feeder also holds while it accesses the ring.
+ *
+ * The feeder also keeps the AO clock current (see ao_update_clock()), so
+ * the player gets the delay without waiting for the mutex.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#ifndef __MINGW32__
+#include <poll.h>
+#define HAVE_AO_POLL 1
+#endif
+
+#include <libavutil/common.h>
+
+#include "talloc.h"
+#include "mp_msg.h"
+#include "profiler.h"
+#include "osdep/timer.h"
+#include "libaf/af_format.h"
+#include "audio_out.h"
+
+#define NO_FINAL_POS UINT64_MAX
+
+struct ao_thread {
+    struct ao *ao;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;      // signaled to wake up the feeder
+    pthread_cond_t drained;     // signaled when the ring becomes empty
+    bool terminate;
+    bool paused;
+    bool waiting;               // feeder waits for data, needs a signal
+
+    uint8_t *ring;
+    uint8_t *bounce;            // linear copy of data wrapping in the ring
+    int size;
+    int unitsize;
+    // Byte positions in the stream of queued audio; never wrap.
+    uint64_t write_pos;         // written by the player thread
+    uint64_t read_pos;          // written by the feeder (or with the lock)
+    uint64_t final_pos;         // end of the AOPLAY_FINAL_CHUNK data
+
+#ifdef HAVE_AO_POLL
+    // driver fds to wait on instead of sleeping for a fixed period
+    struct pollfd poll_fds[AO_MAX_POLL_FDS];
+    int num_poll_fds;
+#endif
+};
+
+static uint64_t load_pos(uint64_t *pos)
+{
+    return __atomic_load_n(pos, __ATOMIC_ACQUIRE);
+}
+
+static void store_pos(uint64_t *pos, uint64_t val)
+{
+    __atomic_store_n(pos, val, __ATOMIC_RELEASE);
+}
+
+static void get_deadline(struct timespec *ts, double secs)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t usec = now.tv_usec + (int64_t)(secs * 1e6);
+    ts->tv_sec = now.tv_sec + usec / 1000000;
+    ts->tv_nsec = usec % 1000000 * 1000;
+}
+
+// Pass up to len bytes at read_pos to the driver. Called locked.
+static int feed_driver(struct ao_thread *t, int len)
+{
+    struct ao *ao = t->ao;
+    uint64_t rpos = t->read_pos;
+    int offset = rpos % t->size;
+    uint8_t *data = t->ring + offset;
+    if (offset + len > t->size) {
+        int part = t->size - offset;
+        memcpy(t->bounce, data, part);
+        memcpy(t->bounce + part, t->ring, len - part);
+        data = t->bounce;
+    }
+    int flags = rpos + len == load_pos(&t->final_pos) ? AOPLAY_FINAL_CHUNK : 0;
+    struct mp_prof_scope prof;
+    MP_PROF_BEGIN(&prof, "ao_play");
+    int played = ao->driver->play(ao, data, len, flags);
+    MP_PROF_END(&prof);
+    if (played > 0)
+        store_pos(&t->read_pos, rpos + played);
+    return played;
+}
+
+#ifdef HAVE_AO_POLL
+// Whether the revents of a poll() wakeup mean the driver can take audio.
+// Drivers need to decode them; ALSA plugins use fds of their own. Called
+// locked.
+static bool poll_ready(struct ao_thread *t)
+{
+    struct ao_poll_fds pfds = { t->num_poll_fds, t->poll_fds };
+    return t->ao->driver->control(t->ao, AOCONTROL_CHECK_POLL_FDS, &pfds)
+           != CONTROL_FALSE;
+}
+#endif
+
+static void *feeder_thread(void *arg)
+{
+    struct ao_thread *t = arg;
+    struct ao *ao = t->ao;
+    // How long to wait for the driver to make room for another chunk.
+    double period = av_clipf(ao->outburst / (double)ao->bps / 2, 0.001, 0.02);
+    bool polled = false;
+
+    mp_prof_set_thread_name("audio");
+    pthread_mutex_lock(&t->lock);
+    while (!t->terminate) {
+        int avail = load_pos(&t->write_pos) - t->read_pos;
+        if (!avail) {
+            pthread_cond_broadcast(&t->drained);
+            // Pairs with ao_thread_play(): either it sees the flag and
+            // signals, or we see the data it queued.
+            __atomic_store_n(&t->waiting, true, __ATOMIC_SEQ_CST);
+            avail = __atomic_load_n(&t->write_pos, __ATOMIC_SEQ_CST)
+                    - t->read_pos;
+        }
+        if (t->paused || !avail) {
+            pthread_cond_wait(&t->wakeup, &t->lock);
+            __atomic_store_n(&t->waiting, false, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        __atomic_store_n(&t->waiting, false, __ATOMIC_SEQ_CST);
+        int space = ao->driver->get_space(ao);
+        int len = FFMIN(avail, space);
+        len -= len % t->unitsize;
+        int played = len > 0 ? feed_driver(t, len) : 0;
+        if (played > 0 || mp_time_ns() - ao->clock.time > AO_CLOCK_REFRESH_NS)
+            ao_update_clock(ao, t->read_pos, true);
+        if (played < avail) {
+#ifdef HAVE_AO_POLL
+            /* Sleep until the driver reports free space. Wakeups the driver
+             * says are not for writing just poll again. Fall back to a timed
+             * sleep if a poll wakeup did not let us write anything, in case
+             * the fds stay ready for some other reason. Polling doesn't call
+             * into the driver, so it needs no lock.
+             */
+            polled = t->num_poll_fds && !(polled && played <= 0);
+            if (polled) {
+                int64_t deadline = mp_time_ns() + (int64_t)(period * 2e9);
+                int r;
+                do {
+                    int64_t left = deadline - mp_time_ns();
+                    pthread_mutex_unlock(&t->lock);
+                    r = poll(t->poll_fds, t->num_poll_fds,
+                             FFMAX(left / 1000000, 0) + 1);
+                    pthread_mutex_lock(&t->lock);
+                } while (r > 0 && !t->terminate && !t->paused &&
+                         !poll_ready(t) && mp_time_ns() < deadline);
+                continue;
+            }
+#endif
+            struct timespec deadline;
+            get_deadline(&deadline, period);
+            pthread_cond_timedwait(&t->wakeup, &t->lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+struct ao_thread *ao_thread_create(struct ao *ao, double buffer)
+{
+    if (ao->untimed || !ao->bps)
+        return NULL;
+    struct ao_thread *t = talloc_zero(NULL, struct ao_thread);
+    t->ao = ao;
+    t->unitsize = ao->channels * af_fmt2bits(ao->format) / 8;
+    if (t->unitsize < 1)
+        t->unitsize = 1;
+    t->size = FFMAX(buffer * ao->bps, ao->outburst);
+    t->size -= t->size % t->unitsize;
+    t->ring = talloc_size(t, t->size);
+    t->bounce = talloc_size(t, t->size);
+    t->final_pos = NO_FINAL_POS;
+#ifdef HAVE_AO_POLL
+    struct ao_poll_fds pfds = { .fds = t->poll_fds };
+    if (ao->driver->control &&
+        ao->driver->control(ao, AOCONTROL_GET_POLL_FDS, &pfds) == CONTROL_OK)
+        t->num_poll_fds = pfds.num_fds;
+#endif
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->wakeup, NULL);
+    pthread_cond_init(&t->drained, NULL);
+    if (pthread_create(&t->thread, NULL, feeder_thread, t)) {
+        mp_msg(MSGT_AO, MSGL_ERR, "[ao] Could not create audio thread.\n");
+        pthread_cond_destroy(&t->drained);
+        pthread_cond_destroy(&t->wakeup);
+        pthread_mutex_destroy(&t->lock);
+        talloc_free(t);
+        return NULL;
+    }
+    mp_msg(MSGT_AO, MSGL_V, "[ao] Feeding audio from a thread with a "
+           "%d byte buffer.\n", t->size);
+    return t;
+}
+
+void ao_thread_uninit(struct ao *ao, bool cut_audio)
+{
+    struct ao_thread *t = ao->thread;
+    pthread_mutex_lock(&t->lock);
+    if (!cut_audio && !t->paused) {
+        // Let the feeder pass the remaining audio to the driver. Give up if
+        // the driver stops accepting data.
+        struct timespec deadline;
+        int left = load_pos(&t->write_pos) - t->read_pos;
+        get_deadline(&deadline, left / (double)ao->bps + 1);
+        while (load_pos(&t->write_pos) != t->read_pos) {
+            if (pthread_cond_timedwait(&t->drained, &t->lock, &deadline)
+                == ETIMEDOUT) {
+                mp_msg(MSGT_AO, MSGL_WARN, "[ao] Audio thread did not "
+                       "drain its buffer.\n");
+                break;
+            }
+        }
+    }
+    t->terminate = true;
+    pthread_cond_signal(&t->wakeup);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->thread, NULL);
+    pthread_cond_destroy(&t->drained);
+    pthread_cond_destroy(&t->wakeup);
+    pthread_mutex_destroy(&t->lock);
+    talloc_free(t);
+    ao->thread = NULL;
+}
+
+int ao_thread_play(struct ao *ao, void *data, int len, int flags)
+{
+    struct ao_thread *t = ao->thread;
+    uint64_t wpos = t->write_pos;
+    uint64_t rpos = load_pos(&t->read_pos);
+    int space = t->size - (int)(wpos - rpos);
+    int n = FFMIN(len, space);
+    n -= n % t->unitsize;
+    if (n <= 0)
+        return 0;
+    int offset = wpos % t->size;
+    int part = FFMIN(n, t->size - offset);
+    memcpy(t->ring + offset, data, part);
+    memcpy(t->ring, (uint8_t *)data + part, n - part);
+    if ((flags & AOPLAY_FINAL_CHUNK) && n == len)
+        store_pos(&t->final_pos, wpos + n);
+    __atomic_store_n(&t->write_pos, wpos + n, __ATOMIC_SEQ_CST);
+    // Only take the lock if the feeder went to sleep on an empty ring.
+    if (__atomic_load_n(&t->waiting, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&t->lock);
+        pthread_cond_signal(&t->wakeup);
+        pthread_mutex_unlock(&t->lock);
+    }
+    return n;
+}
+
+int ao_thread_get_space(struct ao *ao)
+{
+    struct ao_thread *t = ao->thread;
+    int space = t->size - (int)(t->write_pos - load_pos(&t->read_pos));
+    return space - space % t->unitsize;
+}
+
+int ao_thread_control(struct ao *ao, enum aocontrol cmd, void *arg)
+{
+    struct ao_thread *t = ao->thread;
+    pthread_mutex_lock(&t->lock);
+    int r = ao->driver->control(ao, cmd, arg);
+    pthread_mutex_unlock(&t->lock);
+    return r;
+}
+
+void ao_thread_reset(struct ao *ao)
+{
+    struct ao_thread *t = ao->thread;
+    pthread_mutex_lock(&t->lock);
+    store_pos(&t->read_pos, t->write_pos);
+    store_pos(&t->final_pos, NO_FINAL_POS);
+    if (ao->driver->reset)
+        ao->driver->reset(ao);
+    ao_update_clock(ao, t->read_pos, false);
+    pthread_mutex_unlock(&t->lock);
+}
+
+void ao_thread_pause(struct ao *ao)
+{
+    struct ao_thread *t = ao->thread;
+    pthread_mutex_lock(&t->lock);
+    t->paused = true;
+    if (ao->driver->pause)
+        ao->driver->pause(ao);
+    ao_update_clock(ao, t->read_pos, false);
+    pthread_mutex_unlock(&t->lock);
+}
+
+void ao_thread_resume(struct ao *ao)
+{
+    struct ao_thread *t = ao->thread;
+    pthread_mutex_lock(&t->lock);
+    t->paused = false;
+    if (ao->driver->resume)
+        ao->driver->resume(ao);
+    ao_update_clock(ao, t->read_pos, true);
+    pthread_cond_signal(&t->wakeup);
+    pthread_mutex_unlock(&t->lock);
+}
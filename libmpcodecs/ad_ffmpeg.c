@@ -366,12 +366,18 @@ static int decode_new_packet(struct sh_audio *sh)
     }
 
     AVPacket pkt;
-    av_init_packet(&pkt);
-    pkt.data = start;
-    pkt.size = insize;
-    if (mpkt && mpkt->avpacket) {
-        pkt.side_data = mpkt->avpacket->side_data;
-        pkt.side_data_elems = mpkt->avpacket->side_data_elems;
+    if (mpkt && mpkt->avpacket && start == mpkt->avpacket->data
+        && insize == mpkt->avpacket->size) {
+        // whole libavformat packet, pass it on with its timestamps etc.
+        pkt = *mpkt->avpacket;
+    } else {
+        av_init_packet(&pkt);
+        pkt.data = start;
+        pkt.size = insize;
+        if (mpkt && mpkt->avpacket) {
+            pkt.side_data = mpkt->avpacket->side_data;
+            pkt.side_data_elems = mpkt->avpacket->side_data_elems;
+        }
     }
     if (pts != MP_NOPTS_VALUE && !packet_already_used) {
         sh->pts = pts;
@@ -23,6 +23,7 @@
 
 #include "config.h"
 #include "mp_msg.h"
+#include "profiler.h"
 #include "bstr.h"
 
 #include "stream/stream.h"
@@ -309,6 +310,7 @@ int init_audio_filters(sh_audio_t *sh_audio, int in_samplerate,
     // let's autoprobe it!
     if (0 != af_init(afs)) {
 	sh_audio->afilter = NULL;
+	af_uninit(afs);
 	free(afs);
 	return 0;   // failed :(
     }
@@ -347,7 +349,10 @@ static int filter_n_bytes(sh_audio_t *sh, struct bstr *outbuf, int len)
 	unsigned char *buf = sh->a_buffer + sh->a_buffer_len;
 	int minlen = len - sh->a_buffer_len;
 	int maxlen = sh->a_buffer_size - sh->a_buffer_len;
+	struct mp_prof_scope prof;
+	MP_PROF_BEGIN(&prof, "decode_audio");
 	int ret = sh->ad_driver->decode_audio(sh, buf, minlen, maxlen);
+	MP_PROF_END(&prof);
 	int format_change = sh->samplerate != old_samplerate
                             || sh->channels != old_channels
                             || sh->sample_format != old_sample_format;
@@ -25,6 +25,7 @@
 #include <unistd.h>
 
 #include "mp_msg.h"
+#include "profiler.h"
 
 #include "osdep/timer.h"
 #include "osdep/shmem.h"
@@ -467,6 +468,8 @@ void *decode_video(sh_video_t *sh_video, struct demux_packet *packet,
         }
     }
 
+    struct mp_prof_scope prof;
+    MP_PROF_BEGIN(&prof, "decode_video");
     if (sh_video->vd_driver->decode2) {
         mpi = sh_video->vd_driver->decode2(sh_video, packet, start, in_size,
                                            drop_frame, &pts);
@@ -475,6 +478,7 @@ void *decode_video(sh_video_t *sh_video, struct demux_packet *packet,
                                           drop_frame);
         pts = MP_NOPTS_VALUE;
     }
+    MP_PROF_END(&prof);
 
     //------------------------ frame decoded. --------------------
 
@@ -532,7 +536,10 @@ int filter_video(sh_video_t *sh_video, void *frame, double pts)
     unsigned int t2 = GetTimer();
     vf_instance_t *vf = sh_video->vfilter;
     // apply video filters and call the leaf vo/ve
+    struct mp_prof_scope prof;
+    MP_PROF_BEGIN_STAGE(&prof, vf->prof_stage);
     int ret = vf->put_image(vf, mpi, pts);
+    MP_PROF_END(&prof);
 
     t2 = GetTimer() - t2;
     vout_time_usage += t2 * 0.000001;
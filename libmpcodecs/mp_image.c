@@ -21,6 +21,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
 
 #include "talloc.h"
 
@@ -195,15 +201,7 @@ void mp_image_setfmt(mp_image_t* mpi,unsigned int out_fmt){
 
 static int mp_image_destructor(void *ptr)
 {
-    mp_image_t *mpi = ptr;
-
-    if(mpi->flags&MP_IMGFLAG_ALLOCATED){
-        /* because we allocate the whole image at once */
-        av_free(mpi->planes[0]);
-        if (mpi->flags & MP_IMGFLAG_RGB_PALETTE)
-            av_free(mpi->planes[1]);
-    }
-
+    mp_image_free_planes(ptr);
     return 0;
 }
 
@@ -219,3 +217,237 @@ void free_mp_image(mp_image_t* mpi){
     talloc_free(mpi);
 }
 
+/* Image buffer pools.
+ *
+ * A pool recycles plane buffers keyed on format and stored size, so a
+ * buffer freed by one filter can be picked up by the next allocation of the
+ * same geometry anywhere in the chain. Images with pool buffers are
+ * refcounted: mp_image_ref() shares them instead of copying, and the buffer
+ * goes back to the pool when the last reference is dropped. The pool itself
+ * lives until its last user and its last buffer in use are gone.
+ *
+ * Pool buffers have POOL_PAD_LINES of padding above and below each plane,
+ * so filters may read a few lines outside the image (see vf_yadif).
+ */
+
+#define POOL_PAD_LINES 4
+#define POOL_MAX_FREE 16
+
+struct pool_buffer {
+    struct mp_image_pool *pool;
+    uint8_t *data;
+    unsigned int imgfmt;
+    int width, height;
+};
+
+struct mp_image_pool {
+    int refs;           // users + buffers in use
+    struct pool_buffer **free_buffers;  // most recently used last
+    int num_free;
+};
+
+// Protects all pools and image refcounts.
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define pool_lock() pthread_mutex_lock(&pool_mutex)
+#define pool_unlock() pthread_mutex_unlock(&pool_mutex)
+#else
+#define pool_lock() ((void)0)
+#define pool_unlock() ((void)0)
+#endif
+
+struct mp_image_pool *mp_image_pool_new(void)
+{
+    struct mp_image_pool *pool = talloc_zero(NULL, struct mp_image_pool);
+    pool->refs = 1;
+    return pool;
+}
+
+struct mp_image_pool *mp_image_pool_ref(struct mp_image_pool *pool)
+{
+    pool_lock();
+    pool->refs++;
+    pool_unlock();
+    return pool;
+}
+
+static void pool_free_buffer(struct pool_buffer *buf)
+{
+    av_free(buf->data);
+    talloc_free(buf);
+}
+
+// Must be called with the pool locked. Frees the pool if this was the
+// last reference.
+static void pool_unref_locked(struct mp_image_pool *pool)
+{
+    if (--pool->refs)
+        return;
+    for (int i = 0; i < pool->num_free; i++)
+        pool_free_buffer(pool->free_buffers[i]);
+    talloc_free(pool);
+}
+
+void mp_image_pool_unref(struct mp_image_pool *pool)
+{
+    if (!pool)
+        return;
+    pool_lock();
+    pool_unref_locked(pool);
+    pool_unlock();
+}
+
+// Set strides for the pool layout of mpi and return the plane offsets
+// within the buffer and the total size.
+static size_t pool_layout(mp_image_t *mpi, size_t offsets[MP_MAX_PLANES])
+{
+    bool planar = mpi->flags & MP_IMGFLAG_PLANAR;
+    int num_planes = planar ? mpi->num_planes : 1;
+    int bytes = IMGFMT_IS_YUVP16(mpi->imgfmt) ? 2 : 1;
+    int cw = -(-mpi->width >> mpi->chroma_x_shift);
+    int ch = -(-mpi->height >> mpi->chroma_y_shift);
+    size_t size = 0;
+
+    for (int i = 0; i < num_planes; i++) {
+        bool chroma = planar && (i == 1 || i == 2);
+        int linesize;
+        if (!planar)
+            linesize = (mpi->width * mpi->bpp + 7) / 8;
+        else if (chroma && num_planes == 2) // NV12/NV21
+            linesize = 2 * cw;
+        else
+            linesize = bytes * (chroma ? cw : mpi->width);
+        int lines = (chroma ? ch : mpi->height) + 2 * POOL_PAD_LINES;
+        mpi->stride[i] = (linesize + 63) & ~63;
+        offsets[i] = size + (size_t)POOL_PAD_LINES * mpi->stride[i];
+        size += (size_t)lines * mpi->stride[i];
+    }
+    return size;
+}
+
+bool mp_image_pool_alloc_planes(struct mp_image_pool *pool, mp_image_t *mpi)
+{
+    struct pool_buffer *buf = NULL;
+    size_t offsets[MP_MAX_PLANES];
+    size_t size = pool_layout(mpi, offsets);
+    bool fresh = false;
+
+    pool_lock();
+    for (int i = pool->num_free - 1; i >= 0; i--) {
+        struct pool_buffer *b = pool->free_buffers[i];
+        if (b->imgfmt == mpi->imgfmt && b->width == mpi->width
+            && b->height == mpi->height) {
+            buf = b;
+            pool->free_buffers[i] = pool->free_buffers[--pool->num_free];
+            break;
+        }
+    }
+    pool->refs++;
+    pool_unlock();
+
+    if (!buf) {
+        buf = talloc_zero(NULL, struct pool_buffer);
+        buf->pool = pool;
+        buf->imgfmt = mpi->imgfmt;
+        buf->width = mpi->width;
+        buf->height = mpi->height;
+        buf->data = av_malloc(size);
+        if (!buf->data)
+            abort(); // out of memory, like mp_image_alloc_planes()
+        fresh = true;
+    }
+
+    int num_planes = mpi->flags & MP_IMGFLAG_PLANAR ? mpi->num_planes : 1;
+    for (int i = 0; i < MP_MAX_PLANES; i++)
+        mpi->planes[i] = i < num_planes ? buf->data + offsets[i] : NULL;
+    mpi->pool_buffer = buf;
+    mpi->refcount = 1;
+    mpi->flags |= MP_IMGFLAG_ALLOCATED;
+    return fresh;
+}
+
+void mp_image_free_planes(mp_image_t *mpi)
+{
+    struct pool_buffer *buf = mpi->pool_buffer;
+
+    if (!(mpi->flags & MP_IMGFLAG_ALLOCATED))
+        return;
+    mpi->flags &= ~MP_IMGFLAG_ALLOCATED;
+    if (!buf) {
+        /* because we allocate the whole image at once */
+        av_free(mpi->planes[0]);
+        if (mpi->flags & MP_IMGFLAG_RGB_PALETTE)
+            av_free(mpi->planes[1]);
+        return;
+    }
+
+    struct mp_image_pool *pool = buf->pool;
+    mpi->pool_buffer = NULL;
+    pool_lock();
+    if (pool->refs > 1) {
+        if (pool->num_free == POOL_MAX_FREE) {
+            pool_free_buffer(pool->free_buffers[0]);
+            memmove(pool->free_buffers, pool->free_buffers + 1,
+                    --pool->num_free * sizeof(pool->free_buffers[0]));
+        }
+        pool->free_buffers = talloc_realloc(pool, pool->free_buffers,
+                                            struct pool_buffer *,
+                                            pool->num_free + 1);
+        pool->free_buffers[pool->num_free++] = buf;
+        buf = NULL;
+    }
+    pool_unref_locked(pool);
+    pool_unlock();
+    if (buf)
+        pool_free_buffer(buf);
+}
+
+mp_image_t *mp_image_pool_get(struct mp_image_pool *pool, unsigned int fmt,
+                              int w, int h)
+{
+    mp_image_t *mpi = new_mp_image(w, h);
+    mp_image_setfmt(mpi, fmt);
+    mp_image_pool_alloc_planes(pool, mpi);
+    return mpi;
+}
+
+mp_image_t *mp_image_ref(struct mp_image_pool *pool, mp_image_t *mpi)
+{
+    pool_lock();
+    if (mpi->refcount > 0) {
+        mpi->refcount++;
+        pool_unlock();
+        return mpi;
+    }
+    pool_unlock();
+
+    mp_image_t *ref = mp_image_pool_get(pool, mpi->imgfmt, mpi->width,
+                                        mpi->height);
+    ref->w = mpi->w;
+    ref->h = mpi->h;
+    copy_mpi(ref, mpi);
+    ref->pict_type = mpi->pict_type;
+    ref->fields = mpi->fields;
+    return ref;
+}
+
+void mp_image_unref(mp_image_t *mpi)
+{
+    if (!mpi)
+        return;
+    pool_lock();
+    bool last = mpi->refcount <= 1;
+    if (!last)
+        mpi->refcount--;
+    pool_unlock();
+    if (last)
+        free_mp_image(mpi);
+}
+
+int mp_image_refcount(mp_image_t *mpi)
+{
+    pool_lock();
+    int refcount = mpi->refcount;
+    pool_unlock();
+    return refcount;
+}
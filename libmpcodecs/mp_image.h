@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include "mp_msg.h"
 
 //--------- codec's requirements (filled by the codec/vf) ---------
@@ -120,6 +121,9 @@ typedef struct mp_image {
     int usage_count;
     /* for private use by filter or vo driver (to store buffer id or dmpi) */
     void* priv;
+    /* number of references for images with pool buffers, 0 otherwise */
+    int refcount;
+    void *pool_buffer;
 } mp_image_t;
 
 void mp_image_setfmt(mp_image_t* mpi,unsigned int out_fmt);
@@ -129,5 +133,24 @@ void free_mp_image(mp_image_t* mpi);
 mp_image_t* alloc_mpi(int w, int h, unsigned long int fmt);
 void mp_image_alloc_planes(mp_image_t *mpi);
 void copy_mpi(mp_image_t *dmpi, mp_image_t *mpi);
+void mp_image_free_planes(mp_image_t *mpi);
+
+struct mp_image_pool;
+struct mp_image_pool *mp_image_pool_new(void);
+struct mp_image_pool *mp_image_pool_ref(struct mp_image_pool *pool);
+void mp_image_pool_unref(struct mp_image_pool *pool);
+// Allocate planes for mpi, which must have format and size set, from the
+// pool and make it refcounted. Returns true if the buffer is new (not
+// recycled), i.e. its contents are undefined.
+bool mp_image_pool_alloc_planes(struct mp_image_pool *pool, mp_image_t *mpi);
+// Return a new refcounted image from the pool.
+mp_image_t *mp_image_pool_get(struct mp_image_pool *pool, unsigned int fmt,
+                              int w, int h);
+// Return a reference to mpi. Refcounted images are shared, others are
+// copied into an image from the pool.
+mp_image_t *mp_image_ref(struct mp_image_pool *pool, mp_image_t *mpi);
+// Drop a reference; images that aren't refcounted are freed directly.
+void mp_image_unref(mp_image_t *mpi);
+int mp_image_refcount(mp_image_t *mpi);
 
 #endif /* MPLAYER_MP_IMAGE_H */
@@ -0,0 +1,195 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#include "talloc.h"
+#include "mp_msg.h"
+#include "osdep/numcores.h"
+#include "slice_threads.h"
+
+#define MAX_THREADS 16
+
+#ifdef HAVE_PTHREADS
+
+static int slice_start(int size, int align, int num_slices, int slice)
+{
+    if (slice >= num_slices)
+        return size;
+    return (int)((int64_t)size * slice / num_slices) / align * align;
+}
+
+struct slice_threads {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    pthread_cond_t done;
+    pthread_t threads[MAX_THREADS];
+    int num_threads;            // workers, plus the thread calling run
+    bool terminate;
+
+    // current job
+    slice_job_fn fn;
+    void *ctx;
+    int size, align;
+    int next_slice;
+    int slices_done;
+};
+
+// Run slices of the current job until none are left. Called locked.
+static void run_slices(struct slice_threads *st)
+{
+    int n = st->num_threads;
+    while (st->next_slice < n) {
+        int slice = st->next_slice++;
+        int start = slice_start(st->size, st->align, n, slice);
+        int end = slice_start(st->size, st->align, n, slice + 1);
+        pthread_mutex_unlock(&st->lock);
+        if (start < end)
+            st->fn(st->ctx, slice, start, end);
+        pthread_mutex_lock(&st->lock);
+        if (++st->slices_done == n)
+            pthread_cond_signal(&st->done);
+    }
+}
+
+static void *worker_thread(void *arg)
+{
+    struct slice_threads *st = arg;
+    pthread_mutex_lock(&st->lock);
+    while (!st->terminate) {
+        run_slices(st);
+        pthread_cond_wait(&st->wakeup, &st->lock);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return NULL;
+}
+
+struct slice_threads *slice_threads_create(int num_threads)
+{
+    if (num_threads == 0) {
+        num_threads = default_thread_count();
+        if (num_threads < 1) {
+            mp_msg(MSGT_VFILTER, MSGL_WARN, "Could not determine thread "
+                   "count to use, not using slice threads.\n");
+            return NULL;
+        }
+    }
+    if (num_threads > MAX_THREADS)
+        num_threads = MAX_THREADS;
+    if (num_threads < 2)
+        return NULL;
+
+    struct slice_threads *st = talloc_zero(NULL, struct slice_threads);
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->wakeup, NULL);
+    pthread_cond_init(&st->done, NULL);
+    // nothing to run until the first job
+    st->num_threads = num_threads;
+    st->next_slice = st->slices_done = num_threads;
+    pthread_mutex_lock(&st->lock);
+    for (int n = 1; n < num_threads; n++) {
+        if (pthread_create(&st->threads[n], NULL, worker_thread, st)) {
+            mp_msg(MSGT_VFILTER, MSGL_WARN, "Could not create slice "
+                   "thread.\n");
+            // run with the threads started so far
+            st->num_threads = st->next_slice = st->slices_done = n;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&st->lock);
+    if (st->num_threads < 2) {
+        slice_threads_destroy(st);
+        return NULL;
+    }
+    mp_msg(MSGT_VFILTER, MSGL_V, "Using %d slice threads.\n",
+           st->num_threads);
+    return st;
+}
+
+void slice_threads_destroy(struct slice_threads *st)
+{
+    if (!st)
+        return;
+    pthread_mutex_lock(&st->lock);
+    st->terminate = true;
+    pthread_cond_broadcast(&st->wakeup);
+    pthread_mutex_unlock(&st->lock);
+    for (int n = 1; n < st->num_threads; n++)
+        pthread_join(st->threads[n], NULL);
+    pthread_cond_destroy(&st->done);
+    pthread_cond_destroy(&st->wakeup);
+    pthread_mutex_destroy(&st->lock);
+    talloc_free(st);
+}
+
+int slice_threads_count(struct slice_threads *st)
+{
+    return st ? st->num_threads : 1;
+}
+
+void slice_threads_run(struct slice_threads *st, int size, int align,
+                       slice_job_fn fn, void *ctx)
+{
+    if (!st) {
+        if (size > 0)
+            fn(ctx, 0, 0, size);
+        return;
+    }
+    pthread_mutex_lock(&st->lock);
+    st->fn = fn;
+    st->ctx = ctx;
+    st->size = size;
+    st->align = align;
+    st->next_slice = st->slices_done = 0;
+    pthread_cond_broadcast(&st->wakeup);
+    run_slices(st);
+    while (st->slices_done < st->num_threads)
+        pthread_cond_wait(&st->done, &st->lock);
+    pthread_mutex_unlock(&st->lock);
+}
+
+#else /* HAVE_PTHREADS */
+
+struct slice_threads *slice_threads_create(int num_threads)
+{
+    return NULL;
+}
+
+void slice_threads_destroy(struct slice_threads *st)
+{
+}
+
+int slice_threads_count(struct slice_threads *st)
+{
+    return 1;
+}
+
+void slice_threads_run(struct slice_threads *st, int size, int align,
+                       slice_job_fn fn, void *ctx)
+{
+    if (size > 0)
+        fn(ctx, 0, 0, size);
+}
+
+#endif /* HAVE_PTHREADS */
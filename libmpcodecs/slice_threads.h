@@ -0,0 +1,51 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_SLICE_THREADS_H
+#define MPLAYER_SLICE_THREADS_H
+
+struct slice_threads;
+
+/* Thread pool for filters that can process an image in independent
+ * horizontal bands (slices).
+ *
+ * slice_threads_run() splits a range, usually the lines of a plane, into
+ * one slice per thread and calls the job function for each slice in
+ * parallel. A job may read outside its slice, e.g. the lines a filter
+ * kernel overlaps into the neighbouring slices, but must only write to
+ * its own. Jobs get the slice number, so filters can keep scratch
+ * buffers per slice; slice_threads_count() says how many are needed.
+ *
+ * A NULL pool is valid and runs jobs as a single slice on the calling
+ * thread, so filters need no separate code path when threading is off.
+ */
+
+typedef void (*slice_job_fn)(void *ctx, int slice, int start, int end);
+
+// num_threads: 0 for one thread per CPU. Returns NULL if num_threads is 1
+// or threads are not available.
+struct slice_threads *slice_threads_create(int num_threads);
+void slice_threads_destroy(struct slice_threads *st);
+
+int slice_threads_count(struct slice_threads *st);
+
+// Call fn for slices of [0, size). All slice boundaries except size are
+// multiples of align. Returns when all slices are done.
+void slice_threads_run(struct slice_threads *st, int size, int align,
+                       slice_job_fn fn, void *ctx);
+
+#endif /* MPLAYER_SLICE_THREADS_H */
@@ -73,12 +73,16 @@ typedef struct {
     int b_count;
     AVRational last_sample_aspect_ratio;
     enum AVDiscard skip_frame;
+    // decoder-side buffers for frame threading, NULL if not used
+    struct mp_image_pool *pool;
 } vd_ffmpeg_ctx;
 
 #include "m_option.h"
 
 static int get_buffer(AVCodecContext *avctx, AVFrame *pic);
 static void release_buffer(AVCodecContext *avctx, AVFrame *pic);
+static int get_pool_buffer(AVCodecContext *avctx, AVFrame *pic);
+static void release_pool_buffer(AVCodecContext *avctx, AVFrame *pic);
 static void draw_slice(struct AVCodecContext *s, const AVFrame *src,
                        int offset[4], int y, int type, int height);
 
@@ -203,12 +207,26 @@ static int init(sh_video_t *sh)
         lavc_param->threads = threads;
     }
     /* Our get_buffer and draw_horiz_band callbacks are not safe to call
-     * from other threads. */
+     * from other threads, and the VO buffers can't back all the frames the
+     * decoder threads keep referenced. Frame threads decode into refcounted
+     * images from a pool instead, which are passed on without a copy. */
     if (lavc_param->threads > 1) {
         ctx->do_dr1 = false;
         ctx->do_slices = false;
         mp_tmsg(MSGT_DECVIDEO, MSGL_V, "Asking decoder to use "
                 "%d threads if supported.\n", lavc_param->threads);
+#ifdef HAVE_PTHREADS
+        if (lavc_codec->capabilities & CODEC_CAP_DR1 && !do_vis_debug)
+            ctx->pool = mp_image_pool_new();
+#endif
+    }
+
+    if (ctx->pool) {
+        avctx->flags |= CODEC_FLAG_EMU_EDGE;
+        avctx->thread_safe_callbacks = 1;
+        avctx->get_buffer = get_pool_buffer;
+        avctx->release_buffer = release_pool_buffer;
+        avctx->reget_buffer = avcodec_default_reget_buffer;
     }
 
     if (ctx->do_dr1) {
@@ -356,6 +374,8 @@ static void uninit(sh_video_t *sh)
     }
 
     av_freep(&avctx);
+    // Images still referenced by the filter chain keep the pool alive.
+    mp_image_pool_unref(ctx->pool);
 #if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(54, 28, 0)
     avcodec_free_frame(&ctx->pic);
 #else
@@ -682,6 +702,56 @@ static void release_buffer(struct AVCodecContext *avctx, AVFrame *pic)
         pic->data[i] = NULL;
 }
 
+/* Buffers for frame-threaded decoding. These callbacks run on the decoder
+ * threads; the mp_image pool and the image refcounts are locked. lavc owns
+ * one reference until release_buffer(), filters that keep the decoded frame
+ * take their own with mp_image_ref().
+ */
+static int get_pool_buffer(AVCodecContext *avctx, AVFrame *pic)
+{
+    sh_video_t *sh = avctx->opaque;
+    vd_ffmpeg_ctx *ctx = sh->context;
+    int imgfmt = pixfmt2imgfmt(avctx->pix_fmt);
+    int width = avctx->width;
+    int height = avctx->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+
+    // The pool has no palette plane
+    if (!imgfmt || IMGFMT_IS_HWACCEL(imgfmt) || imgfmt == IMGFMT_RGB8
+        || imgfmt == IMGFMT_BGR8)
+        return avcodec_default_get_buffer(avctx, pic);
+
+    // Pool strides are 64 byte aligned, which covers linesize_align.
+    avcodec_align_dimensions2(avctx, &width, &height, linesize_align);
+    mp_image_t *mpi = mp_image_pool_get(ctx->pool, imgfmt, width, height);
+    mpi->w = avctx->width;
+    mpi->h = avctx->height;
+    mpi->chroma_width = mpi->w >> mpi->chroma_x_shift;
+    mpi->chroma_height = mpi->h >> mpi->chroma_y_shift;
+
+    for (int i = 0; i < 4; i++) {
+        pic->data[i] = mpi->planes[i];
+        pic->linesize[i] = mpi->stride[i];
+    }
+    pic->opaque = mpi;
+    pic->type = FF_BUFFER_TYPE_USER;
+    // see get_buffer()
+    pic->reordered_opaque = avctx->reordered_opaque;
+    return 0;
+}
+
+static void release_pool_buffer(AVCodecContext *avctx, AVFrame *pic)
+{
+    if (pic->type != FF_BUFFER_TYPE_USER) {
+        avcodec_default_release_buffer(avctx, pic);
+        return;
+    }
+
+    mp_image_unref(pic->opaque);
+    for (int i = 0; i < 4; i++)
+        pic->data[i] = NULL;
+}
+
 static av_unused void swap_palette(void *pal)
 {
     int i;
@@ -714,17 +784,24 @@ static struct mp_image *decode(struct sh_video *sh, struct demux_packet *packet,
     else
         avctx->skip_frame = ctx->skip_frame;
 
-    av_init_packet(&pkt);
-    pkt.data = data;
-    pkt.size = len;
+    if (packet && packet->avpacket && data == packet->avpacket->data
+        && len == packet->avpacket->size) {
+        // Pass the libavformat packet on as is, including timestamps,
+        // position and side data. The data is not copied.
+        pkt = *packet->avpacket;
+    } else {
+        av_init_packet(&pkt);
+        pkt.data = data;
+        pkt.size = len;
+        if (packet && packet->avpacket) {
+            pkt.side_data = packet->avpacket->side_data;
+            pkt.side_data_elems = packet->avpacket->side_data_elems;
+        }
+    }
     /* Some codecs (ZeroCodec, some cases of PNG) may want keyframe info
      * from demuxer. */
     if (packet && packet->keyframe)
         pkt.flags |= AV_PKT_FLAG_KEY;
-    if (packet && packet->avpacket) {
-        pkt.side_data = packet->avpacket->side_data;
-        pkt.side_data_elems = packet->avpacket->side_data_elems;
-    }
     // The avcodec opaque field stupidly supports only int64_t type
     union pts { int64_t i; double d; };
     avctx->reordered_opaque = (union pts){.d = *reordered_pts}.i;
@@ -819,6 +896,17 @@ static struct mp_image *decode(struct sh_video *sh, struct demux_packet *packet,
     if (dr1 && pic->opaque)
         mpi = (mp_image_t *)pic->opaque;
 
+    /* Pass frame-threaded pool images on as they are. The filter chain
+     * must not write to them, since the decoder threads may still use them
+     * as references. */
+    bool pooled = false;
+    if (ctx->pool && pic->type == FF_BUFFER_TYPE_USER &&
+        ((mp_image_t *)pic->opaque)->imgfmt == sh->outfmt) {
+        mpi = pic->opaque;
+        mpi->flags |= MP_IMGFLAG_PRESERVE;
+        pooled = true;
+    }
+
     if (!mpi)
         mpi = mpcodecs_get_image(sh, MP_IMGTYPE_EXPORT, MP_IMGFLAG_PRESERVE,
                                  avctx->width, avctx->height);
@@ -828,7 +916,7 @@ static struct mp_image *decode(struct sh_video *sh, struct demux_packet *packet,
         return NULL;
     }
 
-    if (!dr1) {
+    if (!dr1 && !pooled) {
         mpi->planes[0] = pic->data[0];
         mpi->planes[1] = pic->data[1];
         mpi->planes[2] = pic->data[2];
@@ -25,6 +25,7 @@
 #include "config.h"
 
 #include "mp_msg.h"
+#include "profiler.h"
 #include "m_option.h"
 #include "m_struct.h"
 
@@ -32,6 +33,7 @@
 #include "img_format.h"
 #include "mp_image.h"
 #include "vf.h"
+#include "options.h"
 #include "mpbswap.h"
 
 #include "libvo/fastmemcpy.h"
@@ -105,6 +107,7 @@ extern const vf_info_t vf_info_softskip;
 extern const vf_info_t vf_info_screenshot;
 extern const vf_info_t vf_info_ass;
 extern const vf_info_t vf_info_yadif;
+extern const vf_info_t vf_info_thread;
 extern const vf_info_t vf_info_blackframe;
 extern const vf_info_t vf_info_geq;
 extern const vf_info_t vf_info_ow;
@@ -285,6 +288,18 @@ void vf_mpi_clear(mp_image_t *mpi, int x0, int y0, int w, int h)
     }
 }
 
+/* If a filter further down kept a reference to the last TEMP image, leave
+ * the image to it and allocate a new one instead of overwriting it.
+ */
+static void release_held_temp_image(struct vf_instance *vf)
+{
+    mp_image_t *mpi = vf->imgctx.temp_images[0];
+    if (mpi && mp_image_refcount(mpi) > 1) {
+        mp_image_unref(mpi);
+        vf->imgctx.temp_images[0] = NULL;
+    }
+}
+
 mp_image_t *vf_get_image(vf_instance_t *vf, unsigned int outfmt,
                          int mp_imgtype, int mp_imgflag, int w, int h)
 {
@@ -324,12 +339,14 @@ mp_image_t *vf_get_image(vf_instance_t *vf, unsigned int outfmt,
         mpi = vf->imgctx.static_images[0];
         break;
     case MP_IMGTYPE_TEMP:
+        release_held_temp_image(vf);
         if (!vf->imgctx.temp_images[0])
             vf->imgctx.temp_images[0] = new_mp_image(w2, h);
         mpi = vf->imgctx.temp_images[0];
         break;
     case MP_IMGTYPE_IPB:
         if (!(mp_imgflag & MP_IMGFLAG_READABLE)) { // B frame:
+            release_held_temp_image(vf);
             if (!vf->imgctx.temp_images[0])
                 vf->imgctx.temp_images[0] = new_mp_image(w2, h);
             mpi = vf->imgctx.temp_images[0];
@@ -372,10 +389,10 @@ mp_image_t *vf_get_image(vf_instance_t *vf, unsigned int outfmt,
             mpi->flags &= ~MP_IMGFLAG_DRAW_CALLBACK;
         if (mpi->width != w2 || mpi->height != h) {
             if (mpi->flags & MP_IMGFLAG_ALLOCATED) {
-                if (mpi->width < w2 || mpi->height < h) {
+                if (mpi->width < w2 || mpi->height < h || mpi->refcount) {
                     // need to re-allocate buffer memory:
-                    av_free(mpi->planes[0]);
-                    mpi->flags &= ~MP_IMGFLAG_ALLOCATED;
+                    mp_image_free_planes(mpi);
+                    mpi->refcount = 0;
                     mp_msg(MSGT_VFILTER, MSGL_V,
                            "vf.c: have to REALLOCATE buffer memory :(\n");
                 }
@@ -428,8 +445,16 @@ mp_image_t *vf_get_image(vf_instance_t *vf, unsigned int outfmt,
                     }
                 }
 
-                mp_image_alloc_planes(mpi);
-                vf_mpi_clear(mpi, 0, 0, mpi->width, mpi->height);
+                // Write-only buffers come from the chain's pool, so that
+                // the next filter can keep them by reference.
+                if (mpi == vf->imgctx.temp_images[0] &&
+                        !(mpi->flags & MP_IMGFLAG_RGB_PALETTE)) {
+                    if (mp_image_pool_alloc_planes(vf->pool, mpi))
+                        vf_mpi_clear(mpi, 0, 0, mpi->width, mpi->height);
+                } else {
+                    mp_image_alloc_planes(mpi);
+                    vf_mpi_clear(mpi, 0, 0, mpi->width, mpi->height);
+                }
             }
         }
         if (mpi->flags & MP_IMGFLAG_DRAW_CALLBACK)
@@ -492,6 +517,7 @@ struct vf_instance *vf_open_plugin_noerr(struct MPOpts *opts,
     vf->opts = opts;
     vf->info = filter_list[i];
     vf->next = next;
+    vf->pool = next ? mp_image_pool_ref(next->pool) : mp_image_pool_new();
     vf->config = vf_next_config;
     vf->control = vf_next_control;
     vf->query_format = vf_default_query_format;
@@ -512,8 +538,15 @@ struct vf_instance *vf_open_plugin_noerr(struct MPOpts *opts,
     else
         args = NULL;
     *retcode = vf->info->vf_open(vf, (char *)args);
-    if (*retcode > 0)
+    if (*retcode > 0) {
+        if (mp_profiling) {
+            char stage[40];
+            snprintf(stage, sizeof(stage), "vf_%s", vf->info->name);
+            vf->prof_stage = mp_prof_get_stage(stage);
+        }
         return vf;
+    }
+    mp_image_pool_unref(vf->pool);
     free(vf);
     return NULL;
 }
@@ -655,19 +688,31 @@ void vf_queue_frame(vf_instance_t *vf, int (*func)(vf_instance_t *))
 // The queue could be kept as a simple stack/list instead avoiding the
 // looping here, but there's currently no good context variable where
 // that could be stored so this was easier to implement.
+// Filters running on pipeline threads (--vf-threads) are skipped; their
+// output is taken from the pipeline once nothing else is queued.
 
-int vf_output_queued_frame(vf_instance_t *vf)
+static int output_queued_frame(vf_instance_t *vf, bool eof)
 {
     while (1) {
         int ret;
         vf_instance_t *current;
         vf_instance_t *last = NULL;
         int (*tmp)(vf_instance_t *);
-        for (current = vf; current; current = current->next)
+        for (current = vf; current; current = current->next) {
+#ifdef HAVE_PTHREADS
+            if (current->info == &vf_info_thread)
+                current = vf_thread_skip_stages(current);
+#endif
             if (current->continue_buffered_image)
                 last = current;
-        if (!last)
+        }
+        if (!last) {
+#ifdef HAVE_PTHREADS
+            return vf_thread_output_frame(vf, eof);
+#else
             return 0;
+#endif
+        }
         tmp = last->continue_buffered_image;
         last->continue_buffered_image = NULL;
         ret = tmp(last);
@@ -676,6 +721,18 @@ int vf_output_queued_frame(vf_instance_t *vf)
     }
 }
 
+int vf_output_queued_frame(vf_instance_t *vf)
+{
+    return output_queued_frame(vf, false);
+}
+
+// Like vf_output_queued_frame(), but wait for frames still being filtered.
+// Used at EOF, when there is no new input to keep the chain going.
+int vf_flush_queued_frame(vf_instance_t *vf)
+{
+    return output_queued_frame(vf, true);
+}
+
 
 /**
  * \brief Video config() function wrapper
@@ -770,7 +827,11 @@ int vf_next_query_format(struct vf_instance *vf, unsigned int fmt)
 
 int vf_next_put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
 {
-    return vf->next->put_image(vf->next, mpi, pts);
+    struct mp_prof_scope prof;
+    MP_PROF_BEGIN_STAGE(&prof, vf->next->prof_stage);
+    int ret = vf->next->put_image(vf->next, mpi, pts);
+    MP_PROF_END(&prof);
+    return ret;
 }
 
 void vf_next_draw_slice(struct vf_instance *vf, unsigned char **src,
@@ -821,12 +882,40 @@ vf_instance_t *append_filters(vf_instance_t *last,
         // We want to add them in the 'right order'
         for (i = 0; vf_settings[i].name; i++)
             /* NOP */;
+#ifdef HAVE_PTHREADS
+        // With --vf-threads, each filter before the first one drawing the
+        // OSD gets a thread filter in front of it. The OSD filters and
+        // everything after them stay on the main thread.
+        int first_osd = 0;
+        if (opts->vf_threads) {
+            while (vf_settings[first_osd].name &&
+                   strcmp(vf_settings[first_osd].name, "ass") &&
+                   strcmp(vf_settings[first_osd].name, "expand"))
+                first_osd++;
+        }
+#endif
         for (i--; i >= 0; i--) {
+#ifdef HAVE_PTHREADS
+            if (i == first_osd - 1) {
+                vf = vf_open_thread_filter(last, true);
+                if (vf)
+                    last = vf;
+                else
+                    first_osd = 0;
+            }
+#endif
             //printf("Open filter %s\n",vf_settings[i].name);
             vf = vf_open_filter(opts, last, vf_settings[i].name,
                                 vf_settings[i].attribs);
             if (vf)
                 last = vf;
+#ifdef HAVE_PTHREADS
+            if (vf && i < first_osd) {
+                vf = vf_open_thread_filter(last, false);
+                if (vf)
+                    last = vf;
+            }
+#endif
         }
     }
     return last;
@@ -840,10 +929,12 @@ void vf_uninit_filter(vf_instance_t *vf)
         vf->uninit(vf);
     free_mp_image(vf->imgctx.static_images[0]);
     free_mp_image(vf->imgctx.static_images[1]);
-    free_mp_image(vf->imgctx.temp_images[0]);
+    // may still be referenced by another filter
+    mp_image_unref(vf->imgctx.temp_images[0]);
     free_mp_image(vf->imgctx.export_images[0]);
     for (int i = 0; i < NUM_NUMBERED_MPI; i++)
         free_mp_image(vf->imgctx.numbered_images[i]);
+    mp_image_pool_unref(vf->pool);
     free(vf);
 }
 
@@ -79,9 +79,12 @@ typedef struct vf_instance {
     struct vf_image_context imgctx;
     struct vf_format_context fmt;
     struct vf_instance *next;
+    // image buffer pool shared by all filters in the chain
+    struct mp_image_pool *pool;
     mp_image_t *dmpi;
     struct vf_priv_s *priv;
     struct MPOpts *opts;
+    struct mp_prof_stage *prof_stage; // for --perf-stats, NULL if disabled
 } vf_instance_t;
 
 typedef struct vf_seteq {
@@ -116,6 +119,7 @@ struct vf_ctrl_screenshot {
 #define VFCTRL_GET_YUV_COLORSPACE 23 // arg is struct mp_csp_details*
 #define VFCTRL_SET_RGB_COLORSPACE 24 // arg is struct mp_csp_rgb*
 #define VFCTRL_GET_RGB_COLORSPACE 25 // arg is struct mp_csp_rgb*
+#define VFCTRL_SEEK_RESET 26 // Drop frames queued in the chain
 
 // functions:
 void vf_mpi_clear(mp_image_t *mpi, int x0, int y0, int w, int h);
@@ -139,6 +143,7 @@ unsigned int vf_match_csp(vf_instance_t **vfp, const unsigned int *list,
 void vf_clone_mpi_attributes(mp_image_t *dst, mp_image_t *src);
 void vf_queue_frame(vf_instance_t *vf, int (*)(vf_instance_t *));
 int vf_output_queued_frame(vf_instance_t *vf);
+int vf_flush_queued_frame(vf_instance_t *vf);
 
 // default wrappers:
 int vf_next_config(struct vf_instance *vf,
@@ -157,6 +162,12 @@ vf_instance_t *append_filters(vf_instance_t *last,
 void vf_uninit_filter(vf_instance_t *vf);
 void vf_uninit_filter_chain(vf_instance_t *vf);
 
+// vf_thread.c
+struct vf_instance *vf_open_thread_filter(struct vf_instance *next,
+                                          bool output);
+struct vf_instance *vf_thread_skip_stages(struct vf_instance *vf);
+int vf_thread_output_frame(struct vf_instance *vf, bool eof);
+
 int vf_config_wrapper(struct vf_instance *vf,
                       int width, int height, int d_width, int d_height,
                       unsigned int flags, unsigned int outfmt);
@@ -25,9 +25,11 @@
 #include <assert.h>
 
 #include "mp_msg.h"
+#include "options.h"
 #include "img_format.h"
 #include "mp_image.h"
 #include "vf.h"
+#include "slice_threads.h"
 
 
 //===========================================================================//
@@ -40,6 +42,13 @@ typedef struct FilterParam{
 struct vf_priv_s {
 	FilterParam lumaParam;
 	FilterParam chromaParam;
+	struct slice_threads *slices;
+};
+
+struct blur_job {
+	struct vf_priv_s *p;
+	mp_image_t *mpi, *dmpi;
+	int vertical;
 };
 
 
@@ -127,9 +136,32 @@ static void vBlur(uint8_t *dst, uint8_t *src, int w, int h, int dstStride, int s
 	}
 }
 
+// Horizontal pass: slices are lines. Vertical pass (done in place on dmpi,
+// after the whole horizontal pass): slices are columns.
+static void blur_slice(void *ctx, int slice, int start, int end){
+	struct blur_job *job= ctx;
+	mp_image_t *mpi= job->mpi, *dmpi= job->dmpi;
+	int i;
+
+	for(i=0; i<3; i++){
+		FilterParam *fp= i ? &job->p->chromaParam : &job->p->lumaParam;
+		int xs= i ? mpi->chroma_x_shift : 0;
+		int ys= i ? mpi->chroma_y_shift : 0;
+
+		if(job->vertical){
+			int x0= start>>xs, x1= end>>xs;
+			vBlur(dmpi->planes[i] + x0, dmpi->planes[i] + x0, x1-x0, mpi->h>>ys,
+				dmpi->stride[i], dmpi->stride[i], fp->radius, fp->power);
+		}else{
+			int y0= start>>ys, y1= end>>ys;
+			hBlur(dmpi->planes[i] + y0*dmpi->stride[i], mpi->planes[i] + y0*mpi->stride[i],
+				mpi->w>>xs, y1-y0, dmpi->stride[i], mpi->stride[i], fp->radius, fp->power);
+		}
+	}
+}
+
 static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
-	int cw= mpi->w >> mpi->chroma_x_shift;
-	int ch= mpi->h >> mpi->chroma_y_shift;
+	struct blur_job job= { .p= vf->priv, .mpi= mpi };
 
 	mp_image_t *dmpi=vf_get_image(vf->next,mpi->imgfmt,
 		MP_IMGTYPE_TEMP, MP_IMGFLAG_ACCEPT_STRIDE | MP_IMGFLAG_READABLE,
@@ -137,23 +169,22 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 
 	assert(mpi->flags&MP_IMGFLAG_PLANAR);
 
-	hBlur(dmpi->planes[0], mpi->planes[0], mpi->w,mpi->h,
-		dmpi->stride[0], mpi->stride[0], vf->priv->lumaParam.radius, vf->priv->lumaParam.power);
-	hBlur(dmpi->planes[1], mpi->planes[1], cw,ch,
-		dmpi->stride[1], mpi->stride[1], vf->priv->chromaParam.radius, vf->priv->chromaParam.power);
-	hBlur(dmpi->planes[2], mpi->planes[2], cw,ch,
-		dmpi->stride[2], mpi->stride[2], vf->priv->chromaParam.radius, vf->priv->chromaParam.power);
-
-	vBlur(dmpi->planes[0], dmpi->planes[0], mpi->w,mpi->h,
-		dmpi->stride[0], dmpi->stride[0], vf->priv->lumaParam.radius, vf->priv->lumaParam.power);
-	vBlur(dmpi->planes[1], dmpi->planes[1], cw,ch,
-		dmpi->stride[1], dmpi->stride[1], vf->priv->chromaParam.radius, vf->priv->chromaParam.power);
-	vBlur(dmpi->planes[2], dmpi->planes[2], cw,ch,
-		dmpi->stride[2], dmpi->stride[2], vf->priv->chromaParam.radius, vf->priv->chromaParam.power);
+	job.dmpi= dmpi;
+	slice_threads_run(vf->priv->slices, mpi->h, 1<<mpi->chroma_y_shift,
+		blur_slice, &job);
+	job.vertical= 1;
+	// wide column slices, so that threads don't share cache lines
+	slice_threads_run(vf->priv->slices, mpi->w, 64, blur_slice, &job);
 
 	return vf_next_put_image(vf,dmpi, pts);
 }
 
+static void uninit(struct vf_instance *vf){
+	slice_threads_destroy(vf->priv->slices);
+	free(vf->priv);
+	vf->priv= NULL;
+}
+
 //===========================================================================//
 
 static int query_format(struct vf_instance *vf, unsigned int fmt){
@@ -178,6 +209,7 @@ static int vf_open(vf_instance_t *vf, char *args){
 	vf->put_image=put_image;
 //	vf->get_image=get_image;
 	vf->query_format=query_format;
+	vf->uninit=uninit;
 	vf->priv=malloc(sizeof(struct vf_priv_s));
 	memset(vf->priv, 0, sizeof(struct vf_priv_s));
 
@@ -199,6 +231,8 @@ static int vf_open(vf_instance_t *vf, char *args){
 	if(vf->priv->lumaParam.radius < 0) return 0;
 	if(vf->priv->chromaParam.radius < 0) return 0;
 
+	vf->priv->slices= slice_threads_create(vf->opts->vf_slice_threads);
+
 	return 1;
 }
 
@@ -46,9 +46,11 @@
 
 #include "mp_msg.h"
 #include "cpudetect.h"
+#include "options.h"
 #include "img_format.h"
 #include "mp_image.h"
 #include "vf.h"
+#include "slice_threads.h"
 #include "libvo/fastmemcpy.h"
 #include "mangle.h"
 
@@ -95,6 +97,18 @@ struct vf_priv_s { //align 16 !
     int16_t *temp;
     int bframes;
     char *non_b_qp;
+    struct slice_threads *slices;
+    struct vf_priv_s **slice_priv; // state of each slice (thresholds, temp)
+    uint8_t *discard; // in slice_priv: lines above the slice are stored here
+};
+
+struct filter_job {
+    struct vf_priv_s *p;
+    uint8_t *dst, *src;
+    int dst_stride, src_stride, stride;
+    int width, height;
+    uint8_t *qp_store;
+    int qp_stride, is_luma;
 };
 
 
@@ -403,41 +417,49 @@ static void row_fdct_mmx(DCTELEM *data,  const uint8_t *pixels,  int line_size,
 #define row_fdct_s row_fdct_mmx
 #endif // HAVE_MMX
 
-static void filter(struct vf_priv_s *p, uint8_t *dst, uint8_t *src,
-		   int dst_stride, int src_stride,
-		   int width, int height,
-		   uint8_t *qp_store, int qp_stride, int is_luma)
+// Copy source lines to p->src, with the left and right edges mirrored.
+static void copy_slice(void *ctx, int slice, int y0, int y1)
+{
+    struct filter_job *job= ctx;
+    const int stride= job->stride;
+    const int width= job->width;
+    uint8_t *p_src= job->p->src;
+    int x, y;
+
+    for(y=y0; y<y1; y++){
+        int index= 8 + 8*stride + y*stride;
+        fast_memcpy(p_src + index, job->src + y*job->src_stride, width);//this line can be avoided by using DR & user fr.buffers
+        for(x=0; x<8; x++){
+            p_src[index         - x - 1]= p_src[index +         x    ];
+            p_src[index + width + x    ]= p_src[index + width - x - 1];
+        }
+    }
+}
+
+/* Filter lines y0 to y1-1; y0 is a multiple of 8. Output lines get their
+ * values from the 8 passes below them, so a slice starts with the pass
+ * after line y0 and an empty accumulator. The lines above y0 it completes
+ * at the start are stored to p->discard instead of the image. */
+static void filter_slice(void *ctx, int slice, int y0, int y1)
 {
+    struct filter_job *job= ctx;
+    struct vf_priv_s *p= job->p->slice_priv[slice];
+    uint8_t *dst= job->dst, *qp_store= job->qp_store;
+    const int dst_stride= job->dst_stride, qp_stride= job->qp_stride;
+    const int width= job->width, height= job->height;
     int x, x0, y, es, qy, t;
-    const int stride= is_luma ? p->temp_stride : (width+16);//((width+16+15)&(~15))
+    const int stride= job->stride;
     const int step=6-p->log2_count;
-    const int qps= 3 + is_luma;
+    const int qps= 3 + job->is_luma;
     int32_t __attribute__((aligned(32))) block_align[4*8*BLOCKSZ+ 4*8*BLOCKSZ];
     DCTELEM *block= (DCTELEM *)block_align;
     DCTELEM *block3=(DCTELEM *)(block_align+4*8*BLOCKSZ);
 
     memset(block3, 0, 4*8*BLOCKSZ);
 
-    //p->src=src-src_stride*8-8;//!
-    if (!src || !dst) return; // HACK avoid crash for Y8 colourspace
-    for(y=0; y<height; y++){
-        int index= 8 + 8*stride + y*stride;
-        fast_memcpy(p->src + index, src + y*src_stride, width);//this line can be avoided by using DR & user fr.buffers
-        for(x=0; x<8; x++){
-            p->src[index         - x - 1]= p->src[index +         x    ];
-            p->src[index + width + x    ]= p->src[index + width - x - 1];
-        }
-    }
-    for(y=0; y<8; y++){
-        fast_memcpy(p->src + (      7-y)*stride, p->src + (      y+8)*stride, stride);
-        fast_memcpy(p->src + (height+8+y)*stride, p->src + (height-y+7)*stride, stride);
-    }
-    //FIXME (try edge emu)
-
-    for(y=8; y<24; y++)
-	memset(p->temp+ 8 +y*stride, 0,width*sizeof(int16_t));
+    memset(p->temp, 0, stride*3*8*sizeof(int16_t));
 
-    for(y=step; y<height+8; y+=step){    //step= 1,2
+    for(y=y0+step; y<y1+8; y+=step){    //step= 1,2
 	qy=y-4;
 	if (qy>height-1) qy=height-1;
 	if (qy<0) qy=0;
@@ -468,10 +490,12 @@ static void filter(struct vf_priv_s *p, uint8_t *dst, uint8_t *src,
 	row_idct_s(block3+0*8, p->temp + (y&15)*stride+x0+2-(y&1), stride, es>>2);
 	{const int y1=y-8+step;//l5-7  l4-6
 	    if (!(y1&7) && y1) {
-		if (y1&8) store_slice_s(dst + (y1-8)*dst_stride, p->temp+ 8 +8*stride,
-					dst_stride, stride, width, 8, 5-p->log2_count);
-		else store_slice2_s(dst + (y1-8)*dst_stride, p->temp+ 8 +0*stride,
-				    dst_stride, stride, width, 8, 5-p->log2_count);
+		uint8_t *out= y1 > y0 ? dst + (y1-8)*dst_stride : p->discard;
+		int out_stride= y1 > y0 ? dst_stride : stride;
+		if (y1&8) store_slice_s(out, p->temp+ 8 +8*stride,
+					out_stride, stride, width, 8, 5-p->log2_count);
+		else store_slice2_s(out, p->temp+ 8 +0*stride,
+				    out_stride, stride, width, 8, 5-p->log2_count);
 	    } }
     }
 
@@ -481,6 +505,45 @@ static void filter(struct vf_priv_s *p, uint8_t *dst, uint8_t *src,
 	else store_slice2_s(dst + ((y-8)&~7)*dst_stride, p->temp+ 8 +0*stride,
 			    dst_stride, stride, width, y&7, 5-p->log2_count);
     }
+
+#if HAVE_MMX
+    if(gCpuCaps.hasMMX) __asm__ volatile ("emms\n\t");
+#endif
+}
+
+static void filter(struct vf_priv_s *p, uint8_t *dst, uint8_t *src,
+		   int dst_stride, int src_stride,
+		   int width, int height,
+		   uint8_t *qp_store, int qp_stride, int is_luma)
+{
+    int y, i;
+    const int stride= is_luma ? p->temp_stride : (width+16);//((width+16+15)&(~15))
+    struct filter_job job= {
+        .p= p, .dst= dst, .src= src,
+        .dst_stride= dst_stride, .src_stride= src_stride, .stride= stride,
+        .width= width, .height= height,
+        .qp_store= qp_store, .qp_stride= qp_stride, .is_luma= is_luma,
+    };
+
+    //p->src=src-src_stride*8-8;//!
+    if (!src || !dst) return; // HACK avoid crash for Y8 colourspace
+    // The whole plane is copied before filtering, which may be in place.
+    slice_threads_run(p->slices, height, 1, copy_slice, &job);
+    for(y=0; y<8; y++){
+        fast_memcpy(p->src + (      7-y)*stride, p->src + (      y+8)*stride, stride);
+        fast_memcpy(p->src + (height+8+y)*stride, p->src + (height-y+7)*stride, stride);
+    }
+    //FIXME (try edge emu)
+
+    for(i=0; i<slice_threads_count(p->slices); i++){
+        struct vf_priv_s *s= p->slice_priv[i];
+        int16_t *temp= s->temp;
+        uint8_t *discard= s->discard;
+        *s= *p;
+        s->temp= temp;
+        s->discard= discard;
+    }
+    slice_threads_run(p->slices, height, 8, filter_slice, &job);
 }
 
 static int config(struct vf_instance *vf,
@@ -489,10 +552,18 @@ static int config(struct vf_instance *vf,
 {
     int h= (height+16+15)&(~15);
 
+    int i;
+
     vf->priv->temp_stride= (width+16+15)&(~15);
-    vf->priv->temp= (int16_t*)av_mallocz(vf->priv->temp_stride*3*8*sizeof(int16_t));
     //this can also be avoided, see above
     vf->priv->src = (uint8_t*)av_malloc(vf->priv->temp_stride*h*sizeof(uint8_t));
+    for(i=0; i<slice_threads_count(vf->priv->slices); i++){
+        struct vf_priv_s *s= vf->priv->slice_priv[i];
+        av_free(s->temp);
+        av_free(s->discard);
+        s->temp= (int16_t*)av_mallocz(vf->priv->temp_stride*3*8*sizeof(int16_t));
+        s->discard= av_malloc(vf->priv->temp_stride*8);
+    }
 
     return vf_next_config(vf,width,height,d_width,d_height,flags,outfmt);
 }
@@ -571,10 +642,17 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
 
 static void uninit(struct vf_instance *vf)
 {
+    int i;
+
     if(!vf->priv) return;
 
-    av_free(vf->priv->temp);
-    vf->priv->temp= NULL;
+    for(i=0; i<slice_threads_count(vf->priv->slices); i++){
+        av_free(vf->priv->slice_priv[i]->temp);
+        av_free(vf->priv->slice_priv[i]->discard);
+        av_free(vf->priv->slice_priv[i]);
+    }
+    free(vf->priv->slice_priv);
+    slice_threads_destroy(vf->priv->slices);
     av_free(vf->priv->src);
     vf->priv->src= NULL;
     //free(vf->priv->avctx);
@@ -671,6 +749,11 @@ static int vf_open(vf_instance_t *vf, char *args)
 
     if (vf->priv->qp) vf->priv->prev_q=vf->priv->qp, mul_thrmat_s(vf->priv, vf->priv->qp);
 
+    vf->priv->slices= slice_threads_create(vf->opts->vf_slice_threads);
+    vf->priv->slice_priv= malloc(slice_threads_count(vf->priv->slices)*sizeof(struct vf_priv_s *));
+    for(i=0; i<slice_threads_count(vf->priv->slices); i++)
+        vf->priv->slice_priv[i]= av_mallocz(sizeof(struct vf_priv_s));//assumes align 16 !
+
     return 1;
 }
 
@@ -25,9 +25,11 @@
 #include <math.h>
 
 #include "mp_msg.h"
+#include "options.h"
 #include "img_format.h"
 #include "mp_image.h"
 #include "vf.h"
+#include "slice_threads.h"
 
 #define PARAM1_DEFAULT 4.0
 #define PARAM2_DEFAULT 3.0
@@ -36,33 +38,55 @@
 //===========================================================================//
 
 struct vf_priv_s {
-        int Coefs[4][512*16];
-        unsigned int *Line;
+        int Coefs[4][512*16+1]; // LowPassMul() can index one past 512*16
+        unsigned int *Line;     // one line per slice
 	unsigned short *Frame[3];
+	unsigned int *Horiz[3]; // horizontally filtered planes, for slices
+	int LineSize;
+	struct slice_threads *slices;
+};
+
+struct denoise_job {
+	struct vf_priv_s *p;
+	mp_image_t *mpi, *dmpi;
 };
 
 
 /***************************************************************************/
 
+static void free_buffers(struct vf_priv_s *p)
+{
+	free(p->Line);
+	free(p->Frame[0]);
+	free(p->Frame[1]);
+	free(p->Frame[2]);
+	free(p->Horiz[0]);
+	free(p->Horiz[1]);
+	free(p->Horiz[2]);
+
+	p->Line     = NULL;
+	p->Frame[0] = NULL;
+	p->Frame[1] = NULL;
+	p->Frame[2] = NULL;
+	p->Horiz[0] = NULL;
+	p->Horiz[1] = NULL;
+	p->Horiz[2] = NULL;
+}
+
 static void uninit(struct vf_instance *vf)
 {
-	free(vf->priv->Line);
-	free(vf->priv->Frame[0]);
-	free(vf->priv->Frame[1]);
-	free(vf->priv->Frame[2]);
-
-	vf->priv->Line     = NULL;
-	vf->priv->Frame[0] = NULL;
-	vf->priv->Frame[1] = NULL;
-	vf->priv->Frame[2] = NULL;
+	free_buffers(vf->priv);
+	slice_threads_destroy(vf->priv->slices);
+	vf->priv->slices = NULL;
 }
 
 static int config(struct vf_instance *vf,
         int width, int height, int d_width, int d_height,
 	unsigned int flags, unsigned int outfmt){
 
-	uninit(vf);
-        vf->priv->Line = malloc(width*sizeof(int));
+	free_buffers(vf->priv);
+	vf->priv->LineSize = width;
+	vf->priv->Line = malloc(width*sizeof(int)*slice_threads_count(vf->priv->slices));
 
 	return vf_next_config(vf,width,height,d_width,d_height,flags,outfmt);
 }
@@ -78,13 +102,16 @@ static void deNoiseTemporal(
                     unsigned char *Frame,        // mpi->planes[x]
                     unsigned char *FrameDest,    // dmpi->planes[x]
                     unsigned short *FrameAnt,
-                    int W, int H, int sStride, int dStride,
+                    int W, int Y0, int Y1, int sStride, int dStride,
                     int *Temporal)
 {
     long X, Y;
     unsigned int PixelDst;
 
-    for (Y = 0; Y < H; Y++){
+    Frame += Y0*sStride;
+    FrameDest += Y0*dStride;
+    FrameAnt += Y0*W;
+    for (Y = Y0; Y < Y1; Y++){
         for (X = 0; X < W; X++){
             PixelDst = LowPassMul(FrameAnt[X]<<8, Frame[X]<<16, Temporal);
             FrameAnt[X] = ((PixelDst+0x1000007F)>>8);
@@ -136,10 +163,26 @@ static void deNoiseSpacial(
     }
 }
 
+static void InitFrameAnt(unsigned char *Frame, unsigned short **FrameAntPtr,
+                         int W, int H, int sStride)
+{
+    long X, Y;
+    unsigned short* FrameAnt;
+
+    if (*FrameAntPtr)
+        return;
+    (*FrameAntPtr)=FrameAnt=malloc(W*H*sizeof(unsigned short));
+    for (Y = 0; Y < H; Y++){
+        unsigned short* dst=&FrameAnt[Y*W];
+        unsigned char* src=Frame+Y*sStride;
+        for (X = 0; X < W; X++) dst[X]=src[X]<<8;
+    }
+}
+
 static void deNoise(unsigned char *Frame,        // mpi->planes[x]
                     unsigned char *FrameDest,    // dmpi->planes[x]
                     unsigned int *LineAnt,      // vf->priv->Line (width bytes)
-		    unsigned short **FrameAntPtr,
+		    unsigned short *FrameAnt,
                     int W, int H, int sStride, int dStride,
                     int *Horizontal, int *Vertical, int *Temporal)
 {
@@ -147,20 +190,10 @@ static void deNoise(unsigned char *Frame,        // mpi->planes[x]
     long sLineOffs = 0, dLineOffs = 0;
     unsigned int PixelAnt;
     unsigned int PixelDst;
-    unsigned short* FrameAnt=(*FrameAntPtr);
-
-    if(!FrameAnt){
-	(*FrameAntPtr)=FrameAnt=malloc(W*H*sizeof(unsigned short));
-	for (Y = 0; Y < H; Y++){
-	    unsigned short* dst=&FrameAnt[Y*W];
-	    unsigned char* src=Frame+Y*sStride;
-	    for (X = 0; X < W; X++) dst[X]=src[X]<<8;
-	}
-    }
 
     if(!Horizontal[0] && !Vertical[0]){
         deNoiseTemporal(Frame, FrameDest, FrameAnt,
-                        W, H, sStride, dStride, Temporal);
+                        W, 0, H, sStride, dStride, Temporal);
         return;
     }
     if(!Temporal[0]){
@@ -207,11 +240,121 @@ static void deNoise(unsigned char *Frame,        // mpi->planes[x]
     }
 }
 
+/* With slice threads, deNoise() is split in two passes so that every slice
+ * computes exactly what it does: the horizontal recursion only depends on
+ * the line, and the vertical and temporal ones only on the column. The
+ * first pass filters bands of lines horizontally into Horiz, the second
+ * runs the vertical and temporal filters on bands of columns.
+ */
+static void deNoiseRows(unsigned char *Frame,        // mpi->planes[x]
+                        unsigned char *FrameDest,    // dmpi->planes[x]
+                        unsigned int *Horiz,
+                        unsigned short *FrameAnt,
+                        int W, int Y0, int Y1, int sStride, int dStride,
+                        int *Horizontal, int *Vertical, int *Temporal)
+{
+    long X, Y;
+    unsigned int PixelAnt;
+
+    if(!Horizontal[0] && !Vertical[0]){
+        deNoiseTemporal(Frame, FrameDest, FrameAnt,
+                        W, Y0, Y1, sStride, dStride, Temporal);
+        return;
+    }
+
+    for (Y = Y0; Y < Y1; Y++){
+        unsigned char *Src = Frame + Y*sStride;
+        unsigned int *Dst = Horiz + Y*W;
+        Dst[0] = PixelAnt = Src[0]<<16;
+        /* deNoiseSpacial() filters the first line against its first pixel
+         * only; do the same to get identical output. */
+        if (Y == 0 && !Temporal[0]) {
+            for (X = 1; X < W; X++)
+                Dst[X] = LowPassMul(PixelAnt, Src[X]<<16, Horizontal);
+            continue;
+        }
+        for (X = 1; X < W; X++)
+            Dst[X] = PixelAnt = LowPassMul(PixelAnt, Src[X]<<16, Horizontal);
+    }
+}
+
+static void deNoiseColumns(unsigned char *FrameDest,    // dmpi->planes[x]
+                           unsigned int *LineAnt,       // indexed by X
+                           unsigned int *Horiz,
+                           unsigned short *FrameAnt,
+                           int W, int H, int X0, int X1, int dStride,
+                           int *Horizontal, int *Vertical, int *Temporal)
+{
+    long X, Y;
+    unsigned int PixelDst;
+
+    if(!Horizontal[0] && !Vertical[0])
+        return;
+
+    for (Y = 0; Y < H; Y++){
+        unsigned int *Src = Horiz + Y*W;
+        unsigned short *LinePrev = &FrameAnt[Y*W];
+        unsigned char *Dst = FrameDest + Y*dStride;
+        for (X = X0; X < X1; X++){
+            /* First line has no top neighbor */
+            LineAnt[X] = Y ? LowPassMul(LineAnt[X], Src[X], Vertical) : Src[X];
+            PixelDst = LineAnt[X];
+            if (Temporal[0]) {
+                PixelDst = LowPassMul(LinePrev[X]<<8, PixelDst, Temporal);
+                LinePrev[X] = ((PixelDst+0x1000007F)>>8);
+            }
+            Dst[X] = ((PixelDst+0x10007FFF)>>16);
+        }
+    }
+}
+
+static void deNoiseRowSlice(void *ctx, int slice, int start, int end){
+	struct denoise_job *job = ctx;
+	struct vf_priv_s *p = job->p;
+	mp_image_t *mpi = job->mpi, *dmpi = job->dmpi;
+	int cw = mpi->w >> mpi->chroma_x_shift;
+	int cs = mpi->chroma_y_shift;
+
+        deNoiseRows(mpi->planes[0], dmpi->planes[0],
+		p->Horiz[0], p->Frame[0], mpi->w, start, end,
+                mpi->stride[0], dmpi->stride[0],
+                p->Coefs[0], p->Coefs[0], p->Coefs[1]);
+        deNoiseRows(mpi->planes[1], dmpi->planes[1],
+		p->Horiz[1], p->Frame[1], cw, start >> cs, end >> cs,
+                mpi->stride[1], dmpi->stride[1],
+                p->Coefs[2], p->Coefs[2], p->Coefs[3]);
+        deNoiseRows(mpi->planes[2], dmpi->planes[2],
+		p->Horiz[2], p->Frame[2], cw, start >> cs, end >> cs,
+                mpi->stride[2], dmpi->stride[2],
+                p->Coefs[2], p->Coefs[2], p->Coefs[3]);
+}
+
+static void deNoiseColumnSlice(void *ctx, int slice, int start, int end){
+	struct denoise_job *job = ctx;
+	struct vf_priv_s *p = job->p;
+	mp_image_t *mpi = job->mpi, *dmpi = job->dmpi;
+	unsigned int *Line = p->Line + slice * p->LineSize;
+	int cw = mpi->w >> mpi->chroma_x_shift;
+	int ch = mpi->h >> mpi->chroma_y_shift;
+	int cs = mpi->chroma_x_shift;
+
+        deNoiseColumns(dmpi->planes[0], Line, p->Horiz[0], p->Frame[0],
+                mpi->w, mpi->h, start, end, dmpi->stride[0],
+                p->Coefs[0], p->Coefs[0], p->Coefs[1]);
+        deNoiseColumns(dmpi->planes[1], Line, p->Horiz[1], p->Frame[1],
+                cw, ch, start >> cs, end >> cs, dmpi->stride[1],
+                p->Coefs[2], p->Coefs[2], p->Coefs[3]);
+        deNoiseColumns(dmpi->planes[2], Line, p->Horiz[2], p->Frame[2],
+                cw, ch, start >> cs, end >> cs, dmpi->stride[2],
+                p->Coefs[2], p->Coefs[2], p->Coefs[3]);
+}
+
 
 static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 	int cw= mpi->w >> mpi->chroma_x_shift;
 	int ch= mpi->h >> mpi->chroma_y_shift;
         int W = mpi->w, H = mpi->h;
+	struct denoise_job job = { vf->priv, mpi };
 
 	mp_image_t *dmpi=vf_get_image(vf->next,mpi->imgfmt,
 		MP_IMGTYPE_TEMP, MP_IMGFLAG_ACCEPT_STRIDE,
@@ -219,24 +362,42 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
 
 	if(!dmpi) return 0;
 
-        deNoise(mpi->planes[0], dmpi->planes[0],
-		vf->priv->Line, &vf->priv->Frame[0], W, H,
-                mpi->stride[0], dmpi->stride[0],
-                vf->priv->Coefs[0],
-                vf->priv->Coefs[0],
-                vf->priv->Coefs[1]);
-        deNoise(mpi->planes[1], dmpi->planes[1],
-		vf->priv->Line, &vf->priv->Frame[1], cw, ch,
-                mpi->stride[1], dmpi->stride[1],
-                vf->priv->Coefs[2],
-                vf->priv->Coefs[2],
-                vf->priv->Coefs[3]);
-        deNoise(mpi->planes[2], dmpi->planes[2],
-		vf->priv->Line, &vf->priv->Frame[2], cw, ch,
-                mpi->stride[2], dmpi->stride[2],
-                vf->priv->Coefs[2],
-                vf->priv->Coefs[2],
-                vf->priv->Coefs[3]);
+	InitFrameAnt(mpi->planes[0], &vf->priv->Frame[0], W, H, mpi->stride[0]);
+	InitFrameAnt(mpi->planes[1], &vf->priv->Frame[1], cw, ch, mpi->stride[1]);
+	InitFrameAnt(mpi->planes[2], &vf->priv->Frame[2], cw, ch, mpi->stride[2]);
+
+	if (!vf->priv->slices) {
+            deNoise(mpi->planes[0], dmpi->planes[0],
+                    vf->priv->Line, vf->priv->Frame[0], W, H,
+                    mpi->stride[0], dmpi->stride[0],
+                    vf->priv->Coefs[0],
+                    vf->priv->Coefs[0],
+                    vf->priv->Coefs[1]);
+            deNoise(mpi->planes[1], dmpi->planes[1],
+                    vf->priv->Line, vf->priv->Frame[1], cw, ch,
+                    mpi->stride[1], dmpi->stride[1],
+                    vf->priv->Coefs[2],
+                    vf->priv->Coefs[2],
+                    vf->priv->Coefs[3]);
+            deNoise(mpi->planes[2], dmpi->planes[2],
+                    vf->priv->Line, vf->priv->Frame[2], cw, ch,
+                    mpi->stride[2], dmpi->stride[2],
+                    vf->priv->Coefs[2],
+                    vf->priv->Coefs[2],
+                    vf->priv->Coefs[3]);
+            return vf_next_put_image(vf,dmpi, pts);
+	}
+
+	for (int i = 0; i < 3; i++) {
+            int w = i ? cw : W, h = i ? ch : H;
+            if (!vf->priv->Horiz[i])
+                vf->priv->Horiz[i] = malloc(w*h*sizeof(unsigned int));
+	}
+	job.dmpi = dmpi;
+	slice_threads_run(vf->priv->slices, H, 1 << mpi->chroma_y_shift,
+			  deNoiseRowSlice, &job);
+	slice_threads_run(vf->priv->slices, W, 1 << mpi->chroma_x_shift,
+			  deNoiseColumnSlice, &job);
 
 	return vf_next_put_image(vf,dmpi, pts);
 }
@@ -358,6 +519,8 @@ static int vf_open(vf_instance_t *vf, char *args){
         PrecalcCoefs(vf->priv->Coefs[2], ChromSpac);
         PrecalcCoefs(vf->priv->Coefs[3], ChromTmp);
 
+	vf->priv->slices = slice_threads_create(vf->opts->vf_slice_threads);
+
 	return 1;
 }
 
@@ -29,12 +29,14 @@
 
 #include "mp_msg.h"
 #include "cpudetect.h"
+#include "options.h"
 
 #include "libavutil/mem.h"
 
 #include "img_format.h"
 #include "mp_image.h"
 #include "vf.h"
+#include "slice_threads.h"
 #include "libvo/fastmemcpy.h"
 
 #define XMIN(a,b) ((a) < (b) ? (a) : (b))
@@ -60,6 +62,18 @@ struct vf_priv_s {
     int mpeg2;
     int temp_stride;
     uint8_t *src;
+    uint8_t *scratch;   // DCT blocks, one set per slice
+    int scratch_size;
+    struct slice_threads *slices;
+};
+
+struct filter_job {
+    struct vf_priv_s *p;
+    uint8_t *dst, *src;
+    int dst_stride, src_stride, stride;
+    int width, height;
+    uint8_t *qp_store;
+    int qp_stride, is_luma;
 };
 #if 0
 static inline void dct7_c(DCTELEM *dst, int s0, int s1, int s2, int s3, int step){
@@ -280,29 +294,38 @@ static int softthresh_c(DCTELEM *src, int qp){
 
 static int (*requantize)(DCTELEM *src, int qp)= hardthresh_c;
 
-static void filter(struct vf_priv_s *p, uint8_t *dst, uint8_t *src, int dst_stride, int src_stride, int width, int height, uint8_t *qp_store, int qp_stride, int is_luma){
+// Copy source lines to p->src, with the left and right edges mirrored.
+static void copy_slice(void *ctx, int slice, int y0, int y1){
+    struct filter_job *job= ctx;
+    const int stride= job->stride;
+    const int width= job->width;
+    uint8_t  *p_src= job->p->src + 8*stride;
     int x, y;
-    const int stride= is_luma ? p->temp_stride : ((width+16+15)&(~15));
-    uint8_t  *p_src= p->src + 8*stride;
-    DCTELEM *block= (DCTELEM *)p->src;
-    DCTELEM *temp= (DCTELEM *)(p->src + 32);
 
-    if (!src || !dst) return; // HACK avoid crash for Y8 colourspace
-    for(y=0; y<height; y++){
+    for(y=y0; y<y1; y++){
         int index= 8 + 8*stride + y*stride;
-        fast_memcpy(p_src + index, src + y*src_stride, width);
+        fast_memcpy(p_src + index, job->src + y*job->src_stride, width);
         for(x=0; x<8; x++){
             p_src[index         - x - 1]= p_src[index +         x    ];
             p_src[index + width + x    ]= p_src[index + width - x - 1];
         }
     }
-    for(y=0; y<8; y++){
-        fast_memcpy(p_src + (       7-y)*stride, p_src + (       y+8)*stride, stride);
-        fast_memcpy(p_src + (height+8+y)*stride, p_src + (height-y+7)*stride, stride);
-    }
-    //FIXME (try edge emu)
+}
+
+static void filter_slice(void *ctx, int slice, int y0, int y1){
+    struct filter_job *job= ctx;
+    struct vf_priv_s *p= job->p;
+    const int stride= job->stride;
+    const int width= job->width, height= job->height;
+    const int is_luma= job->is_luma;
+    uint8_t  *p_src= p->src + 8*stride;
+    uint8_t *dst= job->dst;
+    int dst_stride= job->dst_stride;
+    DCTELEM *block= (DCTELEM *)(p->scratch + slice*p->scratch_size);
+    DCTELEM *temp= block + 16;
+    int x, y;
 
-    for(y=0; y<height; y++){
+    for(y=y0; y<y1; y++){
         for(x=-8; x<0; x+=4){
             const int index= x + y*stride + (8-3)*(1+stride) + 8; //FIXME silly offset
             uint8_t *src  = p_src + index;
@@ -318,7 +341,7 @@ static void filter(struct vf_priv_s *p, uint8_t *dst, uint8_t *src, int dst_stri
             if(p->qp)
                 qp= p->qp;
             else{
-                qp= qp_store[ (XMIN(x, width-1)>>qps) + (XMIN(y, height-1)>>qps) * qp_stride];
+                qp= job->qp_store[ (XMIN(x, width-1)>>qps) + (XMIN(y, height-1)>>qps) * job->qp_stride];
                 qp=norm_qscale(qp, p->mpeg2);
             }
             for(; x<end; x++){
@@ -340,6 +363,33 @@ static void filter(struct vf_priv_s *p, uint8_t *dst, uint8_t *src, int dst_stri
             }
         }
     }
+
+#if HAVE_MMX
+    if(gCpuCaps.hasMMX) __asm__ volatile ("emms\n\t");
+#endif
+}
+
+static void filter(struct vf_priv_s *p, uint8_t *dst, uint8_t *src, int dst_stride, int src_stride, int width, int height, uint8_t *qp_store, int qp_stride, int is_luma){
+    int y;
+    const int stride= is_luma ? p->temp_stride : ((width+16+15)&(~15));
+    uint8_t  *p_src= p->src + 8*stride;
+    struct filter_job job= {
+        .p= p, .dst= dst, .src= src,
+        .dst_stride= dst_stride, .src_stride= src_stride, .stride= stride,
+        .width= width, .height= height,
+        .qp_store= qp_store, .qp_stride= qp_stride, .is_luma= is_luma,
+    };
+
+    if (!src || !dst) return; // HACK avoid crash for Y8 colourspace
+    // The whole plane is copied before filtering, which may be in place.
+    slice_threads_run(p->slices, height, 1, copy_slice, &job);
+    for(y=0; y<8; y++){
+        fast_memcpy(p_src + (       7-y)*stride, p_src + (       y+8)*stride, stride);
+        fast_memcpy(p_src + (height+8+y)*stride, p_src + (height-y+7)*stride, stride);
+    }
+    //FIXME (try edge emu)
+
+    slice_threads_run(p->slices, height, 1, filter_slice, &job);
 }
 
 static int config(struct vf_instance *vf,
@@ -349,6 +399,8 @@ static int config(struct vf_instance *vf,
 
     vf->priv->temp_stride= (width+16+15)&(~15);
     vf->priv->src = av_malloc(vf->priv->temp_stride*(h+8)*sizeof(uint8_t));
+    vf->priv->scratch_size= 8*vf->priv->temp_stride + 64;
+    vf->priv->scratch= av_malloc(vf->priv->scratch_size*slice_threads_count(vf->priv->slices));
 
     return vf_next_config(vf,width,height,d_width,d_height,flags,outfmt);
 }
@@ -410,6 +462,9 @@ static void uninit(struct vf_instance *vf){
 
     av_free(vf->priv->src);
     vf->priv->src= NULL;
+    av_free(vf->priv->scratch);
+    vf->priv->scratch= NULL;
+    slice_threads_destroy(vf->priv->slices);
 
     free(vf->priv);
     vf->priv=NULL;
@@ -476,6 +531,8 @@ static int vf_open(vf_instance_t *vf, char *args){
     }
 #endif
 
+    vf->priv->slices= slice_threads_create(vf->opts->vf_slice_threads);
+
     return 1;
 }
 
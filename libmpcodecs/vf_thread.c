@@ -0,0 +1,484 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Pipelined filter chain (--vf-threads).
+ *
+ * A "thread" filter is inserted in front of each user filter. It queues
+ * the frames passed to it, and a worker thread feeds them to the filters
+ * up to the next "thread" filter, so every filter runs as a pipeline
+ * stage on its own thread. The last one, the output filter, has no
+ * worker: its frames are passed on to the rest of the chain (OSD
+ * filters, vf_vo) on the main thread by vf_output_queued_frame().
+ *
+ * Queues are bounded softly: a worker doesn't start on a frame while the
+ * next stage's queue is full, and the main thread waits for output
+ * instead of decoding more while the first queue is full. Nobody blocks
+ * with a frame in hand, so a full output queue can't deadlock the chain.
+ *
+ * config(), control() and seek resets come from the main thread. They
+ * lock each stage in chain order, which waits for the frame the stage is
+ * working on, and config() and seek resets discard queued frames. OSD
+ * requests go straight to the output filter, as filters that use the OSD
+ * are always left on the main thread.
+ *
+ * A filter on a worker thread can also call config() or control() while
+ * filtering a frame. When such a call reaches the output filter, it is
+ * queued like a frame, and made on the main thread once the frames before
+ * it were passed on. It can't return the real result: config() reports
+ * success, and only controls without argument can be queued.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "talloc.h"
+
+#include "config.h"
+#include "mp_msg.h"
+#include "profiler.h"
+
+#include "img_format.h"
+#include "mp_image.h"
+#include "vf.h"
+
+#define MAX_QUEUED_FRAMES 2
+// filters that output several frames per input can overrun the soft bound
+#define QUEUE_SIZE (MAX_QUEUED_FRAMES * 4)
+
+struct pipeline {
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    pthread_t main_thread;
+    struct vf_instance *output;
+    int refs;
+    int queued;         // frames in all queues
+    int busy;           // stages running filters
+    int generation;     // incremented on resets
+};
+
+enum frame_type {
+    FRAME_IMAGE,
+    FRAME_CONFIG,       // config() call from a worker
+    FRAME_CONTROL,      // control() call from a worker
+};
+
+struct frame {
+    enum frame_type type;
+    mp_image_t *mpi;
+    double pts;
+    // FRAME_CONFIG
+    int width, height, d_width, d_height;
+    unsigned int flags, outfmt;
+    // FRAME_CONTROL
+    int request;
+};
+
+struct vf_priv_s {
+    struct pipeline *pl;
+    bool output;
+    struct frame queue[QUEUE_SIZE];
+    int num_queued;
+    // the thread filter starting the next stage
+    struct vf_instance *next_stage;
+    pthread_mutex_t stage_lock;
+    pthread_t thread;
+    bool thread_running;
+    bool terminate;
+    // output filter: a queued config() failed, drop frames until the next
+    bool config_failed;
+};
+
+extern const vf_info_t vf_info_thread;
+
+static bool is_thread_filter(struct vf_instance *vf)
+{
+    return vf->info == &vf_info_thread;
+}
+
+static bool on_main_thread(struct pipeline *pl)
+{
+    return pthread_equal(pthread_self(), pl->main_thread);
+}
+
+static bool is_osd_request(int request)
+{
+    return request == VFCTRL_DRAW_OSD || request == VFCTRL_SET_OSD_OBJ ||
+           request == VFCTRL_INIT_EOSD || request == VFCTRL_DRAW_EOSD;
+}
+
+// All queue functions must be called with the pipeline locked.
+
+static bool queue_full(struct vf_instance *vf)
+{
+    return vf->priv->num_queued >= MAX_QUEUED_FRAMES;
+}
+
+static void queue_push(struct vf_instance *vf, struct frame f)
+{
+    struct vf_priv_s *p = vf->priv;
+    if (p->num_queued == QUEUE_SIZE) {
+        mp_msg(MSGT_VFILTER, MSGL_WARN, "[thread] Queue overflow, dropping "
+               "frame.\n");
+        if (f.mpi)
+            mp_image_unref(f.mpi);
+        return;
+    }
+    p->queue[p->num_queued++] = f;
+    p->pl->queued++;
+    pthread_cond_broadcast(&p->pl->wakeup);
+}
+
+static struct frame queue_pop(struct vf_instance *vf)
+{
+    struct vf_priv_s *p = vf->priv;
+    struct frame f = p->queue[0];
+    memmove(p->queue, p->queue + 1, --p->num_queued * sizeof(p->queue[0]));
+    p->pl->queued--;
+    pthread_cond_broadcast(&p->pl->wakeup);
+    return f;
+}
+
+// Queued config() calls are kept unless drop_config is set: the filter
+// that made them already switched to the new format.
+static void queue_clear(struct vf_instance *vf, bool drop_config)
+{
+    struct vf_priv_s *p = vf->priv;
+    int n = p->num_queued;
+    for (int i = 0; i < n; i++) {
+        struct frame f = queue_pop(vf);
+        if (f.mpi)
+            mp_image_unref(f.mpi);
+        if (f.type == FRAME_CONFIG && !drop_config)
+            queue_push(vf, f);
+    }
+}
+
+// Like vf_output_queued_frame(), for the filters of one stage.
+static void output_stage_queued_frames(struct vf_instance *vf)
+{
+    struct vf_instance *end = vf->priv->next_stage;
+    while (1) {
+        struct vf_instance *last = NULL;
+        for (struct vf_instance *cur = vf->next; cur != end; cur = cur->next)
+            if (cur->continue_buffered_image)
+                last = cur;
+        if (!last)
+            return;
+        int (*func)(struct vf_instance *) = last->continue_buffered_image;
+        last->continue_buffered_image = NULL;
+        func(last);
+    }
+}
+
+static void *stage_thread(void *arg)
+{
+    struct vf_instance *vf = arg;
+    struct vf_priv_s *p = vf->priv;
+    struct pipeline *pl = p->pl;
+
+    mp_prof_set_thread_name("vf_thread");
+    pthread_mutex_lock(&pl->lock);
+    while (!p->terminate) {
+        if (!p->num_queued || queue_full(p->next_stage)) {
+            pthread_cond_wait(&pl->wakeup, &pl->lock);
+            continue;
+        }
+        struct frame f = queue_pop(vf);
+        int generation = pl->generation;
+        pl->busy++;
+        pthread_mutex_unlock(&pl->lock);
+
+        pthread_mutex_lock(&p->stage_lock);
+        pthread_mutex_lock(&pl->lock);
+        // the frame is stale if a reset happened before we got the stage
+        bool stale = generation != pl->generation;
+        pthread_mutex_unlock(&pl->lock);
+        if (!stale) {
+            vf_next_put_image(vf, f.mpi, f.pts);
+            output_stage_queued_frames(vf);
+        }
+        pthread_mutex_unlock(&p->stage_lock);
+        mp_image_unref(f.mpi);
+
+        pthread_mutex_lock(&pl->lock);
+        pl->busy--;
+        pthread_cond_broadcast(&pl->wakeup);
+    }
+    pthread_mutex_unlock(&pl->lock);
+    return NULL;
+}
+
+static void stage_lock(struct vf_instance *vf)
+{
+    if (!vf->priv->output)
+        pthread_mutex_lock(&vf->priv->stage_lock);
+}
+
+static void stage_unlock(struct vf_instance *vf)
+{
+    if (!vf->priv->output)
+        pthread_mutex_unlock(&vf->priv->stage_lock);
+}
+
+// Discard the frames queued here, then (with this stage locked, so that
+// the worker can't add new ones) everything further down.
+static void reset(struct vf_instance *vf, bool drop_config)
+{
+    struct pipeline *pl = vf->priv->pl;
+    pthread_mutex_lock(&pl->lock);
+    pl->generation++;
+    queue_clear(vf, drop_config);
+    pthread_mutex_unlock(&pl->lock);
+}
+
+static bool from_worker(struct vf_instance *vf)
+{
+    return vf->priv->output && !on_main_thread(vf->priv->pl);
+}
+
+static void queue_call(struct vf_instance *vf, struct frame f)
+{
+    struct pipeline *pl = vf->priv->pl;
+    pthread_mutex_lock(&pl->lock);
+    queue_push(vf, f);
+    pthread_mutex_unlock(&pl->lock);
+}
+
+static int config(struct vf_instance *vf, int width, int height,
+                  int d_width, int d_height, unsigned int flags,
+                  unsigned int outfmt)
+{
+    if (from_worker(vf)) {
+        queue_call(vf, (struct frame){
+            .type = FRAME_CONFIG,
+            .width = width, .height = height,
+            .d_width = d_width, .d_height = d_height,
+            .flags = flags, .outfmt = outfmt,
+        });
+        return 1;
+    }
+    reset(vf, true);
+    vf->priv->config_failed = false;
+    stage_lock(vf);
+    int r = vf_next_config(vf, width, height, d_width, d_height, flags,
+                           outfmt);
+    stage_unlock(vf);
+    return r;
+}
+
+static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts)
+{
+    struct pipeline *pl = vf->priv->pl;
+
+    // Hardware surfaces can't be copied; run the chain synchronously.
+    if (!mpi->bpp) {
+        stage_lock(vf);
+        int r = vf_next_put_image(vf, mpi, pts);
+        if (!vf->priv->output)
+            output_stage_queued_frames(vf);
+        stage_unlock(vf);
+        return r;
+    }
+
+    mp_image_t *ref = mp_image_ref(vf->pool, mpi);
+
+    // The decoder's quantizer table won't stay valid while the frame waits.
+    if (mpi->qscale) {
+        int rows = mpi->qstride ? (mpi->h + 15) >> 4 : 1;
+        int size = (mpi->qstride ? mpi->qstride : (mpi->w + 15) >> 4) * rows;
+        ref->qscale = talloc_memdup(ref, mpi->qscale, size);
+        ref->qstride = mpi->qstride;
+        ref->qscale_type = mpi->qscale_type;
+    }
+
+    pthread_mutex_lock(&pl->lock);
+    queue_push(vf, (struct frame){FRAME_IMAGE, ref, pts});
+    pthread_mutex_unlock(&pl->lock);
+    return 0;
+}
+
+static int control(struct vf_instance *vf, int request, void *data)
+{
+    struct vf_priv_s *p = vf->priv;
+
+    if (!p->output && is_osd_request(request))
+        return vf_next_control(p->pl->output, request, data);
+    if (from_worker(vf)) {
+        // The caller's data and the result can't wait for the main thread.
+        if (data) {
+            mp_msg(MSGT_VFILTER, MSGL_WARN, "[thread] Control %d with "
+                   "argument from a filter thread not supported.\n", request);
+            return CONTROL_UNKNOWN;
+        }
+        queue_call(vf, (struct frame){.type = FRAME_CONTROL,
+                                      .request = request});
+        return CONTROL_TRUE;
+    }
+    if (request == VFCTRL_SEEK_RESET)
+        reset(vf, false);
+    stage_lock(vf);
+    int r = vf_next_control(vf, request, data);
+    stage_unlock(vf);
+    return r;
+}
+
+static void uninit(struct vf_instance *vf)
+{
+    struct vf_priv_s *p = vf->priv;
+    struct pipeline *pl = p->pl;
+
+    pthread_mutex_lock(&pl->lock);
+    p->terminate = true;
+    pthread_cond_broadcast(&pl->wakeup);
+    pthread_mutex_unlock(&pl->lock);
+    if (p->thread_running)
+        pthread_join(p->thread, NULL);
+
+    pthread_mutex_lock(&pl->lock);
+    queue_clear(vf, true);
+    bool last = --pl->refs == 0;
+    pthread_mutex_unlock(&pl->lock);
+    if (last) {
+        pthread_cond_destroy(&pl->wakeup);
+        pthread_mutex_destroy(&pl->lock);
+        talloc_free(pl);
+    }
+    if (!p->output)
+        pthread_mutex_destroy(&p->stage_lock);
+    talloc_free(p);
+}
+
+static int vf_open(vf_instance_t *vf, char *args)
+{
+    struct vf_priv_s *p = talloc_zero(NULL, struct vf_priv_s);
+    vf->priv = p;
+    vf->config = config;
+    vf->put_image = put_image;
+    vf->control = control;
+    vf->uninit = uninit;
+    p->output = args && !strcmp(args, "output");
+
+    if (p->output) {
+        struct pipeline *pl = talloc_zero(NULL, struct pipeline);
+        pthread_mutex_init(&pl->lock, NULL);
+        pthread_cond_init(&pl->wakeup, NULL);
+        pl->main_thread = pthread_self();
+        pl->output = vf;
+        pl->refs = 1;
+        p->pl = pl;
+        return 1;
+    }
+
+    for (p->next_stage = vf->next; p->next_stage;
+         p->next_stage = p->next_stage->next)
+    {
+        if (is_thread_filter(p->next_stage))
+            break;
+    }
+    if (!p->next_stage) {
+        mp_msg(MSGT_VFILTER, MSGL_ERR, "[thread] No output filter.\n");
+        talloc_free(p);
+        return 0;
+    }
+    p->pl = p->next_stage->priv->pl;
+    pthread_mutex_lock(&p->pl->lock);
+    p->pl->refs++;
+    pthread_mutex_unlock(&p->pl->lock);
+    pthread_mutex_init(&p->stage_lock, NULL);
+    if (pthread_create(&p->thread, NULL, stage_thread, vf)) {
+        mp_msg(MSGT_VFILTER, MSGL_ERR, "[thread] Could not create thread.\n");
+        uninit(vf);
+        return 0;
+    }
+    p->thread_running = true;
+    return 1;
+}
+
+const vf_info_t vf_info_thread = {
+    "run filters on a separate thread",
+    "thread",
+    "",
+    "",
+    vf_open,
+    NULL
+};
+
+struct vf_instance *vf_open_thread_filter(struct vf_instance *next,
+                                          bool output)
+{
+    static const vf_info_t *const list[] = {&vf_info_thread, NULL};
+    char *args[] = {"_oldargs_", output ? "output" : NULL, NULL};
+    return vf_open_plugin(next->opts, list, next, "thread", args);
+}
+
+// Return the filter that continues the chain on the main thread after the
+// stages started by the thread filter vf.
+struct vf_instance *vf_thread_skip_stages(struct vf_instance *vf)
+{
+    return vf->priv->pl->output;
+}
+
+int vf_thread_output_frame(struct vf_instance *vf, bool eof)
+{
+    struct vf_instance *first = vf;
+    while (first && !is_thread_filter(first))
+        first = first->next;
+    if (!first)
+        return 0;
+
+    struct pipeline *pl = first->priv->pl;
+    struct vf_instance *out = pl->output;
+    struct vf_priv_s *p = out->priv;
+    pthread_mutex_lock(&pl->lock);
+    while (1) {
+        while (!p->num_queued && (pl->busy || pl->queued)) {
+            // only wait if we'd have to feed a full pipeline otherwise
+            if (!eof && !queue_full(first))
+                break;
+            pthread_cond_wait(&pl->wakeup, &pl->lock);
+        }
+        if (!p->num_queued) {
+            pthread_mutex_unlock(&pl->lock);
+            return 0;
+        }
+        struct frame f = queue_pop(out);
+        pthread_mutex_unlock(&pl->lock);
+
+        switch (f.type) {
+        case FRAME_IMAGE: {
+            int ret = p->config_failed ? 0 :
+                      vf_next_put_image(out, f.mpi, f.pts);
+            mp_image_unref(f.mpi);
+            return ret;
+        }
+        case FRAME_CONFIG:
+            p->config_failed = !vf_next_config(out, f.width, f.height,
+                                               f.d_width, f.d_height,
+                                               f.flags, f.outfmt);
+            if (p->config_failed)
+                mp_msg(MSGT_VFILTER, MSGL_ERR, "[thread] Reconfiguring the "
+                       "output failed, dropping frames.\n");
+            break;
+        case FRAME_CONTROL:
+            vf_next_control(out, f.request, NULL);
+            break;
+        }
+        pthread_mutex_lock(&pl->lock);
+    }
+}
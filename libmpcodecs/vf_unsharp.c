@@ -27,10 +27,12 @@
 #include "config.h"
 #include "mp_msg.h"
 #include "cpudetect.h"
+#include "options.h"
 
 #include "img_format.h"
 #include "mp_image.h"
 #include "vf.h"
+#include "slice_threads.h"
 #include "libvo/fastmemcpy.h"
 #include "libavutil/common.h"
 
@@ -43,12 +45,19 @@ typedef struct FilterParam {
     int msizeX, msizeY;
     double amount;
     uint32_t *SC[MAX_MATRIX_SIZE-1];
+    int SCsize; // elements of each SC buffer used by one slice
 } FilterParam;
 
 struct vf_priv_s {
     FilterParam lumaParam;
     FilterParam chromaParam;
     unsigned int outfmt;
+    struct slice_threads *slices;
+};
+
+struct unsharp_job {
+    struct vf_priv_s *p;
+    mp_image_t *mpi, *dmpi;
 };
 
 
@@ -64,11 +73,13 @@ Originally published Boston, Nov 98
 
 */
 
-static void unsharp( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, int width, int height, FilterParam *fp ) {
+// Filter lines y0 to y1-1. The lines above and below are read as far as
+// the matrix reaches, so the result doesn't depend on the slicing.
+static void unsharp( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, int width, int height, int y0, int y1, int slice, FilterParam *fp ) {
 
-    uint32_t **SC = fp->SC;
+    uint32_t *SC[MAX_MATRIX_SIZE-1];
     uint32_t SR[MAX_MATRIX_SIZE-1], Tmp1, Tmp2;
-    uint8_t* src2 = src; // avoid gcc warning
+    uint8_t* src2;
 
     int32_t res;
     int x, y, z;
@@ -81,19 +92,23 @@ static void unsharp( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, i
     if( !fp->amount ) {
 	if( src == dst )
 	    return;
+	dst += y0*dstStride;
+	src += y0*srcStride;
 	if( dstStride == srcStride )
-	    fast_memcpy( dst, src, srcStride*height );
+	    fast_memcpy( dst, src, srcStride*(y1-y0) );
 	else
-	    for( y=0; y<height; y++, dst+=dstStride, src+=srcStride )
+	    for( y=y0; y<y1; y++, dst+=dstStride, src+=srcStride )
 		fast_memcpy( dst, src, width );
 	return;
     }
 
-    for( y=0; y<2*stepsY; y++ )
+    for( y=0; y<2*stepsY; y++ ) {
+	SC[y] = fp->SC[y] + slice*fp->SCsize;
 	memset( SC[y], 0, sizeof(SC[y][0]) * (width+2*stepsX) );
+    }
 
-    for( y=-stepsY; y<height+stepsY; y++ ) {
-	if( y < height ) src2 = src;
+    for( y=y0-stepsY; y<y1+stepsY; y++ ) {
+	src2 = src + av_clip(y, 0, height-1)*srcStride;
 	memset( SR, 0, sizeof(SR[0]) * (2*stepsX-1) );
 	for( x=-stepsX; x<width+stepsX; x++ ) {
 	    Tmp1 = x<=0 ? src2[0] : x>=width ? src2[width-1] : src2[x];
@@ -105,21 +120,26 @@ static void unsharp( uint8_t *dst, uint8_t *src, int dstStride, int srcStride, i
 		Tmp2 = SC[z+0][x+stepsX] + Tmp1; SC[z+0][x+stepsX] = Tmp1;
 		Tmp1 = SC[z+1][x+stepsX] + Tmp2; SC[z+1][x+stepsX] = Tmp2;
 	    }
-	    if( x>=stepsX && y>=stepsY ) {
-		uint8_t* srx = src - stepsY*srcStride + x - stepsX;
-		uint8_t* dsx = dst - stepsY*dstStride + x - stepsX;
+	    if( x>=stepsX && y>=y0+stepsY ) {
+		uint8_t* srx = src + (y-stepsY)*srcStride + x - stepsX;
+		uint8_t* dsx = dst + (y-stepsY)*dstStride + x - stepsX;
 
 		res = (int32_t)*srx + ( ( ( (int32_t)*srx - (int32_t)((Tmp1+halfscale) >> scalebits) ) * amount ) >> 16 );
 		*dsx = res>255 ? 255 : res<0 ? 0 : (uint8_t)res;
 	    }
 	}
-	if( y >= 0 ) {
-	    dst += dstStride;
-	    src += srcStride;
-	}
     }
 }
 
+static void unsharp_slice( void *ctx, int slice, int start, int end ) {
+    struct unsharp_job *job = ctx;
+    mp_image_t *mpi = job->mpi, *dmpi = job->dmpi;
+
+    unsharp( dmpi->planes[0], mpi->planes[0], dmpi->stride[0], mpi->stride[0], mpi->w,   mpi->h,   start,   end,   slice, &job->p->lumaParam );
+    unsharp( dmpi->planes[1], mpi->planes[1], dmpi->stride[1], mpi->stride[1], mpi->w/2, mpi->h/2, start/2, end/2, slice, &job->p->chromaParam );
+    unsharp( dmpi->planes[2], mpi->planes[2], dmpi->stride[2], mpi->stride[2], mpi->w/2, mpi->h/2, start/2, end/2, slice, &job->p->chromaParam );
+}
+
 //===========================================================================//
 
 static int config( struct vf_instance *vf,
@@ -138,8 +158,9 @@ static int config( struct vf_instance *vf,
     memset( fp->SC, 0, sizeof( fp->SC ) );
     stepsX = fp->msizeX/2;
     stepsY = fp->msizeY/2;
+    fp->SCsize = width+2*stepsX;
     for( z=0; z<2*stepsY; z++ )
-	fp->SC[z] = av_malloc(sizeof(*(fp->SC[z])) * (width+2*stepsX));
+	fp->SC[z] = av_malloc(sizeof(*(fp->SC[z])) * fp->SCsize * slice_threads_count(vf->priv->slices));
 
     fp = &vf->priv->chromaParam;
     effect = fp->amount == 0 ? "don't touch" : fp->amount < 0 ? "blur" : "sharpen";
@@ -147,8 +168,9 @@ static int config( struct vf_instance *vf,
     memset( fp->SC, 0, sizeof( fp->SC ) );
     stepsX = fp->msizeX/2;
     stepsY = fp->msizeY/2;
+    fp->SCsize = width+2*stepsX;
     for( z=0; z<2*stepsY; z++ )
-	fp->SC[z] = av_malloc(sizeof(*(fp->SC[z])) * (width+2*stepsX));
+	fp->SC[z] = av_malloc(sizeof(*(fp->SC[z])) * fp->SCsize * slice_threads_count(vf->priv->slices));
 
     return vf_next_config( vf, width, height, d_width, d_height, flags, outfmt );
 }
@@ -160,6 +182,8 @@ static void get_image( struct vf_instance *vf, mp_image_t *mpi ) {
 	return; // don't change
     if( mpi->imgfmt!=vf->priv->outfmt )
 	return; // colorspace differ
+    if( vf->priv->slices )
+	return; // in place, slices would overwrite lines other slices read
 
     vf->dmpi = vf_get_image( vf->next, mpi->imgfmt, mpi->type, mpi->flags, mpi->w, mpi->h );
     mpi->planes[0] = vf->dmpi->planes[0];
@@ -176,15 +200,17 @@ static void get_image( struct vf_instance *vf, mp_image_t *mpi ) {
 
 static int put_image( struct vf_instance *vf, mp_image_t *mpi, double pts) {
     mp_image_t *dmpi;
+    struct unsharp_job job;
 
     if( !(mpi->flags & MP_IMGFLAG_DIRECT) )
 	// no DR, so get a new image! hope we'll get DR buffer:
 	vf->dmpi = vf_get_image( vf->next,vf->priv->outfmt, MP_IMGTYPE_TEMP, MP_IMGFLAG_ACCEPT_STRIDE, mpi->w, mpi->h);
     dmpi= vf->dmpi;
 
-    unsharp( dmpi->planes[0], mpi->planes[0], dmpi->stride[0], mpi->stride[0], mpi->w,   mpi->h,   &vf->priv->lumaParam );
-    unsharp( dmpi->planes[1], mpi->planes[1], dmpi->stride[1], mpi->stride[1], mpi->w/2, mpi->h/2, &vf->priv->chromaParam );
-    unsharp( dmpi->planes[2], mpi->planes[2], dmpi->stride[2], mpi->stride[2], mpi->w/2, mpi->h/2, &vf->priv->chromaParam );
+    job.p = vf->priv;
+    job.mpi = mpi;
+    job.dmpi = dmpi;
+    slice_threads_run( vf->priv->slices, mpi->h, 2, unsharp_slice, &job );
 
     vf_clone_mpi_attributes(dmpi, mpi);
 
@@ -217,6 +243,7 @@ static void uninit( struct vf_instance *vf ) {
 	fp->SC[z] = NULL;
     }
 
+    slice_threads_destroy( vf->priv->slices );
     free( vf->priv );
     vf->priv = NULL;
 }
@@ -305,6 +332,8 @@ static int vf_open( vf_instance_t *vf, char *args ) {
         return 0; // no csp match :(
     }
 
+    vf->priv->slices = slice_threads_create( vf->opts->vf_slice_threads );
+
     return 1;
 }
 
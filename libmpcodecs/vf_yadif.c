@@ -45,23 +45,37 @@ struct vf_priv_s {
     double buffered_pts;
     double buffered_pts_delta;
     mp_image_t *buffered_mpi;
-    int stride[3];
-    uint8_t *ref[4][3];
+    mp_image_t *ref[3];
     int do_deinterlace;
 };
 
 static void (*filter_line)(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint8_t *cur, uint8_t *next, int w, int refs, int parity);
 
-static void store_ref(struct vf_priv_s *p, uint8_t *src[3], int src_stride[3], int width, int height){
+static void store_ref(struct vf_instance *vf, mp_image_t *mpi){
+    struct vf_priv_s *p = vf->priv;
+    mp_image_t *ref = mp_image_ref(vf->pool, mpi);
     int i;
 
-    memcpy (p->ref[3], p->ref[0], sizeof(uint8_t *)*3);
-    memmove(p->ref[0], p->ref[1], sizeof(uint8_t *)*3*3);
+    mp_image_unref(p->ref[0]);
+    p->ref[0] = p->ref[1];
+    p->ref[1] = p->ref[2];
+    p->ref[2] = ref;
+
+    // filter() needs the same strides for all references; substitute the
+    // current frame for missing or mismatching ones
+    for(i=0; i<2; i++){
+        if(!p->ref[i] || memcmp(p->ref[i]->stride, ref->stride, sizeof(ref->stride))){
+            mp_image_unref(p->ref[i]);
+            p->ref[i] = mp_image_ref(vf->pool, ref);
+        }
+    }
+}
 
+static void release_refs(struct vf_priv_s *p){
+    int i;
     for(i=0; i<3; i++){
-        int is_chroma= !!i;
-
-        memcpy_pic(p->ref[2][i], src[i], width>>is_chroma, height>>is_chroma, p->stride[i], src_stride[i]);
+        mp_image_unref(p->ref[i]);
+        p->ref[i] = NULL;
     }
 }
 
@@ -342,21 +356,21 @@ static void filter_line_c(struct vf_priv_s *p, uint8_t *dst, uint8_t *prev, uint
 static void filter(struct vf_priv_s *p, uint8_t *dst[3], int dst_stride[3], int width, int height, int parity, int tff){
     int y, i;
 
-    for(i=0; i<3; i++){
+    for(i=0; i<3 && p->ref[1]->planes[i]; i++){
         int is_chroma= !!i;
         int w= width >>is_chroma;
         int h= height>>is_chroma;
-        int refs= p->stride[i];
+        int refs= p->ref[1]->stride[i];
 
         for(y=0; y<h; y++){
             if((y ^ parity) & 1){
-                uint8_t *prev= &p->ref[0][i][y*refs];
-                uint8_t *cur = &p->ref[1][i][y*refs];
-                uint8_t *next= &p->ref[2][i][y*refs];
+                uint8_t *prev= &p->ref[0]->planes[i][y*refs];
+                uint8_t *cur = &p->ref[1]->planes[i][y*refs];
+                uint8_t *next= &p->ref[2]->planes[i][y*refs];
                 uint8_t *dst2= &dst[i][y*dst_stride[i]];
                 filter_line(p, dst2, prev, cur, next, w, refs, parity ^ tff);
             }else{
-                fast_memcpy(&dst[i][y*dst_stride[i]], &p->ref[1][i][y*refs], w);
+                fast_memcpy(&dst[i][y*dst_stride[i]], &p->ref[1]->planes[i][y*refs], w);
             }
         }
     }
@@ -368,17 +382,7 @@ static void filter(struct vf_priv_s *p, uint8_t *dst[3], int dst_stride[3], int
 static int config(struct vf_instance *vf,
         int width, int height, int d_width, int d_height,
 	unsigned int flags, unsigned int outfmt){
-        int i, j;
-
-        for(i=0; i<3; i++){
-            int is_chroma= !!i;
-            int w= ((width   + 31) & (~31))>>is_chroma;
-            int h= ((height+6+ 31) & (~31))>>is_chroma;
-
-            vf->priv->stride[i]= w;
-            for(j=0; j<3; j++)
-                vf->priv->ref[j][i]= (char *)malloc(w*h*sizeof(uint8_t))+3*w;
-        }
+        release_refs(vf->priv);
 
 	return vf_next_config(vf,width,height,d_width,d_height,flags,outfmt);
 }
@@ -396,7 +400,7 @@ static int put_image(struct vf_instance *vf, mp_image_t *mpi, double pts){
     }
     else tff = (vf->priv->parity&1)^1;
 
-    store_ref(vf->priv, mpi->planes, mpi->stride, mpi->w, mpi->h);
+    store_ref(vf, mpi);
 
     {
         double delta;
@@ -451,14 +455,9 @@ static int continue_buffered_image(struct vf_instance *vf)
 }
 
 static void uninit(struct vf_instance *vf){
-    int i;
     if(!vf->priv) return;
 
-    for(i=0; i<3*3; i++){
-        uint8_t **p= &vf->priv->ref[i%3][i/3];
-        if(*p) free(*p - 3*vf->priv->stride[i/3]);
-        *p= NULL;
-    }
+    release_refs(vf->priv);
     free(vf->priv);
     vf->priv=NULL;
 }
@@ -27,13 +27,17 @@
 #include <inttypes.h>
 #include <stdbool.h>
 
+#include "config.h"
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 #include <libavutil/common.h>
 #include <libavutil/lzo.h>
 #include <libavutil/intreadwrite.h>
 #include <libavutil/avstring.h>
 
-#include "config.h"
-
 #if CONFIG_ZLIB
 #include <zlib.h>
 #endif
@@ -45,6 +49,7 @@
 #include "demuxer.h"
 #include "stheader.h"
 #include "ebml.h"
+#include "keyframe_index.h"
 #include "matroska.h"
 #include "demux_real.h"
 
@@ -161,8 +166,10 @@ typedef struct mkv_demuxer {
     uint64_t cluster_size;
     uint64_t blockgroup_size;
 
+    // cues sorted by track and timecode
     mkv_index_t *indexes;
     int num_indexes;
+    struct cue_reader *cue_reader;
 
     off_t *parsed_pos;
     int num_parsed_pos;
@@ -172,6 +179,10 @@ typedef struct mkv_demuxer {
     bool parsed_chapters;
     bool parsed_attachments;
 
+    // cluster positions found while playing, if there are no cues
+    struct kf_index *cluster_index;
+    // the same as a plain list, used if the keyframe index disabled itself
+    // because the cluster timecodes are not monotonic
     struct cluster_pos {
         uint64_t filepos;
         uint64_t timecode;
@@ -239,9 +250,11 @@ static mkv_track_t *find_track_by_num(struct mkv_demuxer *d, int n, int type)
 static void add_cluster_position(mkv_demuxer_t *mkv_d, uint64_t filepos,
                                  uint64_t timecode)
 {
-    if (mkv_d->indexes)
+    if (mkv_d->indexes || mkv_d->cue_reader)
         return;
 
+    kf_index_add(mkv_d->cluster_index, timecode / 1e9, filepos);
+
     int n = mkv_d->num_cluster_pos;
     if (n > 0 && mkv_d->cluster_positions[n-1].filepos >= filepos)
         return;
@@ -705,16 +718,20 @@ static int demux_mkv_read_tracks(demuxer_t *demuxer)
     return 0;
 }
 
-static int demux_mkv_read_cues(demuxer_t *demuxer)
+static int compare_cues(const void *a, const void *b)
 {
-    mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
-    stream_t *s = demuxer->stream;
-
-    if (index_mode == 0 || index_mode == 2) {
-        ebml_read_skip(s, NULL);
-        return 0;
-    }
+    const mkv_index_t *ia = a, *ib = b;
+    if (ia->tnum != ib->tnum)
+        return ia->tnum < ib->tnum ? -1 : 1;
+    if (ia->timecode != ib->timecode)
+        return ia->timecode < ib->timecode ? -1 : 1;
+    return ia->filepos < ib->filepos ? -1 : ia->filepos > ib->filepos;
+}
 
+// Parse a Cues element and append its entries to *indexes.
+static int read_cues(stream_t *s, off_t segment_start, mkv_index_t **indexes,
+                     int *num_indexes)
+{
     mp_msg(MSGT_DEMUX, MSGL_V, "[mkv] /---- [ parsing cues ] -----------\n");
     struct ebml_cues cues = {};
     struct ebml_parse_ctx parse_ctx = {};
@@ -732,18 +749,15 @@ static int demux_mkv_read_cues(demuxer_t *demuxer)
                 &cuepoint->cue_track_positions[i];
             uint64_t track = trackpos->cue_track;
             uint64_t pos = trackpos->cue_cluster_position;
-            mkv_d->indexes =
-                grow_array(mkv_d->indexes, mkv_d->num_indexes,
-                           sizeof(mkv_index_t));
-            mkv_d->indexes[mkv_d->num_indexes].tnum = track;
-            mkv_d->indexes[mkv_d->num_indexes].timecode = time;
-            mkv_d->indexes[mkv_d->num_indexes].filepos =
-                mkv_d->segment_start + pos;
+            *indexes = grow_array(*indexes, *num_indexes, sizeof(mkv_index_t));
+            (*indexes)[*num_indexes].tnum = track;
+            (*indexes)[*num_indexes].timecode = time;
+            (*indexes)[*num_indexes].filepos = segment_start + pos;
             mp_msg(MSGT_DEMUX, MSGL_DBG2,
                    "[mkv] |+ found cue point for track %" PRIu64
                    ": timecode %" PRIu64 ", filepos: %" PRIu64 "\n", track,
-                   time, mkv_d->segment_start + pos);
-            mkv_d->num_indexes++;
+                   time, segment_start + pos);
+            (*num_indexes)++;
         }
     }
 
@@ -752,6 +766,107 @@ static int demux_mkv_read_cues(demuxer_t *demuxer)
     return 0;
 }
 
+static int demux_mkv_read_cues(demuxer_t *demuxer)
+{
+    mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
+    stream_t *s = demuxer->stream;
+
+    if (index_mode == 0 || index_mode == 2) {
+        ebml_read_skip(s, NULL);
+        return 0;
+    }
+
+    int res = read_cues(s, mkv_d->segment_start, &mkv_d->indexes,
+                        &mkv_d->num_indexes);
+    qsort(mkv_d->indexes, mkv_d->num_indexes, sizeof(mkv_index_t),
+          compare_cues);
+    return res;
+}
+
+#ifdef HAVE_PTHREADS
+
+/* Cues referenced from the SeekHead are usually at the end of the file, and
+ * can be several MB large. They are read by a thread with a stream of its
+ * own, so that opening the file doesn't wait for them. The first seek (or
+ * closing the file) waits for the thread and takes over the cues.
+ */
+struct cue_reader {
+    pthread_t thread;
+    stream_t *s;
+    off_t pos;
+    off_t segment_start;
+    mkv_index_t *indexes;
+    int num_indexes;
+};
+
+static void *cue_reader_thread(void *arg)
+{
+    struct cue_reader *r = arg;
+    if (stream_seek(r->s, r->pos) &&
+        ebml_read_id(r->s, NULL) == MATROSKA_ID_CUES)
+        read_cues(r->s, r->segment_start, &r->indexes, &r->num_indexes);
+    else
+        mp_msg(MSGT_DEMUX, MSGL_WARN, "[mkv] Cues not found at position "
+               "given in SeekHead\n");
+    return NULL;
+}
+
+static bool start_cue_reader(struct demuxer *demuxer, off_t pos)
+{
+    struct mkv_demuxer *mkv_d = demuxer->priv;
+    stream_t *s = demuxer->stream;
+
+    if (mkv_d->cue_reader || s->type != STREAMTYPE_FILE || !s->url)
+        return false;
+    struct cue_reader *r = talloc_zero(mkv_d, struct cue_reader);
+    r->s = open_stream(s->url, demuxer->opts, NULL);
+    if (!r->s) {
+        talloc_free(r);
+        return false;
+    }
+    r->pos = pos;
+    r->segment_start = mkv_d->segment_start;
+    if (pthread_create(&r->thread, NULL, cue_reader_thread, r)) {
+        free_stream(r->s);
+        talloc_free(r);
+        return false;
+    }
+    mkv_d->cue_reader = r;
+    mp_msg(MSGT_DEMUX, MSGL_V, "[mkv] |+ reading cues in the background\n");
+    return true;
+}
+
+static void join_cue_reader(struct mkv_demuxer *mkv_d)
+{
+    struct cue_reader *r = mkv_d->cue_reader;
+    if (!r)
+        return;
+    pthread_join(r->thread, NULL);
+    free_stream(r->s);
+    if (r->num_indexes) {
+        int num = mkv_d->num_indexes + r->num_indexes;
+        mkv_d->indexes = realloc(mkv_d->indexes, num * sizeof(mkv_index_t));
+        memcpy(mkv_d->indexes + mkv_d->num_indexes, r->indexes,
+               r->num_indexes * sizeof(mkv_index_t));
+        mkv_d->num_indexes = num;
+        qsort(mkv_d->indexes, num, sizeof(mkv_index_t), compare_cues);
+    }
+    free(r->indexes);
+    mkv_d->cue_reader = NULL;
+    talloc_free(r);
+}
+
+#else /* HAVE_PTHREADS */
+
+static bool start_cue_reader(struct demuxer *demuxer, off_t pos)
+{
+    return false;
+}
+
+static void join_cue_reader(struct mkv_demuxer *mkv_d) {}
+
+#endif /* HAVE_PTHREADS */
+
 static int demux_mkv_read_chapters(struct demuxer *demuxer)
 {
     struct MPOpts *opts = demuxer->opts;
@@ -1020,6 +1135,9 @@ static int read_header_element(struct demuxer *demuxer, uint32_t id,
     case MATROSKA_ID_CUES:
         if (is_parsed_header(mkv_d, pos))
             break;
+        if (at_filepos && index_mode != 0 && index_mode != 2
+            && start_cue_reader(demuxer, at_filepos))
+            break;
         if (at_filepos && !seek_pos_id(s, at_filepos, id))
             return -1;
         return demux_mkv_read_cues(demuxer);
@@ -1615,9 +1733,11 @@ static void mkv_free(struct demuxer *demuxer)
     struct mkv_demuxer *mkv_d = demuxer->priv;
     if (!mkv_d)
         return;
+    join_cue_reader(mkv_d);
     for (int i = 0; i < mkv_d->num_tracks; i++)
         demux_mkv_free_trackentry(mkv_d->tracks[i]);
     free(mkv_d->indexes);
+    kf_index_close(mkv_d->cluster_index);
     free(mkv_d->cluster_positions);
 }
 
@@ -1677,6 +1797,7 @@ static int demux_mkv_open(demuxer_t *demuxer)
     demuxer->priv = mkv_d;
     mkv_d->tc_scale = 1000000;
     mkv_d->segment_start = stream_tell(s);
+    mkv_d->cluster_index = kf_index_open(demuxer, 0);
 
     while (1) {
         uint32_t id = ebml_read_id(s, NULL);
@@ -1975,11 +2096,13 @@ static void handle_realaudio(demuxer_t *demuxer, mkv_track_t *track,
     }
 }
 
-static int handle_block(demuxer_t *demuxer, uint8_t *block, uint64_t length,
+static int handle_block(demuxer_t *demuxer, demux_packet_t *block_dp,
                         uint64_t block_duration, bool keyframe,
                         bool simpleblock)
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
+    uint8_t *block = block_dp->buffer;
+    uint64_t length = block_dp->len;
     mkv_track_t *track = NULL;
     demux_stream_t *ds = NULL;
     uint64_t old_length;
@@ -2074,10 +2197,19 @@ static int handle_block(demuxer_t *demuxer, uint8_t *block, uint64_t length,
                 uint8_t *buffer;
                 demux_mkv_decode(track, block, &buffer, &size, 1);
                 if (buffer) {
-                    dp = new_demux_packet(size);
-                    memcpy(dp->buffer, buffer, size);
-                    if (buffer != block)
-                        talloc_free(buffer);
+                    if (buffer == block
+                        && block + size == block_dp->buffer + block_dp->len) {
+                        /* The last lace is followed by the padding of the
+                         * block, so it can reference the block data. */
+                        dp = clone_demux_packet(block_dp);
+                        dp->buffer = block;
+                        dp->len = size;
+                    } else {
+                        dp = new_demux_packet(size);
+                        memcpy(dp->buffer, buffer, size);
+                        if (buffer != block)
+                            talloc_free(buffer);
+                    }
                     dp->keyframe = keyframe;
                     /* If default_duration is 0, assume no pts value is known
                      * for packets after the first one (rather than all pts
@@ -2106,6 +2238,25 @@ static int handle_block(demuxer_t *demuxer, uint8_t *block, uint64_t length,
     return 0;
 }
 
+/* Blocks are read into a demux packet, so that packets for their frames can
+ * reference the data instead of copying it. */
+static demux_packet_t *read_block(demuxer_t *demuxer, uint64_t length)
+{
+    demux_packet_t *block = new_demux_packet(length);
+    demuxer->filepos = stream_tell(demuxer->stream);
+    if (stream_read(demuxer->stream, block->buffer, length) != (int) length) {
+        free_demux_packet(block);
+        return NULL;
+    }
+    return block;
+}
+
+static void free_block(demux_packet_t *block)
+{
+    if (block)
+        free_demux_packet(block);
+}
+
 static int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
 {
     mkv_demuxer_t *mkv_d = (mkv_demuxer_t *) demuxer->priv;
@@ -2117,14 +2268,14 @@ static int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
         while (mkv_d->cluster_size > 0) {
             uint64_t block_duration = 0, block_length = 0;
             bool keyframe = true;
-            uint8_t *block = NULL;
+            demux_packet_t *block = NULL;
 
             while (mkv_d->blockgroup_size > 0) {
                 switch (ebml_read_id(s, &il)) {
                 case MATROSKA_ID_BLOCKDURATION:
                     block_duration = ebml_read_uint(s, &l);
                     if (block_duration == EBML_UINT_INVALID) {
-                        free(block);
+                        free_block(block);
                         return 0;
                     }
                     block_duration *= mkv_d->tc_scale;
@@ -2132,23 +2283,20 @@ static int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
 
                 case MATROSKA_ID_BLOCK:
                     block_length = ebml_read_length(s, &tmp);
-                    free(block);
+                    free_block(block);
+                    block = NULL;
                     if (block_length > 500000000)
                         return 0;
-                    block = malloc(block_length + AV_LZO_INPUT_PADDING);
-                    demuxer->filepos = stream_tell(s);
-                    if (stream_read(s, block, block_length) !=
-                        (int) block_length) {
-                        free(block);
+                    block = read_block(demuxer, block_length);
+                    if (!block)
                         return 0;
-                    }
                     l = tmp + block_length;
                     break;
 
                 case MATROSKA_ID_REFERENCEBLOCK:;
                     int64_t num = ebml_read_int(s, &l);
                     if (num == EBML_INT_INVALID) {
-                        free(block);
+                        free_block(block);
                         return 0;
                     }
                     if (num)
@@ -2156,7 +2304,7 @@ static int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
                     break;
 
                 case EBML_ID_INVALID:
-                    free(block);
+                    free_block(block);
                     return 0;
 
                 default:
@@ -2168,9 +2316,9 @@ static int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
             }
 
             if (block) {
-                int res = handle_block(demuxer, block, block_length,
-                                       block_duration, keyframe, false);
-                free(block);
+                int res = handle_block(demuxer, block, block_duration,
+                                       keyframe, false);
+                free_demux_packet(block);
                 if (res < 0)
                     return 0;
                 if (res)
@@ -2198,17 +2346,13 @@ static int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
                     block_length = ebml_read_length(s, &tmp);
                     if (block_length > 500000000)
                         return 0;
-                    block = malloc(block_length);
-                    demuxer->filepos = stream_tell(s);
-                    if (stream_read(s, block, block_length) !=
-                        (int) block_length) {
-                        free(block);
+                    block = read_block(demuxer, block_length);
+                    if (!block)
                         return 0;
-                    }
                     l = tmp + block_length;
-                    res = handle_block(demuxer, block, block_length,
-                                       block_duration, false, true);
-                    free(block);
+                    res = handle_block(demuxer, block, block_duration,
+                                       false, true);
+                    free_demux_packet(block);
                     mkv_d->cluster_size -= l + il;
                     if (res < 0)
                         return 0;
@@ -2241,6 +2385,43 @@ static int demux_mkv_fill_buffer(demuxer_t *demuxer, demux_stream_t *ds)
     return 0;
 }
 
+/* Let's find the nearest cluster before the target with SEEK_BACKWARD, else
+ * the nearest one in either direction. Returns -1 if no cluster is known.
+ */
+static int64_t find_cluster(struct mkv_demuxer *mkv_d, int64_t target_tc_ns,
+                            int flags)
+{
+    bool exact;
+    double target = target_tc_ns / 1e9;
+    const struct kf_index_entry *before =
+        kf_index_find(mkv_d->cluster_index, target, SEEK_BACKWARD, &exact);
+    const struct kf_index_entry *after =
+        kf_index_find(mkv_d->cluster_index, target, SEEK_FORWARD, &exact);
+    if (before && (flags & SEEK_BACKWARD || !after
+                   || target - before->pts <= after->pts - target))
+        return before->pos;
+    if (after)
+        return after->pos;
+
+    // The keyframe index is disabled or empty.
+    if (!mkv_d->num_cluster_pos)
+        return -1;
+    uint64_t cluster_pos = mkv_d->cluster_positions[0].filepos;
+    int64_t min_diff = 0xFFFFFFFFFFFFFFF;
+    for (int i = 0; i < mkv_d->num_cluster_pos; i++) {
+        int64_t diff = mkv_d->cluster_positions[i].timecode - target_tc_ns;
+        if (flags & SEEK_BACKWARD && diff < 0 && -diff < min_diff) {
+            cluster_pos = mkv_d->cluster_positions[i].filepos;
+            min_diff = -diff;
+        } else if (flags & SEEK_FORWARD
+                   && (diff < 0 ? -1 * diff : diff) < min_diff) {
+            cluster_pos = mkv_d->cluster_positions[i].filepos;
+            min_diff = diff < 0 ? -1 * diff : diff;
+        }
+    }
+    return cluster_pos;
+}
+
 static int seek_creating_index(struct demuxer *demuxer, float rel_seek_secs,
                                int flags)
 {
@@ -2251,8 +2432,12 @@ static int seek_creating_index(struct demuxer *demuxer, float rel_seek_secs,
         target_tc_ns = 0;
     uint64_t max_filepos = 0;
     int64_t max_tc = -1;
+    const struct kf_index_entry *last = kf_index_last(mkv_d->cluster_index);
     int n = mkv_d->num_cluster_pos;
-    if (n > 0) {
+    if (last) {
+        max_filepos = last->pos;
+        max_tc = last->pts * 1e9 + 0.5;
+    } else if (n > 0) {
         max_filepos = mkv_d->cluster_positions[n - 1].filepos;
         max_tc = mkv_d->cluster_positions[n - 1].timecode;
     }
@@ -2288,29 +2473,33 @@ static int seek_creating_index(struct demuxer *demuxer, float rel_seek_secs,
         if (s->eof)
             stream_reset(s);
     }
-    if (!mkv_d->num_cluster_pos) {
+    int64_t cluster_pos = find_cluster(mkv_d, target_tc_ns, flags);
+    if (cluster_pos < 0) {
         mp_msg(MSGT_DEMUX, MSGL_V, "[mkv] no target for seek found\n");
         return -1;
     }
-    uint64_t cluster_pos = mkv_d->cluster_positions[0].filepos;
-    /* Let's find the nearest cluster */
-    int64_t min_diff = 0xFFFFFFFFFFFFFFF;
-    for (int i = 0; i < mkv_d->num_cluster_pos; i++) {
-        int64_t diff = mkv_d->cluster_positions[i].timecode - target_tc_ns;
-        if (flags & SEEK_BACKWARD && diff < 0 && -diff < min_diff) {
-            cluster_pos = mkv_d->cluster_positions[i].filepos;
-            min_diff = -diff;
-        } else if (flags & SEEK_FORWARD
-                   && (diff < 0 ? -1 * diff : diff) < min_diff) {
-            cluster_pos = mkv_d->cluster_positions[i].filepos;
-            min_diff = diff < 0 ? -1 * diff : diff;
-        }
-    }
+    kf_index_break(mkv_d->cluster_index);
     mkv_d->cluster_size = mkv_d->blockgroup_size = 0;
     stream_seek(s, cluster_pos);
     return 0;
 }
 
+// Index of the first cue at or after timecode in track tnum, in the order of
+// the cues array.
+static int find_cue(struct mkv_demuxer *mkv_d, int tnum, uint64_t timecode)
+{
+    int lo = 0, hi = mkv_d->num_indexes;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        mkv_index_t *e = &mkv_d->indexes[mid];
+        if (e->tnum < tnum || (e->tnum == tnum && e->timecode < timecode))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
 static struct mkv_index *seek_with_cues(struct demuxer *demuxer, int seek_id,
                                         int64_t target_timecode, int flags)
 {
@@ -2327,8 +2516,17 @@ static struct mkv_index *seek_with_cues(struct demuxer *demuxer, int seek_id,
     if (flags & SEEK_BACKWARD)
         min_diff = -min_diff;
     min_diff = FFMAX(min_diff, 1);
-    for (int i = 0; i < mkv_d->num_indexes; i++)
-        if (seek_id < 0 || mkv_d->indexes[i].tnum == seek_id) {
+    uint64_t target_tc = (FFMAX(target_timecode, 0) + mkv_d->tc_scale - 1)
+                         / mkv_d->tc_scale;
+    int start = 0;
+    while (start < mkv_d->num_indexes) {
+        int tnum = seek_id < 0 ? mkv_d->indexes[start].tnum : seek_id;
+        int first = find_cue(mkv_d, tnum, 0);
+        int end = find_cue(mkv_d, tnum + 1, 0);
+        /* The best entries in either direction are the ones next to the
+         * first entry at or after the target. */
+        int k = find_cue(mkv_d, tnum, target_tc);
+        for (int i = FFMAX(k - 1, first); i <= FFMIN(k + 1, end - 1); i++) {
             int64_t diff =
                 target_timecode -
                 (int64_t) (mkv_d->indexes[i].timecode * mkv_d->tc_scale);
@@ -2342,6 +2540,10 @@ static struct mkv_index *seek_with_cues(struct demuxer *demuxer, int seek_id,
             min_diff = diff;
             index = mkv_d->indexes + i;
         }
+        if (seek_id >= 0)
+            break;
+        start = end;
+    }
 
     if (index) {        /* We've found an entry. */
         mkv_d->cluster_size = mkv_d->blockgroup_size = 0;
@@ -2354,6 +2556,7 @@ static void demux_mkv_seek(demuxer_t *demuxer, float rel_seek_secs,
                            float audio_delay, int flags)
 {
     mkv_demuxer_t *mkv_d = demuxer->priv;
+    join_cue_reader(mkv_d);
     uint64_t v_tnum = -1;
     if (demuxer->video->id >= 0)
         v_tnum = find_track_by_num(mkv_d, demuxer->video->id,
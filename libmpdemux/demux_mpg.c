@@ -35,6 +35,7 @@
 #include "parse_es.h"
 #include "stheader.h"
 #include "mp3_hdr.h"
+#include "keyframe_index.h"
 
 //#define MAX_PS_PACKETSIZE 2048
 #define MAX_PS_PACKETSIZE (224*1024)
@@ -58,6 +59,7 @@ typedef struct mpg_demuxer {
   unsigned int es_map[0x40];	//es map of stream types (associated to the pes id) from 0xb0 to 0xef
   int num_a_streams;
   int a_stream_ids[MAX_A_STREAMS];
+  struct kf_index *kf_index;    // positions of video packets with keyframes
 } mpg_demuxer_t;
 
 static int mpeg_pts_error=0;
@@ -240,6 +242,8 @@ static demuxer_t* demux_mpg_open(demuxer_t* demuxer) {
 
       stream_seek(s,pos);
       ds_fill_buffer(demuxer->video);
+
+      mpg_d->kf_index = kf_index_open(demuxer, 0.5);
     } // if ( demuxer->seekable )
   } // if ( mpg_d )
   return demuxer;
@@ -247,6 +251,8 @@ static demuxer_t* demux_mpg_open(demuxer_t* demuxer) {
 
 static void demux_close_mpg(demuxer_t* demuxer) {
   mpg_demuxer_t* mpg_d = demuxer->priv;
+  if (mpg_d)
+    kf_index_close(mpg_d->kf_index);
   free(mpg_d);
 }
 
@@ -605,6 +611,13 @@ static int demux_mpg_read_packet(demuxer_t *demux,int id){
     */
     if(ds == demux->video && stream_control(demux->stream, STREAM_CTRL_GET_CURRENT_TIME,(void *)&stream_pts)!=STREAM_UNSUPPORTED)
       dp->stream_pts = stream_pts;
+    if (ds == demux->video && set_pts && demux->priv) {
+      mpg_demuxer_t *mpg_d = demux->priv;
+      sh_video_t *sh_video = ds->sh;
+      if (mpg_d->kf_index && sh_video &&
+          kf_index_is_keyframe(sh_video->format, dp->buffer, len))
+        kf_index_add(mpg_d->kf_index, dp->pts, dp->pos);
+    }
     ds_add_packet(ds,dp);
     if (demux->priv && set_pts) ((mpg_demuxer_t*)demux->priv)->last_pts = pts/90000.0f;
 //    if(ds==demux->sub) parse_dvdsub(ds->last->buffer,ds->last->len);
@@ -928,6 +941,9 @@ static void demux_seek_mpg(demuxer_t *demuxer, float rel_seek_secs,
       newpts += rel_seek_secs;
     if (newpts < 0) newpts = 0;
 
+    if (mpg_d && mpg_d->kf_index)
+      kf_index_break(mpg_d->kf_index);
+
     if(flags&SEEK_FACTOR){
 	// float seek 0..1
 	newpos+=(demuxer->movi_end-demuxer->movi_start)*rel_seek_secs;
@@ -942,6 +958,22 @@ static void demux_seek_mpg(demuxer_t *demuxer, float rel_seek_secs,
           newpos+=2324*75*rel_seek_secs; // 174.3 kbyte/sec
         else
           newpos+=sh_video->i_bps*rel_seek_secs;
+
+        // Prefer the keyframe positions seen before, if the target is in
+        // a range that was read completely.
+        if (mpg_d && mpg_d->kf_index) {
+          int dir = flags & (SEEK_FORWARD | SEEK_BACKWARD);
+          bool exact;
+          const struct kf_index_entry *e;
+          if (!dir)
+            dir = flags & SEEK_ABSOLUTE || rel_seek_secs < 0 ?
+                  SEEK_BACKWARD : SEEK_FORWARD;
+          e = kf_index_find(mpg_d->kf_index, newpts, dir, &exact);
+          if (e && exact) {
+            newpos = e->pos;
+            precision = 0;
+          }
+        }
     }
 
     while (1) {
@@ -1001,6 +1033,8 @@ static void demux_seek_mpg(demuxer_t *demuxer, float rel_seek_secs,
 	if(mpg_d) {
         newpos += (newpts - mpg_d->last_pts) * (newpos - oldpos) / (mpg_d->last_pts - oldpts);
         demux_flush(demuxer);
+        if (mpg_d->kf_index)
+          kf_index_break(mpg_d->kf_index);
         demuxer->stream->eof=0; // clear eof flag
         d_video->eof=0;
         d_audio->eof=0;
@@ -30,6 +30,7 @@ typedef struct demux_packet {
     double stream_pts;
     off_t pos; // position in index (AVI) or file (MPG)
     unsigned char *buffer;
+    size_t alloc_size; // allocated size of buffer, 0 if not owned by the pool
     bool keyframe;
     int refcount; // counter for the master packet, if 0, buffer can be free()d
     struct demux_packet *master; //in clones, pointer to the master packet
@@ -38,6 +38,7 @@
 #include "ms_hdr.h"
 #include "mpeg_hdr.h"
 #include "demux_ts.h"
+#include "keyframe_index.h"
 
 #define TS_PH_PACKET_SIZE 192
 #define TS_FEC_PACKET_SIZE 204
@@ -242,6 +243,7 @@ typedef struct {
 	int last_sid;
 	char packet[TS_FEC_PACKET_SIZE];
 	TS_stream_info vstr, astr;
+	struct kf_index *kf_index;	//positions of video PES with keyframes
 } ts_priv_t;
 
 
@@ -1098,6 +1100,9 @@ static demuxer_t *demux_open_ts(demuxer_t * demuxer)
 	for(i = 0; i < priv->pmt_cnt; i++)
 		priv->pmt[i].section.buffer_len = 0;
 
+	if(demuxer->seekable && sh_video)
+		priv->kf_index = kf_index_open(demuxer, 0.5);
+
 	demuxer->filepos = stream_tell(demuxer->stream);
 	return demuxer;
 }
@@ -1109,6 +1114,7 @@ static void demux_close_ts(demuxer_t * demuxer)
 
 	if(priv)
 	{
+		kf_index_close(priv->kf_index);
 		free(priv->pat.section.buffer);
 		free(priv->pat.progs);
 
@@ -2779,7 +2785,8 @@ static int ts_parse(demuxer_t *demuxer , ES_stream_t *es, unsigned char *packet,
 	demux_packet_t **dp = NULL;
 	int *dp_offset = 0, *buffer_size = 0;
 	int32_t progid, pid_type, bad, ts_error;
-	int junk = 0, rap_flag = 0;
+	int junk = 0, rap_flag = 0, has_pts;
+	off_t pkt_pos;
 	pmt_t *pmt;
 	mp4_decoder_config_t *mp4_dec;
 	TS_stream_info *si;
@@ -2818,6 +2825,7 @@ static int ts_parse(demuxer_t *demuxer , ES_stream_t *es, unsigned char *packet,
 			mp_msg(MSGT_DEMUX, MSGL_INFO, "TS_PARSE: COULDN'T SYNC\n");
 			return 0;
 		}
+		pkt_pos = stream_tell(stream) - 1;
 
 		len = stream_read(stream, &packet[1], 3);
 		if (len != 3)
@@ -3116,6 +3124,7 @@ static int ts_parse(demuxer_t *demuxer , ES_stream_t *es, unsigned char *packet,
 			}
 			else
 			{
+				has_pts = es->pts != 0.0;
 				if(es->pts == 0.0)
 					es->pts = tss->pts = tss->last_pts;
 				else
@@ -3130,6 +3139,9 @@ static int ts_parse(demuxer_t *demuxer , ES_stream_t *es, unsigned char *packet,
 					mp_msg(MSGT_DEMUX, MSGL_ERR, "Broken ES packet size\n");
 					es->size = 0;
 				}
+				if(ds == demuxer->video && priv->kf_index && has_pts &&
+				   (rap_flag || kf_index_is_keyframe(((sh_video_t *)ds->sh)->format, es->start, es->size)))
+					kf_index_add(priv->kf_index, es->pts, pkt_pos);
 				memmove(p, es->start, es->size);
 				*dp_offset += es->size;
 				(*dp)->keyframe = 0;
@@ -3250,9 +3262,28 @@ static void demux_seek_ts(demuxer_t *demuxer, float rel_seek_secs, float audio_d
 	ts_priv_t * priv = (ts_priv_t*) demuxer->priv;
 	int i, video_stats;
 	off_t newpos;
+	double newpts = rel_seek_secs;
+	const struct kf_index_entry *kf = NULL;
 
 	//================= seek in MPEG-TS ==========================
 
+	// look up the target in the keyframe positions seen before
+	if(priv->kf_index && !(flags & SEEK_FACTOR) &&
+	   ((flags & SEEK_ABSOLUTE) || d_video->pts > 0))
+	{
+		int dir = flags & (SEEK_FORWARD | SEEK_BACKWARD);
+		bool exact;
+		if(!(flags & SEEK_ABSOLUTE))
+			newpts += d_video->pts;
+		if(!dir)
+			dir = (flags & SEEK_ABSOLUTE) || rel_seek_secs < 0 ? SEEK_BACKWARD : SEEK_FORWARD;
+		kf = kf_index_find(priv->kf_index, newpts, dir, &exact);
+		if(kf && !exact)
+			kf = NULL;
+	}
+	if(priv->kf_index)
+		kf_index_break(priv->kf_index);
+
 	ts_dump_streams(demuxer->priv);
 	reset_fifos(demuxer, sh_audio != NULL, sh_video != NULL, demuxer->sub->id > 0);
 
@@ -3271,7 +3302,9 @@ static void demux_seek_ts(demuxer_t *demuxer, float rel_seek_secs, float audio_d
 	}
 
 	newpos = (flags & SEEK_ABSOLUTE) ? demuxer->movi_start : demuxer->filepos;
-	if(flags & SEEK_FACTOR) // float seek 0..1
+	if(kf)
+		newpos = kf->pos;
+	else if(flags & SEEK_FACTOR) // float seek 0..1
 		newpos+=(demuxer->movi_end-demuxer->movi_start)*rel_seek_secs;
 	else
 	{
@@ -392,12 +392,11 @@ static int demux_vivo_fill_buffer(demuxer_t *demux, demux_stream_t *dsds){
         demux_packet_t* dp=ds->asf_packet;
         if(dp->len + len + MP_INPUT_BUFFER_PADDING_SIZE < 0)
 	    return 0;
-        dp->buffer=realloc(dp->buffer,dp->len+len+MP_INPUT_BUFFER_PADDING_SIZE);
-        memset(dp->buffer+dp->len+len, 0, MP_INPUT_BUFFER_PADDING_SIZE);
+        int old_len=dp->len;
+        resize_demux_packet(dp,old_len+len);
         //memcpy(dp->buffer+dp->len,data,len);
-	stream_read(demux->stream,dp->buffer+dp->len,len);
-        mp_dbg(MSGT_DEMUX,MSGL_DBG4,"data appended! %d+%d\n",dp->len,len);
-        dp->len+=len;
+	stream_read(demux->stream,dp->buffer+old_len,len);
+        mp_dbg(MSGT_DEMUX,MSGL_DBG4,"data appended! %d+%d\n",old_len,len);
         // we are ready now.
 	if((c&0xF0)==0x20) --ds->asf_seq; // hack!
         return 1;
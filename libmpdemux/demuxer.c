@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <unistd.h>
 
@@ -28,10 +29,18 @@
 #include <sys/stat.h>
 
 #include "config.h"
+
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
+#endif
+
 #include "options.h"
 #include "talloc.h"
 #include "mp_msg.h"
 #include "m_config.h"
+#include "profiler.h"
 
 #include "libvo/fastmemcpy.h"
 
@@ -163,6 +172,167 @@ const demuxer_desc_t *const demuxer_list[] = {
     NULL
 };
 
+/* Packet pool
+ *
+ * Packet structs and buffers are recycled instead of going through malloc()
+ * and free() for every packet. Buffers are allocated in power-of-2 size
+ * classes, so that a freed buffer can be reused for any later packet of
+ * similar size, and kept on per-class free lists. Buffers too large for the
+ * biggest class are allocated directly. The amount of idle memory held by
+ * the pool is limited, and everything is released when the last demuxer is
+ * closed. Packets may be freed by a different thread than the one that
+ * allocated them, so the pool is locked.
+ */
+
+#define POOL_MIN_CLASS 8   // 256 bytes
+#define POOL_MAX_CLASS 22  // 4 MiB
+#define POOL_NUM_CLASSES (POOL_MAX_CLASS - POOL_MIN_CLASS + 1)
+#define POOL_MAX_IDLE_BYTES (32 << 20)
+#define POOL_MAX_IDLE_PACKETS 4096
+
+struct pool_buffer {
+    struct pool_buffer *next;
+};
+
+static struct {
+    struct demux_packet *free_packets;
+    int num_free_packets;
+    struct pool_buffer *free_buffers[POOL_NUM_CLASSES];
+    int64_t idle_bytes;
+    int num_demuxers;
+    struct demux_packet_pool_stats stats;
+} pool;
+
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define pool_lock() pthread_mutex_lock(&pool_mutex)
+#define pool_unlock() pthread_mutex_unlock(&pool_mutex)
+#else
+#define pool_lock() ((void)0)
+#define pool_unlock() ((void)0)
+#endif
+
+static void *checked_malloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (!ptr) {
+        mp_msg(MSGT_DEMUXER, MSGL_FATAL, "Memory allocation failure!\n");
+        abort();
+    }
+    return ptr;
+}
+
+static int pool_class(size_t size)
+{
+    int c = 0;
+    while (c < POOL_NUM_CLASSES && size > (size_t)1 << (c + POOL_MIN_CLASS))
+        c++;
+    return c;
+}
+
+static struct demux_packet *pool_get_packet(void)
+{
+    pool_lock();
+    struct demux_packet *dp = pool.free_packets;
+    if (dp) {
+        pool.free_packets = dp->next;
+        pool.num_free_packets--;
+    }
+    pool_unlock();
+    return dp ? dp : checked_malloc(sizeof(struct demux_packet));
+}
+
+static void pool_put_packet(struct demux_packet *dp)
+{
+    pool_lock();
+    if (pool.num_free_packets < POOL_MAX_IDLE_PACKETS) {
+        dp->next = pool.free_packets;
+        pool.free_packets = dp;
+        pool.num_free_packets++;
+        dp = NULL;
+    }
+    pool_unlock();
+    free(dp);
+}
+
+// Allocate a buffer of at least size bytes, store the real size in *alloc.
+static void *pool_get_buffer(size_t size, size_t *alloc)
+{
+    int c = pool_class(size);
+    struct pool_buffer *buf = NULL;
+    pool_lock();
+    pool.stats.allocations++;
+    if (c < POOL_NUM_CLASSES) {
+        *alloc = (size_t)1 << (c + POOL_MIN_CLASS);
+        buf = pool.free_buffers[c];
+        if (buf) {
+            pool.free_buffers[c] = buf->next;
+            pool.idle_bytes -= *alloc;
+            pool.stats.reused++;
+        }
+    } else {
+        *alloc = size;
+        pool.stats.oversized++;
+    }
+    pool.stats.bytes_in_use += *alloc;
+    if (pool.stats.bytes_in_use > pool.stats.peak_bytes_in_use)
+        pool.stats.peak_bytes_in_use = pool.stats.bytes_in_use;
+    pool_unlock();
+    return buf ? (void *)buf : checked_malloc(*alloc);
+}
+
+static void pool_put_buffer(void *ptr, size_t alloc)
+{
+    int c = pool_class(alloc);
+    pool_lock();
+    pool.stats.bytes_in_use -= alloc;
+    if (c < POOL_NUM_CLASSES && pool.num_demuxers > 0
+        && pool.idle_bytes + alloc <= POOL_MAX_IDLE_BYTES) {
+        struct pool_buffer *buf = ptr;
+        buf->next = pool.free_buffers[c];
+        pool.free_buffers[c] = buf;
+        pool.idle_bytes += alloc;
+        ptr = NULL;
+    }
+    pool_unlock();
+    free(ptr);
+}
+
+// Release all idle memory held by the pool.
+static void pool_trim(void)
+{
+    pool_lock();
+    struct demux_packet *dp = pool.free_packets;
+    struct pool_buffer *buffers[POOL_NUM_CLASSES];
+    memcpy(buffers, pool.free_buffers, sizeof(buffers));
+    memset(pool.free_buffers, 0, sizeof(pool.free_buffers));
+    pool.free_packets = NULL;
+    pool.num_free_packets = 0;
+    pool.idle_bytes = 0;
+    pool_unlock();
+    while (dp) {
+        struct demux_packet *next = dp->next;
+        free(dp);
+        dp = next;
+    }
+    for (int c = 0; c < POOL_NUM_CLASSES; c++) {
+        struct pool_buffer *buf = buffers[c];
+        while (buf) {
+            struct pool_buffer *next = buf->next;
+            free(buf);
+            buf = next;
+        }
+    }
+}
+
+void demux_packet_pool_stats(struct demux_packet_pool_stats *stats)
+{
+    pool_lock();
+    *stats = pool.stats;
+    stats->idle_bytes = pool.idle_bytes;
+    pool_unlock();
+}
+
 static struct demux_packet *create_packet(size_t len)
 {
     if (len > 1000000000) {
@@ -170,7 +340,7 @@ static struct demux_packet *create_packet(size_t len)
                "over 1 GB!\n");
         abort();
     }
-    struct demux_packet *dp = malloc(sizeof(struct demux_packet));
+    struct demux_packet *dp = pool_get_packet();
     dp->len = len;
     dp->next = NULL;
     dp->pts = MP_NOPTS_VALUE;
@@ -181,6 +351,7 @@ static struct demux_packet *create_packet(size_t len)
     dp->refcount = 1;
     dp->master = NULL;
     dp->buffer = NULL;
+    dp->alloc_size = 0;
     dp->avpacket = NULL;
     return dp;
 }
@@ -188,12 +359,9 @@ static struct demux_packet *create_packet(size_t len)
 struct demux_packet *new_demux_packet(size_t len)
 {
     struct demux_packet *dp = create_packet(len);
-    dp->buffer = malloc(len + MP_INPUT_BUFFER_PADDING_SIZE);
-    if (!dp->buffer) {
-        mp_msg(MSGT_DEMUXER, MSGL_FATAL, "Memory allocation failure!\n");
-        abort();
-    }
-    memset(dp->buffer + len, 0, 8);
+    dp->buffer = pool_get_buffer(len + MP_INPUT_BUFFER_PADDING_SIZE,
+                                 &dp->alloc_size);
+    memset(dp->buffer + len, 0, MP_INPUT_BUFFER_PADDING_SIZE);
     return dp;
 }
 
@@ -212,44 +380,63 @@ void resize_demux_packet(struct demux_packet *dp, size_t len)
                "over 1 GB!\n");
         abort();
     }
-    dp->buffer = realloc(dp->buffer, len + MP_INPUT_BUFFER_PADDING_SIZE);
-    if (!dp->buffer) {
-        mp_msg(MSGT_DEMUXER, MSGL_FATAL, "Memory allocation failure!\n");
-        abort();
+    size_t size = len + MP_INPUT_BUFFER_PADDING_SIZE;
+    if (dp->alloc_size && size > dp->alloc_size) {
+        size_t alloc;
+        unsigned char *buffer = pool_get_buffer(size, &alloc);
+        memcpy(buffer, dp->buffer, FFMIN((size_t)dp->len, len));
+        pool_put_buffer(dp->buffer, dp->alloc_size);
+        dp->buffer = buffer;
+        dp->alloc_size = alloc;
+    } else if (!dp->alloc_size) {
+        dp->buffer = realloc(dp->buffer, size);
+        if (!dp->buffer) {
+            mp_msg(MSGT_DEMUXER, MSGL_FATAL, "Memory allocation failure!\n");
+            abort();
+        }
     }
-    memset(dp->buffer + len, 0, 8);
+    memset(dp->buffer + len, 0, MP_INPUT_BUFFER_PADDING_SIZE);
     dp->len = len;
 }
 
+// Clones share the buffer of the master packet. The caller may point the
+// clone's buffer/len at a part of it, as long as the data is still padded.
 struct demux_packet *clone_demux_packet(struct demux_packet *pack)
 {
-    struct demux_packet *dp = malloc(sizeof(struct demux_packet));
+    struct demux_packet *dp = pool_get_packet();
     while (pack->master)
         pack = pack->master;  // find the master
     memcpy(dp, pack, sizeof(struct demux_packet));
     dp->next = NULL;
     dp->refcount = 0;
     dp->master = pack;
+    // the master and its clones can be freed on different threads
+    pool_lock();
     pack->refcount++;
+    pool_unlock();
     return dp;
 }
 
 void free_demux_packet(struct demux_packet *dp)
 {
     if (dp->master == NULL) {  //dp is a master packet
-        dp->refcount--;
-        if (dp->refcount == 0) {
+        pool_lock();
+        int refcount = --dp->refcount;
+        pool_unlock();
+        if (refcount == 0) {
             if (dp->avpacket)
                 talloc_free(dp->avpacket);
+            else if (dp->alloc_size)
+                pool_put_buffer(dp->buffer, dp->alloc_size);
             else
                 free(dp->buffer);
-            free(dp);
+            pool_put_packet(dp);
         }
         return;
     }
     // dp is a clone:
     free_demux_packet(dp->master);
-    free(dp);
+    pool_put_packet(dp);
 }
 
 static void free_demuxer_stream(struct demux_stream *ds)
@@ -288,6 +475,281 @@ static const demuxer_desc_t *get_demuxer_desc_from_type(int file_format)
 }
 
 
+/* Demuxer thread
+ *
+ * With --demuxer-thread, the demuxer's fill_buffer runs on a separate thread
+ * that reads ahead into the demux_stream packet queues, until the queue of
+ * an active audio or video stream reaches --demuxer-readahead-secs or
+ * --demuxer-readahead-size. ds_fill_buffer() then only takes packets off the
+ * queue, and waits for the thread if the queue is empty.
+ *
+ * The thread holds demux_thread.lock while it calls into the demuxer. Code
+ * on the main thread that touches demuxer or stream state takes the same
+ * lock with demux_lock(); it is recursive, so the functions in this file
+ * take it themselves where needed. The packet queues (first, last, packs,
+ * bytes) are protected by the separate queue_lock, which is never held
+ * while waiting for the demuxer lock. While the main thread holds the
+ * demuxer lock, demuxing is done synchronously as without the thread.
+ */
+
+#ifdef HAVE_PTHREADS
+
+struct demux_thread {
+    pthread_t thread;
+    pthread_mutex_t lock;       // demuxer lock, recursive
+    int lock_depth;             // main thread demux_lock() nesting
+    pthread_mutex_t queue_lock;
+    pthread_cond_t wakeup;      // signals the demuxer thread
+    pthread_cond_t filled;      // signals the reader
+    bool terminate;
+    bool eof;                   // demuxer returned EOF while reading ahead
+    // packets requested by ds_fill_buffer() and fulfilled or refused by the
+    // demuxer thread; a request is pending if requests > served
+    int64_t requests, served;
+    struct demux_stream *wanted;
+    int64_t max_bytes;
+    double max_secs;
+};
+
+static bool ds_is_active(struct demux_stream *ds)
+{
+    return ds->sh && ds->id != -2;
+}
+
+static bool ds_readahead_full(struct demux_thread *t, struct demux_stream *ds)
+{
+    if (!ds_is_active(ds))
+        return false;
+    if (ds->bytes >= t->max_bytes || ds->packs >= MAX_PACKS / 2)
+        return true;
+    return ds->first && ds->first->pts != MP_NOPTS_VALUE
+        && ds->last->pts != MP_NOPTS_VALUE
+        && ds->last->pts - ds->first->pts >= t->max_secs;
+}
+
+// Return whether the hard buffering limits were reached, like the checks in
+// the non-threaded ds_fill_buffer().
+static bool demux_overflow(struct demuxer *demux)
+{
+    return demux->audio->packs >= MAX_PACKS
+        || demux->audio->bytes >= MAX_PACK_BYTES
+        || demux->video->packs >= MAX_PACKS
+        || demux->video->bytes >= MAX_PACK_BYTES;
+}
+
+static void *demux_thread_loop(void *arg)
+{
+    struct demuxer *demux = arg;
+    struct demux_thread *t = demux->thread;
+
+    mp_prof_set_thread_name("demux");
+    pthread_mutex_lock(&t->queue_lock);
+    while (!t->terminate) {
+        struct demux_stream *ds = NULL;
+        int64_t request = t->requests;
+        // the reader may not have woken up yet after the last fill
+        bool pending = t->served < request && !t->wanted->first;
+        if (pending) {
+            ds = t->wanted;
+            if (demux_overflow(demux)) {
+                mp_msg(MSGT_DEMUXER, MSGL_ERR, "\nToo many packets in the "
+                       "buffer: (A: %d in %d bytes, V: %d in %d bytes).\n",
+                       demux->audio->packs, demux->audio->bytes,
+                       demux->video->packs, demux->video->bytes);
+                t->served = request;
+                pthread_cond_broadcast(&t->filled);
+                continue;
+            }
+        } else if (!t->eof && !ds_readahead_full(t, demux->video)
+                   && !ds_readahead_full(t, demux->audio)) {
+            // read ahead for the stream with less data queued; this matters
+            // for demuxers that can read streams independently
+            ds = demux->video;
+            if (!ds_is_active(ds) || (ds_is_active(demux->audio)
+                                      && demux->audio->bytes < ds->bytes))
+                ds = demux->audio;
+        } else {
+            pthread_cond_wait(&t->wakeup, &t->queue_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&t->queue_lock);
+
+        pthread_mutex_lock(&t->lock);
+        struct mp_prof_scope prof;
+        MP_PROF_BEGIN(&prof, "demux_read");
+        int res = demux_fill_buffer(demux, ds);
+        MP_PROF_END(&prof);
+        pthread_mutex_lock(&t->queue_lock);
+        pthread_mutex_unlock(&t->lock);
+        if (!res) {
+            t->eof = true;
+            if (pending)
+                t->served = FFMAX(t->served, request);
+        }
+        pthread_cond_broadcast(&t->filled);
+    }
+    pthread_mutex_unlock(&t->queue_lock);
+    return NULL;
+}
+
+static void get_deadline(struct timespec *ts, int ms)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t usec = now.tv_usec + ms * 1000LL;
+    ts->tv_sec = now.tv_sec + usec / 1000000;
+    ts->tv_nsec = usec % 1000000 * 1000;
+}
+
+// Whether ds_fill_buffer() should wait for the demuxer thread instead of
+// calling the demuxer itself.
+static bool use_demux_thread(struct demuxer *demux)
+{
+    struct demux_thread *t = demux->thread;
+    return t && !pthread_equal(pthread_self(), t->thread) && !t->lock_depth;
+}
+
+// Wait until the queue of ds has a packet. Returns false on EOF.
+static bool demux_thread_wait(struct demux_stream *ds)
+{
+    struct demux_thread *t = ds->demuxer->thread;
+    pthread_mutex_lock(&t->queue_lock);
+    if (ds->first) {
+        pthread_mutex_unlock(&t->queue_lock);
+        return true;
+    }
+    int64_t request = ++t->requests;
+    t->wanted = ds;
+    pthread_cond_signal(&t->wakeup);
+    while (!ds->first && t->served < request) {
+        struct timespec deadline;
+        get_deadline(&deadline, 100);
+        if (pthread_cond_timedwait(&t->filled, &t->queue_lock, &deadline)
+            == ETIMEDOUT) {
+            // don't block user input while the demuxer is stalled
+            pthread_mutex_unlock(&t->queue_lock);
+            bool interrupted = stream_check_interrupt(0);
+            pthread_mutex_lock(&t->queue_lock);
+            if (interrupted)
+                break;
+        }
+    }
+    bool res = ds->first;
+    t->served = FFMAX(t->served, request);
+    t->wanted = NULL;
+    pthread_mutex_unlock(&t->queue_lock);
+    return res;
+}
+
+void demux_start_thread(struct demuxer *demuxer)
+{
+    struct MPOpts *opts = demuxer->opts;
+    if (demuxer->thread || demuxer->type == DEMUXER_TYPE_DEMUXERS)
+        return;
+    struct demux_thread *t = talloc_zero(demuxer, struct demux_thread);
+    t->max_bytes = (int64_t)opts->demuxer_readahead_size * 1024;
+    t->max_secs = opts->demuxer_readahead_secs;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&t->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_mutex_init(&t->queue_lock, NULL);
+    pthread_cond_init(&t->wakeup, NULL);
+    pthread_cond_init(&t->filled, NULL);
+    demuxer->thread = t;
+    if (pthread_create(&t->thread, NULL, demux_thread_loop, demuxer)) {
+        mp_msg(MSGT_DEMUXER, MSGL_ERR, "Could not create demuxer thread.\n");
+        demuxer->thread = NULL;
+        pthread_cond_destroy(&t->filled);
+        pthread_cond_destroy(&t->wakeup);
+        pthread_mutex_destroy(&t->queue_lock);
+        pthread_mutex_destroy(&t->lock);
+        talloc_free(t);
+        return;
+    }
+    mp_msg(MSGT_DEMUXER, MSGL_V, "DEMUXER: started demuxer thread\n");
+}
+
+static void demux_stop_thread(struct demuxer *demuxer)
+{
+    struct demux_thread *t = demuxer->thread;
+    if (!t)
+        return;
+    pthread_mutex_lock(&t->queue_lock);
+    t->terminate = true;
+    pthread_cond_signal(&t->wakeup);
+    pthread_mutex_unlock(&t->queue_lock);
+    pthread_join(t->thread, NULL);
+    demuxer->thread = NULL;
+    pthread_cond_destroy(&t->filled);
+    pthread_cond_destroy(&t->wakeup);
+    pthread_mutex_destroy(&t->queue_lock);
+    pthread_mutex_destroy(&t->lock);
+    talloc_free(t);
+}
+
+void demux_lock(struct demuxer *demuxer)
+{
+    struct demux_thread *t = demuxer->thread;
+    if (t) {
+        pthread_mutex_lock(&t->lock);
+        t->lock_depth++;
+    }
+}
+
+void demux_unlock(struct demuxer *demuxer)
+{
+    struct demux_thread *t = demuxer->thread;
+    if (t) {
+        t->lock_depth--;
+        pthread_mutex_unlock(&t->lock);
+    }
+}
+
+static void queue_lock(struct demuxer *demuxer)
+{
+    if (demuxer->thread)
+        pthread_mutex_lock(&demuxer->thread->queue_lock);
+}
+
+static void queue_unlock(struct demuxer *demuxer)
+{
+    if (demuxer->thread)
+        pthread_mutex_unlock(&demuxer->thread->queue_lock);
+}
+
+// Called with the demuxer lock held after the queues were flushed.
+static void demux_thread_reset(struct demuxer *demuxer)
+{
+    struct demux_thread *t = demuxer->thread;
+    if (t) {
+        pthread_mutex_lock(&t->queue_lock);
+        t->eof = false;
+        pthread_cond_signal(&t->wakeup);
+        pthread_mutex_unlock(&t->queue_lock);
+    }
+}
+
+#else /* HAVE_PTHREADS */
+
+void demux_start_thread(struct demuxer *demuxer)
+{
+    mp_msg(MSGT_DEMUXER, MSGL_WARN, "Demuxer thread requires pthreads.\n");
+}
+
+static void demux_stop_thread(struct demuxer *demuxer) {}
+void demux_lock(struct demuxer *demuxer) {}
+void demux_unlock(struct demuxer *demuxer) {}
+static void queue_lock(struct demuxer *demuxer) {}
+static void queue_unlock(struct demuxer *demuxer) {}
+static void demux_thread_reset(struct demuxer *demuxer) {}
+static bool use_demux_thread(struct demuxer *demux) { return false; }
+static bool demux_thread_wait(struct demux_stream *ds) { return false; }
+
+#endif /* HAVE_PTHREADS */
+
+
 demuxer_t *new_demuxer(struct MPOpts *opts, stream_t *stream, int type,
                        int a_id, int v_id, int s_id, char *filename)
 {
@@ -298,6 +760,9 @@ demuxer_t *new_demuxer(struct MPOpts *opts, stream_t *stream, int type,
     d->movi_start = stream->start_pos;
     d->movi_end = stream->end_pos;
     d->seekable = 1;
+    pool_lock();
+    pool.num_demuxers++;
+    pool_unlock();
     d->synced = 0;
     d->filepos = -1;
     d->audio = new_demuxer_stream(d, a_id);
@@ -441,6 +906,7 @@ void free_demuxer(demuxer_t *demuxer)
     int i;
     mp_msg(MSGT_DEMUXER, MSGL_DBG2, "DEMUXER: freeing %s demuxer at %p\n",
            demuxer->desc->shortdesc, demuxer);
+    demux_stop_thread(demuxer);
     if (demuxer->desc->close)
         demuxer->desc->close(demuxer);
     // Very ugly hack to make it behave like old implementation
@@ -465,12 +931,25 @@ void free_demuxer(demuxer_t *demuxer)
     if (demuxer->teletext)
         teletext_control(demuxer->teletext, TV_VBI_CONTROL_STOP, NULL);
     talloc_free(demuxer);
+
+    pool_lock();
+    bool last = --pool.num_demuxers == 0;
+    struct demux_packet_pool_stats st = pool.stats;
+    pool_unlock();
+    if (last) {
+        mp_msg(MSGT_DEMUXER, MSGL_V, "DEMUXER: packet pool: %"PRId64
+               " buffer allocations, %"PRId64" reused, %"PRId64" oversized, "
+               "peak %"PRId64" KiB in use\n", st.allocations, st.reused,
+               st.oversized, st.peak_bytes_in_use >> 10);
+        pool_trim();
+    }
 }
 
 
 void ds_add_packet(demux_stream_t *ds, demux_packet_t *dp)
 {
     // append packet to DS stream:
+    queue_lock(ds->demuxer);
     ++ds->packs;
     ds->bytes += dp->len;
     if (ds->last) {
@@ -486,6 +965,7 @@ void ds_add_packet(demux_stream_t *ds, demux_packet_t *dp)
            (ds == ds->demuxer->audio) ? "d_audio" : "d_video", dp->len,
            dp->pts, (unsigned int) dp->pos, ds->demuxer->audio->packs,
            ds->demuxer->video->packs);
+    queue_unlock(ds->demuxer);
 }
 
 static void allocate_parser(AVCodecContext **avctx,
@@ -626,7 +1106,13 @@ int ds_fill_buffer(demux_stream_t *ds)
     mp_dbg(MSGT_DEMUXER, MSGL_DBG3, "ds_fill_buffer (%s) called\n",
            ds == demux->audio ? "d_audio" : ds == demux->video ? "d_video" :
            ds == demux->sub   ? "d_sub"   : "unknown");
+    struct mp_prof_scope prof;
+    MP_PROF_BEGIN(&prof, "demux_fill");
+    bool threaded = use_demux_thread(demux);
     while (1) {
+        if (threaded && !demux_thread_wait(ds))
+            break; // EOF
+        queue_lock(demux);
         if (ds->packs) {
             demux_packet_t *p = ds->first;
             // copy useful data:
@@ -651,6 +1137,7 @@ int ds_fill_buffer(demux_stream_t *ds)
             if (!ds->first)
                 ds->last = NULL;
             --ds->packs;
+            queue_unlock(demux);
             /* The code below can set ds->eof to 1 when another stream runs
              * out of buffer space. That makes sense because in that situation
              * the calling code should not count on being able to demux more
@@ -659,8 +1146,12 @@ int ds_fill_buffer(demux_stream_t *ds)
              * despite the eof flag then it's better to clear it to avoid
              * weird behavior. */
             ds->eof = 0;
+            MP_PROF_END(&prof);
             return 1;
         }
+        queue_unlock(demux);
+        if (threaded)
+            continue;
 
 #define MaybeNI _("Maybe you are playing a non-interleaved stream/file or the codec failed?\n" \
                 "For AVI files, try to force non-interleaved mode with the -ni option.\n")
@@ -691,6 +1182,7 @@ int ds_fill_buffer(demux_stream_t *ds)
            "ds_fill_buffer: EOF reached (stream: %s)  \n",
            ds == demux->audio ? "audio" : "video");
     ds->eof = 1;
+    MP_PROF_END(&prof);
     return 0;
 }
 
@@ -755,7 +1247,13 @@ int demux_pattern_3(demux_stream_t *ds, unsigned char *mem, int maxlen,
 
 void ds_free_packs(demux_stream_t *ds)
 {
+    demux_lock(ds->demuxer);
+    queue_lock(ds->demuxer);
     demux_packet_t *dp = ds->first;
+    ds->first = ds->last = NULL;
+    ds->packs = 0; // !!!!!
+    ds->bytes = 0;
+    queue_unlock(ds->demuxer);
     while (dp) {
         demux_packet_t *dn = dp->next;
         free_demux_packet(dp);
@@ -763,13 +1261,9 @@ void ds_free_packs(demux_stream_t *ds)
     }
     if (ds->asf_packet) {
         // free unfinished .asf fragments:
-        free(ds->asf_packet->buffer);
-        free(ds->asf_packet);
+        free_demux_packet(ds->asf_packet);
         ds->asf_packet = NULL;
     }
-    ds->first = ds->last = NULL;
-    ds->packs = 0; // !!!!!
-    ds->bytes = 0;
     if (ds->current)
         free_demux_packet(ds->current);
     ds->current = NULL;
@@ -777,6 +1271,7 @@ void ds_free_packs(demux_stream_t *ds)
     ds->buffer_pos = ds->buffer_size;
     ds->pts = MP_NOPTS_VALUE;
     ds->pts_bytes = 0;
+    demux_unlock(ds->demuxer);
 }
 
 int ds_get_packet(demux_stream_t *ds, unsigned char **start)
@@ -839,6 +1334,11 @@ double ds_get_next_pts(demux_stream_t *ds)
     demuxer_t *demux = ds->demuxer;
     // if we have not read from the "current" packet, consider it
     // as the next, otherwise we never get the pts for the first packet.
+    if (use_demux_thread(demux) && (!ds->current || ds->buffer_pos)) {
+        // only this thread removes packets, so ds->first stays valid
+        if (!demux_thread_wait(ds))
+            return MP_NOPTS_VALUE;
+    }
     while (!ds->first && (!ds->current || ds->buffer_pos)) {
         if (demux->audio->packs >= MAX_PACKS
             || demux->audio->bytes >= MAX_PACK_BYTES) {
@@ -1153,13 +1653,16 @@ struct demuxer *demux_open_withparams(struct MPOpts *opts, stream_t *vs,
 
 void demux_flush(demuxer_t *demuxer)
 {
+    demux_lock(demuxer);
     ds_free_packs(demuxer->video);
     ds_free_packs(demuxer->audio);
     ds_free_packs(demuxer->sub);
+    demux_thread_reset(demuxer);
+    demux_unlock(demuxer);
 }
 
-int demux_seek(demuxer_t *demuxer, float rel_seek_secs, float audio_delay,
-               int flags)
+static int seek_locked(demuxer_t *demuxer, float rel_seek_secs,
+                       float audio_delay, int flags)
 {
     if (!demuxer->seekable) {
         if (demuxer->file_format == DEMUXER_TYPE_AVI)
@@ -1217,6 +1720,17 @@ int demux_seek(demuxer_t *demuxer, float rel_seek_secs, float audio_delay,
     return 1;
 }
 
+int demux_seek(demuxer_t *demuxer, float rel_seek_secs, float audio_delay,
+               int flags)
+{
+    demux_lock(demuxer);
+    int res = seek_locked(demuxer, rel_seek_secs, audio_delay, flags);
+    // the demuxer thread may have hit EOF after the flush
+    demux_thread_reset(demuxer);
+    demux_unlock(demuxer);
+    return res;
+}
+
 int demux_info_add(demuxer_t *demuxer, const char *opt, const char *param)
 {
     return demux_info_add_bstr(demuxer, bstr(opt), bstr(param));
@@ -1288,43 +1802,48 @@ char *demux_info_get(demuxer_t *demuxer, const char *opt)
 
 int demux_control(demuxer_t *demuxer, int cmd, void *arg)
 {
+    int res = DEMUXER_CTRL_NOTIMPL;
 
+    demux_lock(demuxer);
     if (demuxer->desc->control)
-        return demuxer->desc->control(demuxer, cmd, arg);
+        res = demuxer->desc->control(demuxer, cmd, arg);
+    demux_unlock(demuxer);
 
-    return DEMUXER_CTRL_NOTIMPL;
+    return res;
 }
 
 int demuxer_switch_audio(demuxer_t *demuxer, int index)
 {
+    demux_lock(demuxer);
     int res = demux_control(demuxer, DEMUXER_CTRL_SWITCH_AUDIO, &index);
     if (res == DEMUXER_CTRL_NOTIMPL) {
         struct sh_audio *sh_audio = demuxer->audio->sh;
-        return sh_audio ? sh_audio->aid : -2;
-    }
-    if (demuxer->audio->id >= 0) {
+        index = sh_audio ? sh_audio->aid : -2;
+    } else if (demuxer->audio->id >= 0) {
         struct sh_audio *sh_audio = demuxer->a_streams[demuxer->audio->id];
         demuxer->audio->sh = sh_audio;
         index = sh_audio->aid; // internal MPEG demuxers don't set it right
     }
     else
         demuxer->audio->sh = NULL;
+    demux_unlock(demuxer);
     return index;
 }
 
 int demuxer_switch_video(demuxer_t *demuxer, int index)
 {
+    demux_lock(demuxer);
     int res = demux_control(demuxer, DEMUXER_CTRL_SWITCH_VIDEO, &index);
     if (res == DEMUXER_CTRL_NOTIMPL) {
         struct sh_video *sh_video = demuxer->video->sh;
-        return sh_video ? sh_video->vid : -2;
-    }
-    if (demuxer->video->id >= 0) {
+        index = sh_video ? sh_video->vid : -2;
+    } else if (demuxer->video->id >= 0) {
         struct sh_video *sh_video = demuxer->v_streams[demuxer->video->id];
         demuxer->video->sh = sh_video;
         index = sh_video->vid; // internal MPEG demuxers don't set it right
     } else
         demuxer->video->sh = NULL;
+    demux_unlock(demuxer);
     return index;
 }
 
@@ -1378,12 +1897,14 @@ int demuxer_seek_chapter(demuxer_t *demuxer, int chapter, double *seek_pts)
     int ris;
 
     if (!demuxer->num_chapters || !demuxer->chapters) {
+        demux_lock(demuxer);
         demux_flush(demuxer);
 
         ris = stream_control(demuxer->stream, STREAM_CTRL_SEEK_TO_CHAPTER,
                              &chapter);
         if (ris != STREAM_UNSUPPORTED)
             demux_control(demuxer, DEMUXER_CTRL_RESYNC, NULL);
+        demux_unlock(demuxer);
 
         // exit status may be ok, but main() doesn't have to seek itself
         // (because e.g. dvds depend on sectors, not on pts)
@@ -1406,9 +1927,11 @@ int demuxer_get_current_chapter(demuxer_t *demuxer, double time_now)
 {
     int chapter = -2;
     if (!demuxer->num_chapters || !demuxer->chapters) {
+        demux_lock(demuxer);
         if (stream_control(demuxer->stream, STREAM_CTRL_GET_CURRENT_CHAPTER,
                            &chapter) == STREAM_UNSUPPORTED)
             chapter = -2;
+        demux_unlock(demuxer);
     } else {
         uint64_t now = time_now * 1e9 + 0.5;
         for (chapter = demuxer->num_chapters - 1; chapter >= 0; --chapter) {
@@ -1444,9 +1967,11 @@ int demuxer_chapter_count(demuxer_t *demuxer)
 {
     if (!demuxer->num_chapters || !demuxer->chapters) {
         int num_chapters = 0;
+        demux_lock(demuxer);
         if (stream_control(demuxer->stream, STREAM_CTRL_GET_NUM_CHAPTERS,
                            &num_chapters) == STREAM_UNSUPPORTED)
             num_chapters = 0;
+        demux_unlock(demuxer);
         return num_chapters;
     } else
         return demuxer->num_chapters;
@@ -1456,7 +1981,9 @@ int demuxer_angles_count(demuxer_t *demuxer)
 {
     int ris, angles = -1;
 
+    demux_lock(demuxer);
     ris = stream_control(demuxer->stream, STREAM_CTRL_GET_NUM_ANGLES, &angles);
+    demux_unlock(demuxer);
     if (ris == STREAM_UNSUPPORTED)
         return -1;
     return angles;
@@ -1465,7 +1992,9 @@ int demuxer_angles_count(demuxer_t *demuxer)
 int demuxer_get_current_angle(demuxer_t *demuxer)
 {
     int ris, curr_angle = -1;
+    demux_lock(demuxer);
     ris = stream_control(demuxer->stream, STREAM_CTRL_GET_ANGLE, &curr_angle);
+    demux_unlock(demuxer);
     if (ris == STREAM_UNSUPPORTED)
         return -1;
     return curr_angle;
@@ -1480,15 +2009,15 @@ int demuxer_set_angle(demuxer_t *demuxer, int angle)
     if ((angles < 1) || (angle > angles))
         return -1;
 
+    demux_lock(demuxer);
     demux_flush(demuxer);
 
     ris = stream_control(demuxer->stream, STREAM_CTRL_SET_ANGLE, &angle);
-    if (ris == STREAM_UNSUPPORTED)
-        return -1;
-
-    demux_control(demuxer, DEMUXER_CTRL_RESYNC, NULL);
+    if (ris != STREAM_UNSUPPORTED)
+        demux_control(demuxer, DEMUXER_CTRL_RESYNC, NULL);
+    demux_unlock(demuxer);
 
-    return angle;
+    return ris == STREAM_UNSUPPORTED ? -1 : angle;
 }
 
 int demuxer_audio_track_by_lang_and_default(struct demuxer *d, char **langt)
@@ -279,6 +279,7 @@ typedef struct demuxer {
     char **info;  // metadata
     struct MPOpts *opts;
     struct demuxer_params *params;
+    struct demux_thread *thread; // set while the demuxer thread is running
 } demuxer_t;
 
 typedef struct {
@@ -293,6 +294,16 @@ void resize_demux_packet(struct demux_packet *dp, size_t len);
 struct demux_packet *clone_demux_packet(struct demux_packet *pack);
 void free_demux_packet(struct demux_packet *dp);
 
+struct demux_packet_pool_stats {
+    int64_t allocations;       // packet buffers requested
+    int64_t reused;            // ... of which were served from the pool
+    int64_t oversized;         // ... of which were too large to be pooled
+    int64_t bytes_in_use;      // allocated size of all live packet buffers
+    int64_t peak_bytes_in_use;
+    int64_t idle_bytes;        // memory held by the pool for reuse
+};
+void demux_packet_pool_stats(struct demux_packet_pool_stats *stats);
+
 #ifndef SIZE_MAX
 #define SIZE_MAX ((size_t)-1)
 #endif
@@ -368,6 +379,13 @@ struct demuxer *demux_open_withparams(struct MPOpts *opts,
         struct stream *stream, int file_format, int aid, int vid, int sid,
         char *filename, struct demuxer_params *params);
 
+// Move demuxing to a separate thread that reads ahead (--demuxer-thread).
+void demux_start_thread(struct demuxer *demuxer);
+// Required around direct access to demuxer or stream state by the player
+// while the demuxer thread runs. Recursive, no-op without the thread.
+void demux_lock(struct demuxer *demuxer);
+void demux_unlock(struct demuxer *demuxer);
+
 void demux_flush(struct demuxer *demuxer);
 int demux_seek(struct demuxer *demuxer, float rel_seek_secs, float audio_delay,
                int flags);
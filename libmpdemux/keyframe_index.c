@@ -0,0 +1,348 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A cache file consists of a header, the key, and the entries in the order
+ * of their positions. It is replaced as a whole (written to a temporary
+ * file and renamed) when the demuxer is closed, so readers only ever see
+ * complete files.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "talloc.h"
+#include "mp_msg.h"
+#include "mpcommon.h"
+#include "options.h"
+#include "path.h"
+#include "osdep/io.h"
+#include "stream/stream.h"
+#include "demuxer.h"
+#include "aviheader.h"
+#include "keyframe_index.h"
+
+#define KF_INDEX_MAGIC "MPKI0001"
+// refuse cache files that would take unreasonable amounts of memory
+#define KF_INDEX_MAX_ENTRIES (16 * 1024 * 1024)
+
+struct file_header {
+    char magic[8];
+    int64_t size;
+    int32_t key_len;
+    int32_t num_entries;
+};
+
+struct file_entry {
+    double pts;
+    int64_t pos;
+    int64_t joined;
+};
+
+struct kf_index {
+    struct kf_index_entry *entries;
+    int num_entries;
+    double min_interval;
+    int last;           // entry added or found last, -1 after a seek
+    bool disabled;      // timestamps are not usable
+
+    // persistence, path is NULL if the index is not saved
+    char *path;
+    char *key;
+    int64_t size;
+    bool dirty;
+};
+
+static uint64_t hash_key(const char *key, int64_t size)
+{
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const char *p = key; *p; p++)
+        h = (h ^ (uint8_t)*p) * 0x100000001b3ULL;
+    for (int i = 0; i < 8; i++)
+        h = (h ^ (uint8_t)(size >> (i * 8))) * 0x100000001b3ULL;
+    return h;
+}
+
+// Something that changes whenever the file does, or NULL if there is no
+// way to tell.
+static char *file_identity(void *ctx, struct stream *s)
+{
+    struct stat st;
+    if (s->type == STREAMTYPE_FILE && s->fd >= 0 && fstat(s->fd, &st) == 0)
+        return talloc_asprintf(ctx, "file %s %"PRIu64" %"PRIu64" %"PRId64,
+                               s->url ? mp_basename(s->url) : "",
+                               (uint64_t)st.st_dev, (uint64_t)st.st_ino,
+                               (int64_t)st.st_mtime);
+    if (s->url && s->disk_cache_validator && s->disk_cache_validator[0])
+        return talloc_asprintf(ctx, "url %s %s", s->url,
+                               s->disk_cache_validator);
+    return NULL;
+}
+
+static bool entries_valid(struct kf_index_entry *e, int num)
+{
+    for (int i = 1; i < num; i++)
+        if (e[i].pos <= e[i - 1].pos || e[i].pts < e[i - 1].pts)
+            return false;
+    return true;
+}
+
+static void load(struct kf_index *idx)
+{
+    struct file_header hdr;
+    FILE *f = fopen(idx->path, "rb");
+    if (!f)
+        return;
+    int key_len = strlen(idx->key);
+    char *key = talloc_size(NULL, key_len);
+    struct file_entry *fe = NULL;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr.magic, KF_INDEX_MAGIC, 8) || hdr.size != idx->size ||
+        hdr.key_len != key_len || hdr.num_entries <= 0 ||
+        hdr.num_entries > KF_INDEX_MAX_ENTRIES ||
+        fread(key, key_len, 1, f) != 1 || memcmp(key, idx->key, key_len))
+        goto done;
+    fe = talloc_array(key, struct file_entry, hdr.num_entries);
+    size_t num = hdr.num_entries;
+    if (fread(fe, sizeof(*fe), num, f) != num)
+        goto done;
+
+    struct kf_index_entry *e = talloc_array(idx, struct kf_index_entry,
+                                            hdr.num_entries);
+    for (int i = 0; i < hdr.num_entries; i++)
+        e[i] = (struct kf_index_entry){fe[i].pts, fe[i].pos, fe[i].joined};
+    if (!entries_valid(e, hdr.num_entries)) {
+        talloc_free(e);
+        goto done;
+    }
+    talloc_free(idx->entries);
+    idx->entries = e;
+    idx->num_entries = hdr.num_entries;
+    mp_msg(MSGT_DEMUX, MSGL_V, "[kf_index] Loaded %d keyframes from %s\n",
+           idx->num_entries, idx->path);
+done:
+    talloc_free(key);
+    fclose(f);
+}
+
+static void save(struct kf_index *idx)
+{
+    if (!idx->path || !idx->dirty || idx->disabled || !idx->num_entries)
+        return;
+    void *tmp = talloc_new(NULL);
+    char *tmp_path = talloc_asprintf(tmp, "%s.tmp", idx->path);
+    struct file_header hdr = {
+        .size = idx->size,
+        .key_len = strlen(idx->key),
+        .num_entries = idx->num_entries,
+    };
+    memcpy(hdr.magic, KF_INDEX_MAGIC, 8);
+    struct file_entry *fe = talloc_array(tmp, struct file_entry,
+                                         idx->num_entries);
+    for (int i = 0; i < idx->num_entries; i++) {
+        struct kf_index_entry *e = &idx->entries[i];
+        fe[i] = (struct file_entry){e->pts, e->pos, e->joined};
+    }
+
+    FILE *f = fopen(tmp_path, "wb");
+    bool ok = f && fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(idx->key, hdr.key_len, 1, f) == 1 &&
+              fwrite(fe, sizeof(*fe), idx->num_entries, f) ==
+                  (size_t)idx->num_entries;
+    if (f && fclose(f) != 0)
+        ok = false;
+    if (ok && rename(tmp_path, idx->path) == 0) {
+        mp_msg(MSGT_DEMUX, MSGL_V, "[kf_index] Saved %d keyframes to %s\n",
+               idx->num_entries, idx->path);
+    } else {
+        mp_msg(MSGT_DEMUX, MSGL_WARN, "[kf_index] Cannot write %s: %s\n",
+               idx->path, strerror(errno));
+        unlink(tmp_path);
+    }
+    talloc_free(tmp);
+}
+
+struct kf_index *kf_index_open(struct demuxer *demuxer, double min_interval)
+{
+    struct kf_index *idx = talloc_zero(NULL, struct kf_index);
+    idx->entries = talloc_array(idx, struct kf_index_entry, 16);
+    idx->min_interval = min_interval;
+    idx->last = -1;
+
+    struct stream *s = demuxer->stream;
+    const char *dir = demuxer->opts->index_cache_dir;
+    char *identity = file_identity(idx, s);
+    if (!dir || !dir[0] || !demuxer->seekable || !identity || s->end_pos <= 0)
+        return idx;
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        mp_msg(MSGT_DEMUX, MSGL_ERR, "[kf_index] Cannot create %s: %s\n",
+               dir, strerror(errno));
+        return idx;
+    }
+    idx->key = talloc_asprintf(idx, "%s %s", demuxer->desc->name, identity);
+    idx->size = s->end_pos;
+    idx->path = talloc_asprintf(idx, "%s/%016"PRIx64".kfi", dir,
+                                hash_key(idx->key, idx->size));
+    load(idx);
+    return idx;
+}
+
+void kf_index_close(struct kf_index *idx)
+{
+    if (!idx)
+        return;
+    save(idx);
+    talloc_free(idx);
+}
+
+// Index of the first entry at pos or after it.
+static int find_pos(struct kf_index *idx, int64_t pos)
+{
+    int lo = 0, hi = idx->num_entries;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (idx->entries[mid].pos < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void kf_index_add(struct kf_index *idx, double pts, int64_t pos)
+{
+    if (idx->disabled || pts == MP_NOPTS_VALUE || pos < 0)
+        return;
+    struct kf_index_entry *e = idx->entries;
+    int n = idx->num_entries;
+    int i = find_pos(idx, pos);
+    bool joined = idx->last >= 0 && idx->last == i - 1;
+
+    if (i < n && e[i].pos == pos) {     // known already
+        if (joined && !e[i].joined) {
+            e[i].joined = true;
+            idx->dirty = true;
+        }
+        idx->last = i;
+        return;
+    }
+    if ((i > 0 && pts < e[i - 1].pts) || (i < n && pts > e[i].pts)) {
+        mp_msg(MSGT_DEMUX, MSGL_V, "[kf_index] Timestamps are not monotonic, "
+               "disabling the keyframe index.\n");
+        idx->disabled = true;
+        return;
+    }
+    // Skipping keyframes close to the previous one still leaves the range
+    // joined; seeks just land up to min_interval earlier.
+    if (joined && pts - e[i - 1].pts < idx->min_interval)
+        return;
+
+    MP_GROW_ARRAY(idx->entries, idx->num_entries);
+    e = idx->entries;
+    memmove(&e[i + 1], &e[i], (n - i) * sizeof(*e));
+    // Inside a joined range, the new entry is joined as well.
+    e[i] = (struct kf_index_entry){
+        pts, pos, joined || (i < n && e[i + 1].joined)
+    };
+    idx->num_entries++;
+    idx->last = i;
+    idx->dirty = true;
+}
+
+void kf_index_break(struct kf_index *idx)
+{
+    idx->last = -1;
+}
+
+const struct kf_index_entry *kf_index_find(struct kf_index *idx, double pts,
+                                           int flags, bool *exact)
+{
+    struct kf_index_entry *e = idx->entries;
+    int n = idx->num_entries;
+    *exact = false;
+    if (idx->disabled || !n)
+        return NULL;
+    // number of entries at or before pts
+    int lo = 0, hi = n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (e[mid].pts <= pts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int i;
+    if (flags & SEEK_BACKWARD) {
+        if (lo == 0)
+            return NULL;
+        i = lo - 1;
+        *exact = e[i].pts == pts || (lo < n && e[lo].joined);
+    } else {
+        i = lo > 0 && e[lo - 1].pts == pts ? lo - 1 : lo;
+        if (i == n)
+            return NULL;
+        *exact = e[i].pts == pts || (i > 0 && e[i].joined);
+    }
+    return &e[i];
+}
+
+const struct kf_index_entry *kf_index_last(struct kf_index *idx)
+{
+    if (idx->disabled || !idx->num_entries)
+        return NULL;
+    return &idx->entries[idx->num_entries - 1];
+}
+
+bool kf_index_is_keyframe(uint32_t format, const unsigned char *buf, int len)
+{
+    for (int i = 0; i + 4 < len; i++) {
+        if (buf[i] || buf[i + 1] || buf[i + 2] != 1)
+            continue;
+        int code = 0x100 | buf[i + 3];
+        switch (format) {
+        case 0x10000001:        // MPEG-1
+        case 0x10000002:        // MPEG-2
+            // sequence or GOP header
+            if (code == 0x1B3 || code == 0x1B8)
+                return true;
+            break;
+        case 0x10000004:        // MPEG-4
+            // I-VOP
+            if (code == 0x1B6 && (buf[i + 4] & 0xC0) == 0)
+                return true;
+            break;
+        case 0x10000005:        // H.264
+            // IDR slice or SPS
+            if ((code & ~0x60) == 0x105 || (code & ~0x60) == 0x107)
+                return true;
+            break;
+        case mmioFOURCC('W', 'V', 'C', '1'):
+            // entry point or sequence header
+            if (code == 0x10E || code == 0x10F)
+                return true;
+            break;
+        default:
+            return false;
+        }
+    }
+    return false;
+}
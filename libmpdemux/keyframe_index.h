@@ -0,0 +1,73 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_KEYFRAME_INDEX_H
+#define MPLAYER_KEYFRAME_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct demuxer;
+
+/* Keyframe index for demuxers of files without a (usable) index.
+ *
+ * The demuxer adds the pts and file position of keyframes as it reads
+ * them, during playback or while scanning for a seek target, and looks up
+ * seek targets in the index instead of estimating a position. Entries are
+ * kept sorted by position, and their pts must increase with the position;
+ * if they don't (timestamp resets or wraps) the index disables itself.
+ *
+ * An entry is "joined" to the previous one if the demuxer read the file
+ * continuously between the two, so no keyframe more than min_interval
+ * seconds apart from its neighbors can be missing there. Lookups report
+ * whether the target lies within such a contiguous range.
+ *
+ * With --index-cache-dir, the index is loaded from and saved to a file in
+ * that directory, keyed by the identity of the file (device, inode, size
+ * and mtime for local files; URL, size and validator for remote streams
+ * with a --disk-cache-dir validator) and the demuxer.
+ */
+
+struct kf_index_entry {
+    double pts;
+    int64_t pos;
+    bool joined;
+};
+
+struct kf_index;
+
+struct kf_index *kf_index_open(struct demuxer *demuxer, double min_interval);
+// Save the index if it changed, and free it.
+void kf_index_close(struct kf_index *idx);
+
+void kf_index_add(struct kf_index *idx, double pts, int64_t pos);
+// The demuxer seeked; the next entry added is not joined to the last one.
+void kf_index_break(struct kf_index *idx);
+
+// Return the last keyframe at or before pts with SEEK_BACKWARD in flags,
+// else the first keyframe at or after pts; NULL if there is none. *exact is
+// set if no keyframe between the target and the result can be missing.
+const struct kf_index_entry *kf_index_find(struct kf_index *idx, double pts,
+                                           int flags, bool *exact);
+// Entry with the highest position, NULL if the index is empty.
+const struct kf_index_entry *kf_index_last(struct kf_index *idx);
+
+// Whether a video packet of the given format (as in sh_video->format)
+// contains the start of a keyframe, judged by its start codes.
+bool kf_index_is_keyframe(uint32_t format, const unsigned char *buf, int len);
+
+#endif /* MPLAYER_KEYFRAME_INDEX_H */
@@ -38,6 +38,7 @@
 #include "mp_fifo.h"
 #include "m_config.h"
 #include "mp_msg.h"
+#include "profiler.h"
 
 #include "osdep/shmem.h"
 #ifdef CONFIG_X11
@@ -203,20 +204,22 @@ int vo_draw_image(struct vo *vo, struct mp_image *mpi, double pts)
 {
     if (!vo->config_ok)
         return 0;
+    int ret = 0;
+    struct mp_prof_scope prof;
+    MP_PROF_BEGIN(&prof, "vo_draw");
     if (vo->driver->buffer_frames) {
         vo->driver->draw_image(vo, mpi, pts);
-        return 0;
-    }
-    vo->frame_loaded = true;
-    vo->next_pts = pts;
-    // Guaranteed to support at least DRAW_IMAGE later
-    if (vo->driver->is_new) {
-        vo->waiting_mpi = mpi;
-        return 0;
+    } else {
+        vo->frame_loaded = true;
+        vo->next_pts = pts;
+        // Guaranteed to support at least DRAW_IMAGE later
+        if (vo->driver->is_new)
+            vo->waiting_mpi = mpi;
+        else if (vo_control(vo, VOCTRL_DRAW_IMAGE, mpi) == VO_NOTIMPL)
+            ret = -1;
     }
-    if (vo_control(vo, VOCTRL_DRAW_IMAGE, mpi) == VO_NOTIMPL)
-        return -1;
-    return 0;
+    MP_PROF_END(&prof);
+    return ret;
 }
 
 int vo_redraw_frame(struct vo *vo)
@@ -265,12 +268,15 @@ void vo_new_frame_imminent(struct vo *vo)
 {
     if (!vo->driver->is_new)
         return;
+    struct mp_prof_scope prof;
+    MP_PROF_BEGIN(&prof, "vo_draw");
     if (vo->driver->buffer_frames)
         vo_control(vo, VOCTRL_NEWFRAME, NULL);
     else {
         vo_control(vo, VOCTRL_DRAW_IMAGE, vo->waiting_mpi);
         vo->waiting_mpi = NULL;
     }
+    MP_PROF_END(&prof);
 }
 
 void vo_draw_osd(struct vo *vo, struct osd_state *osd)
@@ -280,7 +286,7 @@ void vo_draw_osd(struct vo *vo, struct osd_state *osd)
     vo->driver->draw_osd(vo, osd);
 }
 
-void vo_flip_page(struct vo *vo, unsigned int pts_us, int duration)
+void vo_flip_page(struct vo *vo, int64_t pts_ns, int duration)
 {
     if (!vo->config_ok)
         return;
@@ -290,10 +296,13 @@ void vo_flip_page(struct vo *vo, unsigned int pts_us, int duration)
     }
     vo->want_redraw = false;
     vo->redrawing = false;
+    struct mp_prof_scope prof;
+    MP_PROF_BEGIN(&prof, "vo_flip");
     if (vo->driver->flip_page_timed)
-        vo->driver->flip_page_timed(vo, pts_us, duration);
+        vo->driver->flip_page_timed(vo, pts_ns, duration);
     else
         vo->driver->flip_page(vo);
+    MP_PROF_END(&prof);
     vo->hasframe = true;
 }
 
@@ -107,7 +107,7 @@ struct vdpctx {
     VdpPresentationQueueTarget         flip_target;
     VdpPresentationQueue               flip_queue;
     uint64_t                           last_vdp_time;
-    unsigned int                       last_sync_update;
+    int64_t                            last_sync_update;
 
     VdpOutputSurface                   output_surfaces[MAX_OUTPUT_SURFACES];
     VdpOutputSurface                   screenshot_surface;
@@ -197,19 +197,19 @@ struct vdpctx {
     bool mode_switched;
 };
 
-static int change_vdptime_sync(struct vdpctx *vc, unsigned int *t)
+static int change_vdptime_sync(struct vdpctx *vc, int64_t *t)
 {
     struct vdp_functions *vdp = vc->vdp;
     VdpStatus vdp_st;
     VdpTime vdp_time;
     vdp_st = vdp->presentation_queue_get_time(vc->flip_queue, &vdp_time);
     CHECK_ST_ERROR("Error when calling vdp_presentation_queue_get_time");
-    unsigned int t1 = *t;
-    unsigned int t2 = GetTimer();
-    uint64_t old = vc->last_vdp_time + (t1 - vc->last_sync_update) * 1000ULL;
+    int64_t t1 = *t;
+    int64_t t2 = mp_time_ns();
+    uint64_t old = vc->last_vdp_time + (t1 - vc->last_sync_update);
     if (vdp_time > old)
-        if (vdp_time > old + (t2 - t1) * 1000ULL)
-            vdp_time -= (t2 - t1) * 1000ULL;
+        if (vdp_time > old + (t2 - t1))
+            vdp_time -= t2 - t1;
         else
             vdp_time = old;
     mp_msg(MSGT_VO, MSGL_DBG2, "[vdpau] adjusting VdpTime offset by %f µs\n",
@@ -224,19 +224,19 @@ static uint64_t sync_vdptime(struct vo *vo)
 {
     struct vdpctx *vc = vo->priv;
 
-    unsigned int t = GetTimer();
-    if (t - vc->last_sync_update > 5000000)
+    int64_t t = mp_time_ns();
+    if (t - vc->last_sync_update > 5000000000LL)
         change_vdptime_sync(vc, &t);
-    uint64_t now = (t - vc->last_sync_update) * 1000ULL + vc->last_vdp_time;
+    uint64_t now = (t - vc->last_sync_update) + vc->last_vdp_time;
     // Make sure nanosecond inaccuracies don't make things inconsistent
     now = FFMAX(now, vc->recent_vsync_time);
     return now;
 }
 
-static uint64_t convert_to_vdptime(struct vo *vo, unsigned int t)
+static uint64_t convert_to_vdptime(struct vo *vo, int64_t t)
 {
     struct vdpctx *vc = vo->priv;
-    return (int)(t - vc->last_sync_update) * 1000LL + vc->last_vdp_time;
+    return (t - vc->last_sync_update) + vc->last_vdp_time;
 }
 
 static int render_video_to_output_surface(struct vo *vo,
@@ -532,7 +532,7 @@ static int win_x11_init_vdpau_flip_queue(struct vo *vo)
     vdp_st = vdp->presentation_queue_get_time(vc->flip_queue, &vdp_time);
     CHECK_ST_ERROR("Error when calling vdp_presentation_queue_get_time");
     vc->last_vdp_time = vdp_time;
-    vc->last_sync_update = GetTimer();
+    vc->last_sync_update = mp_time_ns();
 
     vc->vsync_interval = 1;
     if (vc->composite_detect && vo_x11_screen_is_composited(vo)) {
@@ -1322,7 +1322,7 @@ static inline uint64_t prev_vs2(struct vdpctx *vc, uint64_t ts, int shift)
     return ts - offset;
 }
 
-static void flip_page_timed(struct vo *vo, unsigned int pts_us, int duration)
+static void flip_page_timed(struct vo *vo, int64_t pts_ns, int duration)
 {
     struct vdpctx *vc = vo->priv;
     struct vdp_functions *vdp = vc->vdp;
@@ -1341,7 +1341,7 @@ static void flip_page_timed(struct vo *vo, unsigned int pts_us, int duration)
         duration = -1;  // Make sure drop logic is disabled
 
     uint64_t now = sync_vdptime(vo);
-    uint64_t pts = pts_us ? convert_to_vdptime(vo, pts_us) : now;
+    uint64_t pts = pts_ns ? convert_to_vdptime(vo, pts_ns) : now;
     uint64_t ideal_pts = pts;
     uint64_t npts = duration >= 0 ? pts + duration : UINT64_MAX;
 
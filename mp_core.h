@@ -20,6 +20,7 @@
 #define MPLAYER_MP_CORE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "options.h"
 #include "mixer.h"
@@ -165,9 +166,9 @@ typedef struct MPContext {
     unsigned int start_timestamp;
 
     // Timestamp from the last time some timing functions read the
-    // current time, in (occasionally wrapping) microseconds. Used
-    // to turn a new time value to a delta from last time.
-    unsigned int last_time;
+    // current time, from mp_time_ns(). Used to turn a new time value
+    // to a delta from last time.
+    int64_t last_time;
 
     // Used to communicate the parameters of a seek between parts
     struct seek_params {
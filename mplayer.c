@@ -37,11 +37,13 @@
 // No proper file descriptor event handling; keep waking up to poll input
 #define WAKEUP_PERIOD 0.02
 #else
-/* Even if we can immediately wake up in response to most input events,
- * there are some timers which are not registered to the event loop
- * and need to be checked periodically (like automatic mouse cursor hiding).
- * OSD content updates behave similarly. Also some uncommon input devices
- * may not have proper FD event support.
+/* The playloop sleeps in mp_input_wait() until the next frame or audio
+ * deadline, and wakes up immediately on input events or mp_input_wakeup()
+ * calls from the audio output or the cache. Still, there are some timers
+ * which are not registered to the event loop and need to be checked
+ * periodically (like automatic mouse cursor hiding). OSD content updates
+ * behave similarly. Also some uncommon input devices may not have proper
+ * FD event support.
  */
 #define WAKEUP_PERIOD 0.5
 #endif
@@ -88,6 +90,7 @@
 #include "mp_osd.h"
 #include "libvo/video_out.h"
 #include "screenshot.h"
+#include "profiler.h"
 
 #include "sub/sub.h"
 #include "libmpcodecs/dec_teletext.h"
@@ -324,10 +327,10 @@ int use_filename_title;
 
 static float get_relative_time(struct MPContext *mpctx)
 {
-    unsigned int new_time = GetTimer();
-    unsigned int delta = new_time - mpctx->last_time;
+    int64_t new_time = mp_time_ns();
+    int64_t delta = new_time - mpctx->last_time;
     mpctx->last_time = new_time;
-    return delta * 0.000001;
+    return delta * 1e-9;
 }
 
 static int is_valid_metadata_type(struct MPContext *mpctx, metadata_t type)
@@ -670,6 +673,10 @@ void uninit_player(struct MPContext *mpctx, unsigned int mask)
 void exit_player_with_rc(struct MPContext *mpctx, enum exit_reason how, int rc)
 {
     uninit_player(mpctx, INITIALIZED_ALL);
+    if (mpctx->opts.perf_stats_file)
+        mp_profiler_dump(mpctx->opts.perf_stats_file);
+    if (mpctx->opts.trace_file)
+        mp_trace_dump(mpctx->opts.trace_file);
 #if defined(__MINGW32__) || defined(__CYGWIN__)
     timeEndPeriod(1);
 #endif
@@ -2105,6 +2112,8 @@ static int check_framedrop(struct MPContext *mpctx, double frame_time)
             && !mpctx->restart_playback) {
             ++drop_frame_cnt;
             ++dropped_frames;
+            if (frame_dropping)
+                mp_trace_instant("frame_drop");
             return frame_dropping;
         } else
             dropped_frames = 0;
@@ -2117,6 +2126,19 @@ static int check_framedrop(struct MPContext *mpctx, double frame_time)
 int rtc_fd = -1;
 #endif
 
+/* How long before a frame deadline the playloop stops waiting for events
+ * and sleeps with timing_sleep() instead. Event waits are only accurate to
+ * a millisecond; the RTC is only read in timing_sleep().
+ */
+static double frame_wait_margin(void)
+{
+#ifdef HAVE_RTC
+    if (rtc_fd >= 0)
+        return 0.040;
+#endif
+    return 0.001;
+}
+
 static float timing_sleep(struct MPContext *mpctx, float time_frame)
 {
 #ifdef HAVE_RTC
@@ -2138,8 +2160,10 @@ static float timing_sleep(struct MPContext *mpctx, float time_frame)
         struct MPOpts *opts = &mpctx->opts;
         float margin = opts->softsleep ? 0.011 : 0;
         current_module = "sleep_timer";
-        while (time_frame > margin) {
-            usec_sleep(1000000 * (time_frame - margin));
+        if (time_frame > margin) {
+            // time_frame is relative to the last get_relative_time() call
+            mp_sleep_until_ns(mpctx->last_time +
+                              (int64_t)((time_frame - margin) * 1e9));
             time_frame -= get_relative_time(mpctx);
         }
         if (opts->softsleep) {
@@ -2495,6 +2519,7 @@ static int fill_audio_out_buffers(struct MPContext *mpctx, double endpts)
     sh_audio_t * const sh_audio = mpctx->sh_audio;
     bool modifiable_audio_format = !(ao->format & AF_FORMAT_SPECIAL_MASK);
     int unitsize = ao->channels * af_fmt2bits(ao->format) / 8;
+    MP_PROF_SCOPE("fill_audio_out_buffers");
 
     current_module = "play_audio";
 
@@ -2607,9 +2632,11 @@ int reinit_video_chain(struct MPContext *mpctx)
         mpctx->initialized_flags |= INITIALIZED_VO;
     }
 
+    demux_lock(mpctx->demuxer);
     if (stream_control(mpctx->demuxer->stream, STREAM_CTRL_GET_ASPECT_RATIO,
                 &ar) != STREAM_UNSUPPORTED)
         mpctx->sh_video->stream_aspect = ar;
+    demux_unlock(mpctx->demuxer);
     current_module = "init_video_filters";
     {
         char *vf_arg[] = {
@@ -2735,7 +2762,11 @@ static double update_video_nocorrect_pts(struct MPContext *mpctx)
                 mpctx->stream->eof = 0;
             } else
 #endif
-            return -1;
+            {
+                if (vf_flush_queued_frame(sh_video->vfilter))
+                    break;
+                return -1;
+            }
         }
         if (in_size > max_framesize)
             max_framesize = in_size;
@@ -2802,6 +2833,7 @@ static double update_video(struct MPContext *mpctx)
 {
     struct sh_video *sh_video = mpctx->sh_video;
     struct vo *video_out = mpctx->video_out;
+    MP_PROF_SCOPE("update_video");
     sh_video->vfilter->control(sh_video->vfilter, VFCTRL_SET_OSD_OBJ,
                                mpctx->osd); // hack for vf_expand
     if (!mpctx->opts.correct_pts)
@@ -2850,6 +2882,8 @@ static double update_video(struct MPContext *mpctx)
             current_module = "filter video";
             filter_video(sh_video, decoded_frame, sh_video->pts);
         } else if (!pkt) {
+            if (vf_flush_queued_frame(sh_video->vfilter))
+                break;
             if (vo_get_buffered_frame(video_out, true) < 0)
                 return -1;
         }
@@ -2905,6 +2939,14 @@ static int get_cache_fill(struct MPContext *mpctx)
     return -1;
 }
 
+static void set_cache_wakeup(struct MPContext *mpctx, bool enable)
+{
+#ifdef CONFIG_STREAM_CACHE
+    if (mpctx->stream && mpctx->stream->cached)
+        cache_set_player_wakeup(mpctx->stream, enable);
+#endif
+}
+
 static void update_pause_message(struct MPContext *mpctx)
 {
     struct MPOpts *opts = &mpctx->opts;
@@ -2956,6 +2998,7 @@ void pause_player(struct MPContext *mpctx)
     mpctx->paused_cache_fill = get_cache_fill(mpctx);
     mpctx->status_printed = true;
     update_pause_message(mpctx);
+    set_cache_wakeup(mpctx, true);
 
     if (!mpctx->opts.quiet)
         mp_msg(MSGT_IDENTIFY, MSGL_INFO, "ID_PAUSED\n");
@@ -2968,6 +3011,7 @@ void unpause_player(struct MPContext *mpctx)
     mpctx->paused = 0;
     if (!mpctx->step_frames)
         mpctx->osd_function = OSD_PLAY;
+    set_cache_wakeup(mpctx, false);
 
     if (mpctx->ao && mpctx->sh_audio)
         ao_resume(mpctx->ao);
@@ -3012,6 +3056,8 @@ static void seek_reset(struct MPContext *mpctx, bool reset_ao, bool reset_ac)
         resync_video_stream(mpctx->sh_video);
         mpctx->sh_video->timer = 0;
         vo_seek_reset(mpctx->video_out);
+        mpctx->sh_video->vfilter->control(mpctx->sh_video->vfilter,
+                                          VFCTRL_SEEK_RESET, NULL);
         mpctx->sh_video->timer = 0;
         mpctx->sh_video->num_buffered_pts = 0;
         mpctx->sh_video->last_pts = MP_NOPTS_VALUE;
@@ -3099,6 +3145,7 @@ static int seek(MPContext *mpctx, struct seek_params seek,
                 bool timeline_fallthrough)
 {
     struct MPOpts *opts = &mpctx->opts;
+    MP_PROF_SCOPE("seek");
 
     current_module = "seek";
     if (mpctx->stop_play == AT_END_OF_FILE)
@@ -3512,8 +3559,10 @@ static void run_playloop(struct MPContext *mpctx)
         }
 
         double vsleep = mpctx->time_frame - vo->flip_queue_offset;
-        if (vsleep > 0.050) {
-            sleeptime = FFMIN(sleeptime, vsleep - 0.040);
+        double margin = frame_wait_margin();
+        if (vsleep > margin + 0.001) {
+            // wait for the deadline below, handling events meanwhile
+            sleeptime = FFMIN(sleeptime, vsleep - margin);
             break;
         }
         sleeptime = 0;
@@ -3531,8 +3580,11 @@ static void run_playloop(struct MPContext *mpctx)
         mpctx->osd->sub_pts = mpctx->video_pts;
         if (mpctx->osd->sub_pts != MP_NOPTS_VALUE)
             mpctx->osd->sub_pts += opts->sub_delay - mpctx->osd->sub_offset;
+        struct mp_prof_scope prof;
+        MP_PROF_BEGIN(&prof, "osd");
         vf->control(vf, VFCTRL_DRAW_EOSD, mpctx->osd);
         vf->control(vf, VFCTRL_DRAW_OSD, mpctx->osd);
+        MP_PROF_END(&prof);
         vo_osd_changed(0);
 
         mpctx->time_frame -= get_relative_time(mpctx);
@@ -3546,9 +3598,9 @@ static void run_playloop(struct MPContext *mpctx)
         unsigned int t2 = GetTimer();
         /* Playing with playback speed it's possible to get pathological
          * cases with mpctx->time_frame negative enough to cause an
-         * overflow in pts_us calculation, thus the FFMAX. */
+         * overflow in pts_ns calculation, thus the FFMAX. */
         double time_frame = FFMAX(mpctx->time_frame, -1);
-        unsigned int pts_us = mpctx->last_time + time_frame * 1e6;
+        int64_t pts_ns = mpctx->last_time + (int64_t)(time_frame * 1e9);
         int duration = -1;
         double pts2 = vo->next_pts2;
         if (pts2 != MP_NOPTS_VALUE && opts->correct_pts &&
@@ -3564,7 +3616,7 @@ static void run_playloop(struct MPContext *mpctx)
                 diff = 10;
             duration = diff * 1e6;
         }
-        vo_flip_page(vo, pts_us | 1, duration);
+        vo_flip_page(vo, pts_ns | 1, duration);
 
         mpctx->last_vo_flip_duration = (GetTimer() - t2) * 0.000001;
         vout_time_usage += mpctx->last_vo_flip_duration;
@@ -3624,11 +3676,13 @@ static void run_playloop(struct MPContext *mpctx)
 
         if (mp_dvdnav_stream_has_changed(mpctx->stream)) {
             double ar = -1.0;
+            demux_lock(mpctx->demuxer);
             if (mpctx->sh_video &&
                 stream_control(mpctx->demuxer->stream,
                                STREAM_CTRL_GET_ASPECT_RATIO, &ar)
                 != STREAM_UNSUPPORTED)
                 mpctx->sh_video->stream_aspect = ar;
+            demux_unlock(mpctx->demuxer);
         }
     }
 #endif
@@ -3719,7 +3773,7 @@ static void run_playloop(struct MPContext *mpctx)
                     vo_osd_changed(0);
             } else {
             novideo:
-                mp_input_get_cmd(mpctx->input, sleeptime * 1000, true);
+                mp_input_wait(mpctx->input, sleeptime);
             }
         }
     }
@@ -3969,6 +4023,12 @@ int main(int argc, char *argv[])
     set_priority();
 #endif
 
+    if (opts->perf_stats_file)
+        mp_profiler_enable();
+    if (opts->trace_file)
+        mp_trace_enable(opts->trace_buffer);
+    mp_prof_set_thread_name("player");
+
     if (opts->video_driver_list &&
             strcmp(opts->video_driver_list[0], "help") == 0) {
         list_video_out();
@@ -4120,6 +4180,7 @@ int main(int argc, char *argv[])
         mp_input_add_key_fd(mpctx->input, 0, 1, read_keys, NULL, mpctx->key_fifo);
     // Set the libstream interrupt callback
     stream_set_interrupt_callback(mp_input_check_interrupt, mpctx->input);
+    stream_set_wakeup_callback(mp_input_wakeup);
 
     current_module = NULL;
 
@@ -4424,6 +4485,7 @@ goto_enable_cache:
                                       opts->stream_cache_size,
                                       opts->stream_cache_min_percent,
                                       opts->stream_cache_seek_min_percent);
+    set_cache_wakeup(mpctx, mpctx->paused);
     if (res == 0)
         if ((mpctx->stop_play = libmpdemux_was_interrupted(mpctx,
                                                            PT_NEXT_ENTRY)))
@@ -4823,6 +4885,10 @@ goto_enable_cache:
     else if (opts->loop_times == 1)
         opts->loop_times = -1;
 
+    // dvdnav needs the player to drive the stream directly
+    if (opts->demuxer_thread && mpctx->stream->type != STREAMTYPE_DVDNAV)
+        demux_start_thread(mpctx->demuxer);
+
     mp_tmsg(MSGT_CPLAYER, MSGL_INFO, "Starting playback...\n");
 
     total_time_usage_start = GetTimer();
@@ -12,6 +12,7 @@ typedef struct MPOpts {
     float softvol_max;
     int gapless_audio;
     int ao_buffersize;
+    float ao_thread_buffer;
     int screen_size_x;
     int screen_size_y;
     int vo_screenwidth;
@@ -45,6 +46,9 @@ typedef struct MPOpts {
     char *vobsub_name;
     int auto_quality;
     int benchmark;
+    char *perf_stats_file;
+    char *trace_file;
+    int trace_buffer;
     char *stream_dump_name;
     int capture_dump;
     int loop_times;
@@ -55,6 +59,9 @@ typedef struct MPOpts {
     int stream_cache_size;
     float stream_cache_min_percent;
     float stream_cache_seek_min_percent;
+    char *disk_cache_dir;
+    int disk_cache_size;
+    char *index_cache_dir;
     int chapterrange[2];
     int edition_id;
     int correct_pts;
@@ -92,12 +99,17 @@ typedef struct MPOpts {
     char *audio_demuxer_name;
     char *sub_demuxer_name;
     int extension_parsing;
+    int demuxer_thread;
+    float demuxer_readahead_secs;
+    int demuxer_readahead_size;
 
     int audio_output_channels;
     int audio_output_format;
     float playback_speed;
     float drc_level;
     struct m_obj_settings *vf_settings;
+    int vf_threads;
+    int vf_slice_threads;
     int softzoom;
     float movie_aspect;
     float screen_size_xy;
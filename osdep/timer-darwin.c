@@ -51,6 +51,16 @@ int usec_sleep(int usec_delay)
 }
 
 
+int64_t mp_time_ns(void)
+{
+  return mach_absolute_time() * timebase_ratio * 1e9;
+}
+
+void mp_sleep_until_ns(int64_t deadline)
+{
+  mach_wait_until(deadline / (timebase_ratio * 1e9));
+}
+
 /* current time in microseconds */
 unsigned int GetTimer(void)
 {
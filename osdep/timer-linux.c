@@ -24,6 +24,8 @@
 #define usleep(t) snooze(t)
 #endif
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
 #include <time.h>
 #include <sys/time.h>
 #include "config.h"
@@ -48,20 +50,45 @@ int usec_sleep(int usec_delay)
 #endif
 }
 
+int64_t mp_time_ns(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * INT64_C(1000000000) + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * INT64_C(1000000000) + tv.tv_usec * 1000;
+#endif
+}
+
+void mp_sleep_until_ns(int64_t deadline)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_NANOSLEEP)
+    struct timespec ts = {
+        .tv_sec  = deadline / 1000000000,
+        .tv_nsec = deadline % 1000000000,
+    };
+    // returns EINTR when a signal handler ran; sleep the rest
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#else
+    int64_t left = deadline - mp_time_ns();
+    if (left > 0)
+        usec_sleep(left / 1000);
+#endif
+}
+
 // Returns current time in microseconds
 unsigned int GetTimer(void)
 {
-  struct timeval tv;
-  gettimeofday(&tv,NULL);
-  return tv.tv_sec * 1000000 + tv.tv_usec;
+  return mp_time_ns() / 1000;
 }
 
 // Returns current time in milliseconds
 unsigned int GetTimerMS(void)
 {
-  struct timeval tv;
-  gettimeofday(&tv,NULL);
-  return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  return mp_time_ns() / 1000000;
 }
 
 // Initialize timer, must be called at least once at start
@@ -20,10 +20,33 @@
 
 #include <windows.h>
 #include <mmsystem.h>
+#include <stdint.h>
 #include "timer.h"
 
 const char timer_name[] = "Windows native";
 
+static int64_t perf_freq;
+
+int64_t mp_time_ns(void)
+{
+  LARGE_INTEGER count;
+  if (!perf_freq) {
+    // timeGetTime() wraps after 49 days, but is all there is without QPC
+    return timeGetTime() * INT64_C(1000000);
+  }
+  QueryPerformanceCounter(&count);
+  // split to avoid overflowing the multiplication
+  return count.QuadPart / perf_freq * INT64_C(1000000000) +
+         count.QuadPart % perf_freq * INT64_C(1000000000) / perf_freq;
+}
+
+void mp_sleep_until_ns(int64_t deadline)
+{
+  int64_t left = deadline - mp_time_ns();
+  if (left > 0)
+    usec_sleep(left / 1000);
+}
+
 // Returns current time in microseconds
 unsigned int GetTimer(void)
 {
@@ -47,4 +70,7 @@ int usec_sleep(int usec_delay){
 
 void InitTimer(void)
 {
+  LARGE_INTEGER freq;
+  if (QueryPerformanceFrequency(&freq))
+    perf_freq = freq.QuadPart;
 }
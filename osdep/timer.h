@@ -19,12 +19,22 @@
 #ifndef MPLAYER_TIMER_H
 #define MPLAYER_TIMER_H
 
+#include <stdint.h>
+
 extern const char timer_name[];
 
 void InitTimer(void);
+// 32 bit timestamps which wrap around; only use them for short intervals.
 unsigned int GetTimer(void);
 unsigned int GetTimerMS(void);
 
+// Monotonic time in nanoseconds from an arbitrary starting point. It does
+// not jump when the system clock is set and does not wrap.
+int64_t mp_time_ns(void);
+// Sleep until mp_time_ns() reaches the absolute time deadline. Unlike
+// repeated relative sleeps this does not accumulate wakeup latency.
+void mp_sleep_until_ns(int64_t deadline);
+
 int usec_sleep(int usec_delay);
 
 #endif /* MPLAYER_TIMER_H */
@@ -0,0 +1,342 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include <libavutil/common.h>
+
+#include "config.h"
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
+#include "talloc.h"
+#include "mp_msg.h"
+#include "osdep/timer.h"
+#include "profiler.h"
+
+#define MAX_STAGES 64
+
+/* Latencies are counted in log-linear buckets: each power of two range of
+ * nanoseconds is split into 2^SUB_BITS buckets, which bounds the error of
+ * the reported percentiles to about 6%. Values below 2^SUB_BITS get a
+ * bucket each.
+ */
+#define SUB_BITS 3
+#define SUB_COUNT (1 << SUB_BITS)
+#define NUM_BUCKETS ((64 - SUB_BITS + 1) * SUB_COUNT)
+
+struct mp_prof_stage {
+    char name[48];
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+    uint32_t buckets[NUM_BUCKETS];
+};
+
+#define MAX_THREADS 64
+
+/* Trace events are kept in a ring buffer which is overwritten when full.
+ * Writers claim a slot with an atomic increment. A slot's seq is cleared
+ * while it is written and then set to its position + 1, so that the dump
+ * can skip slots that are being overwritten.
+ */
+struct trace_event {
+    uint64_t seq;
+    const char *name;
+    int64_t start;
+    int64_t duration;           // -1 for instant events
+    int tid;
+};
+
+bool mp_profiling;
+bool mp_tracing;
+
+static struct mp_prof_stage stages[MAX_STAGES];
+static int num_stages;
+static int64_t start_time;
+#ifdef HAVE_PTHREADS
+static pthread_mutex_t stages_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static struct trace_event *trace_events;
+static uint64_t trace_size;
+static uint64_t trace_pos;
+static const char *thread_names[MAX_THREADS];
+static int num_threads;
+
+// innermost scope being measured by the current thread
+static __thread struct mp_prof_scope *current_scope;
+// 1-based index of the current thread in the trace
+static __thread int thread_id;
+
+void mp_profiler_enable(void)
+{
+    if (!mp_profiling)
+        start_time = mp_time_ns();
+    mp_profiling = true;
+}
+
+void mp_trace_enable(int max_events)
+{
+    if (mp_tracing)
+        return;
+    trace_size = FFMAX(max_events, 1);
+    trace_events = talloc_zero_array(NULL, struct trace_event, trace_size);
+    mp_profiler_enable();
+    mp_tracing = true;
+}
+
+static int get_thread_id(void)
+{
+    if (!thread_id) {
+        int n = __atomic_fetch_add(&num_threads, 1, __ATOMIC_RELAXED);
+        thread_id = n + 1;
+    }
+    return thread_id;
+}
+
+void mp_prof_set_thread_name(const char *name)
+{
+    int id = get_thread_id();
+    if (id <= MAX_THREADS)
+        __atomic_store_n(&thread_names[id - 1], name, __ATOMIC_RELEASE);
+}
+
+static void trace_add(const char *name, int64_t start, int64_t duration)
+{
+    uint64_t pos = __atomic_fetch_add(&trace_pos, 1, __ATOMIC_RELAXED);
+    struct trace_event *ev = &trace_events[pos % trace_size];
+    __atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&ev->name, name, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->start, start, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->duration, duration, __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->tid, get_thread_id(), __ATOMIC_RELAXED);
+    __atomic_store_n(&ev->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+void mp_trace_instant(const char *name)
+{
+    if (mp_tracing)
+        trace_add(name, mp_time_ns(), -1);
+}
+
+struct mp_prof_stage *mp_prof_get_stage(const char *name)
+{
+    struct mp_prof_stage *stage = NULL;
+#ifdef HAVE_PTHREADS
+    pthread_mutex_lock(&stages_lock);
+#endif
+    for (int i = 0; i < num_stages; i++) {
+        if (!strcmp(stages[i].name, name)) {
+            stage = &stages[i];
+            break;
+        }
+    }
+    if (!stage && num_stages < MAX_STAGES) {
+        stage = &stages[num_stages];
+        snprintf(stage->name, sizeof(stage->name), "%s", name);
+        __atomic_store_n(&num_stages, num_stages + 1, __ATOMIC_RELEASE);
+    }
+#ifdef HAVE_PTHREADS
+    pthread_mutex_unlock(&stages_lock);
+#endif
+    if (!stage)
+        mp_msg(MSGT_GLOBAL, MSGL_WARN, "[profiler] Too many stages, not "
+               "measuring %s.\n", name);
+    return stage;
+}
+
+static int bucket_index(uint64_t v)
+{
+    if (v < SUB_COUNT)
+        return v;
+    int e = 63 - __builtin_clzll(v);
+    int sub = (v >> (e - SUB_BITS)) & (SUB_COUNT - 1);
+    return (e - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+// middle of the range of values counted in the bucket
+static uint64_t bucket_value(int idx)
+{
+    if (idx < SUB_COUNT)
+        return idx;
+    int shift = idx / SUB_COUNT - 1;
+    uint64_t low = (uint64_t)(SUB_COUNT + idx % SUB_COUNT) << shift;
+    return low + ((1ULL << shift) >> 1);
+}
+
+static void record(struct mp_prof_stage *stage, uint64_t v)
+{
+    __atomic_fetch_add(&stage->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stage->total, v, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stage->buckets[bucket_index(v)], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&stage->max, __ATOMIC_RELAXED);
+    while (v > max && !__atomic_compare_exchange_n(&stage->max, &max, v, true,
+                                                   __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED));
+}
+
+void mp_prof_begin_scope(struct mp_prof_scope *scope,
+                         struct mp_prof_stage *stage)
+{
+    scope->stage = stage;
+    scope->nested = 0;
+    scope->parent = current_scope;
+    current_scope = scope;
+    scope->start = mp_time_ns();
+}
+
+void mp_prof_end_scope(struct mp_prof_scope *scope)
+{
+    int64_t duration = mp_time_ns() - scope->start;
+    current_scope = scope->parent;
+    if (scope->parent)
+        scope->parent->nested += duration;
+    record(scope->stage, FFMAX(duration - scope->nested, 0));
+    if (mp_tracing)
+        trace_add(scope->stage->name, scope->start, duration);
+    scope->stage = NULL;
+}
+
+static double percentile(struct mp_prof_stage *stage, uint64_t count,
+                         double p)
+{
+    uint64_t rank = count * p + 0.999999;
+    uint64_t sum = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        sum += __atomic_load_n(&stage->buckets[i], __ATOMIC_RELAXED);
+        if (sum >= rank)
+            return bucket_value(i);
+    }
+    return 0;
+}
+
+bool mp_profiler_dump(const char *filename)
+{
+    if (!mp_profiling)
+        return true;
+    int n = __atomic_load_n(&num_stages, __ATOMIC_ACQUIRE);
+    char *s = talloc_asprintf(NULL, "{\n  \"duration_s\": %.3f,\n"
+                              "  \"stages\": [",
+                              (mp_time_ns() - start_time) / 1e9);
+    for (int i = 0; i < n; i++) {
+        struct mp_prof_stage *stage = &stages[i];
+        uint64_t count = __atomic_load_n(&stage->count, __ATOMIC_RELAXED);
+        uint64_t total = __atomic_load_n(&stage->total, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&stage->max, __ATOMIC_RELAXED);
+        // bucket midpoints can be above the largest value in the bucket
+        double p50 = FFMIN(percentile(stage, count, 0.50), max);
+        double p95 = FFMIN(percentile(stage, count, 0.95), max);
+        double p99 = FFMIN(percentile(stage, count, 0.99), max);
+        s = talloc_asprintf_append(s, "%s\n    {\"name\": \"%s\", "
+                                   "\"count\": %"PRIu64", "
+                                   "\"total_ms\": %.3f, \"mean_us\": %.3f, "
+                                   "\"p50_us\": %.3f, \"p95_us\": %.3f, "
+                                   "\"p99_us\": %.3f, \"max_us\": %.3f}",
+                                   i ? "," : "", stage->name, count,
+                                   total / 1e6,
+                                   count ? total / 1e3 / count : 0,
+                                   p50 / 1e3, p95 / 1e3, p99 / 1e3,
+                                   max / 1e3);
+    }
+    s = talloc_strdup_append(s, "\n  ]\n}\n");
+
+    bool ok = true;
+    if (!strcmp(filename, "-")) {
+        mp_msg(MSGT_GLOBAL, MSGL_INFO, "%s", s);
+    } else {
+        FILE *f = fopen(filename, "w");
+        if (!f || fputs(s, f) < 0)
+            ok = false;
+        if (f && fclose(f))
+            ok = false;
+        if (!ok)
+            mp_msg(MSGT_GLOBAL, MSGL_ERR, "[profiler] Could not write "
+                   "%s.\n", filename);
+    }
+    talloc_free(s);
+    return ok;
+}
+
+bool mp_trace_dump(const char *filename)
+{
+    if (!mp_tracing)
+        return true;
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        mp_msg(MSGT_GLOBAL, MSGL_ERR, "[profiler] Could not write %s.\n",
+               filename);
+        return false;
+    }
+    fprintf(f, "{\"displayTimeUnit\": \"ms\",\n\"traceEvents\": [\n"
+            "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+            "\"args\": {\"name\": \"mplayer\"}}");
+    int threads = FFMIN(__atomic_load_n(&num_threads, __ATOMIC_RELAXED),
+                        MAX_THREADS);
+    for (int i = 0; i < threads; i++) {
+        const char *name = __atomic_load_n(&thread_names[i], __ATOMIC_ACQUIRE);
+        if (name)
+            fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", "
+                    "\"pid\": 1, \"tid\": %d, "
+                    "\"args\": {\"name\": \"%s\"}}", i + 1, name);
+    }
+
+    uint64_t end = __atomic_load_n(&trace_pos, __ATOMIC_RELAXED);
+    uint64_t pos = end > trace_size ? end - trace_size : 0;
+    uint64_t dropped = pos;
+    for (; pos < end; pos++) {
+        struct trace_event *ev = &trace_events[pos % trace_size];
+        uint64_t seq = __atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE);
+        const char *name = __atomic_load_n(&ev->name, __ATOMIC_RELAXED);
+        int64_t start = __atomic_load_n(&ev->start, __ATOMIC_RELAXED);
+        int64_t duration = __atomic_load_n(&ev->duration, __ATOMIC_RELAXED);
+        int tid = __atomic_load_n(&ev->tid, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq != pos + 1 || __atomic_load_n(&ev->seq, __ATOMIC_RELAXED)
+                              != seq) {
+            // still being written, or already overwritten
+            dropped++;
+            continue;
+        }
+        double ts = (start - start_time) / 1e3;
+        if (duration < 0)
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"i\", "
+                    "\"s\": \"t\", \"ts\": %.3f, \"pid\": 1, "
+                    "\"tid\": %d}", name, ts, tid);
+        else
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", "
+                    "\"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, "
+                    "\"tid\": %d}", name, ts, duration / 1e3, tid);
+    }
+    fprintf(f, "\n],\n\"otherData\": {\"dropped_events\": %"PRIu64"}}\n",
+            dropped);
+    if (fclose(f)) {
+        mp_msg(MSGT_GLOBAL, MSGL_ERR, "[profiler] Could not write %s.\n",
+               filename);
+        return false;
+    }
+    if (dropped)
+        mp_msg(MSGT_GLOBAL, MSGL_V, "[profiler] Trace buffer overflowed, "
+               "%"PRIu64" oldest events were dropped.\n", dropped);
+    return true;
+}
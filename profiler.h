@@ -0,0 +1,112 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_PROFILER_H
+#define MPLAYER_PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Per-stage latency statistics for the playback hot paths.
+ *
+ * Code to be measured is put between MP_PROF_BEGIN() and MP_PROF_END().
+ * Every measured interval is added to the latency histogram of its stage.
+ * Intervals nest per thread, and a stage only gets the time not spent in
+ * nested intervals, so e.g. a video filter is not charged for the filters
+ * after it, which it calls from its put_image().
+ *
+ * With tracing enabled, every measured interval is also recorded as an
+ * event with its start time, duration and thread, and the recent events can
+ * be written as a Chrome trace-event JSON file, which shows how the stages
+ * of different threads overlap in time.
+ *
+ * When profiling is not enabled the macros only test a global flag.
+ */
+
+struct mp_prof_stage;
+
+struct mp_prof_scope {
+    struct mp_prof_stage *stage;
+    int64_t start;
+    int64_t nested;             // time spent in nested scopes
+    struct mp_prof_scope *parent;
+};
+
+extern bool mp_profiling;
+extern bool mp_tracing;
+
+void mp_profiler_enable(void);
+// Also keep the last max_events measured intervals for mp_trace_dump().
+void mp_trace_enable(int max_events);
+// Name the calling thread in the trace. The string must stay valid.
+void mp_prof_set_thread_name(const char *name);
+// Return the stage with the given name, creating it if needed. Returns NULL
+// if there are too many stages. Stages live until the player exits.
+struct mp_prof_stage *mp_prof_get_stage(const char *name);
+void mp_prof_begin_scope(struct mp_prof_scope *scope,
+                         struct mp_prof_stage *stage);
+void mp_prof_end_scope(struct mp_prof_scope *scope);
+// Write the statistics of all stages as JSON. "-" writes to the log.
+// Returns false if the file could not be written.
+bool mp_profiler_dump(const char *filename);
+// Record a point in time, e.g. a dropped frame, in the trace. The name must
+// stay valid.
+void mp_trace_instant(const char *name);
+// Write the recorded events in Chrome trace-event format.
+bool mp_trace_dump(const char *filename);
+
+// Measure until the MP_PROF_END() with the same scope in stage, which may
+// be NULL.
+#define MP_PROF_BEGIN_STAGE(scope, stage_) do {                        \
+        (scope)->stage = NULL;                                          \
+        if (mp_profiling && (stage_))                                   \
+            mp_prof_begin_scope(scope, stage_);                         \
+    } while (0)
+
+// Same, with a stage that is looked up by name once per call site.
+#define MP_PROF_BEGIN(scope, name) do {                                 \
+        (scope)->stage = NULL;                                          \
+        if (mp_profiling) {                                             \
+            static struct mp_prof_stage *prof_stage_;                   \
+            struct mp_prof_stage *st_ =                                 \
+                __atomic_load_n(&prof_stage_, __ATOMIC_ACQUIRE);        \
+            if (!st_) {                                                 \
+                st_ = mp_prof_get_stage(name);                          \
+                __atomic_store_n(&prof_stage_, st_, __ATOMIC_RELEASE);  \
+            }                                                           \
+            if (st_)                                                    \
+                mp_prof_begin_scope(scope, st_);                        \
+        }                                                               \
+    } while (0)
+
+#define MP_PROF_END(scope) do {                 \
+        if ((scope)->stage)                     \
+            mp_prof_end_scope(scope);           \
+    } while (0)
+
+static inline void mp_prof_scope_cleanup(struct mp_prof_scope *scope)
+{
+    MP_PROF_END(scope);
+}
+
+// Measure until the end of the enclosing block, including early returns.
+#define MP_PROF_SCOPE(name)                                             \
+    struct mp_prof_scope prof_scope_                                    \
+        __attribute__((cleanup(mp_prof_scope_cleanup)));                \
+    MP_PROF_BEGIN(&prof_scope_, name)
+
+#endif /* MPLAYER_PROFILER_H */
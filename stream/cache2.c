@@ -17,8 +17,17 @@
  */
 
 // Initial draft of my new cache system...
-// Note it runs in 2 processes (using fork()), but doesn't require locking!!
-// TODO: seeking, data consistency checking
+// Note it runs in 2 processes (using fork()), which share a spinlock in the
+// shared memory, since the block lists and hash chains are relinked by the
+// filler while the reader walks them.
+// When built with pthreads the cache runs in a thread instead, and reader and
+// filler are synchronized with a mutex and wake each other up through
+// condition variables rather than polling.
+// The buffer is split into fixed size blocks, each holding data from one
+// aligned region of the file. Blocks are recycled in LRU order, so the cache
+// keeps several unrelated byte ranges around and seeking back into any of
+// them does not need to touch the stream.
+// TODO: data consistency checking
 
 #define READ_SLEEP_TIME 10
 // These defines are used to reduce the cost of many successive
@@ -28,6 +37,8 @@
 #define FILL_USLEEP_TIME 50000
 #define PREFILL_SLEEP_TIME 200
 #define CONTROL_SLEEP_TIME 0
+// preferred size of the units the cache memory is managed in
+#define CACHE_BLOCK_SIZE (64 * 1024)
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -36,6 +47,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <libavutil/common.h>
 
@@ -48,6 +60,8 @@
 static void ThreadProc( void *s );
 #elif defined(PTHREAD_CACHE)
 #include <pthread.h>
+#include <sys/time.h>
+#define COND_CACHE 1
 static void *ThreadProc(void *s);
 #else
 #include <sys/wait.h>
@@ -56,13 +70,30 @@ static void *ThreadProc(void *s);
 #ifndef FORKED_CACHE
 #define FORKED_CACHE 0
 #endif
+#ifndef COND_CACHE
+#define COND_CACHE 0
+#endif
+#if COND_CACHE
+// waits are woken up by the cache thread, so this only limits how often
+// user input is polled while waiting for a control to complete
+#undef CONTROL_SLEEP_TIME
+#define CONTROL_SLEEP_TIME 10
+#endif
 
 #include "mp_msg.h"
+#include "profiler.h"
 
 #include "stream.h"
 #include "cache2.h"
 #include "mpcommon.h"
 
+typedef struct {
+  off_t pos;          // file position of the first byte, -1 if unused
+  int start, end;     // valid data is at [pos+start, pos+end)
+  unsigned last_use;  // LRU stamp
+  int next;           // next block in the same hash chain, -1 terminates
+} cache_block_t;
+
 typedef struct {
   // constats:
   unsigned char *buffer;      // base pointer of the allocated buffer memory
@@ -71,11 +102,17 @@ typedef struct {
   int back_size;   // we should keep back_size amount of old bytes for backward seek
   int fill_limit;  // we should fill buffer only if space>=fill_limit
   int seek_limit;  // keep filling cache if distance is less that seek limit
+  int block_size;  // multiple of sector_size
+  int num_blocks;  // buffer_size / block_size
+  int hash_mask;   // number of hash buckets - 1
+  cache_block_t *blocks;
+  int *hash;       // first block index per bucket, -1 if empty
   // filler's pointers:
   int eof;
-  off_t min_filepos; // buffer contain only a part of the file, from min-max pos
-  off_t max_filepos;
-  off_t offset;      // filepos <-> bufferpos  offset value (filepos of the buffer's first byte)
+  off_t eof_pos;     // where the stream returned EOF, valid if eof is set
+  off_t max_filepos; // [read_filepos, max_filepos) is known to be cached
+  int cached_bytes;  // total amount of data in all blocks
+  unsigned use_count;
   // reader's pointers:
   off_t read_filepos;
   // commands/locking:
@@ -90,163 +127,390 @@ typedef struct {
   volatile off_t control_new_pos;
   volatile double stream_time_length;
   volatile double stream_time_pos;
+  volatile int wakeup_player; // the player waits for fill status changes
+#if COND_CACHE
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t fill_cond;   // signaled to wake up the cache thread
+  pthread_cond_t read_cond;   // signaled when data or control results arrive
+  int fill_wakeup;            // pending wakeup for the cache thread
+#else
+  int lock;                   // spinlock, 1 while held
+#endif
 } cache_vars_t;
 
 static int min_fill=0;
 
-static void cache_wakeup(stream_t *s)
+/**
+ * The lock is only ever held for short updates and copies, never across
+ * stream I/O or sleeps, so without pthreads spinning is good enough. It also
+ * works between the processes of the forked cache.
+ */
+static void cache_lock(cache_vars_t *s)
+{
+#if COND_CACHE
+  pthread_mutex_lock(&s->mutex);
+#else
+  while (__atomic_exchange_n(&s->lock, 1, __ATOMIC_ACQUIRE))
+    usec_sleep(0);
+#endif
+}
+
+static void cache_unlock(cache_vars_t *s)
+{
+#if COND_CACHE
+  pthread_mutex_unlock(&s->mutex);
+#else
+  __atomic_store_n(&s->lock, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+#if COND_CACHE
+/**
+ * Wait on cond for at most ms milliseconds, must be called with the cache
+ * locked.
+ * \return 1 if the wait timed out
+ */
+static int cache_cond_timedwait(cache_vars_t *s, pthread_cond_t *cond, int ms)
+{
+  struct timeval tv;
+  struct timespec ts;
+  gettimeofday(&tv, NULL);
+  ts.tv_sec  = tv.tv_sec + ms / 1000;
+  ts.tv_nsec = (tv.tv_usec + (ms % 1000) * 1000) * 1000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+  return pthread_cond_timedwait(cond, &s->mutex, &ts) == ETIMEDOUT;
+}
+#endif
+
+/**
+ * Wake up the cache process/thread, e.g. after a seek or after the reader
+ * freed space in the buffer. Must be called with the cache locked.
+ */
+static void cache_wakeup(stream_t *stream)
 {
 #if FORKED_CACHE
   // signal process to wake up immediately
-  kill(s->cache_pid, SIGUSR1);
+  kill(stream->cache_pid, SIGUSR1);
+#elif COND_CACHE
+  cache_vars_t *s = stream->cache_data;
+  s->fill_wakeup = 1;
+  pthread_cond_signal(&s->fill_cond);
+#endif
+}
+
+/**
+ * Called by the reader side to wait for the cache to make progress.
+ * Must be called with the cache locked, which may be released meanwhile.
+ * \param timed_out set to 1 if no wakeup arrived within ms milliseconds
+ * \return 1 if the user requested to interrupt the current operation
+ */
+static int cache_wait_reader(cache_vars_t *s, int ms, int *timed_out)
+{
+  int res = 0;
+  struct mp_prof_scope prof;
+  MP_PROF_BEGIN(&prof, "cache_wait");
+#if COND_CACHE
+  *timed_out = cache_cond_timedwait(s, &s->read_cond, ms);
+  if (*timed_out) {
+    // only poll for user input if the cache is really stalling
+    cache_unlock(s);
+    res = stream_check_interrupt(0);
+    cache_lock(s);
+  }
+#else
+  *timed_out = 1;
+  cache_unlock(s);
+  res = stream_check_interrupt(ms);
+  cache_lock(s);
 #endif
+  MP_PROF_END(&prof);
+  return res;
+}
+
+/**
+ * Wake up all readers waiting in cache_wait_reader().
+ * Must be called with the cache locked.
+ */
+static void cache_wakeup_reader(cache_vars_t *s)
+{
+#if COND_CACHE
+  pthread_cond_broadcast(&s->read_cond);
+#endif
+}
+
+static int cache_hash(cache_vars_t *s, off_t pos)
+{
+  return (pos / s->block_size) & s->hash_mask;
+}
+
+/// \return index of the block caching the aligned position pos, or -1
+static int cache_find_block(cache_vars_t *s, off_t pos)
+{
+  int i;
+  for (i = s->hash[cache_hash(s, pos)]; i >= 0; i = s->blocks[i].next)
+    if (s->blocks[i].pos == pos)
+      return i;
+  return -1;
+}
+
+static void cache_unlink_block(cache_vars_t *s, int idx)
+{
+  cache_block_t *b = &s->blocks[idx];
+  int *p;
+  if (b->pos < 0)
+    return;
+  for (p = &s->hash[cache_hash(s, b->pos)]; *p >= 0; p = &s->blocks[*p].next) {
+    if (*p == idx) {
+      *p = b->next;
+      break;
+    }
+  }
+  s->cached_bytes -= b->end - b->start;
+  b->pos = -1;
+  b->start = b->end = 0;
+  b->next = -1;
 }
 
-static int cache_read(cache_vars_t *s, unsigned char *buf, int size)
+static void cache_flush_blocks(cache_vars_t *s)
 {
+  int i;
+  for (i = 0; i < s->num_blocks; i++)
+    cache_unlink_block(s, i);
+}
+
+/**
+ * Return the block for the aligned position pos, recycling the least
+ * recently used block if it is not cached yet. Blocks holding data from
+ * [protect_start, protect_end) are never recycled.
+ * \return block index or -1 if all blocks are protected
+ */
+static int cache_get_block(cache_vars_t *s, off_t pos,
+                           off_t protect_start, off_t protect_end)
+{
+  int i, idx = cache_find_block(s, pos);
+  int h;
+  if (idx >= 0)
+    return idx;
+  for (i = 0; i < s->num_blocks; i++) {
+    cache_block_t *b = &s->blocks[i];
+    if (b->pos < 0) {
+      idx = i;
+      break;
+    }
+    if (b->pos + b->end > protect_start && b->pos + b->start < protect_end)
+      continue;
+    if (idx < 0 || b->last_use - s->blocks[idx].last_use > UINT_MAX / 2)
+      idx = i;
+  }
+  if (idx < 0)
+    return -1;
+  if (s->blocks[idx].pos >= 0)
+    mp_msg(MSGT_CACHE, MSGL_DBG2, "Dropping cached range 0x%"PRIX64"-0x%"PRIX64"\n",
+           (int64_t)(s->blocks[idx].pos + s->blocks[idx].start),
+           (int64_t)(s->blocks[idx].pos + s->blocks[idx].end));
+  cache_unlink_block(s, idx);
+  h = cache_hash(s, pos);
+  s->blocks[idx].pos = pos;
+  s->blocks[idx].next = s->hash[h];
+  s->hash[h] = idx;
+  return idx;
+}
+
+/// \return first position at or after pos that is not cached
+static off_t cache_find_end(cache_vars_t *s, off_t pos)
+{
+  for (;;) {
+    off_t bpos = pos - pos % s->block_size;
+    int idx = cache_find_block(s, bpos);
+    cache_block_t *b;
+    if (idx < 0)
+      return pos;
+    b = &s->blocks[idx];
+    if (pos - bpos < b->start || pos - bpos >= b->end)
+      return pos;
+    pos = bpos + b->end;
+    if (b->end < s->block_size)
+      return pos;
+  }
+}
+
+static int cache_read(stream_t *stream, unsigned char *buf, int size)
+{
+  cache_vars_t *s = stream->cache_data;
   int total=0;
   int sleep_count = 0;
-  int last_max = s->max_filepos;
+  off_t last_max;
+  cache_lock(s);
+  last_max = s->max_filepos;
   while(size>0){
-    int pos,newb,len;
+    off_t bpos;
+    int idx,pos,newb,timed_out;
+    cache_block_t *b;
 
-  //printf("CACHE2_READ: 0x%X <= 0x%X <= 0x%X  \n",s->min_filepos,s->read_filepos,s->max_filepos);
+    bpos = s->read_filepos - s->read_filepos % s->block_size;
+    pos = s->read_filepos - bpos;
+    idx = cache_find_block(s, bpos);
+    b = idx >= 0 ? &s->blocks[idx] : NULL;
 
-    if(s->read_filepos>=s->max_filepos || s->read_filepos<s->min_filepos){
+    if(!b || pos<b->start || pos>=b->end){
 	// eof?
-	if(s->eof) break;
+	if(s->eof && s->read_filepos>=s->eof_pos) break;
 	if (s->max_filepos == last_max) {
-	    if (sleep_count++ == 10)
+	    if (sleep_count == 10)
 	        mp_msg(MSGT_CACHE, MSGL_WARN, "Cache not filling, consider increasing -cache and/or -cache-min!\n");
 	} else {
 	    last_max = s->max_filepos;
 	    sleep_count = 0;
 	}
 	// waiting for buffer fill...
-	if (stream_check_interrupt(READ_SLEEP_TIME)) {
+	if (cache_wait_reader(s, READ_SLEEP_TIME, &timed_out)) {
 	    s->eof = 1;
+	    s->eof_pos = s->read_filepos;
 	    break;
 	}
+	sleep_count += timed_out;
 	continue; // try again...
     }
     sleep_count = 0;
 
-    newb=s->max_filepos-s->read_filepos; // new bytes in the buffer
+    newb=b->end-pos; // new bytes in the block
     if(newb<min_fill) min_fill=newb; // statistics...
-
-//    printf("*** newb: %d bytes ***\n",newb);
-
-    pos=s->read_filepos - s->offset;
-    if(pos<0) pos+=s->buffer_size; else
-    if(pos>=s->buffer_size) pos-=s->buffer_size;
-
-    if(newb>s->buffer_size-pos) newb=s->buffer_size-pos; // handle wrap...
     if(newb>size) newb=size;
 
-    // check:
-    if(s->read_filepos<s->min_filepos) mp_msg(MSGT_CACHE,MSGL_ERR,"Ehh. s->read_filepos<s->min_filepos !!! Report bug...\n");
-
-    // len=write(mem,newb)
-    //printf("Buffer read: %d bytes\n",newb);
-    memcpy(buf,&s->buffer[pos],newb);
+    memcpy(buf,&s->buffer[idx*s->block_size+pos],newb);
+    b->last_use=++s->use_count;
     buf+=newb;
-    len=newb;
-    // ...
-
-    s->read_filepos+=len;
-    size-=len;
-    total+=len;
-
+    s->read_filepos+=newb;
+    size-=newb;
+    total+=newb;
   }
+  // we consumed data, so there might be space for the cache to fill again
+  if (total)
+    cache_wakeup(stream);
+  cache_unlock(s);
   return total;
 }
 
 static int cache_fill(cache_vars_t *s)
 {
-  int back,back2,newb,space,len,pos;
-  off_t read=s->read_filepos;
-  int read_chunk;
-  int wraparound_copy = 0;
-
-  if(read<s->min_filepos || read>s->max_filepos){
-      // seek...
-      mp_msg(MSGT_CACHE,MSGL_DBG2,"Out of boundaries... seeking to 0x%"PRIX64"  \n",(int64_t)read);
-      // drop cache contents only if seeking backward or too much fwd.
-      // This is also done for on-disk files, since it loses the backseek cache.
-      // That in turn can cause major bandwidth increase and performance
-      // issues with e.g. mov or badly interleaved files
-      if(read<s->min_filepos || read>=s->max_filepos+s->seek_limit)
-      {
-        s->offset= // FIXME!?
-        s->min_filepos=s->max_filepos=read; // drop cache content :(
-        if(s->stream->eof) stream_reset(s->stream);
-        stream_seek_internal(s->stream,read);
-        mp_msg(MSGT_CACHE,MSGL_DBG2,"Seek done. new pos: 0x%"PRIX64"  \n",(int64_t)stream_tell(s->stream));
-      }
+  off_t read,fill_pos,stream_pos,bpos;
+  int ahead,history,space,len,pos,idx,read_chunk;
+  int discard = 0, bounce = 0;
+  cache_block_t *b;
+
+  // The lock is dropped around all stream I/O so that the reader is never
+  // blocked by a slow stream. This is safe since only the filler modifies
+  // blocks, and the reader only looks at the valid part of each block.
+  cache_lock(s);
+  read=s->read_filepos;
+  // [read, max_filepos) stays cached since it is never recycled
+  fill_pos=cache_find_end(s, FFMAX(read, s->max_filepos));
+  s->max_filepos=fill_pos;
+
+  if(s->eof && fill_pos>=s->eof_pos){
+    cache_unlock(s);
+    return 0; // nothing more to read
   }
 
-  // calc number of back-bytes:
-  back=read - s->min_filepos;
-  if(back<0) back=0; // strange...
-  if(back>s->back_size) back=s->back_size;
-
-  // calc number of new bytes:
-  newb=s->max_filepos - read;
-  if(newb<0) newb=0; // strange...
-
-  // calc free buffer space:
-  space=s->buffer_size - (newb+back);
-
-  // calc bufferpos:
-  pos=s->max_filepos - s->offset;
-  if(pos>=s->buffer_size) pos-=s->buffer_size; // wrap-around
-
+  // keep up to back_size bytes of other cached data for seeking back
+  ahead=fill_pos-read;
+  history=FFMIN(s->back_size, s->cached_bytes-ahead);
+  space=s->buffer_size-(ahead+history);
   if(space<s->fill_limit){
 //    printf("Buffer is full (%d bytes free, limit: %d)\n",space,s->fill_limit);
+    cache_unlock(s);
     return 0; // no fill...
   }
+  cache_unlock(s);
+
+  stream_pos=s->stream->pos;
+  // Only seek when the stream is not going to reach fill_pos soon anyway.
+  // Reading through is cheaper for small gaps and the only option for
+  // streams that cannot seek.
+  if(stream_pos!=fill_pos &&
+     !(stream_pos<fill_pos && fill_pos-stream_pos<s->seek_limit)){
+      mp_msg(MSGT_CACHE,MSGL_DBG2,"Out of boundaries... seeking to 0x%"PRIX64"  \n",(int64_t)fill_pos);
+      if(s->stream->eof) stream_reset(s->stream);
+      stream_seek_internal(s->stream,fill_pos);
+      stream_pos=s->stream->pos;
+      mp_msg(MSGT_CACHE,MSGL_DBG2,"Seek done. new pos: 0x%"PRIX64"  \n",(int64_t)stream_pos);
+      if(stream_pos>fill_pos){
+        // the data cannot be reached anymore, treat it like EOF
+        cache_lock(s);
+        s->eof=1;
+        s->eof_pos=fill_pos;
+        cache_wakeup_reader(s);
+        cache_unlock(s);
+        return 0;
+      }
+  }
 
-//  printf("### read=0x%X  back=%d  newb=%d  space=%d  pos=%d\n",read,back,newb,space,pos);
-
-  // try to avoid wrap-around. If not possible due to sector size
-  // do an extra copy.
-  if(space>s->buffer_size-pos) {
-    if (s->buffer_size-pos >= s->sector_size) {
-      space=s->buffer_size-pos;
-    } else {
-      space = s->sector_size;
-      wraparound_copy = 1;
+  cache_lock(s);
+  bpos=stream_pos-stream_pos%s->block_size;
+  pos=stream_pos-bpos;
+  idx=cache_get_block(s, bpos, read, fill_pos);
+  if(idx<0){
+    cache_unlock(s);
+    return 0;
+  }
+  b=&s->blocks[idx];
+  if(pos>=b->start && pos<b->end){
+    // reading through data we already have
+    discard=1;
+    space=b->end-pos;
+  } else if(pos<b->start && b->pos+b->end>read && b->pos+b->start<fill_pos){
+    // cannot prepend, but the block is still needed by the reader
+    discard=1;
+    space=b->start-pos;
+  } else {
+    if(pos!=b->end){
+      // not contiguous with the block's data, start over
+      s->cached_bytes-=b->end-b->start;
+      b->start=b->end=pos;
     }
+    space=s->block_size-pos;
   }
+  cache_unlock(s);
 
   // limit one-time block size
   read_chunk = s->stream->read_chunk;
   if (!read_chunk) read_chunk = 4*s->sector_size;
   space = FFMIN(space, read_chunk);
 
-#if 1
-  // back+newb+space <= buffer_size
-  back2=s->buffer_size-(space+newb); // max back size
-  if(s->min_filepos<(read-back2)) s->min_filepos=read-back2;
-#else
-  s->min_filepos=read-back; // avoid seeking-back to temp area...
-#endif
+  // Streams with a sector size must be read in whole sectors.
+  // If that does not fit do an extra copy.
+  if (discard || space < s->sector_size) {
+    bounce = 1;
+    space = FFMAX(space, s->sector_size);
+    space = FFMIN(space, STREAM_MAX_SECTOR_SIZE);
+  }
 
-  if (wraparound_copy) {
-    int to_copy;
+  struct mp_prof_scope prof;
+  MP_PROF_BEGIN(&prof, "cache_read");
+  if (bounce)
     len = stream_read_internal(s->stream, s->stream->buffer, space);
-    to_copy = FFMIN(len, s->buffer_size-pos);
-    memcpy(s->buffer + pos, s->stream->buffer, to_copy);
-    memcpy(s->buffer, s->stream->buffer + to_copy, len - to_copy);
-  } else
-  len = stream_read_internal(s->stream, &s->buffer[pos], space);
-  s->eof= !len;
+  else
+    len = stream_read_internal(s->stream, &s->buffer[idx*s->block_size+pos], space);
+  MP_PROF_END(&prof);
 
-  s->max_filepos+=len;
-  if(pos+len>=s->buffer_size){
-      // wrap...
-      s->offset+=s->buffer_size;
+  cache_lock(s);
+  s->eof= !len;
+  if (!len)
+    s->eof_pos=stream_pos;
+  if (!discard && len > 0) {
+    int copy = FFMIN(len, s->block_size-pos);
+    if (bounce)
+      memcpy(&s->buffer[idx*s->block_size+pos], s->stream->buffer, copy);
+    b->end+=copy;
+    b->last_use=++s->use_count;
+    s->cached_bytes+=copy;
   }
+  cache_wakeup_reader(s);
+  cache_unlock(s);
 
   return len;
 
@@ -256,13 +520,23 @@ static int cache_execute_control(cache_vars_t *s) {
   double double_res;
   unsigned uint_res;
   static unsigned last;
-  int quit = s->control == -2;
+  int control, res;
+  int quit;
+  cache_lock(s);
+  control = s->control;
+  double_res = s->control_double_arg;
+  uint_res = s->control_uint_arg;
+  cache_unlock(s);
+  quit = control == -2;
   if (quit || !s->stream->control) {
+    cache_lock(s);
     s->stream_time_length = 0;
     s->stream_time_pos = MP_NOPTS_VALUE;
     s->control_new_pos = 0;
     s->control_res = STREAM_UNSUPPORTED;
     s->control = -1;
+    cache_wakeup_reader(s);
+    cache_unlock(s);
     return !quit;
   }
   if (GetTimerMS() - last > 99) {
@@ -277,31 +551,42 @@ static int cache_execute_control(cache_vars_t *s) {
       s->stream_time_pos = MP_NOPTS_VALUE;
     last = GetTimerMS();
   }
-  if (s->control == -1) return 1;
-  switch (s->control) {
+  if (control == -1) return 1;
+  switch (control) {
     case STREAM_CTRL_SEEK_TO_TIME:
-      double_res = s->control_double_arg;
     case STREAM_CTRL_GET_CURRENT_TIME:
     case STREAM_CTRL_GET_ASPECT_RATIO:
-      s->control_res = s->stream->control(s->stream, s->control, &double_res);
-      s->control_double_arg = double_res;
+      res = s->stream->control(s->stream, control, &double_res);
       break;
     case STREAM_CTRL_SEEK_TO_CHAPTER:
     case STREAM_CTRL_SET_ANGLE:
-      uint_res = s->control_uint_arg;
     case STREAM_CTRL_GET_NUM_CHAPTERS:
     case STREAM_CTRL_GET_CURRENT_CHAPTER:
     case STREAM_CTRL_GET_NUM_ANGLES:
     case STREAM_CTRL_GET_ANGLE:
-      s->control_res = s->stream->control(s->stream, s->control, &uint_res);
-      s->control_uint_arg = uint_res;
+      res = s->stream->control(s->stream, control, &uint_res);
       break;
     default:
-      s->control_res = STREAM_UNSUPPORTED;
+      res = STREAM_UNSUPPORTED;
       break;
   }
+  cache_lock(s);
+  switch (control) {
+    case STREAM_CTRL_SEEK_TO_TIME:
+    case STREAM_CTRL_SEEK_TO_CHAPTER:
+    case STREAM_CTRL_SET_ANGLE:
+      // byte positions might refer to different data now
+      if (res == STREAM_OK)
+        cache_flush_blocks(s);
+      break;
+  }
+  s->control_double_arg = double_res;
+  s->control_uint_arg = uint_res;
+  s->control_res = res;
   s->control_new_pos = s->stream->pos;
   s->control = -1;
+  cache_wakeup_reader(s);
+  cache_unlock(s);
   return 1;
 }
 
@@ -321,8 +606,17 @@ static void shared_free(void *ptr, int size) {
 #endif
 }
 
+static void cache_free(cache_vars_t *s) {
+  shared_free(s->buffer, s->buffer_size);
+  shared_free(s->blocks, s->num_blocks * sizeof(cache_block_t));
+  shared_free(s->hash, (s->hash_mask + 1) * sizeof(int));
+  s->buffer = NULL;
+  s->blocks = NULL;
+  s->hash = NULL;
+}
+
 static cache_vars_t* cache_init(int size,int sector){
-  int num;
+  int num, i;
   cache_vars_t* s=shared_alloc(sizeof(cache_vars_t));
   if(s==NULL) return NULL;
 
@@ -331,17 +625,34 @@ static cache_vars_t* cache_init(int size,int sector){
   if(num < 16){
      num = 16;
   }//32kb min_size
-  s->buffer_size=num*sector;
+  // use blocks of about CACHE_BLOCK_SIZE bytes, but at least 16 of them
+  s->block_size=FFMAX(FFMIN(CACHE_BLOCK_SIZE / sector, num / 16), 1)*sector;
+  s->num_blocks=num*sector/s->block_size;
+  s->buffer_size=s->num_blocks*s->block_size;
   s->sector_size=sector;
+  for (s->hash_mask = 1; s->hash_mask < s->num_blocks; s->hash_mask <<= 1);
+  s->hash_mask--;
   s->buffer=shared_alloc(s->buffer_size);
+  s->blocks=shared_alloc(s->num_blocks * sizeof(cache_block_t));
+  s->hash=shared_alloc((s->hash_mask + 1) * sizeof(int));
 
-  if(s->buffer == NULL){
+  if(s->buffer == NULL || s->blocks == NULL || s->hash == NULL){
+    cache_free(s);
     shared_free(s, sizeof(cache_vars_t));
     return NULL;
   }
+  for (i = 0; i <= s->hash_mask; i++)
+    s->hash[i] = -1;
+  for (i = 0; i < s->num_blocks; i++)
+    s->blocks[i] = (cache_block_t){.pos = -1, .next = -1};
 
   s->fill_limit=8*sector;
   s->back_size=s->buffer_size/2;
+#if COND_CACHE
+  pthread_mutex_init(&s->mutex, NULL);
+  pthread_cond_init(&s->fill_cond, NULL);
+  pthread_cond_init(&s->read_cond, NULL);
+#endif
   return s;
 }
 
@@ -353,12 +664,21 @@ void cache_uninit(stream_t *s) {
 #else
     kill(s->cache_pid,SIGKILL);
     waitpid(s->cache_pid,NULL,0);
+#endif
+#if COND_CACHE
+    pthread_join(c->thread, NULL);
+    // the thread's private copy of the stream struct
+    free(c->stream);
 #endif
     s->cache_pid = 0;
   }
   if(!c) return;
-  shared_free(c->buffer, c->buffer_size);
-  c->buffer = NULL;
+#if COND_CACHE
+  pthread_mutex_destroy(&c->mutex);
+  pthread_cond_destroy(&c->fill_cond);
+  pthread_cond_destroy(&c->read_cond);
+#endif
+  cache_free(c);
   c->stream = NULL;
   shared_free(s->cache_data, sizeof(cache_vars_t));
   s->cache_data = NULL;
@@ -374,10 +694,44 @@ static void dummy_sighandler(int x) {
 }
 #endif
 
+/**
+ * Wake up the player if it asked for it with cache_set_player_wakeup() and
+ * the fill status changed, so that it does not have to poll it.
+ */
+static void cache_notify_fill(cache_vars_t *s, int *last_fill)
+{
+  int fill;
+  if (!s->wakeup_player)
+    return;
+  cache_lock(s);
+  fill = FFMAX(s->max_filepos - s->read_filepos, 0) / (s->buffer_size / 100);
+  cache_unlock(s);
+  if (fill != *last_fill) {
+    *last_fill = fill;
+    stream_wakeup_player();
+  }
+}
+
 /**
  * Main loop of the cache process or thread.
  */
 static void cache_mainloop(cache_vars_t *s) {
+    int last_fill = -1;
+#if COND_CACHE
+    do {
+        if (!cache_fill(s)) {
+            // Nothing to do: sleep until the reader seeks, consumes data or
+            // sends a control. The timeout keeps the cached time/position
+            // values updated by cache_execute_control() fresh.
+            cache_lock(s);
+            if (!s->fill_wakeup && s->control == -1)
+                cache_cond_timedwait(s, &s->fill_cond, FILL_USLEEP_TIME / 1000);
+            s->fill_wakeup = 0;
+            cache_unlock(s);
+        } else
+            cache_notify_fill(s, &last_fill);
+    } while (cache_execute_control(s));
+#else
     int sleep_count = 0;
 #if FORKED_CACHE
     struct sigaction sa = { .sa_handler = SIG_IGN };
@@ -401,9 +755,12 @@ static void cache_mainloop(cache_vars_t *s) {
             sa.sa_handler = SIG_IGN;
             sigaction(SIGUSR1, &sa, NULL);
 #endif
-        } else
+        } else {
             sleep_count = 0;
+            cache_notify_fill(s, &last_fill);
+        }
     } while (cache_execute_control(s));
+#endif
 }
 
 int stream_enable_cache_percent(stream_t *stream, int stream_cache_size,
@@ -461,11 +818,8 @@ int stream_enable_cache(stream_t *stream, int size, int min, int seek_limit)
 #if defined(__MINGW32__)
     stream->cache_pid = _beginthread( ThreadProc, 0, s );
 #else
-    {
-    pthread_t tid;
-    pthread_create(&tid, NULL, ThreadProc, s);
-    stream->cache_pid = 1;
-    }
+    if (!pthread_create(&s->thread, NULL, ThreadProc, s))
+        stream->cache_pid = 1;
 #endif
 #endif
     if (!stream->cache_pid) {
@@ -474,19 +828,23 @@ int stream_enable_cache(stream_t *stream, int size, int min, int seek_limit)
         goto err_out;
     }
     // wait until cache is filled at least prefill_init %
-    mp_msg(MSGT_CACHE,MSGL_V,"CACHE_PRE_INIT: %"PRId64" [%"PRId64"] %"PRId64"  pre:%d  eof:%d  \n",
-	(int64_t)s->min_filepos,(int64_t)s->read_filepos,(int64_t)s->max_filepos,min,s->eof);
-    while(s->read_filepos<s->min_filepos || s->max_filepos-s->read_filepos<min){
+    cache_lock(s);
+    mp_msg(MSGT_CACHE,MSGL_V,"CACHE_PRE_INIT: [%"PRId64"] %"PRId64"  pre:%d  eof:%d  blocks:%d*%d\n",
+	(int64_t)s->read_filepos,(int64_t)s->max_filepos,min,s->eof,s->num_blocks,s->block_size);
+    while(s->max_filepos-s->read_filepos<min){
+	int timed_out;
 	mp_tmsg(MSGT_STATUSLINE, MSGL_STATUS, "\rCache fill: %5.2f%% (%"PRId64" bytes)   ",
 	    100.0*(float)(s->max_filepos-s->read_filepos)/(float)(s->buffer_size),
 	    (int64_t)s->max_filepos-s->read_filepos
 	);
 	if(s->eof) break; // file is smaller than prefill size
-	if(stream_check_interrupt(PREFILL_SLEEP_TIME)) {
+	if(cache_wait_reader(s, PREFILL_SLEEP_TIME, &timed_out)) {
+	  cache_unlock(s);
 	  res = 0;
 	  goto err_out;
         }
     }
+    cache_unlock(s);
     stream->cached = true;
     return 1; // parent exits
 
@@ -511,6 +869,7 @@ static void ThreadProc( void *s ){
 }
 #else
 static void *ThreadProc( void *s ){
+  mp_prof_set_thread_name("cache");
   cache_mainloop(s);
   return NULL;
 }
@@ -529,7 +888,7 @@ int cache_stream_fill_buffer(stream_t *s){
     sector_size = STREAM_MAX_SECTOR_SIZE;
   }
 
-  len=cache_read(s->cache_data,s->buffer, sector_size);
+  len=cache_read(s,s->buffer, sector_size);
   //printf("cache_stream_fill_buffer->read -> %d\n",len);
 
   if(len<=0){ s->eof=1; s->buf_pos=s->buf_len=0; return 0; }
@@ -549,7 +908,13 @@ int cache_fill_status(stream_t *s) {
   if (!s || !s->cache_data)
     return -1;
   cv = s->cache_data;
-  return (cv->max_filepos-cv->read_filepos)/(cv->buffer_size / 100);
+  return FFMAX(cv->max_filepos-cv->read_filepos, 0)/(cv->buffer_size / 100);
+}
+
+void cache_set_player_wakeup(stream_t *s, bool enable) {
+  cache_vars_t *cv = s->cache_data;
+  if (cv)
+    cv->wakeup_player = enable;
 }
 
 int cache_stream_seek_long(stream_t *stream,off_t pos){
@@ -560,12 +925,13 @@ int cache_stream_seek_long(stream_t *stream,off_t pos){
   s=stream->cache_data;
 //  s->seek_lock=1;
 
-  mp_msg(MSGT_CACHE,MSGL_DBG2,"CACHE2_SEEK: 0x%"PRIX64" <= 0x%"PRIX64" (0x%"PRIX64") <= 0x%"PRIX64"  \n",s->min_filepos,pos,s->read_filepos,s->max_filepos);
-
   newpos=pos/s->sector_size; newpos*=s->sector_size; // align
-  stream->pos=s->read_filepos=newpos;
+  cache_lock(s);
+  mp_msg(MSGT_CACHE,MSGL_DBG2,"CACHE2_SEEK: 0x%"PRIX64" (0x%"PRIX64") <= 0x%"PRIX64"  \n",(int64_t)pos,(int64_t)s->read_filepos,(int64_t)s->max_filepos);
+  stream->pos=s->read_filepos=s->max_filepos=newpos;
   s->eof=0; // !!!!!!!
   cache_wakeup(stream);
+  cache_unlock(s);
 
   cache_stream_fill_buffer(stream);
 
@@ -584,7 +950,9 @@ int cache_stream_seek_long(stream_t *stream,off_t pos){
 
 int cache_do_control(stream_t *stream, int cmd, void *arg) {
   int sleep_count = 0;
+  int res;
   cache_vars_t* s = stream->cache_data;
+  cache_lock(s);
   switch (cmd) {
     case STREAM_CTRL_SEEK_TO_TIME:
       s->control_double_arg = *(double *)arg;
@@ -598,9 +966,11 @@ int cache_do_control(stream_t *stream, int cmd, void *arg) {
     // the core might call these every frame, so cache them...
     case STREAM_CTRL_GET_TIME_LENGTH:
       *(double *)arg = s->stream_time_length;
+      cache_unlock(s);
       return s->stream_time_length ? STREAM_OK : STREAM_UNSUPPORTED;
     case STREAM_CTRL_GET_CURRENT_TIME:
       *(double *)arg = s->stream_time_pos;
+      cache_unlock(s);
       return s->stream_time_pos != MP_NOPTS_VALUE ? STREAM_OK : STREAM_UNSUPPORTED;
     case STREAM_CTRL_GET_NUM_CHAPTERS:
     case STREAM_CTRL_GET_CURRENT_CHAPTER:
@@ -611,19 +981,26 @@ int cache_do_control(stream_t *stream, int cmd, void *arg) {
       s->control = cmd;
       break;
     default:
+      cache_unlock(s);
       return STREAM_UNSUPPORTED;
   }
   cache_wakeup(stream);
   while (s->control != -1) {
-    if (sleep_count++ == 1000)
+    int timed_out;
+    if (sleep_count == 1000)
       mp_msg(MSGT_CACHE, MSGL_WARN, "Cache not responding!\n");
-    if (stream_check_interrupt(CONTROL_SLEEP_TIME)) {
+    if (cache_wait_reader(s, CONTROL_SLEEP_TIME, &timed_out)) {
       s->eof = 1;
+      cache_unlock(s);
       return STREAM_UNSUPPORTED;
     }
+    sleep_count += timed_out;
+  }
+  res = s->control_res;
+  if (res != STREAM_OK) {
+    cache_unlock(s);
+    return res;
   }
-  if (s->control_res != STREAM_OK)
-    return s->control_res;
   switch (cmd) {
     case STREAM_CTRL_GET_TIME_LENGTH:
     case STREAM_CTRL_GET_CURRENT_TIME:
@@ -639,8 +1016,9 @@ int cache_do_control(stream_t *stream, int cmd, void *arg) {
     case STREAM_CTRL_SEEK_TO_CHAPTER:
     case STREAM_CTRL_SEEK_TO_TIME:
     case STREAM_CTRL_SET_ANGLE:
-      stream->pos = s->read_filepos = s->control_new_pos;
+      stream->pos = s->read_filepos = s->max_filepos = s->control_new_pos;
       break;
   }
-  return s->control_res;
+  cache_unlock(s);
+  return res;
 }
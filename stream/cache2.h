@@ -19,10 +19,15 @@
 #ifndef MPLAYER_CACHE2_H
 #define MPLAYER_CACHE2_H
 
+#include <stdbool.h>
+
 #include "stream.h"
 
 void cache_uninit(stream_t *s);
 int cache_do_control(stream_t *stream, int cmd, void *arg);
 int cache_fill_status(stream_t *s);
+/// Make the cache wake up the player when its fill status changes, e.g.
+/// while the player is paused and shows it.
+void cache_set_player_wakeup(stream_t *s, bool enable);
 
 #endif /* MPLAYER_CACHE2_H */
@@ -0,0 +1,499 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Every cache entry consists of two files named after a hash of the key:
+ * <hash>.dat holds the cached blocks at their offset in the remote file
+ * (sparse where nothing is cached), <hash>.idx holds a header with the key
+ * followed by a bitmap of the blocks present in the data file. A block's bit
+ * is only set after its data has been written, and single bits are updated
+ * in place, so an interrupted session leaves a valid index behind. The idx
+ * file's mtime is used as the time of last use for LRU eviction. The file
+ * "usage" records the time of the last directory scan and the total size.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <libavutil/common.h>
+
+#include "talloc.h"
+#include "mp_msg.h"
+#include "osdep/io.h"
+#include "stream.h"
+#include "disk_cache.h"
+
+#define DISK_CACHE_MAGIC "MPDC0001"
+#define DISK_CACHE_BLOCK_SIZE (256 * 1024)
+// minimum time in seconds between two scans of the cache directory on open
+#define DISK_CACHE_SCAN_INTERVAL 600
+
+struct index_header {
+    char magic[8];
+    int64_t size;
+    int32_t block_size;
+    int32_t url_len;
+    int32_t validator_len;
+};
+
+struct disk_cache {
+    char *dir;
+    char *name;             // file name without extension
+    int index_fd;
+    int data_fd;
+    char *url;
+    char *validator;
+    int64_t size;
+    int block_size;
+    int num_blocks;
+    off_t bitmap_offset;    // position of the bitmap in the index file
+    uint8_t *bitmap;
+    int64_t max_bytes;
+    int64_t used_bytes;     // disk usage of this entry
+    int64_t other_bytes;    // disk usage of all other entries
+    int64_t scan_time;      // time of the last directory scan, 0 if unknown
+    bool full;              // stop storing data, the size limit is reached
+
+    // block currently assembled from sequential reads
+    uint8_t *stage;
+    int64_t stage_pos;      // position of the next byte expected, -1 if none
+    int stage_len;
+
+    int64_t stream_pos;     // position of the underlying stream, -1 if unknown
+};
+
+static uint64_t hash_key(const char *url, const char *validator, int64_t size)
+{
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    char sizebuf[32];
+    const char *parts[3] = {url, validator, sizebuf};
+    snprintf(sizebuf, sizeof(sizebuf), "%"PRId64, size);
+    for (int n = 0; n < 3; n++) {
+        for (const char *p = parts[n]; ; p++) {
+            h = (h ^ (uint8_t)*p) * 0x100000001b3ULL;
+            if (!*p)
+                break;
+        }
+    }
+    return h;
+}
+
+static char *entry_path(void *ctx, struct disk_cache *dc, const char *name,
+                        const char *ext)
+{
+    return talloc_asprintf(ctx, "%s/%s.%s", dc->dir, name, ext);
+}
+
+static bool read_at(int fd, int64_t pos, void *buf, int len)
+{
+    return lseek(fd, pos, SEEK_SET) == pos && read(fd, buf, len) == len;
+}
+
+static bool write_at(int fd, int64_t pos, const void *buf, int len)
+{
+    return lseek(fd, pos, SEEK_SET) == pos && write(fd, buf, len) == len;
+}
+
+static int64_t bitmap_usage(const uint8_t *bitmap, int num_blocks,
+                            int block_size)
+{
+    int64_t count = 0;
+    for (int i = 0; i < num_blocks; i++)
+        count += (bitmap[i >> 3] >> (i & 7)) & 1;
+    return count * block_size;
+}
+
+// Return the disk usage of the entry with the given index file, -1 if the
+// index is not valid.
+static int64_t index_usage(const char *path)
+{
+    struct index_header hdr;
+    int64_t usage = -1;
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) == 0 && read_at(fd, 0, &hdr, sizeof(hdr)) &&
+        !memcmp(hdr.magic, DISK_CACHE_MAGIC, 8) && hdr.block_size > 0 &&
+        hdr.size > 0 && hdr.url_len >= 0 && hdr.validator_len >= 0) {
+        int64_t num_blocks = hdr.size / hdr.block_size +
+                             (hdr.size % hdr.block_size != 0);
+        int64_t bitmap_offset = (int64_t)sizeof(hdr) + hdr.url_len +
+                                hdr.validator_len;
+        // The header is not trusted: the bitmap must be contained in the file.
+        if (num_blocks <= INT_MAX &&
+            (num_blocks + 7) / 8 <= st.st_size - bitmap_offset) {
+            int bitmap_size = (num_blocks + 7) / 8;
+            uint8_t *bitmap = talloc_size(NULL, bitmap_size);
+            if (bitmap && read_at(fd, bitmap_offset, bitmap, bitmap_size))
+                usage = bitmap_usage(bitmap, num_blocks, hdr.block_size);
+            talloc_free(bitmap);
+        }
+    }
+    close(fd);
+    return usage;
+}
+
+struct entry {
+    char *name;
+    time_t last_use;
+    int64_t usage;
+};
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct entry *ea = a, *eb = b;
+    return ea->last_use < eb->last_use ? -1 : ea->last_use > eb->last_use;
+}
+
+static void remove_entry(struct disk_cache *dc, const char *name)
+{
+    void *tmp = talloc_new(NULL);
+    mp_msg(MSGT_CACHE, MSGL_V, "[disk_cache] Removing %s\n", name);
+    unlink(entry_path(tmp, dc, name, "dat"));
+    unlink(entry_path(tmp, dc, name, "idx"));
+    talloc_free(tmp);
+}
+
+static char *usage_path(void *ctx, struct disk_cache *dc)
+{
+    return talloc_asprintf(ctx, "%s/usage", dc->dir);
+}
+
+// Record the time of the last directory scan and the total disk usage.
+static void write_usage(struct disk_cache *dc)
+{
+    void *tmp = talloc_new(NULL);
+    FILE *f = fopen(usage_path(tmp, dc), "w");
+    if (f) {
+        fprintf(f, "%"PRId64" %"PRId64"\n", dc->scan_time,
+                dc->other_bytes + dc->used_bytes);
+        fclose(f);
+    }
+    talloc_free(tmp);
+}
+
+/* Take the usage of the other entries from the last directory scan if it is
+ * recent enough. Return false if the directory has to be scanned again.
+ */
+static bool read_usage(struct disk_cache *dc)
+{
+    void *tmp = talloc_new(NULL);
+    FILE *f = fopen(usage_path(tmp, dc), "r");
+    int64_t scan_time, total;
+    int64_t now = time(NULL);
+    bool ok = f && fscanf(f, "%"SCNd64" %"SCNd64, &scan_time, &total) == 2 &&
+              scan_time <= now && now - scan_time < DISK_CACHE_SCAN_INTERVAL &&
+              total >= 0;
+    if (f)
+        fclose(f);
+    talloc_free(tmp);
+    if (!ok)
+        return false;
+    // The total includes this entry if it existed at the time of the scan.
+    dc->scan_time = scan_time;
+    dc->other_bytes = FFMAX(total - dc->used_bytes, 0);
+    return true;
+}
+
+/* Recompute the usage of all other entries and delete the least recently
+ * used ones until everything fits into max_bytes.
+ */
+static void trim_cache(struct disk_cache *dc)
+{
+    void *tmp = talloc_new(NULL);
+    struct entry *entries = NULL;
+    int num_entries = 0;
+    DIR *d = opendir(dc->dir);
+    struct dirent *ent;
+
+    dc->other_bytes = 0;
+    while (d && (ent = readdir(d))) {
+        int len = strlen(ent->d_name);
+        if (len < 5 || strcmp(ent->d_name + len - 4, ".idx"))
+            continue;
+        char *name = talloc_strndup(tmp, ent->d_name, len - 4);
+        if (!strcmp(name, dc->name))
+            continue;
+        char *path = entry_path(tmp, dc, name, "idx");
+        struct stat st;
+        int64_t usage = index_usage(path);
+        if (usage < 0 || mp_stat(path, &st) < 0) {
+            remove_entry(dc, name);
+            continue;
+        }
+        entries = talloc_realloc(tmp, entries, struct entry, num_entries + 1);
+        entries[num_entries++] = (struct entry){name, st.st_mtime, usage};
+        dc->other_bytes += usage;
+    }
+    if (d)
+        closedir(d);
+
+    qsort(entries, num_entries, sizeof(*entries), compare_entries);
+    for (int i = 0; i < num_entries; i++) {
+        if (dc->other_bytes + dc->used_bytes <= dc->max_bytes)
+            break;
+        remove_entry(dc, entries[i].name);
+        dc->other_bytes -= entries[i].usage;
+    }
+    talloc_free(tmp);
+    dc->scan_time = time(NULL);
+    write_usage(dc);
+}
+
+static bool open_entry(struct disk_cache *dc)
+{
+    void *tmp = talloc_new(NULL);
+    char *index_path = entry_path(tmp, dc, dc->name, "idx");
+    char *data_path = entry_path(tmp, dc, dc->name, "dat");
+    int bitmap_size = (dc->num_blocks + 7) / 8;
+    struct index_header hdr;
+    bool valid = false;
+
+    dc->bitmap = talloc_zero_size(dc, bitmap_size);
+    dc->bitmap_offset = sizeof(hdr) + strlen(dc->url) + strlen(dc->validator);
+
+    dc->index_fd = open(index_path, O_RDWR | O_CREAT | O_BINARY, 0644);
+    dc->data_fd = open(data_path, O_RDWR | O_CREAT | O_BINARY, 0644);
+    if (dc->index_fd < 0 || dc->data_fd < 0) {
+        mp_msg(MSGT_CACHE, MSGL_ERR, "[disk_cache] Cannot open %s: %s\n",
+               index_path, strerror(errno));
+        talloc_free(tmp);
+        return false;
+    }
+
+    // The file name is only a hash, so make sure this really is our entry.
+    if (read_at(dc->index_fd, 0, &hdr, sizeof(hdr)) &&
+        !memcmp(hdr.magic, DISK_CACHE_MAGIC, 8) && hdr.size == dc->size &&
+        hdr.block_size == dc->block_size &&
+        hdr.url_len == strlen(dc->url) &&
+        hdr.validator_len == strlen(dc->validator)) {
+        char *key = talloc_size(tmp, hdr.url_len + hdr.validator_len + 1);
+        if (read_at(dc->index_fd, sizeof(hdr), key,
+                    hdr.url_len + hdr.validator_len) &&
+            !memcmp(key, dc->url, hdr.url_len) &&
+            !memcmp(key + hdr.url_len, dc->validator, hdr.validator_len))
+            valid = read_at(dc->index_fd, dc->bitmap_offset, dc->bitmap,
+                            bitmap_size);
+    }
+
+    if (valid) {
+        dc->used_bytes = bitmap_usage(dc->bitmap, dc->num_blocks,
+                                      dc->block_size);
+        mp_msg(MSGT_CACHE, MSGL_V, "[disk_cache] %"PRId64" bytes of %s "
+               "cached in %s\n", dc->used_bytes, dc->url, data_path);
+        utime(index_path, NULL);
+    } else {
+        memset(dc->bitmap, 0, bitmap_size);
+        hdr = (struct index_header){
+            .size = dc->size,
+            .block_size = dc->block_size,
+            .url_len = strlen(dc->url),
+            .validator_len = strlen(dc->validator),
+        };
+        memcpy(hdr.magic, DISK_CACHE_MAGIC, 8);
+        if (ftruncate(dc->index_fd, 0) < 0 || ftruncate(dc->data_fd, 0) < 0 ||
+            !write_at(dc->index_fd, 0, &hdr, sizeof(hdr)) ||
+            !write_at(dc->index_fd, sizeof(hdr), dc->url, hdr.url_len) ||
+            !write_at(dc->index_fd, sizeof(hdr) + hdr.url_len, dc->validator,
+                      hdr.validator_len) ||
+            !write_at(dc->index_fd, dc->bitmap_offset, dc->bitmap,
+                      bitmap_size)) {
+            mp_msg(MSGT_CACHE, MSGL_ERR, "[disk_cache] Cannot write %s: %s\n",
+                   index_path, strerror(errno));
+            talloc_free(tmp);
+            return false;
+        }
+    }
+    talloc_free(tmp);
+    return true;
+}
+
+struct disk_cache *disk_cache_open(const char *dir, int64_t max_bytes,
+                                   struct stream *s)
+{
+    const char *validator = s->disk_cache_validator;
+    int64_t size = s->end_pos;
+    if (!dir || !dir[0] || !validator || size <= 0 || max_bytes <= 0)
+        return NULL;
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        mp_msg(MSGT_CACHE, MSGL_ERR, "[disk_cache] Cannot create %s: %s\n",
+               dir, strerror(errno));
+        return NULL;
+    }
+
+    struct disk_cache *dc = talloc_zero(NULL, struct disk_cache);
+    dc->dir = talloc_strdup(dc, dir);
+    dc->url = talloc_strdup(dc, s->url);
+    dc->validator = talloc_strdup(dc, validator);
+    dc->name = talloc_asprintf(dc, "%016"PRIx64,
+                               hash_key(dc->url, dc->validator, size));
+    dc->size = size;
+    dc->block_size = DISK_CACHE_BLOCK_SIZE;
+    dc->num_blocks = (size + dc->block_size - 1) / dc->block_size;
+    dc->max_bytes = max_bytes;
+    dc->stage = talloc_size(dc, dc->block_size);
+    dc->stage_pos = -1;
+    dc->stream_pos = s->pos;
+    dc->index_fd = dc->data_fd = -1;
+
+    if (!open_entry(dc)) {
+        disk_cache_close(dc);
+        return NULL;
+    }
+    // Scanning large cache directories is slow, so do it only once in a
+    // while. store_block() still trims when the estimate exceeds the limit.
+    if (!read_usage(dc))
+        trim_cache(dc);
+    return dc;
+}
+
+void disk_cache_close(struct disk_cache *dc)
+{
+    if (!dc)
+        return;
+    if (dc->scan_time)
+        write_usage(dc);
+    if (dc->index_fd >= 0)
+        close(dc->index_fd);
+    if (dc->data_fd >= 0)
+        close(dc->data_fd);
+    talloc_free(dc);
+}
+
+static bool have_block(struct disk_cache *dc, int n)
+{
+    return dc->bitmap[n >> 3] & (1 << (n & 7));
+}
+
+static int block_length(struct disk_cache *dc, int n)
+{
+    int64_t pos = (int64_t)n * dc->block_size;
+    return FFMIN(dc->block_size, dc->size - pos);
+}
+
+int disk_cache_read(struct disk_cache *dc, int64_t pos, void *buf, int len)
+{
+    int total = 0;
+    while (len > 0 && pos < dc->size) {
+        int n = pos / dc->block_size;
+        int offset = pos - (int64_t)n * dc->block_size;
+        int chunk = FFMIN(len, block_length(dc, n) - offset);
+        if (!have_block(dc, n))
+            break;
+        if (!read_at(dc->data_fd, pos, buf, chunk)) {
+            mp_msg(MSGT_CACHE, MSGL_WARN, "[disk_cache] Read error, "
+                   "dropping block %d\n", n);
+            dc->bitmap[n >> 3] &= ~(1 << (n & 7));
+            write_at(dc->index_fd, dc->bitmap_offset + (n >> 3),
+                     &dc->bitmap[n >> 3], 1);
+            break;
+        }
+        pos += chunk;
+        buf = (char *)buf + chunk;
+        len -= chunk;
+        total += chunk;
+    }
+    return total;
+}
+
+static void store_block(struct disk_cache *dc, int n)
+{
+    int len = block_length(dc, n);
+    if (dc->full)
+        return;
+    if (dc->used_bytes + dc->other_bytes + len > dc->max_bytes) {
+        trim_cache(dc);
+        if (dc->used_bytes + dc->other_bytes + len > dc->max_bytes) {
+            mp_msg(MSGT_CACHE, MSGL_V, "[disk_cache] Size limit reached, "
+                   "not caching more of %s\n", dc->url);
+            dc->full = true;
+            return;
+        }
+    }
+    if (!write_at(dc->data_fd, (int64_t)n * dc->block_size, dc->stage, len)) {
+        mp_msg(MSGT_CACHE, MSGL_WARN, "[disk_cache] Write error: %s\n",
+               strerror(errno));
+        dc->full = true;
+        return;
+    }
+    dc->bitmap[n >> 3] |= 1 << (n & 7);
+    write_at(dc->index_fd, dc->bitmap_offset + (n >> 3), &dc->bitmap[n >> 3],
+             1);
+    dc->used_bytes += len;
+}
+
+void disk_cache_write(struct disk_cache *dc, int64_t pos, const void *buf,
+                      int len)
+{
+    const uint8_t *data = buf;
+    dc->stream_pos = pos + len;
+    while (len > 0 && pos < dc->size) {
+        int n = pos / dc->block_size;
+        int offset = pos - (int64_t)n * dc->block_size;
+        int chunk = FFMIN(len, block_length(dc, n) - offset);
+        if (dc->stage_pos != pos) {
+            // Blocks can only be assembled from their start.
+            dc->stage_pos = -1;
+            if (offset == 0 && !have_block(dc, n)) {
+                dc->stage_pos = pos;
+                dc->stage_len = 0;
+            }
+        }
+        if (dc->stage_pos >= 0) {
+            memcpy(dc->stage + dc->stage_len, data, chunk);
+            dc->stage_len += chunk;
+            dc->stage_pos += chunk;
+            if (dc->stage_len == block_length(dc, n)) {
+                store_block(dc, n);
+                dc->stage_pos = -1;
+            }
+        }
+        pos += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+bool disk_cache_sync_stream(struct disk_cache *dc, struct stream *s)
+{
+    off_t pos = s->pos;
+    if (dc->stream_pos == pos)
+        return true;
+    dc->stage_pos = -1;
+    if (!s->seek || !s->seek(s, pos))
+        return false;
+    s->pos = pos;
+    dc->stream_pos = pos;
+    return true;
+}
+
+void disk_cache_reset_stream(struct disk_cache *dc)
+{
+    dc->stream_pos = -1;
+}
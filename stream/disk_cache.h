@@ -0,0 +1,50 @@
+/*
+ * This file is part of mplayer2.
+ *
+ * mplayer2 is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * mplayer2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with mplayer2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MPLAYER_DISK_CACHE_H
+#define MPLAYER_DISK_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct stream;
+struct disk_cache;
+
+/* Persistent read-through cache for remote streams.
+ *
+ * Data read from the stream is stored in blocks in a directory on disk,
+ * keyed by URL, size (stream_t.end_pos) and a validator string which must
+ * change whenever the remote file does, e.g. a HTTP ETag. Streams opt in by
+ * setting stream_t.disk_cache_validator, to "" if the size is the only
+ * validator available. The total disk usage is kept under max_bytes by
+ * deleting the least recently used entries.
+ */
+struct disk_cache *disk_cache_open(const char *dir, int64_t max_bytes,
+                                   struct stream *s);
+void disk_cache_close(struct disk_cache *dc);
+
+// Read cached data at pos. Returns the number of bytes read, 0 on a miss.
+int disk_cache_read(struct disk_cache *dc, int64_t pos, void *buf, int len);
+// Store data that was just read from the stream at pos.
+void disk_cache_write(struct disk_cache *dc, int64_t pos, const void *buf,
+                      int len);
+// Seek the underlying stream to s->pos if cache hits left it elsewhere.
+bool disk_cache_sync_stream(struct disk_cache *dc, struct stream *s);
+// Forget the position of the underlying stream, e.g. after a read error.
+void disk_cache_reset_stream(struct disk_cache *dc);
+
+#endif /* MPLAYER_DISK_CACHE_H */
@@ -871,8 +871,13 @@ static int fixup_open(stream_t *stream,int seekable) {
 	stream->type = STREAMTYPE_STREAM;
 	if(!is_icy && !is_ultravox && seekable)
 	{
+		const char *validator = http_get_field(http_hdr, "ETag");
+		if (!validator)
+			validator = http_get_field(http_hdr, "Last-Modified");
 		stream->flags |= MP_STREAM_SEEK;
 		stream->seek = http_seek;
+		// without ETag or Last-Modified only the size identifies the file
+		stream->disk_cache_validator = strdup(validator ? validator : "");
 	}
 	stream->streaming_ctrl->bandwidth = network_bandwidth;
 	if ((!is_icy && !is_ultravox) || scast_streaming_start(stream))
@@ -37,6 +37,10 @@
 
 #include "config.h"
 
+#ifdef HAVE_PTHREADS
+#include <pthread.h>
+#endif
+
 #if HAVE_WINSOCK2_H
 #include <winsock2.h>
 #endif
@@ -53,6 +57,7 @@
 #include "m_struct.h"
 
 #include "cache2.h"
+#include "disk_cache.h"
 
 char* cdrom_device=NULL;
 char* dvd_device=NULL;
@@ -61,6 +66,10 @@ int dvd_title=0;
 struct input_ctx;
 static int (*stream_check_interrupt_cb)(struct input_ctx *ctx, int time);
 static struct input_ctx *stream_check_interrupt_ctx;
+static void (*stream_wakeup_cb)(struct input_ctx *ctx);
+#ifdef HAVE_PTHREADS
+static pthread_t stream_check_interrupt_thread;
+#endif
 
 extern const stream_info_t stream_info_vcd;
 extern const stream_info_t stream_info_cdda;
@@ -205,6 +214,10 @@ static stream_t *open_stream_plugin(const stream_info_t *sinfo,
 
   s->mode = mode;
 
+  if (options && options->disk_cache_dir && s->seek && mode == STREAM_READ)
+    s->disk_cache = disk_cache_open(options->disk_cache_dir,
+                                    (int64_t)options->disk_cache_size << 20, s);
+
   mp_msg(MSGT_OPEN,MSGL_V, "STREAM: [%s] %s\n",sinfo->name,filename);
   mp_msg(MSGT_OPEN,MSGL_V, "STREAM: Description: %s\n",sinfo->info);
   mp_msg(MSGT_OPEN,MSGL_V, "STREAM: Author: %s\n", sinfo->author);
@@ -295,6 +308,18 @@ void stream_capture_do(stream_t *s)
 int stream_read_internal(stream_t *s, void *buf, int len)
 {
   int orig_len = len;
+  if (s->disk_cache) {
+    int cached = disk_cache_read(s->disk_cache, s->pos, buf, len);
+    if (cached > 0) {
+      s->eof = 0;
+      s->pos += cached;
+      return cached;
+    }
+    if (!disk_cache_sync_stream(s->disk_cache, s)) {
+      len = 0;
+      goto read_done;
+    }
+  }
   // we will retry even if we already reached EOF previously.
   switch(s->type){
   case STREAMTYPE_STREAM:
@@ -318,6 +343,7 @@ int stream_read_internal(stream_t *s, void *buf, int len)
   default:
     len= s->fill_buffer ? s->fill_buffer(s, buf, len) : 0;
   }
+read_done:
   if(len<=0){
     off_t pos = s->pos;
     // do not retry if this looks like proper eof
@@ -335,6 +361,8 @@ int stream_read_internal(stream_t *s, void *buf, int len)
     // e.g. a STREAM_CTRL_RECONNECT to do this
     s->eof=1;
     stream_reset(s);
+    if (s->disk_cache) // force a real seek on the retry
+      disk_cache_reset_stream(s->disk_cache);
     if (stream_seek_internal(s, pos) >= 0 || s->pos != pos) // seek failed
       goto eof_out;
     // make sure EOF is set to ensure no endless loops
@@ -348,6 +376,8 @@ eof_out:
   // When reading succeeded we are obviously not at eof.
   // This e.g. avoids issues with eof getting stuck when lavf seeks in MPEG-TS
   s->eof=0;
+  if (s->disk_cache)
+    disk_cache_write(s->disk_cache, s->pos, buf, len);
   s->pos+=len;
   return len;
 }
@@ -378,6 +408,11 @@ int stream_write_buffer(stream_t *s, unsigned char *buf, int len) {
 
 int stream_seek_internal(stream_t *s, off_t newpos)
 {
+  if (s->disk_cache) {
+    // the real seek is done on the next read that misses the disk cache
+    s->pos = newpos;
+    return -1;
+  }
 if(newpos==0 || newpos!=s->pos){
   switch(s->type){
   case STREAMTYPE_STREAM:
@@ -545,6 +580,8 @@ void free_stream(stream_t *s){
     s->capture_file = NULL;
   }
 
+  disk_cache_close(s->disk_cache);
+  free(s->disk_cache_validator);
   if(s->close) s->close(s);
   if(s->fd>0){
     /* on unix we define closesocket to close
@@ -576,10 +613,30 @@ void stream_set_interrupt_callback(int (*cb)(struct input_ctx *, int),
 {
     stream_check_interrupt_cb = cb;
     stream_check_interrupt_ctx = ctx;
+#ifdef HAVE_PTHREADS
+    stream_check_interrupt_thread = pthread_self();
+#endif
+}
+
+void stream_set_wakeup_callback(void (*cb)(struct input_ctx *))
+{
+    stream_wakeup_cb = cb;
+}
+
+void stream_wakeup_player(void)
+{
+    if (stream_wakeup_cb && stream_check_interrupt_ctx)
+        stream_wakeup_cb(stream_check_interrupt_ctx);
 }
 
 int stream_check_interrupt(int time) {
-    if(!stream_check_interrupt_cb) {
+    bool other_thread = false;
+#ifdef HAVE_PTHREADS
+    // the input code may only be used from the thread that set the callback
+    other_thread = !pthread_equal(pthread_self(),
+                                  stream_check_interrupt_thread);
+#endif
+    if(!stream_check_interrupt_cb || other_thread) {
         usec_sleep(time * 1000);
         return 0;
     }
@@ -162,6 +162,9 @@ typedef struct stream {
   bool cached;
   unsigned int cache_pid;
   void* cache_data;
+  // set by streams that can use the disk cache, see disk_cache.h
+  char *disk_cache_validator;
+  struct disk_cache *disk_cache;
   void* priv; // used for DVD, TV, RTSP etc
   char* url;  // strdup() of filename/url
   char *lavf_type; // name of expected demuxer type for lavf
@@ -358,6 +361,11 @@ struct stream *new_ds_stream(struct demux_stream *ds);
 struct input_ctx;
 void stream_set_interrupt_callback(int (*cb)(struct input_ctx*, int),
                                    struct input_ctx *ctx);
+/// Set the callback used to wake up the player from other threads or the
+/// cache process. It is passed the context of the interrupt callback.
+void stream_set_wakeup_callback(void (*cb)(struct input_ctx *));
+/// Wake up the player, e.g. when the cache fill status changed.
+void stream_wakeup_player(void);
 /// Call the interrupt checking callback if there is one and
 /// wait for time milliseconds
 int stream_check_interrupt(int time);
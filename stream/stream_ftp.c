@@ -495,6 +495,7 @@ static int open_f(stream_t *stream,int mode, void* opts, int* file_format) {
   if(len > 0) {
     stream->seek = seek;
     stream->end_pos = len;
+    stream->disk_cache_validator = strdup("");
   }
 
   // The data connection is really opened only at the first
@@ -163,7 +163,10 @@ static int open_f (stream_t *stream, int mode, void *opts, int* file_format) {
   if(len > 0 || mode == STREAM_WRITE) {
     stream->flags |= MP_STREAM_SEEK;
     stream->seek = seek;
-    if(mode == STREAM_READ) stream->end_pos = len;
+    if(mode == STREAM_READ) {
+      stream->end_pos = len;
+      stream->disk_cache_validator = strdup("");
+    }
   }
   stream->type = STREAMTYPE_SMB;
   stream->fd = fd;